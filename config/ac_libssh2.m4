@@ -0,0 +1,48 @@
+##*****************************************************************************
+## $Id$
+##*****************************************************************************
+#  SYNOPSIS:
+#    AC_LIBSSH2
+#
+#  DESCRIPTION:
+#    Checks for libssh2, used by the in-process "libssh2" rcmd module.
+#
+#  WARNINGS:
+#    This macro must be placed after AC_PROG_CC or equivalent.
+##*****************************************************************************
+
+AC_DEFUN([AC_LIBSSH2],
+[
+  #
+  # Check for whether to include libssh2 module
+  #
+  AC_MSG_CHECKING([for whether to build libssh2 module])
+  AC_ARG_WITH([libssh2],
+    AS_HELP_STRING([--with-libssh2],[Build in-process ssh module using libssh2]),
+    [ case "$withval" in
+        no)  ac_with_libssh2=no ;;
+        yes) ac_with_libssh2=yes ;;
+        *)   AC_MSG_RESULT([doh!])
+             AC_MSG_ERROR([bad value "$withval" for --with-libssh2]) ;;
+      esac
+    ]
+  )
+  AC_MSG_RESULT([${ac_with_libssh2=no}])
+
+  if test "$ac_with_libssh2" = "yes"; then
+    # libssh2_userauth_publickey_frommemory() appeared in libssh2 1.6
+    AC_CHECK_HEADER([libssh2.h],
+      [AC_CHECK_LIB([ssh2], [libssh2_userauth_publickey_frommemory],
+                    [ac_have_libssh2=yes], [])])
+
+    if test "$ac_have_libssh2" = "yes"; then
+      AC_ADD_STATIC_MODULE("libssh2cmd")
+      LIBSSH2_LIBS="-lssh2"
+      AC_DEFINE([HAVE_LIBSSH2], [1], [Define if you have libssh2.])
+    else
+      AC_MSG_NOTICE([Cannot support libssh2 module without libssh2 >= 1.6])
+    fi
+  fi
+
+  AC_SUBST(LIBSSH2_LIBS)
+])
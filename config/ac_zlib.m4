@@ -0,0 +1,43 @@
+##*****************************************************************************
+## $Id$
+##*****************************************************************************
+#  SYNOPSIS:
+#    AC_ZLIB
+#
+#  DESCRIPTION:
+#    Adds support for --with-zlib, used for pdcp on-the-wire compression.
+#    Checks for zlib by default and exports ZLIB_LIBS if found.
+#
+#  WARNINGS:
+#    This macro must be placed after AC_PROG_CC or equivalent.
+##*****************************************************************************
+
+AC_DEFUN([AC_ZLIB],
+[
+  AC_MSG_CHECKING([for whether to include zlib support for pdcp])
+  AC_ARG_WITH([zlib],
+    AS_HELP_STRING([--without-zlib],[disable pdcp compression support]),
+    [ case "$withval" in
+        yes) ac_with_zlib=yes ;;
+        no)  ac_with_zlib=no ;;
+        *)   AC_MSG_RESULT([doh!])
+             AC_MSG_ERROR([bad value "$withval" for --with-zlib]) ;;
+      esac
+    ]
+  )
+  AC_MSG_RESULT([${ac_with_zlib=yes}])
+
+  if test "$ac_with_zlib" = "yes"; then
+    AC_CHECK_HEADER([zlib.h],
+      [AC_CHECK_LIB([z], [deflate], [ac_have_zlib=yes], [])])
+
+    if test "$ac_have_zlib" = "yes"; then
+      ZLIB_LIBS="-lz"
+      AC_DEFINE([HAVE_LIBZ], [1], [Define if you have zlib.])
+    else
+      AC_MSG_NOTICE([Cannot support pdcp compression without zlib])
+    fi
+  fi
+
+  AC_SUBST(ZLIB_LIBS)
+])
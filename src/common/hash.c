@@ -0,0 +1,162 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include "xmalloc.h"
+#include "hash64.h"
+#include "hash.h"
+
+struct hash_node {
+    struct hash_node *next;     /* next node in the same bucket */
+    const void       *key;
+    void             *data;
+};
+
+struct hash {
+    struct hash_node **table;
+    size_t             nbuckets;    /* always a power of 2 */
+    size_t             count;
+    HashKeyF           key_f;
+    HashCmpF           cmp_f;
+    HashDelF           del_f;
+};
+
+static void _grow (hash_t h)
+{
+    size_t n = h->nbuckets * 2;
+    struct hash_node **new = Malloc (n * sizeof (*new));
+    size_t i;
+
+    memset (new, 0, n * sizeof (*new));
+
+    for (i = 0; i < h->nbuckets; i++) {
+        struct hash_node *p = h->table[i];
+        while (p) {
+            struct hash_node *next = p->next;
+            size_t b = h->key_f (p->key) & (n - 1);
+            p->next = new[b];
+            new[b] = p;
+            p = next;
+        }
+    }
+
+    Free ((void **) &h->table);
+    h->table = new;
+    h->nbuckets = n;
+}
+
+hash_t hash_create (size_t size, HashKeyF key_f, HashCmpF cmp_f,
+                    HashDelF del_f)
+{
+    hash_t h = Malloc (sizeof (*h));
+    size_t n = 1;
+
+    while (n < size)
+        n *= 2;
+
+    h->table = Malloc (n * sizeof (*h->table));
+    memset (h->table, 0, n * sizeof (*h->table));
+    h->nbuckets = n;
+    h->count = 0;
+    h->key_f = key_f;
+    h->cmp_f = cmp_f;
+    h->del_f = del_f;
+
+    return (h);
+}
+
+void hash_destroy (hash_t h)
+{
+    size_t i;
+
+    if (h == NULL)
+        return;
+
+    for (i = 0; i < h->nbuckets; i++) {
+        struct hash_node *p = h->table[i];
+        while (p) {
+            struct hash_node *next = p->next;
+            if (h->del_f)
+                h->del_f (p->data);
+            Free ((void **) &p);
+            p = next;
+        }
+    }
+    Free ((void **) &h->table);
+    Free ((void **) &h);
+}
+
+void * hash_find (hash_t h, const void *key)
+{
+    struct hash_node *p;
+
+    p = h->table[h->key_f (key) & (h->nbuckets - 1)];
+    for (; p; p = p->next) {
+        if (h->cmp_f (p->key, key) == 0)
+            return (p->data);
+    }
+    return (NULL);
+}
+
+void * hash_insert (hash_t h, const void *key, void *data)
+{
+    struct hash_node *p;
+    size_t b;
+
+    if (hash_find (h, key))
+        return (NULL);
+
+    /*
+     *  Keep the average chain length at or below one.
+     */
+    if (h->count >= h->nbuckets)
+        _grow (h);
+
+    p = Malloc (sizeof (*p));
+    p->key = key;
+    p->data = data;
+
+    b = h->key_f (key) & (h->nbuckets - 1);
+    p->next = h->table[b];
+    h->table[b] = p;
+    h->count++;
+
+    return (data);
+}
+
+uint64_t hash_key_string (const void *key)
+{
+    return (hash64 (key, strlen (key), 0));
+}
+
+int hash_cmp_string (const void *key1, const void *key2)
+{
+    return (strcmp (key1, key2));
+}
+
+/*
+ * vi: tabstop=4 shiftwidth=4 expandtab
+ */
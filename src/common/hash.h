@@ -0,0 +1,87 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ *  Chained hash table mapping keys to data items. The number of
+ *   buckets is doubled whenever the table holds as many items as
+ *   buckets. These routines are not thread-safe; callers sharing a
+ *   table between threads must lock it themselves.
+ */
+typedef struct hash * hash_t;
+
+typedef uint64_t (*HashKeyF) (const void *key);
+/*
+ *  Function prototype returning the hash of [key].
+ */
+
+typedef int (*HashCmpF) (const void *key1, const void *key2);
+/*
+ *  Function prototype comparing two keys. Returns zero if the keys
+ *   are equal, and non-zero otherwise.
+ */
+
+typedef void (*HashDelF) (void *data);
+/*
+ *  Function prototype to deallocate a data item stored in the table.
+ */
+
+hash_t hash_create (size_t size, HashKeyF key_f, HashCmpF cmp_f,
+                    HashDelF del_f);
+/*
+ *  Create an empty table of at least [size] buckets, rounded up to a
+ *   power of two, using [key_f] and [cmp_f] on keys. If [del_f] is
+ *   not NULL, it is called on each data item removed by hash_destroy().
+ */
+
+void hash_destroy (hash_t h);
+/*
+ *  Destroy table [h], calling its delete function on every item.
+ */
+
+void * hash_find (hash_t h, const void *key);
+/*
+ *  Return the data item stored under [key], or NULL if not found.
+ */
+
+void * hash_insert (hash_t h, const void *key, void *data);
+/*
+ *  Store [data], which must not be NULL, under [key]. [key] must remain
+ *   valid until the table is destroyed. Returns [data], or NULL if [key]
+ *   is already present, in which case the table is not changed.
+ */
+
+uint64_t hash_key_string (const void *key);
+int hash_cmp_string (const void *key1, const void *key2);
+/*
+ *  Key and compare functions for NUL terminated string keys.
+ */
+
+#endif /* !_HASH_H */
@@ -0,0 +1,211 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "hash64.h"
+
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+
+#define HASH64_BUFSIZ   (256 * 1024)
+
+#define rotl64(x, r)    (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*
+ *  Little-endian loads, independent of host byte order and alignment
+ */
+static inline uint64_t _read64 (const unsigned char *p)
+{
+    return ((uint64_t) p[0])       | ((uint64_t) p[1] << 8)
+         | ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24)
+         | ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40)
+         | ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+static inline uint32_t _read32 (const unsigned char *p)
+{
+    return ((uint32_t) p[0])       | ((uint32_t) p[1] << 8)
+         | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t _round (uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64 (acc, 31);
+    return (acc * PRIME64_1);
+}
+
+static inline uint64_t _merge_round (uint64_t acc, uint64_t val)
+{
+    acc ^= _round (0, val);
+    return (acc * PRIME64_1 + PRIME64_4);
+}
+
+void hash64_init (hash64_t *h, uint64_t seed)
+{
+    memset (h, 0, sizeof (*h));
+    h->seed = seed;
+    h->v[0] = seed + PRIME64_1 + PRIME64_2;
+    h->v[1] = seed + PRIME64_2;
+    h->v[2] = seed;
+    h->v[3] = seed - PRIME64_1;
+}
+
+static const unsigned char *
+_consume_stripes (hash64_t *h, const unsigned char *p, const unsigned char *end)
+{
+    uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
+
+    while (p + 32 <= end) {
+        v0 = _round (v0, _read64 (p));
+        v1 = _round (v1, _read64 (p + 8));
+        v2 = _round (v2, _read64 (p + 16));
+        v3 = _round (v3, _read64 (p + 24));
+        p += 32;
+    }
+
+    h->v[0] = v0; h->v[1] = v1; h->v[2] = v2; h->v[3] = v3;
+    return (p);
+}
+
+void hash64_update (hash64_t *h, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    const unsigned char *end = p + len;
+
+    h->total += len;
+
+    /*  Complete any partial stripe saved from the last update
+     */
+    if (h->memsize > 0) {
+        size_t n = 32 - h->memsize;
+        if (n > len)
+            n = len;
+        memcpy (h->mem + h->memsize, p, n);
+        h->memsize += n;
+        p += n;
+        if (h->memsize < 32)
+            return;
+        _consume_stripes (h, h->mem, h->mem + 32);
+        h->memsize = 0;
+    }
+
+    p = _consume_stripes (h, p, end);
+
+    if (p < end) {
+        memcpy (h->mem, p, end - p);
+        h->memsize = end - p;
+    }
+}
+
+uint64_t hash64_final (hash64_t *h)
+{
+    const unsigned char *p = h->mem;
+    const unsigned char *end = p + h->memsize;
+    uint64_t hash;
+
+    if (h->total >= 32) {
+        hash = rotl64 (h->v[0], 1)  + rotl64 (h->v[1], 7)
+             + rotl64 (h->v[2], 12) + rotl64 (h->v[3], 18);
+        hash = _merge_round (hash, h->v[0]);
+        hash = _merge_round (hash, h->v[1]);
+        hash = _merge_round (hash, h->v[2]);
+        hash = _merge_round (hash, h->v[3]);
+    }
+    else
+        hash = h->seed + PRIME64_5;
+
+    hash += h->total;
+
+    while (p + 8 <= end) {
+        hash ^= _round (0, _read64 (p));
+        hash = rotl64 (hash, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t) _read32 (p) * PRIME64_1;
+        hash = rotl64 (hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p++) * PRIME64_5;
+        hash = rotl64 (hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+
+    return (hash);
+}
+
+uint64_t hash64 (const void *buf, size_t len, uint64_t seed)
+{
+    hash64_t h;
+
+    hash64_init (&h, seed);
+    hash64_update (&h, buf, len);
+    return (hash64_final (&h));
+}
+
+int hash64_fd (int fd, uint64_t *hashp)
+{
+    hash64_t h;
+    char *buf;
+    ssize_t n;
+
+    if (!(buf = malloc (HASH64_BUFSIZ)))
+        return (-1);
+
+    hash64_init (&h, 0);
+    for (;;) {
+        if ((n = read (fd, buf, HASH64_BUFSIZ)) < 0) {
+            if (errno == EINTR)
+                continue;
+            free (buf);
+            return (-1);
+        }
+        if (n == 0)
+            break;
+        hash64_update (&h, buf, n);
+    }
+    free (buf);
+
+    *hashp = hash64_final (&h);
+    return (0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,70 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _HASH64_H
+#define _HASH64_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ *  Fast non-cryptographic 64-bit hash (XXH64 algorithm), used to
+ *   detect changed file contents.
+ */
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char mem[32];
+    int memsize;
+    uint64_t seed;
+} hash64_t;
+
+void hash64_init (hash64_t *h, uint64_t seed);
+/*
+ *  Initialize hash state [h] with [seed].
+ */
+
+void hash64_update (hash64_t *h, const void *buf, size_t len);
+/*
+ *  Add [len] bytes of [buf] to the hash state [h].
+ */
+
+uint64_t hash64_final (hash64_t *h);
+/*
+ *  Return the hash of all data added to [h].  The state is not modified.
+ */
+
+uint64_t hash64 (const void *buf, size_t len, uint64_t seed);
+/*
+ *  Return the hash of [len] bytes of [buf].
+ */
+
+int hash64_fd (int fd, uint64_t *hashp);
+/*
+ *  Hash the contents of [fd], read from the current offset until EOF,
+ *    into [hashp].  Returns 0 on success, or -1 on read error.
+ */
+
+#endif /* !_HASH64_H */
@@ -1622,28 +1622,86 @@ int hostlist_push(hostlist_t hl, const char *hosts)
     return retval;
 }
 
+/* Hosts are often pushed one at a time in order (e.g. when reading
+ * a file with one host per line), so parse the hostname in place and
+ * extend the last range when possible, only allocating a new range
+ * when the host does not follow on from the tail of the list.
+ */
 int hostlist_push_host(hostlist_t hl, const char *str)
 {
-    hostrange_t hr;
-    hostname_t hn;
+    hostrange_t hr, tail;
+    unsigned long num = 0;
+    int len, idx, width = 0;
+    int valid = 0;
+    char *p;
 
     if (str == NULL)
         return 0;
 
-    hn = hostname_create(str);
+    len = strlen(str);
+    idx = host_prefix_end(str);
 
-    if (hostname_suffix_is_valid(hn)) {
-        hr = hostrange_create(hn->prefix, hn->num, hn->num,
-                      hostname_suffix_width(hn));
-    } else
-        hr = hostrange_create_single(str);
+    if (idx != len - 1) {
+        num = strtoul(str + idx + 1, &p, 10);
+        if ((*p == '\0') && (num <= MAX_HOST_SUFFIX)) {
+            valid = 1;
+            width = len - idx - 1;
+        }
+    }
 
-    hostlist_push_range(hl, hr);
+    LOCK_HOSTLIST(hl);
 
-    hostrange_destroy(hr);
-    hostname_destroy(hn);
+    if (valid && hl->nranges > 0) {
+        tail = hl->hr[hl->nranges - 1];
+        if (!tail->singlehost
+            && tail->hi == num - 1
+            && strlen(tail->prefix) == (size_t) idx + 1
+            && strncmp(tail->prefix, str, idx + 1) == 0
+            && _width_equiv(tail->lo, &tail->width, num, &width)) {
+            tail->hi = num;
+            hl->nhosts++;
+            UNLOCK_HOSTLIST(hl);
+            return 1;
+        }
+    }
+
+    if (hl->size == hl->nranges && !hostlist_expand(hl)) {
+        UNLOCK_HOSTLIST(hl);
+        return 0;
+    }
+
+    if (!(hr = hostrange_new())) {
+        UNLOCK_HOSTLIST(hl);
+        return 0;
+    }
+    if (valid) {
+        if (!(hr->prefix = malloc(idx + 2)))
+            goto error;
+        memcpy(hr->prefix, str, idx + 1);
+        hr->prefix[idx + 1] = '\0';
+        hr->lo = hr->hi = num;
+        hr->width = width;
+        hr->singlehost = 0;
+    } else {
+        if (!(hr->prefix = strdup(str)))
+            goto error;
+        hr->lo = hr->hi = 0L;
+        hr->width = 0;
+        hr->singlehost = 1;
+    }
+
+    hl->hr[hl->nranges++] = hr;
+    hl->nhosts++;
+
+    UNLOCK_HOSTLIST(hl);
 
     return 1;
+
+  error:
+    free(hr);
+    UNLOCK_HOSTLIST(hl);
+    errno = ENOMEM;
+    return 0;
 }
 
 int hostlist_push_list(hostlist_t h1, hostlist_t h2)
@@ -1802,25 +1860,116 @@ char *hostlist_shift_range(hostlist_t hl)
     return strdup(buf);
 }
 
-/* XXX: Note: efficiency improvements needed */
 int hostlist_delete(hostlist_t hl, const char *hosts)
 {
-    int n = 0;
-    char *hostname = NULL;
+    int n;
     hostlist_t hltmp;
 
     if (!(hltmp = hostlist_create(hosts)))
         seterrno_ret(EINVAL, 0);
 
-    while ((hostname = hostlist_pop(hltmp)) != NULL) {
-        n += hostlist_delete_host(hl, hostname);
-        free(hostname);
-    }
+    n = hostlist_delete_list(hl, hltmp);
     hostlist_destroy(hltmp);
 
     return n;
 }
 
+/* a host to be deleted by hostlist_delete_list() */
+struct _delete_entry {
+    char *host;
+    int count;            /* occurrences left to delete */
+};
+
+static int _delete_entry_cmp(const void *e1, const void *e2)
+{
+    return strcmp(((const struct _delete_entry *) e1)->host,
+                  ((const struct _delete_entry *) e2)->host);
+}
+
+/* Sort the hosts to delete once and look up each host in hl with
+ * bsearch(), rather than scanning hl once per deleted host as
+ * hostlist_delete_host() does. hl is rebuilt in a single pass.
+ */
+int hostlist_delete_list(hostlist_t hl, hostlist_t dl)
+{
+    struct _delete_entry *del, *e, key;
+    hostlist_iterator_t i;
+    hostlist_t new = NULL;
+    char *host;
+    int n, j, k;
+    int ndel = 0, rc = 0;
+
+    if (dl == NULL || (n = hostlist_count(dl)) == 0)
+        return 0;
+
+    if (!(del = malloc(n * sizeof(*del))))
+        seterrno_ret(ENOMEM, 0);
+
+    if (!(i = hostlist_iterator_create(dl)))
+        goto done;
+    while (ndel < n && (host = hostlist_next(i))) {
+        del[ndel].host = host;
+        del[ndel].count = 1;
+        ndel++;
+    }
+    hostlist_iterator_destroy(i);
+
+    qsort(del, ndel, sizeof(*del), _delete_entry_cmp);
+    for (j = 0, k = 1; k < ndel; k++) {
+        if (strcmp(del[j].host, del[k].host) == 0) {
+            del[j].count++;
+            free(del[k].host);
+        } else
+            del[++j] = del[k];
+    }
+    if (ndel > 0)
+        ndel = j + 1;
+
+    if (!(new = hostlist_new()) || !(i = hostlist_iterator_create(hl)))
+        goto done;
+    while ((host = hostlist_next(i))) {
+        key.host = host;
+        e = bsearch(&key, del, ndel, sizeof(*del), _delete_entry_cmp);
+        if (e && e->count > 0) {
+            e->count--;
+            rc++;
+        } else
+            hostlist_push_host(new, host);
+        free(host);
+    }
+    hostlist_iterator_destroy(i);
+
+    if (rc > 0) {
+        hostrange_t *hr;
+        hostlist_iterator_t hli;
+        int size;
+
+        /* swap the rebuilt ranges into hl, and new frees the old ones */
+        LOCK_HOSTLIST(hl);
+        hr = hl->hr;
+        size = hl->size;
+        n = hl->nranges;
+        hl->hr = new->hr;
+        hl->size = new->size;
+        hl->nranges = new->nranges;
+        hl->nhosts = new->nhosts;
+        new->hr = hr;
+        new->size = size;
+        new->nranges = n;
+
+        for (hli = hl->ilist; hli; hli = hli->next)
+            hostlist_iterator_reset(hli);
+        UNLOCK_HOSTLIST(hl);
+    }
+
+  done:
+    hostlist_destroy(new);
+    for (j = 0; j < ndel; j++)
+        free(del[j].host);
+    free(del);
+    return rc;
+}
+
 
 /* XXX watch out! poor implementation follows! (fix it at some point) */
 int hostlist_delete_host(hostlist_t hl, const char *hostname)
@@ -2070,7 +2219,7 @@ static int _attempt_range_join(hostlist_t hl, int loc)
 
 void hostlist_uniq(hostlist_t hl)
 {
-    int i = 1;
+    int i, j = 0;
     hostlist_iterator_t hli;
     LOCK_HOSTLIST(hl);
     if (hl->nranges <= 1) {
@@ -2079,10 +2228,20 @@ void hostlist_uniq(hostlist_t hl)
     }
     qsort(hl->hr, hl->nranges, sizeof(hostrange_t), &_cmp);
 
-    while (i < hl->nranges) {
-        if (_attempt_range_join(hl, i) < 0) /* No range join occurred */
-            i++;
+    /* join each range into the last one kept, compacting the array
+     * in one pass instead of shifting it down after every join
+     */
+    for (i = 1; i < hl->nranges; i++) {
+        int ndup = hostrange_join(hl->hr[j], hl->hr[i]);
+        if (ndup >= 0) {
+            hostrange_destroy(hl->hr[i]);
+            hl->nhosts -= ndup;
+        } else
+            hl->hr[++j] = hl->hr[i];
     }
+    for (i = j + 1; i < hl->nranges; i++)
+        hl->hr[i] = NULL;
+    hl->nranges = j + 1;
 
     /* reset all iterators */
     for (hli = hl->ilist; hli; hli = hli->next)
@@ -229,6 +229,17 @@ int hostlist_delete(hostlist_t hl, const char *hosts);
 int hostlist_delete_host(hostlist_t hl, const char *hostname);
 
 
+/* hostlist_delete_list():
+ *
+ * Deletes the first occurrence in hl of each host in hostlist dl, as
+ * calling hostlist_delete_host() for every host in dl would, but in
+ * a single pass over hl. The order of the remaining hosts is kept.
+ *
+ * Returns the number of hosts successfully deleted
+ */
+int hostlist_delete_list(hostlist_t hl, hostlist_t dl);
+
+
 /* hostlist_delete_nth():
  *
  * Deletes the host from position n in the hostlist.
@@ -50,8 +50,6 @@
 #define MIN(a,b)	((a) < (b) ? (a) : (b))
 #endif
 
-#define IP_ADDR_LEN	4       /* XXX */
-
 #if !HAVE_PTHREAD_SIGMASK && HAVE_SIGTHREADMASK
 #define pthread_sigmask(x, y, z)	sigthreadmask(x, y, z)
 #endif
@@ -28,8 +28,14 @@
 #include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE    /* POSIX_SPAWN_SETSID, close_range() */
+#endif
+
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <pthread.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
@@ -37,6 +43,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#if HAVE_POSIX_SPAWNP
+#include <spawn.h>
+#endif
+#if HAVE_SYS_PIDFD_H
+#include <sys/pidfd.h>
+#endif
+#if HAVE_POLL
+#include <poll.h>
+#endif
 
 #include "src/common/xmalloc.h"
 #include "src/common/xstring.h"
@@ -58,10 +73,44 @@ struct pipe_info_struct {
     int rank;               /* Rank 1-N of this instance        */
     int fd;                 /* stdin/out fd                     */
     int efd;                /* stderr fd                        */
+    int pidfd;              /* pidfd of child, or -1            */
+    int watched;            /* nonzero if child is reaper's     */
+    int status;             /* wait status set by reaper        */
+    int wait_errno;         /* errno from reaper waitpid()      */
+    int reaped;             /* nonzero once reaper has status   */
+    int orphaned;           /* destroyed before it was reaped   */
 };
 
 static int _pipecmd (char *path, char *args[], int *fd2p, pid_t *ppid);
 
+/*
+ *  Use posix_spawn(3) if it can do all that is done after fork() below.
+ *   It avoids copying the page tables of a large pdsh process for every
+ *   command, and closing stray fds one at a time in the child.
+ */
+#if HAVE_POSIX_SPAWNP && HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP \
+    && defined (POSIX_SPAWN_SETSID)
+#  define PIPECMD_USE_SPAWN 1
+extern char **environ;
+#endif
+
+/*
+ *  With pidfds, children are reaped by a single thread polling on the
+ *   pidfds of all running commands, instead of a blocking waitpid(2) in
+ *   each host thread. A child is handed to the reaper when it is started
+ *   and reaped as soon as it exits, whether or not its host thread has
+ *   got to pipecmd_wait() yet, so that call usually just collects the
+ *   status. Every child that exits between two polls is reaped in one
+ *   pass.
+ */
+#if HAVE_PIDFD_OPEN && HAVE_SYS_PIDFD_H && HAVE_POLL
+#  define PIPECMD_USE_REAPER 1
+static pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  reaper_cond = PTHREAD_COND_INITIALIZER;
+static List reaper_new = NULL;     /* started, not yet polled by reaper */
+static int reaper_wakefd [2] = { -1, -1 };
+#endif
+
 pipecmd_t pipe_info_create (const char *path, const char *target,
         const char *user, int rank)
 {
@@ -77,6 +126,12 @@ pipecmd_t pipe_info_create (const char *path, const char *target,
     e->args = NULL;
     e->fd = -1;
     e->efd = -1;
+    e->pidfd = -1;
+    e->watched = 0;
+    e->status = 0;
+    e->wait_errno = 0;
+    e->reaped = 0;
+    e->orphaned = 0;
 
     return (e);
 }
@@ -169,13 +224,37 @@ static void cmd_args_destroy (char **args)
     Free ((void **) &args);
 }
 
-void pipecmd_destroy (pipecmd_t p)
+static void _pipecmd_free (pipecmd_t p)
 {
+    if (p->pidfd >= 0)
+        (void) close (p->pidfd);
     cmd_args_destroy (p->args);
     pipe_info_destroy (p);
+}
+
+void pipecmd_destroy (pipecmd_t p)
+{
+#if PIPECMD_USE_REAPER
+    /*  If the child is still running, the reaper frees p once it exits
+     */
+    if (p->watched) {
+        pthread_mutex_lock (&reaper_mutex);
+        if (!p->reaped) {
+            p->orphaned = 1;
+            pthread_mutex_unlock (&reaper_mutex);
+            return;
+        }
+        pthread_mutex_unlock (&reaper_mutex);
+    }
+#endif
+    _pipecmd_free (p);
     return;
 }
 
+#if PIPECMD_USE_REAPER
+static void _reaper_watch (pipecmd_t p);
+#endif
+
 pipecmd_t pipecmd (const char *path, const char **args, const char *target,
         const char *user, int rank)
 {
@@ -187,6 +266,12 @@ pipecmd_t pipecmd (const char *path, const char **args, const char *target,
         pipecmd_destroy (p);
         return (NULL);
     }
+#if PIPECMD_USE_REAPER
+    /*  On failure, fall back to waitpid() in pipecmd_wait()
+     */
+    if ((p->pidfd = pidfd_open (p->pid, 0)) >= 0)
+        _reaper_watch (p);
+#endif
     return (p);
 }
 
@@ -207,6 +292,7 @@ int pipecmd_stderrfd (pipecmd_t p)
 int pipecmd_signal (pipecmd_t p, int signo)
 {
     char *cmd;
+    int rc;
 
     if (p == NULL)
         return (-1);
@@ -215,7 +301,170 @@ int pipecmd_signal (pipecmd_t p, int signo)
     err ("sending signal %d to %s [%s] pid %d\n", signo, p->target, cmd,
             p->pid);
 
-    return (kill (p->pid, signo));
+#if PIPECMD_USE_REAPER
+    /*  Once reaped, the pid may already belong to another process
+     */
+    if (p->watched) {
+        pthread_mutex_lock (&reaper_mutex);
+        rc = p->reaped ? 0 : kill (p->pid, signo);
+        pthread_mutex_unlock (&reaper_mutex);
+        return (rc);
+    }
+#endif
+    rc = kill (p->pid, signo);
+    return (rc);
+}
+
+#if PIPECMD_USE_REAPER
+/*
+ *  The reaper keeps its own poll array of the pidfds of running
+ *   children. Children started since the last poll are appended from
+ *   reaper_new, and reaped children are removed by moving the last
+ *   entry into their slot.
+ */
+static void * _reaper (void *arg)
+{
+    int size = 64;
+    int n = 1;
+    struct pollfd *pfds = Malloc (size * sizeof (*pfds));
+    pipecmd_t *owners = Malloc (size * sizeof (*owners));
+
+    pfds[0].fd = reaper_wakefd[0];
+    pfds[0].events = POLLIN;
+
+    for (;;) {
+        pipecmd_t p;
+        char buf [64];
+        int nreaped = 0;
+        int j;
+
+        if (poll (pfds, n, -1) < 0) {
+            if (errno != EINTR)
+                err ("%p: pipecmd: reaper: poll: %m\n");
+            continue;
+        }
+
+        pthread_mutex_lock (&reaper_mutex);
+        for (j = 1; j < n; ) {
+            if (!pfds[j].revents) {
+                j++;
+                continue;
+            }
+            p = owners[j];
+            if (waitpid (p->pid, &p->status, 0) < 0)
+                p->wait_errno = errno;
+            (void) close (p->pidfd);
+            p->pidfd = -1;
+            p->reaped = 1;
+            if (p->orphaned)
+                _pipecmd_free (p);
+            nreaped++;
+
+            pfds[j] = pfds[--n];
+            owners[j] = owners[n];
+        }
+
+        if (pfds[0].revents) {
+            while (read (reaper_wakefd[0], buf, sizeof (buf)) > 0)
+                ;
+            while ((p = list_pop (reaper_new))) {
+                if (n == size) {
+                    size *= 2;
+                    Realloc ((void **) &pfds, size * sizeof (*pfds));
+                    Realloc ((void **) &owners, size * sizeof (*owners));
+                }
+                pfds[n].fd = p->pidfd;
+                pfds[n].events = POLLIN;
+                pfds[n].revents = 0;
+                owners[n++] = p;
+            }
+        }
+
+        if (nreaped)
+            pthread_cond_broadcast (&reaper_cond);
+        pthread_mutex_unlock (&reaper_mutex);
+    }
+
+    return (NULL);
+}
+
+/*
+ *  Start the reaper thread if not already running. Called with
+ *   reaper_mutex held.
+ */
+static int _reaper_start (void)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+    int rc;
+
+    if (reaper_new)
+        return (0);
+
+    if (pipe (reaper_wakefd) < 0)
+        return (-1);
+    fcntl (reaper_wakefd[0], F_SETFL, O_NONBLOCK);
+    fcntl (reaper_wakefd[1], F_SETFL, O_NONBLOCK);
+    fcntl (reaper_wakefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl (reaper_wakefd[1], F_SETFD, FD_CLOEXEC);
+
+    reaper_new = list_create (NULL);
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create (&tid, &attr, _reaper, NULL);
+    pthread_attr_destroy (&attr);
+
+    if (rc != 0) {
+        list_destroy (reaper_new);
+        reaper_new = NULL;
+        (void) close (reaper_wakefd[0]);
+        (void) close (reaper_wakefd[1]);
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ *  Hand the child of p to the reaper. If the reaper cannot be started,
+ *   the child is left to waitpid() in pipecmd_wait().
+ */
+static void _reaper_watch (pipecmd_t p)
+{
+    pthread_mutex_lock (&reaper_mutex);
+    if (_reaper_start () == 0) {
+        p->watched = 1;
+        list_append (reaper_new, p);
+        (void) write (reaper_wakefd[1], "", 1);
+    }
+    pthread_mutex_unlock (&reaper_mutex);
+
+    if (!p->watched) {
+        (void) close (p->pidfd);
+        p->pidfd = -1;
+    }
+}
+#endif /* PIPECMD_USE_REAPER */
+
+/*
+ *  Wait for child of pipecmd p, through the reaper thread if possible.
+ *   The reaper has usually collected the status already, and the
+ *   caller only sleeps if the child is still running.
+ */
+static int _wait (pipecmd_t p, int *pstatus)
+{
+#if PIPECMD_USE_REAPER
+    if (p->watched) {
+        pthread_mutex_lock (&reaper_mutex);
+        while (!p->reaped)
+            pthread_cond_wait (&reaper_cond, &reaper_mutex);
+        pthread_mutex_unlock (&reaper_mutex);
+        *pstatus = p->status;
+        errno = p->wait_errno;
+        return (p->wait_errno ? -1 : 0);
+    }
+#endif
+    return (waitpid (p->pid, pstatus, 0) < 0 ? -1 : 0);
 }
 
 int pipecmd_wait (pipecmd_t p, int *pstatus)
@@ -225,7 +474,7 @@ int pipecmd_wait (pipecmd_t p, int *pstatus)
     if (p == NULL)
         return (-1);
 
-    if (waitpid (p->pid, &status, 0) < 0)
+    if (_wait (p, &status) < 0)
         err ("%p: %S: %s pid %ld: waitpid: %m\n", p->target,
                 xbasename (p->path), p->pid);
 
@@ -255,6 +504,10 @@ const char * pipecmd_target (pipecmd_t p)
 
 static void closeall (int fd)
 {
+#if HAVE_CLOSE_RANGE
+    if (close_range (fd, ~0U, 0) == 0)
+        return;
+#endif
 #ifdef __linux
     struct dirent *d;
     DIR *dir;
@@ -288,23 +541,14 @@ static void closeall (int fd)
     return;
 }
 
-static int _pipecmd (char *path, char *args[], int *fd2p, pid_t *ppid)
+/*
+ *  Fork and exec cmd with stdin/out on sp[1] and stderr on esp[1] if
+ *   fd2p is set, all other fds closed, in a new session. A failed exec
+ *   is reported on the command's stderr and exits with status 255.
+ */
+static int _fork_exec (char *path, char *args[], int sp[2], int esp[2],
+                       int *fd2p, pid_t *ppid)
 {
-    int sp[2], esp[2];
-
-    /*
-     *  Get socketpair for stdin/out
-     */
-    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sp) < 0) {
-        err ("%p: pipecmd: socketpair: %m\n");
-        return (-1);
-    }
-
-    if (fd2p && socketpair (AF_UNIX, SOCK_STREAM, 0, esp) < 0) {
-        err ("%p: pipecmd: socketpair: %m\n");
-        return (-1);
-    }
-
     if ((*ppid = fork ()) < 0) {
         err ("%p: pipecmd: fork: %m\n");
         return (-1);
@@ -342,6 +586,74 @@ static int _pipecmd (char *path, char *args[], int *fd2p, pid_t *ppid)
         err ("%p: execvp %s failed: %m\n", path);
         _exit (255);
     }
+    return (0);
+}
+
+#if PIPECMD_USE_SPAWN
+/*
+ *  Spawn cmd with stdin/out on fd and stderr on efd, all other fds
+ *   closed, in a new session. Returns nonzero if the command could not
+ *   be spawned, e.g. because it was not found.
+ */
+static int _spawn (char *path, char *args[], int fd, int efd, pid_t *ppid)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    int rc;
+
+    if ((rc = posix_spawn_file_actions_init (&fa)) != 0)
+        goto out;
+    if ((rc = posix_spawnattr_init (&attr)) != 0) {
+        posix_spawn_file_actions_destroy (&fa);
+        goto out;
+    }
+
+    /*  Closing all stray file descriptors ensures cmd stdin is closed
+     *   when pdsh/pdcp close their end of the socketpair.
+     */
+    if ((rc = posix_spawn_file_actions_adddup2 (&fa, fd, 0))
+     || (rc = posix_spawn_file_actions_adddup2 (&fa, fd, 1))
+     || (rc = posix_spawn_file_actions_adddup2 (&fa, efd, 2))
+     || (rc = posix_spawn_file_actions_addclosefrom_np (&fa, 3))
+     || (rc = posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSID)))
+        goto done;
+
+    rc = posix_spawnp (ppid, path, &fa, &attr, args, environ);
+done:
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&fa);
+out:
+    return (rc);
+}
+#endif /* PIPECMD_USE_SPAWN */
+
+static int _pipecmd (char *path, char *args[], int *fd2p, pid_t *ppid)
+{
+    int sp[2], esp[2] = { -1, -1 };
+
+    /*
+     *  Get socketpair for stdin/out
+     */
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sp) < 0) {
+        err ("%p: pipecmd: socketpair: %m\n");
+        return (-1);
+    }
+
+    if (fd2p && socketpair (AF_UNIX, SOCK_STREAM, 0, esp) < 0) {
+        err ("%p: pipecmd: socketpair: %m\n");
+        goto fail;
+    }
+
+#if PIPECMD_USE_SPAWN
+    /*
+     *  posix_spawnp(3) returns exec errors to the caller. Fall back to
+     *   fork and exec so that they are reported per host with exit
+     *   status 255, just as without posix_spawn.
+     */
+    if (_spawn (path, args, sp[1], fd2p ? esp[1] : sp[1], ppid) != 0)
+#endif
+    if (_fork_exec (path, args, sp, esp, fd2p, ppid) < 0)
+        goto fail;
 
     /*
      * Parent continues
@@ -353,6 +665,15 @@ static int _pipecmd (char *path, char *args[], int *fd2p, pid_t *ppid)
     }
 
     return (sp[0]);
+
+fail:
+    (void) close (sp[0]);
+    (void) close (sp[1]);
+    if (esp[0] >= 0) {
+        (void) close (esp[0]);
+        (void) close (esp[1]);
+    }
+    return (-1);
 }
 
 
@@ -38,11 +38,13 @@
 
 #include "src/pdsh/wcoll.h"
 #include "src/pdsh/mod.h"
+#include "src/pdsh/wcollcache.h"
 #include "src/common/hostlist.h"
 #include "src/common/xmalloc.h"
 #include "src/common/err.h"
 #include "src/common/list.h"
 #include "src/common/split.h"
+#include "src/common/xstring.h"
 
 #if STATIC_MODULES
 #  define pdsh_module_info dshgroup_module_info
@@ -53,17 +55,25 @@ int pdsh_module_priority = DEFAULT_MODULE_PRIORITY;
 
 static hostlist_t read_groupfile(opt_t *opt);
 static int dshgroup_postop (opt_t *);
+static int dshgroup_exit (void);
 static int dshgroup_process_opt(opt_t *, int, char *);
+static hostlist_t _cached_groupfile (const char *group, opt_t *opt);
 
 static List groups = NULL;
 static List exgroups = NULL;
 
+/*
+ *  Groups named with -g or -X. Each is read at most once per run,
+ *   however many times it is named.
+ */
+static wcoll_groups_t dshgroups = NULL;
+
 /*
  * Export pdsh module operations structure
  */
 struct pdsh_module_operations dshgroup_module_ops = {
     (ModInitF)       NULL,
-    (ModExitF)       NULL,
+    (ModExitF)       dshgroup_exit,
     (ModReadWcollF)  read_groupfile,
     (ModPostOpF)     dshgroup_postop,
 };
@@ -104,6 +114,9 @@ struct pdsh_module pdsh_module_info = {
 
 static int dshgroup_process_opt(opt_t *pdsh_opt, int opt, char *arg)
 {
+    if (dshgroups == NULL)
+        dshgroups = wcoll_groups_create ((WcollGroupF) _cached_groupfile);
+
     switch (opt) {
     case 'g':
         groups = list_split_append (groups, ",", arg);
@@ -119,13 +132,18 @@ static int dshgroup_process_opt(opt_t *pdsh_opt, int opt, char *arg)
     return 0;
 }
 
-static hostlist_t _read_groupfile (const char *group)
+static char *search_path = NULL;
+
+static const char * _search_path (void)
 {
     int maxpathlen;
     char path [4096];
     char *home = getenv("HOME");
     char *dshgroup_path = getenv("DSHGROUP_PATH");
 
+    if (search_path)
+        return (search_path);
+
     maxpathlen = sizeof (path) - 1;
 
     if (!dshgroup_path)
@@ -141,65 +159,73 @@ static hostlist_t _read_groupfile (const char *group)
     else {
         err ("%p: dshgroup: warning: Unable to read $HOME env var\n");
         strncpy (path, dshgroup_path, sizeof (path));
+        path [maxpathlen] = '\0';
     }
 
-    return read_wcoll_path (path, group);
+    search_path = Strdup (path);
+    return (search_path);
 }
 
-static hostlist_t _read_groups (List grouplist)
+static hostlist_t _read_groupfile (const char *group)
 {
-    ListIterator i  = NULL;
-    hostlist_t   hl = NULL;
-    char *group;
-
-    i = list_iterator_create (grouplist);
-
-    while ((group = list_next (i))) {
-        hostlist_t l = _read_groupfile (group);
-
-        if (l == NULL)
-            continue;
+    return read_wcoll_path (_search_path (), group);
+}
 
-        if (hl == NULL) {
-            hl = l;
-        } else {
-            hostlist_push_list (hl, l);
-            hostlist_destroy (l);
+/*
+ *  Read [group], using the wcoll cache if it is enabled. Entries record
+ *   the group files read, including any #include'd ones, and the paths
+ *   searched before each was found, and are used only while none of
+ *   those has changed.
+ */
+static hostlist_t _cached_groupfile (const char *group, opt_t *opt)
+{
+    const char *dir = opt->wcoll_cache_dir;
+    int ttl = opt->wcoll_cache_ttl;
+    hostlist_t hl = NULL;
+    char *key = NULL;
+    int lockfd;
+
+    if (ttl <= 0)
+        return (_read_groupfile (group));
+
+    xstrcat (&key, "misc/dshgroup path=");
+    xstrcat (&key, (char *) _search_path ());
+    xstrcat (&key, " group=");
+    xstrcat (&key, (char *) group);
+
+    if (!(hl = wcoll_cache_get (dir, key, ttl))) {
+        lockfd = wcoll_cache_lock (dir, key);
+        if (!(hl = wcoll_cache_get (dir, key, ttl))) {
+            List files = wcoll_cache_files_create ();
+
+            hl = read_wcoll_path_files (_search_path (), group, files);
+            if (hl && hostlist_count (hl) > 0)
+                wcoll_cache_put_files (dir, key, hl, ttl, files);
+            list_destroy (files);
         }
+        wcoll_cache_unlock (dir, key, lockfd);
     }
 
-    list_iterator_destroy (i);
-
-    if (hl != NULL)
-        hostlist_uniq (hl);
-
+    Free ((void **) &key);
     return (hl);
 }
 
 static hostlist_t read_groupfile(opt_t *opt)
 {
-    if (!groups)
+    if (!groups && !exgroups)
         return NULL;
 
     if (opt->wcoll && groups)
         errx("Do not specify both -w and -g");
 
-    return _read_groups (groups);
-}
-
-static int
-_delete_all (hostlist_t hl, hostlist_t dl)
-{
-    int                 rc   = 0;
-    char *              host = NULL;
-    hostlist_iterator_t i    = hostlist_iterator_create (dl);
+    /*
+     *  Read the -X groups here as well, so that all group files
+     *   are read in one pass alongside the other modules.
+     */
+    wcoll_groups_read (dshgroups, groups, opt);
+    wcoll_groups_read (dshgroups, exgroups, opt);
 
-    while ((host = hostlist_next (i))) {
-        rc += hostlist_delete_host (hl, host);
-        free (host);
-    }
-    hostlist_iterator_destroy (i);
-    return (rc);
+    return wcoll_groups_hostlist (dshgroups, groups, opt);
 }
 
 static int dshgroup_postop (opt_t *opt)
@@ -209,14 +235,22 @@ static int dshgroup_postop (opt_t *opt)
     if (!opt->wcoll || !exgroups)
         return (0);
 
-    if ((hl = _read_groups (exgroups)) == NULL)
+    if ((hl = wcoll_groups_hostlist (dshgroups, exgroups, opt)) == NULL)
         return (0);
 
-    _delete_all (opt->wcoll, hl);
+    hostlist_delete_list (opt->wcoll, hl);
+    hostlist_destroy (hl);
 
     return 0;
 }
 
+static int dshgroup_exit (void)
+{
+    wcoll_groups_destroy (dshgroups);
+    dshgroups = NULL;
+    return (0);
+}
+
 /*
  * vi: tabstop=4 shiftwidth=4 expandtab
  */
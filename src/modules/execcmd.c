@@ -141,6 +141,13 @@ static int exec_init(opt_t * opt)
     if (rcmd_opt_set (RCMD_OPT_RESOLVE_HOSTS, 0) < 0)
         errx ("%p: execcmd_init: rcmd_opt_set: %m\n");
 
+    /*
+     *  Remote exit status is returned from exec_destroy, so
+     *   pdsh does not need to echo it after the command output
+     */
+    if (rcmd_opt_set (RCMD_OPT_EXIT_STATUS, (void *) 1) < 0)
+        errx ("%p: execcmd_init: rcmd_opt_set: %m\n");
+
     return 0;
 }
 
@@ -191,6 +198,13 @@ exec_destroy (pipecmd_t p)
 
     pipecmd_destroy (p);
 
+    /*
+     *  Report death by signal the same way a shell would, so that
+     *   -k and -S treat it as a failure.
+     */
+    if (WIFSIGNALED (status))
+        return (128 + WTERMSIG (status));
+
     return (WEXITSTATUS (status));
 }
 
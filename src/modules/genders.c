@@ -27,13 +27,23 @@
 #  include "config.h"
 #endif
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <genders.h>
 
 #include "src/common/hostlist.h"
+#include "src/common/hash64.h"
+#include "src/common/hash.h"
+#include "src/common/fd.h"
 #include "src/common/err.h"
 #include "src/common/xmalloc.h"
 #include "src/common/split.h"
@@ -150,17 +160,263 @@ struct pdsh_module pdsh_module_info = {
  * Static prototypes
  */
 static genders_t  _handle_create();
-static hostlist_t _genders_to_altnames(genders_t g, hostlist_t hl);
+static void       _index_init();
+static hostlist_t _genders_to_altnames(hostlist_t hl);
 static hostlist_t _read_genders(List l);
-static hostlist_t _read_genders_attr(char *query);
+static void       _read_genders_attr(char *query, uint64_t *bits);
 static void       _genders_opt_verify(opt_t *opt);
-static int        _delete_all (hostlist_t hl, hostlist_t dl);
 static int        register_genders_rcmd_types (opt_t *opt);
 
+/*
+ *  In-memory index of the genders database, built once when the
+ *   genders handle is created. Nodes are numbered in database order
+ *   and every attribute keeps a bitmap over node ids, so -g, -X and -a
+ *   become bitmap operations, and lookups by canonical or alternate
+ *   name are hash table lookups instead of libgenders calls per host.
+ */
+#define GINDEX_MIN_BUCKETS  256
+#define BITS_PER_WORD       64
+
+struct gindex_attr {
+    char           *name;
+    uint64_t       *bits;       /* nodes having this attribute        */
+    int            *val_node;   /* nodes with a value for attribute   */
+    char          **val;        /* value for each node in val_node    */
+    int             nvals;
+    int             size;
+};
+
+struct genders_index {
+    int                 nnodes;
+    int                 nwords;     /* length of a node bitmap        */
+    char              **node;       /* node id -> canonical name      */
+    char              **altname;    /* node id -> altname or NULL     */
+    char              **rcmd_type;  /* node id -> pdsh_rcmd_type/NULL */
+    hash_t              nodes;      /* canonical names and altnames   */
+    struct gindex_attr *attr;
+    int                 nattrs;
+    hash_t              attrs;
+    void               *map;        /* mapped cache file, if loaded   */
+    size_t              mapsize;    /*  from the genders cache        */
+};
+
+static struct genders_index *gi = NULL;
+
 
 /*
  *  Functions:
  */
+/*
+ *  Ids are stored in the maps offset by one, so that id 0 is not
+ *   a NULL data item.
+ */
+static hash_t _map_create (void)
+{
+    return (hash_create (GINDEX_MIN_BUCKETS, hash_key_string,
+                         hash_cmp_string, NULL));
+}
+
+/*
+ *  Return the id stored for [key] in map [m], or -1 if not found.
+ */
+static int _map_find (hash_t m, const char *key)
+{
+    return ((int) (intptr_t) hash_find (m, key) - 1);
+}
+
+/*
+ *  Map [key] to [id] unless [key] is already present. [key] must
+ *   remain valid for the lifetime of the map.
+ */
+static void _map_insert (hash_t m, char *key, int id)
+{
+    hash_insert (m, key, (void *) (intptr_t) (id + 1));
+}
+
+static uint64_t * _bitmap_create (struct genders_index *idx)
+{
+    return (Malloc (idx->nwords * sizeof (uint64_t)));
+}
+
+static void _bit_set (uint64_t *bits, int i)
+{
+    bits[i / BITS_PER_WORD] |= (uint64_t) 1 << (i % BITS_PER_WORD);
+}
+
+static int _bit_test (uint64_t *bits, int i)
+{
+    return ((bits[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1);
+}
+
+static void
+_index_add_attr (struct genders_index *idx, int node, char *name, char *val)
+{
+    struct gindex_attr *a;
+    int id;
+
+    if ((id = _map_find (idx->attrs, name)) < 0) {
+        id = idx->nattrs++;
+        if (idx->attr == NULL)
+            idx->attr = Malloc (sizeof (*a));
+        else
+            Realloc ((void **) &idx->attr, idx->nattrs * sizeof (*a));
+        a = &idx->attr[id];
+        memset (a, 0, sizeof (*a));
+        a->name = Strdup (name);
+        a->bits = _bitmap_create (idx);
+        _map_insert (idx->attrs, a->name, id);
+    }
+    a = &idx->attr[id];
+    _bit_set (a->bits, node);
+
+    if (val[0] == '\0')
+        return;
+
+    if (a->nvals == a->size) {
+        if (a->size == 0) {
+            a->size = 16;
+            a->val_node = Malloc (a->size * sizeof (int));
+            a->val = Malloc (a->size * sizeof (char *));
+        } else {
+            a->size *= 2;
+            Realloc ((void **) &a->val_node, a->size * sizeof (int));
+            Realloc ((void **) &a->val, a->size * sizeof (char *));
+        }
+    }
+    a->val_node[a->nvals] = node;
+    a->val[a->nvals] = Strdup (val);
+
+    if (strcmp (name, GENDERS_ALTNAME_ATTRIBUTE) == 0)
+        idx->altname[node] = a->val[a->nvals];
+    else if (strcmp (name, "pdsh_rcmd_type") == 0)
+        idx->rcmd_type[node] = a->val[a->nvals];
+
+    a->nvals++;
+}
+
+static struct genders_index * _index_create (genders_t g)
+{
+    struct genders_index *idx = Malloc (sizeof (*idx));
+    char **nodes = NULL;
+    char **attrs = NULL;
+    char **vals = NULL;
+    int nnodes, maxattrs;
+    int i;
+
+    idx->nwords = 1;
+    idx->nodes = _map_create ();
+    idx->attrs = _map_create ();
+
+    /*
+     *  If no genders data was loaded (e.g. default genders file is
+     *   missing), leave the index empty so all lookups simply fail.
+     */
+    if ((nnodes = genders_getnumnodes (g)) <= 0)
+        return (idx);
+
+    if ((maxattrs = genders_getmaxattrs (g)) < 0)
+        errx("%p: genders: getmaxattrs: %s\n", genders_errormsg (g));
+
+    if (genders_nodelist_create (g, &nodes) < 0)
+        errx("%p: genders: nodelist_create: %s\n", genders_errormsg (g));
+    if ((nnodes = genders_getnodes (g, nodes, nnodes, NULL, NULL)) < 0)
+        errx("%p: genders: getnodes: %s\n", genders_errormsg (g));
+
+    if (maxattrs > 0) {
+        if (genders_attrlist_create (g, &attrs) < 0)
+            errx("%p: genders: attrlist_create: %s\n", genders_errormsg (g));
+        if (genders_vallist_create (g, &vals) < 0)
+            errx("%p: genders: vallist_create: %s\n", genders_errormsg (g));
+    }
+
+    idx->nnodes = nnodes;
+    idx->nwords = nnodes / BITS_PER_WORD + 1;
+    idx->node = Malloc (nnodes * sizeof (char *));
+    idx->altname = Malloc (nnodes * sizeof (char *));
+    idx->rcmd_type = Malloc (nnodes * sizeof (char *));
+
+    for (i = 0; i < nnodes; i++) {
+        int j, n;
+
+        idx->node[i] = Strdup (nodes[i]);
+        _map_insert (idx->nodes, idx->node[i], i);
+
+        if (maxattrs == 0)
+            continue;
+
+        if ((genders_attrlist_clear (g, attrs) < 0)
+           || (genders_vallist_clear (g, vals) < 0))
+            errx("%p: genders: list_clear: %s\n", genders_errormsg (g));
+
+        if ((n = genders_getattr (g, attrs, vals, maxattrs, nodes[i])) < 0)
+            errx("%p: genders: getattr: %s: %s\n",
+                 nodes[i], genders_errormsg (g));
+
+        for (j = 0; j < n; j++)
+            _index_add_attr (idx, i, attrs[j], vals[j]);
+    }
+
+    /*
+     *  Add altnames only after all canonical names, so a canonical
+     *   name always takes precedence over an identical altname.
+     */
+    for (i = 0; i < nnodes; i++) {
+        if (idx->altname[i])
+            _map_insert (idx->nodes, idx->altname[i], i);
+    }
+
+    if (vals && (genders_vallist_destroy (g, vals) < 0))
+        errx("%p: genders: vallist_destroy: %s\n", genders_errormsg (g));
+    if (attrs && (genders_attrlist_destroy (g, attrs) < 0))
+        errx("%p: genders: attrlist_destroy: %s\n", genders_errormsg (g));
+    if (genders_nodelist_destroy (g, nodes) < 0)
+        errx("%p: genders: nodelist_destroy: %s\n", genders_errormsg (g));
+
+    return (idx);
+}
+
+static void _index_destroy (struct genders_index *idx)
+{
+    int i, j;
+
+    /*
+     *  Strings and bitmaps of an index loaded from the genders
+     *   cache point into the mapped file.
+     */
+    for (i = 0; i < idx->nattrs; i++) {
+        struct gindex_attr *a = &idx->attr[i];
+        if (idx->map == NULL) {
+            for (j = 0; j < a->nvals; j++)
+                Free ((void **) &a->val[j]);
+            Free ((void **) &a->bits);
+            Free ((void **) &a->name);
+        }
+        if (a->size) {
+            Free ((void **) &a->val_node);
+            Free ((void **) &a->val);
+        }
+    }
+    if (idx->attr)
+        Free ((void **) &idx->attr);
+
+    if (idx->map == NULL) {
+        for (i = 0; i < idx->nnodes; i++)
+            Free ((void **) &idx->node[i]);
+    }
+    if (idx->nnodes) {
+        Free ((void **) &idx->node);
+        Free ((void **) &idx->altname);
+        Free ((void **) &idx->rcmd_type);
+    }
+
+    hash_destroy (idx->nodes);
+    hash_destroy (idx->attrs);
+
+    if (idx->map)
+        munmap (idx->map, idx->mapsize);
+    Free ((void **) &idx);
+}
+
 int
 genders_process_opt(opt_t *pdsh_opts, int opt, char *arg)
 {
@@ -209,6 +465,9 @@ genders_fini(void)
     if (excllist)
         list_destroy (excllist);
 
+    if (gi)
+        _index_destroy (gi);
+
     if ((gh != NULL) && (genders_handle_destroy(gh) < 0))
         errx("%p: Error destroying genders handle: %s\n", genders_errormsg(gh));
 
@@ -231,38 +490,52 @@ genders_wcoll(opt_t *opt)
         return NULL;
 #endif /* !GENDERS_G_ONLY */
 
-    if (gh == NULL)
-        gh = _handle_create();
+    _index_init ();
 
     generate_altnames = true;
     return _read_genders(attrlist);
 }
 
-static hostlist_t hostlist_intersect (hostlist_t h1, hostlist_t h2)
+/*
+ *  Return a bitmap of nodes matching any genders query in list [l].
+ */
+static uint64_t *
+_genders_select (List l)
+{
+    uint64_t *bits = _bitmap_create (gi);
+    ListIterator i = list_iterator_create (l);
+    char *query;
+
+    while ((query = list_next (i)))
+        _read_genders_attr (query, bits);
+    list_iterator_destroy (i);
+
+    return (bits);
+}
+
+/*
+ *  Return a new hostlist with the hosts of [hl] that are (if [match]
+ *   is true) or are not (if [match] is false) set in [bits]. Hosts
+ *   are looked up by canonical name or altname.
+ */
+static hostlist_t
+_genders_filter_bits (hostlist_t hl, uint64_t *bits, bool match)
 {
-    char *host;
     hostlist_t r = hostlist_create (NULL);
-    hostlist_iterator_t i = hostlist_iterator_create (h1);
+    hostlist_iterator_t i = hostlist_iterator_create (hl);
+    char *host;
 
     while ((host = hostlist_next (i))) {
-        if (hostlist_find (h2, host) >= 0) {
+        int id = _map_find (gi->nodes, host);
+        bool found = (id >= 0) && _bit_test (bits, id);
+        if (found == match)
             hostlist_push_host (r, host);
-	}
         free (host);
     }
     hostlist_iterator_destroy (i);
     return (r);
 }
 
-static hostlist_t genders_query_with_altnames (char *query)
-{
-    hostlist_t r = _read_genders_attr (query);
-    hostlist_t altlist = _genders_to_altnames (gh, r);
-    hostlist_push_list (r, altlist);
-    hostlist_destroy (altlist);
-    return (r);
-}
-
 /*
  *  Filter hostlist hl on a list of genders queries in query_list.
  *   Multiple queries are ORed together, so a given host must only
@@ -270,31 +543,16 @@ static hostlist_t genders_query_with_altnames (char *query)
  */
 static hostlist_t genders_filter (hostlist_t hl, List query_list)
 {
-    char *s;
-    ListIterator i;
+    uint64_t *bits;
     hostlist_t result;
 
     if ((query_list == NULL) || (list_count (query_list) == 0))
         return hl;
 
-    if ((i = list_iterator_create (query_list)) == NULL) {
-        err ("%p: genders: failed to create list or hostlist iterator\n");
-        return hl;
-    }
-
-    /*
-     *  Result is the union of the intersection of each genders query
-     *   with the incoming hostlist [hl]
-     */
-    result = hostlist_create (NULL);
-    while ((s = list_next (i))) {
-        hostlist_t ghl = genders_query_with_altnames (s);
-        hostlist_t r = hostlist_intersect (hl, ghl);
-        hostlist_destroy (ghl);
+    bits = _genders_select (query_list);
+    result = _genders_filter_bits (hl, bits, true);
+    Free ((void **) &bits);
 
-        hostlist_push_list (result, r);
-    }
-    list_iterator_destroy (i);
     hostlist_uniq (result);
     hostlist_destroy (hl);
     return (result);
@@ -303,24 +561,20 @@ static hostlist_t genders_filter (hostlist_t hl, List query_list)
 static int
 genders_postop(opt_t *opt)
 {
-    hostlist_t hl = NULL;
-
     if (!opt->wcoll)
         return (0);
 
-    if (gh == NULL)
-        gh = _handle_create();
+    _index_init ();
 
     if (attrlist)
         opt->wcoll = genders_filter (opt->wcoll, attrlist);
 
-    if (excllist && (hl = _read_genders (excllist))) {
-        hostlist_t altlist = _genders_to_altnames (gh, hl);
-        _delete_all (opt->wcoll, hl);
-        _delete_all (opt->wcoll, altlist);
-
-        hostlist_destroy (altlist);
+    if (excllist && (list_count (excllist) > 0)) {
+        uint64_t *bits = _genders_select (excllist);
+        hostlist_t hl = opt->wcoll;
+        opt->wcoll = _genders_filter_bits (hl, bits, false);
         hostlist_destroy (hl);
+        Free ((void **) &bits);
     }
 
 #if !GENDERS_G_ONLY
@@ -331,7 +585,7 @@ genders_postop(opt_t *opt)
      */
     if ((generate_altnames && !opt_i) || (!generate_altnames && opt_i)) {
         hostlist_t hl = opt->wcoll;
-        opt->wcoll = _genders_to_altnames(gh, hl);
+        opt->wcoll = _genders_to_altnames(hl);
         hostlist_destroy(hl);
     }
 #endif
@@ -364,83 +618,45 @@ _genders_opt_verify(opt_t *opt)
     return;
 }
 
-static int
-_maxnamelen (genders_t g)
-{
-    int maxvallen, maxnodelen;
-    if ((maxvallen = genders_getmaxvallen(g)) < 0)
-        errx("%p: genders: getmaxvallen: %s\n", genders_errormsg(g));
-    if ((maxnodelen = genders_getmaxvallen(g)) < 0)
-        errx("%p: genders: getmaxnodelen: %s\n", genders_errormsg(g));
-
-    return (maxvallen > maxnodelen ? maxvallen : maxnodelen);
-}
-
-
+/*
+ *  Convert canonical names in [hl] to altnames, and altnames
+ *   back to canonical names.
+ */
 static hostlist_t
-_genders_to_altnames(genders_t g, hostlist_t hl)
+_genders_to_altnames(hostlist_t hl)
 {
     hostlist_t retlist = NULL;
     hostlist_iterator_t i = NULL;
-    int  maxlen = 0;
-    char *altname = NULL;
-    char *altattr = GENDERS_ALTNAME_ATTRIBUTE;
     char *host    = NULL;
-    int  rc;
 
     if ((retlist = hostlist_create(NULL)) == NULL)
         errx("%p: genders: hostlist_create: %m\n");
 
-    maxlen = _maxnamelen (g);
-    altname = Malloc (maxlen + 1);
-
     if ((i = hostlist_iterator_create(hl)) == NULL)
         errx("%p: genders: hostlist_iterator_create: %m");
 
     while ((host = hostlist_next (i))) {
-        memset(altname, '\0', maxlen);
-
-        rc = genders_testattr(g, host, altattr, altname, maxlen + 1);
-
-        /*
-         *  If node not found, attempt to lookup canonical name via
-         *   alternate name.
-         */
-        if ((rc < 0) && (genders_errnum(g) == GENDERS_ERR_NOTFOUND))
-            rc = genders_getnodes (g, &altname, 1, altattr, host);
+        char *name = host;
+        int id = _map_find (gi->nodes, host);
+
+        if (id >= 0) {
+            if (strcmp (gi->node[id], host) != 0)
+                name = gi->node[id];
+            else if (gi->altname[id])
+                name = gi->altname[id];
+        }
 
-        if (hostlist_push_host(retlist, (rc > 0 ? altname : host)) <= 0)
-            err("%p: genders: warning: target `%s' not parsed: %m", host);
+        if (hostlist_push_host(retlist, name) <= 0)
+            err("%p: genders: warning: target `%s' not parsed: %m", name);
 
         free(host);
     }
 
     hostlist_iterator_destroy(i);
 
-    Free((void **) &altname);
-
     return (retlist);
 }
 
-static hostlist_t
-_genders_to_hostlist(genders_t gh, char **nodes, int nnodes)
-{
-    hostlist_t hl = NULL;
-    int i;
-
-    if ((hl = hostlist_create(NULL)) == NULL)
-        errx("%p: genders: hostlist_create failed: %m");
-
-    for (i = 0; i < nnodes; i++) {
-        if (hostlist_push_host(hl, nodes[i]) <= 0)
-            err("%p: warning: target `%s' not parsed: %m\n", nodes[i]);
-    }
-
-    hostlist_uniq(hl);
-
-    return hl;
-}
-
 static char * genders_filename_create (char *file)
 {
     char *genders_file;
@@ -464,21 +680,31 @@ static char * genders_filename_create (char *file)
     return (genders_file);
 }
 
-static genders_t _handle_create()
+/*
+ *  Return the path of the genders file to use, from -F,
+ *   PDSH_GENDERS_FILE or the default.
+ */
+static char * _genders_file ()
 {
     char *gfile_env;
+
+    if (gfile)
+        return genders_filename_create (gfile);
+    else if ((gfile_env = getenv ("PDSH_GENDERS_FILE")))
+        return genders_filename_create (gfile_env);
+    else
+        return genders_filename_create ("genders");
+}
+
+static genders_t _handle_create()
+{
     char *genders_file = NULL;
     genders_t gh = NULL;
 
     if ((gh = genders_handle_create()) == NULL)
         errx("%p: Unable to create genders handle: %m\n");
 
-    if (gfile)
-        genders_file = genders_filename_create (gfile);
-    else if ((gfile_env = getenv ("PDSH_GENDERS_FILE")))
-        genders_file = genders_filename_create (gfile_env);
-    else
-        genders_file = genders_filename_create ("genders");
+    genders_file = _genders_file ();
 
     /*
      *  Only exit on error from genders_load_data() if an genders
@@ -487,9 +713,455 @@ static genders_t _handle_create()
     if ((genders_load_data(gh, genders_file) < 0) && genders_opt_invoked)
         errx("%p: %s: %s\n", genders_file, genders_errormsg(gh));
 
+    Free ((void **) &genders_file);
+
     return gh;
 }
 
+/*
+ *  Binary genders cache.
+ *
+ *  When PDSH_GENDERS_CACHE_DIR is set, the genders index is saved there
+ *   after libgenders loads the genders file, and later runs map the
+ *   saved index instead of parsing the genders file again. An entry is
+ *   used only if the size, mtime and hash of the genders file match
+ *   those recorded in its header; otherwise it is rebuilt.
+ *
+ *  Layout, in native byte order:
+ *
+ *    struct gcache_header
+ *    uint64_t bits [nattrs][nwords]        attribute bitmaps
+ *    uint32_t node [nnodes]                name offsets
+ *    uint32_t altname [nnodes]             offsets, or GCACHE_NONE
+ *    uint32_t rcmd_type [nnodes]           offsets, or GCACHE_NONE
+ *    struct gcache_attr attr [nattrs]
+ *    struct gcache_val val [nvals]         grouped by attribute
+ *    char strtab [strsize]                 NUL terminated strings
+ */
+#define GCACHE_MAGIC      "pdshgndr"
+#define GCACHE_VERSION    1
+#define GCACHE_NONE       UINT32_MAX
+
+struct gcache_header {
+    char     magic[8];
+    uint32_t version;       /* also detects a foreign byte order */
+    uint32_t nnodes;
+    uint32_t nattrs;
+    uint32_t nvals;
+    uint32_t strsize;
+    uint32_t reserved;
+    uint64_t src_size;      /* size, mtime and hash of genders file */
+    int64_t  src_mtime;
+    uint64_t src_hash;
+};
+
+struct gcache_attr {
+    uint32_t name;
+    uint32_t nvals;
+    uint32_t firstval;      /* index of first value in val table */
+    uint32_t reserved;
+};
+
+struct gcache_val {
+    uint32_t node;
+    uint32_t val;
+};
+
+struct gcache_source {
+    uint64_t size;
+    int64_t  mtime;
+    uint64_t hash;
+};
+
+struct gcache_strtab {
+    char    *buf;
+    uint32_t size;
+    uint32_t max;
+};
+
+/*
+ *  Get size, mtime and content hash of genders file [path].
+ */
+static int _gcache_source (const char *path, struct gcache_source *src)
+{
+    struct stat st;
+    char *buf;
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0)
+        return (-1);
+    if (fstat (fd, &st) < 0 || !S_ISREG (st.st_mode)) {
+        close (fd);
+        return (-1);
+    }
+
+    buf = Malloc (st.st_size + 1);
+    if (fd_read_n (fd, buf, st.st_size) != st.st_size) {
+        Free ((void **) &buf);
+        close (fd);
+        return (-1);
+    }
+    close (fd);
+
+    src->size = st.st_size;
+    src->mtime = st.st_mtime;
+    src->hash = hash64 (buf, st.st_size, 0);
+    Free ((void **) &buf);
+    return (0);
+}
+
+/*
+ *  Create cache directory [dir] if needed. Since the cache decides
+ *   target hosts and rcmd types, it must be private to the user.
+ */
+static int _gcache_dir_check (const char *dir)
+{
+    struct stat st;
+
+    if (mkdir (dir, 0700) < 0 && errno != EEXIST) {
+        err ("%p: genders cache: mkdir %s: %m\n", dir);
+        return (-1);
+    }
+    if (lstat (dir, &st) < 0) {
+        err ("%p: genders cache: %s: %m\n", dir);
+        return (-1);
+    }
+    if (!S_ISDIR (st.st_mode)
+        || st.st_uid != geteuid ()
+        || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        err ("%p: genders cache: %s: not a private directory\n", dir);
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ *  Cache entry for genders file [file], named by a hash of its path.
+ */
+static char * _gcache_path (const char *dir, const char *file)
+{
+    char name [64];
+    char *path = NULL;
+
+    snprintf (name, sizeof (name), "/genders.%016llx",
+              (unsigned long long) hash64 (file, strlen (file), 0));
+    xstrcat (&path, (char *) dir);
+    xstrcat (&path, name);
+    return (path);
+}
+
+static struct genders_index *
+_gcache_load (const char *path, struct gcache_source *src)
+{
+    struct genders_index *idx;
+    struct gcache_header *h;
+    struct gcache_attr *attrs;
+    struct gcache_val *vals;
+    uint32_t *node, *altname, *rcmd_type;
+    const char *strtab;
+    uint64_t *bits;
+    uint64_t need;
+    size_t nwords;
+    struct stat st;
+    void *map;
+    uint32_t i;
+    int fd, j;
+
+    if ((fd = open (path, O_RDONLY)) < 0)
+        return (NULL);
+    if (fstat (fd, &st) < 0
+        || st.st_uid != geteuid ()
+        || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || (size_t) st.st_size < sizeof (*h)) {
+        close (fd);
+        return (NULL);
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return (NULL);
+
+    h = map;
+    nwords = h->nnodes / BITS_PER_WORD + 1;
+    need = sizeof (*h)
+         + (uint64_t) h->nattrs * nwords * sizeof (uint64_t)
+         + (uint64_t) h->nnodes * 3 * sizeof (uint32_t)
+         + (uint64_t) h->nattrs * sizeof (struct gcache_attr)
+         + (uint64_t) h->nvals * sizeof (struct gcache_val)
+         + h->strsize;
+
+    if (memcmp (h->magic, GCACHE_MAGIC, sizeof (h->magic)) != 0
+        || h->version != GCACHE_VERSION
+        || need != (uint64_t) st.st_size
+        || h->nnodes == 0
+        || h->strsize == 0
+        || ((char *) map)[st.st_size - 1] != '\0'
+        || h->src_size != src->size
+        || h->src_mtime != src->mtime
+        || h->src_hash != src->hash)
+        goto bad;
+
+    bits = (uint64_t *) (h + 1);
+    node = (uint32_t *) (bits + (size_t) h->nattrs * nwords);
+    altname = node + h->nnodes;
+    rcmd_type = altname + h->nnodes;
+    attrs = (struct gcache_attr *) (rcmd_type + h->nnodes);
+    vals = (struct gcache_val *) (attrs + h->nattrs);
+    strtab = (const char *) (vals + h->nvals);
+
+    /*
+     *  Check every offset before building the index on top of
+     *   the map, so a damaged entry is just rebuilt.
+     */
+    for (i = 0; i < h->nnodes; i++) {
+        if (node[i] >= h->strsize
+            || (altname[i] != GCACHE_NONE && altname[i] >= h->strsize)
+            || (rcmd_type[i] != GCACHE_NONE && rcmd_type[i] >= h->strsize))
+            goto bad;
+    }
+    for (i = 0; i < h->nattrs; i++) {
+        if (attrs[i].name >= h->strsize
+            || attrs[i].firstval > h->nvals
+            || attrs[i].nvals > h->nvals - attrs[i].firstval)
+            goto bad;
+    }
+    for (i = 0; i < h->nvals; i++) {
+        if (vals[i].node >= h->nnodes || vals[i].val >= h->strsize)
+            goto bad;
+    }
+
+    idx = Malloc (sizeof (*idx));
+    idx->nodes = _map_create ();
+    idx->attrs = _map_create ();
+    idx->map = map;
+    idx->mapsize = st.st_size;
+    idx->nnodes = h->nnodes;
+    idx->nwords = nwords;
+    idx->node = Malloc (h->nnodes * sizeof (char *));
+    idx->altname = Malloc (h->nnodes * sizeof (char *));
+    idx->rcmd_type = Malloc (h->nnodes * sizeof (char *));
+
+    for (i = 0; i < h->nnodes; i++) {
+        idx->node[i] = (char *) strtab + node[i];
+        _map_insert (idx->nodes, idx->node[i], i);
+        if (altname[i] != GCACHE_NONE)
+            idx->altname[i] = (char *) strtab + altname[i];
+        if (rcmd_type[i] != GCACHE_NONE)
+            idx->rcmd_type[i] = (char *) strtab + rcmd_type[i];
+    }
+    for (i = 0; i < h->nnodes; i++) {
+        if (idx->altname[i])
+            _map_insert (idx->nodes, idx->altname[i], i);
+    }
+
+    if (h->nattrs)
+        idx->attr = Malloc (h->nattrs * sizeof (struct gindex_attr));
+    idx->nattrs = h->nattrs;
+    for (i = 0; i < h->nattrs; i++) {
+        struct gindex_attr *a = &idx->attr[i];
+        struct gcache_val *v = vals + attrs[i].firstval;
+
+        a->name = (char *) strtab + attrs[i].name;
+        a->bits = bits + (size_t) i * nwords;
+        _map_insert (idx->attrs, a->name, i);
+
+        if ((a->nvals = a->size = attrs[i].nvals) == 0)
+            continue;
+        a->val_node = Malloc (a->nvals * sizeof (int));
+        a->val = Malloc (a->nvals * sizeof (char *));
+        for (j = 0; j < a->nvals; j++) {
+            a->val_node[j] = v[j].node;
+            a->val[j] = (char *) strtab + v[j].val;
+        }
+    }
+
+    return (idx);
+
+  bad:
+    munmap (map, st.st_size);
+    return (NULL);
+}
+
+static uint32_t _strtab_add (struct gcache_strtab *t, const char *s)
+{
+    uint32_t off = t->size;
+    size_t len = strlen (s) + 1;
+
+    while (t->size + len > t->max) {
+        t->max *= 2;
+        Realloc ((void **) &t->buf, t->max);
+    }
+    memcpy (t->buf + t->size, s, len);
+    t->size += len;
+    return (off);
+}
+
+/*
+ *  Write [len] bytes of [buf] to [fd], returning -1 with an error
+ *   message naming [path] on failure.
+ */
+static int _gcache_write_n (int fd, const char *path, void *buf, size_t len)
+{
+    if (len && fd_write_n (fd, buf, len) < 0) {
+        err ("%p: genders cache: %s: write: %m\n", path);
+        return (-1);
+    }
+    return (0);
+}
+
+static int _gcache_write (const char *path, struct genders_index *idx,
+                          struct gcache_source *src)
+{
+    struct gcache_header h;
+    struct gcache_strtab t;
+    struct gcache_attr *attrs;
+    struct gcache_val *vals;
+    uint32_t *node;
+    uint32_t nvals = 0;
+    char *tmp = NULL;
+    int rc = -1;
+    int fd = -1;
+    int i, j;
+
+    t.max = 4096;
+    t.size = 0;
+    t.buf = Malloc (t.max);
+
+    node = Malloc (idx->nnodes * 3 * sizeof (uint32_t));
+    for (i = 0; i < idx->nnodes; i++) {
+        node[i] = _strtab_add (&t, idx->node[i]);
+        node[idx->nnodes + i] = GCACHE_NONE;
+        node[2 * idx->nnodes + i] = GCACHE_NONE;
+    }
+
+    for (i = 0; i < idx->nattrs; i++)
+        nvals += idx->attr[i].nvals;
+
+    attrs = Malloc ((idx->nattrs + 1) * sizeof (*attrs));
+    vals = Malloc ((nvals + 1) * sizeof (*vals));
+    nvals = 0;
+
+    for (i = 0; i < idx->nattrs; i++) {
+        struct gindex_attr *a = &idx->attr[i];
+
+        attrs[i].name = _strtab_add (&t, a->name);
+        attrs[i].nvals = a->nvals;
+        attrs[i].firstval = nvals;
+
+        for (j = 0; j < a->nvals; j++, nvals++) {
+            int n = a->val_node[j];
+            vals[nvals].node = n;
+            vals[nvals].val = _strtab_add (&t, a->val[j]);
+
+            /*  altname and rcmd_type point at attribute values */
+            if (idx->altname[n] == a->val[j])
+                node[idx->nnodes + n] = vals[nvals].val;
+            if (idx->rcmd_type[n] == a->val[j])
+                node[2 * idx->nnodes + n] = vals[nvals].val;
+        }
+    }
+
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, GCACHE_MAGIC, sizeof (h.magic));
+    h.version = GCACHE_VERSION;
+    h.nnodes = idx->nnodes;
+    h.nattrs = idx->nattrs;
+    h.nvals = nvals;
+    h.strsize = t.size;
+    h.src_size = src->size;
+    h.src_mtime = src->mtime;
+    h.src_hash = src->hash;
+
+    xstrcat (&tmp, (char *) path);
+    xstrcat (&tmp, ".XXXXXX");
+    if ((fd = mkstemp (tmp)) < 0) {
+        err ("%p: genders cache: %s: %m\n", tmp);
+        goto out;
+    }
+
+    if (_gcache_write_n (fd, tmp, &h, sizeof (h)) < 0)
+        goto fail;
+    for (i = 0; i < idx->nattrs; i++) {
+        if (_gcache_write_n (fd, tmp, idx->attr[i].bits,
+                             idx->nwords * sizeof (uint64_t)) < 0)
+            goto fail;
+    }
+    if (_gcache_write_n (fd, tmp, node, idx->nnodes * 3 * sizeof (*node)) < 0
+        || _gcache_write_n (fd, tmp, attrs, idx->nattrs * sizeof (*attrs)) < 0
+        || _gcache_write_n (fd, tmp, vals, nvals * sizeof (*vals)) < 0
+        || _gcache_write_n (fd, tmp, t.buf, t.size) < 0)
+        goto fail;
+
+    if (close (fd) < 0) {
+        fd = -1;
+        err ("%p: genders cache: %s: %m\n", tmp);
+        goto fail;
+    }
+    fd = -1;
+
+    if (rename (tmp, path) < 0) {
+        err ("%p: genders cache: rename %s: %m\n", tmp);
+        goto fail;
+    }
+    rc = 0;
+    goto out;
+
+  fail:
+    if (fd >= 0)
+        close (fd);
+    unlink (tmp);
+  out:
+    Free ((void **) &tmp);
+    Free ((void **) &vals);
+    Free ((void **) &attrs);
+    Free ((void **) &node);
+    Free ((void **) &t.buf);
+    return (rc);
+}
+
+/*
+ *  Build the genders index, from the genders cache if enabled and
+ *   valid for the current genders file, otherwise by loading the
+ *   genders file with libgenders (refreshing the cache afterwards).
+ */
+static void _index_init ()
+{
+    char *dir = getenv ("PDSH_GENDERS_CACHE_DIR");
+    struct gcache_source src, now;
+    char *file = NULL;
+    char *path = NULL;
+
+    if (gi != NULL)
+        return;
+
+    if (dir && *dir && _gcache_dir_check (dir) == 0) {
+        file = _genders_file ();
+        if (_gcache_source (file, &src) == 0) {
+            path = _gcache_path (dir, file);
+            if ((gi = _gcache_load (path, &src)))
+                goto out;
+        }
+    }
+
+    gh = _handle_create ();
+    gi = _index_create (gh);
+
+    /*
+     *  Don't save the index if the genders file changed while
+     *   libgenders was reading it.
+     */
+    if (path && gi->nnodes > 0
+        && _gcache_source (file, &now) == 0
+        && memcmp (&src, &now, sizeof (src)) == 0)
+        _gcache_write (path, gi, &src);
+
+  out:
+    if (file)
+        Free ((void **) &file);
+    if (path)
+        Free ((void **) &path);
+}
+
 /*
  *  Search attr argument for an '=' char indicating an
  *   attr=value pair. If found, nullify '=' and return
@@ -497,7 +1169,6 @@ static genders_t _handle_create()
  *
  *  Returns NULL if no '=' found.
  */
-#if !HAVE_GENDERS_QUERY
 static char *
 _get_val(char *attr)
 {
@@ -513,92 +1184,135 @@ _get_val(char *attr)
 
     return (val);
 }
-#endif /* !HAVE_GENDERS_QUERY */
 
-static hostlist_t
-_read_genders_attr(char *query)
+#if HAVE_GENDERS_QUERY
+/*
+ *  Return true if [query] uses genders query operators, and so must be
+ *   evaluated by libgenders instead of directly from the index.
+ */
+static bool
+_is_compound_query (const char *query)
+{
+    return (strstr (query, "||") || strstr (query, "&&")
+            || strstr (query, "--") || strpbrk (query, "~()"));
+}
+
+/*
+ *  Evaluate compound genders [query] with libgenders, setting the
+ *   resulting nodes in [bits].
+ */
+static void
+_read_genders_query (char *query, uint64_t *bits)
 {
-    hostlist_t hl = NULL;
     char **nodes;
-    int len, nnodes;
+    int len, nnodes, i;
+
+    /*
+     *  No libgenders handle if the index came from the genders cache
+     */
+    if (gh == NULL)
+        gh = _handle_create();
 
     if ((len = genders_nodelist_create(gh, &nodes)) < 0)
         errx("%p: genders: nodelist_create: %s\n", genders_errormsg(gh));
 
-#if HAVE_GENDERS_QUERY
     if ((nnodes = genders_query (gh, nodes, len, query)) < 0) {
         errx("%p: Error querying genders for query \"%s\": %s\n",
-                query ? query : "(all)", genders_errormsg(gh));
-    }
-#else /* !HAVE_GENDERS_QUERY */
-    {
-        /* query defaults to just an attribute or attribute=value pair */
-        char *val;
-        val = _get_val(query);
-        if ((nnodes = genders_getnodes(gh, nodes, len, query, val)) < 0) {
-            errx("%p: Error querying genders for attr \"%s\": %s\n",
-                 query ? query : "(all)", genders_errormsg(gh));
-        }
+                query, genders_errormsg(gh));
     }
-#endif /* HAVE_GENDERS_QUERY */
 
-    hl = _genders_to_hostlist(gh, nodes, nnodes);
+    for (i = 0; i < nnodes; i++) {
+        int id = _map_find (gi->nodes, nodes[i]);
+        if (id >= 0)
+            _bit_set (bits, id);
+    }
 
     if (genders_nodelist_destroy(gh, nodes) < 0) {
         errx("%p: Error destroying genders node list: %s\n",
                 genders_errormsg(gh));
     }
-
-    return hl;
 }
+#endif /* HAVE_GENDERS_QUERY */
 
-static hostlist_t
-_read_genders (List attrs)
+/*
+ *  Set nodes matching genders [query] (attr or attr=val) in [bits].
+ *   A query of ALL_NODES matches every node.
+ */
+static void
+_read_genders_attr (char *query, uint64_t *bits)
 {
-    hostlist_t   hl = NULL;
-    char *    query = NULL;
-
-    if ((attrs == NULL) && (allnodes)) /* Special "all nodes" case */
-        return _read_genders_attr (ALL_NODES);
+    struct gindex_attr *a;
+    char *attr, *val;
+    int i, id;
+
+    if (query == ALL_NODES) {
+        for (i = 0; i < gi->nnodes; i++)
+            _bit_set (bits, i);
+        return;
+    }
 
-    if ((attrs == NULL) || (list_count (attrs) == 0))
-        return NULL;
+#if HAVE_GENDERS_QUERY
+    if (_is_compound_query (query)) {
+        _read_genders_query (query, bits);
+        return;
+    }
+#endif /* HAVE_GENDERS_QUERY */
 
-    while ((query = list_pop (attrs))) {
-        hostlist_t l = _read_genders_attr (query);
+    attr = Strdup (query);
+    val = _get_val (attr);
 
-        if (hl == NULL) {
-            hl = l;
+    if ((id = _map_find (gi->attrs, attr)) >= 0) {
+        a = &gi->attr[id];
+        if (val == NULL) {
+            for (i = 0; i < gi->nwords; i++)
+                bits[i] |= a->bits[i];
         } else {
-            hostlist_push_list (hl, l);
-            hostlist_destroy (l);
+            for (i = 0; i < a->nvals; i++) {
+                if (strcmp (a->val[i], val) == 0)
+                    _bit_set (bits, a->val_node[i]);
+            }
         }
-        Free ((void **)&query);
     }
 
-    hostlist_uniq (hl);
-
-    return (hl);
+    Free ((void **) &attr);
 }
 
-static int
-attrval_by_altname (genders_t g, const char *host, const char *attr,
-                           char *val, int len)
+static hostlist_t
+_read_genders (List attrs)
 {
-    char *altname = NULL;
-    char *altattr = GENDERS_ALTNAME_ATTRIBUTE;
-    int maxlen = _maxnamelen (g);
-    int rc = -1;
+    hostlist_t   hl = NULL;
+    uint64_t *bits = NULL;
+    char *    query = NULL;
+    int i;
 
-    altname = Malloc (maxlen + 1);
-    memset (altname, 0, maxlen);
+    if ((attrs == NULL) && (allnodes)) { /* Special "all nodes" case */
+        bits = _bitmap_create (gi);
+        _read_genders_attr (ALL_NODES, bits);
+    }
+    else if ((attrs == NULL) || (list_count (attrs) == 0))
+        return NULL;
+    else
+        bits = _genders_select (attrs);
 
-    if ((rc = genders_getnodes (g, &altname, 1, altattr, host)) > 0)
-        rc = genders_testattr (g, altname, attr, val, sizeof (val));
+    /*
+     *  Consume the query list, so it is not applied again
+     *   as a filter in genders_postop().
+     */
+    while (attrs && (query = list_pop (attrs)))
+        Free ((void **)&query);
+
+    if ((hl = hostlist_create (NULL)) == NULL)
+        errx("%p: genders: hostlist_create failed: %m");
+
+    for (i = 0; i < gi->nnodes; i++) {
+        if (_bit_test (bits, i) && (hostlist_push_host (hl, gi->node[i]) <= 0))
+            err("%p: warning: target `%s' not parsed: %m\n", gi->node[i]);
+    }
+    Free ((void **) &bits);
 
-    Free ((void **) &altname);
+    hostlist_uniq (hl);
 
-    return rc;
+    return (hl);
 }
 
 /*
@@ -632,7 +1346,6 @@ register_genders_rcmd_types (opt_t *opt)
     char *host;
     char *rcmd;
     char *user;
-    char val[64];
     char rcmd_attr[] = "pdsh_rcmd_type";
     hostlist_iterator_t i = NULL;
 
@@ -640,28 +1353,24 @@ register_genders_rcmd_types (opt_t *opt)
         return (0);
 
     /*
-     *  Assume no nodes have "pdsh_rcmd_type" attr if index fails:
+     *  Nothing to do if no nodes have "pdsh_rcmd_type" attr:
      */
-    if (genders_index_attrvals (gh, rcmd_attr) < 0)
+    if (_map_find (gi->attrs, rcmd_attr) < 0)
         return (0);
 
     i = hostlist_iterator_create (opt->wcoll);
     while ((host = hostlist_next (i))) {
-        int rc;
-        memset (val, 0, sizeof (val));
-        rc = genders_testattr (gh, host, rcmd_attr, val, sizeof (val));
-
         /*
-         *  If host wasn't found, try to see if "host" is the altname
-         *   for this node, then lookup with the real name
+         *  Index lookup finds host by canonical name or altname
          */
-        if (rc < 0 && (genders_errnum(gh) == GENDERS_ERR_NOTFOUND))
-            rc = attrval_by_altname (gh, host, rcmd_attr, val, sizeof (val));
+        int id = _map_find (gi->nodes, host);
 
-        rcmd_type_parse (val, &rcmd, &user);
-
-        if (rc > 0)
+        if (id >= 0 && gi->rcmd_type[id]) {
+            char *val = Strdup (gi->rcmd_type[id]);
+            rcmd_type_parse (val, &rcmd, &user);
             rcmd_register_defaults (host, rcmd, user);
+            Free ((void **) &val);
+        }
 
         free (host);
     }
@@ -671,21 +1380,6 @@ register_genders_rcmd_types (opt_t *opt)
     return 0;
 }
 
-static int
-_delete_all (hostlist_t hl, hostlist_t dl)
-{
-    int                 rc   = 0;
-    char *              host = NULL;
-    hostlist_iterator_t i    = hostlist_iterator_create (dl);
-
-    while ((host = hostlist_next (i))) {
-        rc += hostlist_delete_host (hl, host);
-        free (host);
-    }
-    hostlist_iterator_destroy (i);
-    return (rc);
-}
-
 /*
  * vi: tabstop=4 shiftwidth=4 expandtab
  */
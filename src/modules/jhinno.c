@@ -37,15 +37,18 @@
 #include "src/common/split.h"
 #include "src/common/err.h"
 #include "src/common/xmalloc.h"
+#include "src/common/xstring.h"
 #include "src/pdsh/mod.h"
 #include "src/pdsh/opt.h"
 
 #if STATIC_MODULES
 #  define pdsh_module_info jhinno_module_info
 #  define pdsh_module_priority jhinno_module_priority
+#  define pdsh_module_ops_version jhinno_module_ops_version
 #endif
 
 int pdsh_module_priority = 10;
+int pdsh_module_ops_version = PDSH_MODULE_OPS_VERSION;
 
 /*
  * Module operations
@@ -53,6 +56,7 @@ int pdsh_module_priority = 10;
 static int mod_jhinno_init(void);
 static int mod_jhinno_exit(void);
 static int mod_jhinno_wcoll(opt_t *opt);
+static char *mod_jhinno_wcoll_key(opt_t *opt);
 static int jhinno_process_opt(opt_t *, int opt, char *arg);
 
 static List job_list = NULL;
@@ -63,7 +67,8 @@ struct pdsh_module_operations jhinno_module_ops = {
     (ModInitF)       mod_jhinno_init,
     (ModExitF)       mod_jhinno_exit,
     (ModReadWcollF)  mod_jhinno_wcoll,
-    (ModPostOpF)     NULL
+    (ModPostOpF)     NULL,
+    (ModWcollKeyF)   mod_jhinno_wcoll_key
 };
 
 /*
@@ -200,439 +205,377 @@ static int _is_jobid_numeric(const char *s)
 }
 
 /*
- * Parse jjobs output: "64*ev-hpc-compute098:64*ev-hpc-compute164"
- * Extract node names, ignore the numeric prefix (CPU count)
+ * Growable token buffer for the streaming output parsers, so that
+ *  there is no limit on the length of scheduler output lines.
  */
-static hostlist_t _jhinno_wcoll_from_jobid(const char *jobid)
+struct token {
+    char   *buf;
+    size_t  len;
+    size_t  size;
+};
+
+static void _token_add(struct token *t, int c)
 {
-    FILE *fp = NULL;
-    char cmd[1024];
-    char line[8192];  /* Large buffer for long host lists */
-    char line_copy[8192];  /* Copy for strtok */
-    hostlist_t hl = NULL;
-    int ret;
-    
-    (void)ret;  /* Suppress unused variable warning */
-    
-    if (jobid == NULL) {
-        err("%p: jhinno: jobid is NULL\n");
-        return NULL;
-    }
-    
-    ret = snprintf(cmd, sizeof(cmd), "jjobs -o exec_host:4096 %s 2>/dev/null", jobid);
-    if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-        err("%p: jhinno: jobid too long\n");
-        return NULL;
-    }
-    
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        err("%p: jhinno: Failed to execute jjobs command: %s\n", strerror(errno));
-        return NULL;
-    }
-    
-    /* Skip header line */
-    if (fgets(line, sizeof(line), fp) == NULL) {
-        err("%p: jhinno: No output from jjobs\n");
-        pclose(fp);
-        return NULL;
-    }
-    
-    /* Read data line */
-    if (fgets(line, sizeof(line), fp) != NULL) {
-        /* Make a copy for strtok since it modifies the string */
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        /* Remove newline */
-        line_copy[strcspn(line_copy, "\n")] = '\0';
-        
-        /* Skip if still header */
-        if (strstr(line_copy, "EXEC_HOST")) {
-            if (fgets(line, sizeof(line), fp) == NULL) {
-                err("%p: jhinno: No data line from jjobs\n");
-                pclose(fp);
-                return NULL;
-            }
-            strncpy(line_copy, line, sizeof(line_copy) - 1);
-            line_copy[sizeof(line_copy) - 1] = '\0';
-            line_copy[strcspn(line_copy, "\n")] = '\0';
-        }
-        
-        /* Split by colon */
-        char *token = strtok(line_copy, ":");
-        while (token != NULL) {
-            char hostname[256];
-            char *sep;
-            
-            /* Skip whitespace */
-            while (*token == ' ' || *token == '\t')
-                token++;
-            
-            if (*token == '\0')
-                continue;
-            
-            sep = strchr(token, '*');
-            
-            if (sep != NULL) {
-                /* Format: "64*hostname" - extract hostname after '*' */
-                size_t len = strlen(sep + 1);
-                if (len == 0) {
-                    token = strtok(NULL, ":");
-                    continue;
-                }
-                len = (len < sizeof(hostname) - 1) ? len : sizeof(hostname) - 1;
-                memcpy(hostname, sep + 1, len);
-                hostname[len] = '\0';
-            } else {
-                /* No prefix, use as-is */
-                size_t len = strlen(token);
-                if (len == 0) {
-                    token = strtok(NULL, ":");
-                    continue;
-                }
-                len = (len < sizeof(hostname) - 1) ? len : sizeof(hostname) - 1;
-                memcpy(hostname, token, len);
-                hostname[len] = '\0';
-            }
-            
-            /* Trim trailing whitespace from hostname */
-            while (strlen(hostname) > 0 && 
-                   (hostname[strlen(hostname) - 1] == ' ' || 
-                    hostname[strlen(hostname) - 1] == '\t')) {
-                hostname[strlen(hostname) - 1] = '\0';
-            }
-            
-            /* Skip empty hostnames and "-" (waiting jobs) */
-            if (strlen(hostname) > 0 && strcmp(hostname, "-") != 0) {
-                if (hl == NULL) {
-                    hl = hostlist_create(hostname);
-                    if (hl == NULL) {
-                        err("%p: jhinno: Failed to create hostlist\n");
-                        pclose(fp);
-                        return NULL;
-                    }
-                } else {
-                    ret = hostlist_push_host(hl, hostname);
-                    if (ret < 0) {
-                        err("%p: jhinno: Failed to add host to list\n");
-                        /* Continue with other hosts */
-                    }
-                }
-            }
-            
-            token = strtok(NULL, ":");
-        }
-    }
-    
-    if (fp) {
-        if (pclose(fp) != 0) {
-            err("%p: jhinno: jjobs command failed\n");
-        }
-    }
-    
-    if (hl)
-        hostlist_uniq(hl);
-    
-    return hl;
+    if (t->len + 1 >= t->size) {
+        t->size = t->size ? t->size * 2 : 256;
+        if (t->buf)
+            Realloc((void **) &t->buf, t->size);
+        else
+            t->buf = Malloc(t->size);
+    }
+    t->buf[t->len++] = c;
+    t->buf[t->len] = '\0';
 }
 
 /*
- * Parse jhosts output for specific node group
- * Format: skip header line, then read data rows, extract first column
+ * Add one exec_host entry from jjobs, e.g. "64*ev-hpc-compute098".
+ *  The CPU count prefix is dropped, as is "-" for jobs not running.
  */
-static hostlist_t _jhinno_wcoll_from_group(const char *nodegroup)
+static void _exec_host_push(hostlist_t hl, struct token *t)
 {
-    FILE *fp = NULL;
-    char cmd[1024];
-    char line[8192];  /* Large buffer for long host lists */
-    char line_copy[8192];  /* Copy for strtok */
-    hostlist_t hl = NULL;
-    int line_num = 0;
-    int ret;
-    int cmd_len;
-    
-    if (nodegroup == NULL || nodegroup[0] == '\0') {
-        err("%p: jhinno: nodegroup is NULL or empty\n");
-        return NULL;
-    }
-    
-    /* Build command: jhosts -w [nodegroup] [-R "filter"] */
-    if (filter_expression != NULL) {
-        cmd_len = snprintf(cmd, sizeof(cmd), 
-                          "jhosts -w %s -R \"%s\" 2>/dev/null", 
-                          nodegroup, filter_expression);
-    } else {
-        cmd_len = snprintf(cmd, sizeof(cmd), 
-                          "jhosts -w %s 2>/dev/null", 
-                          nodegroup);
-    }
-    
-    if (cmd_len < 0 || (size_t)cmd_len >= sizeof(cmd)) {
-        err("%p: jhinno: command too long\n");
-        return NULL;
+    char *host;
+
+    if (t->len == 0)
+        return;
+
+    host = strchr(t->buf, '*');
+    host = host ? host + 1 : t->buf;
+
+    if (*host != '\0' && strcmp(host, "-") != 0) {
+        if (hostlist_push_host(hl, host) < 0)
+            err("%p: jhinno: Failed to add host to list\n");
     }
-    
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        err("%p: jhinno: Failed to execute jhosts command: %s\n", strerror(errno));
-        return NULL;
+    t->len = 0;
+}
+
+/*
+ * Read the rest of a JSON string whose opening quote has been read
+ *  into [t]. Returns -1 if the input ends first.
+ */
+static int _json_string(FILE *fp, struct token *t)
+{
+    int c;
+
+    t->len = 0;
+    while ((c = getc(fp)) != EOF && c != '"') {
+        if (c == '\\' && (c = getc(fp)) == EOF)
+            break;
+        _token_add(t, c);
     }
-    
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line_num++;
-        
-        /* Skip first line (header) */
-        if (line_num == 1)
-            continue;
-        
-        /* Make a copy for strtok since it modifies the string */
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        /* Remove newline */
-        line_copy[strcspn(line_copy, "\n")] = '\0';
-        
-        /* Skip empty lines */
-        if (strlen(line_copy) == 0)
+    return (c == '"' ? 0 : -1);
+}
+
+/*
+ * Parse "jjobs -json -o exec_host" output. Each job record holds
+ *  e.g. "EXEC_HOST":"64*ev-hpc-compute098:64*ev-hpc-compute164".
+ *  JSON output is not cut to a column width, unlike "-o exec_host:N".
+ */
+static void _parse_jjobs(FILE *fp, hostlist_t hl)
+{
+    struct token t = { NULL, 0, 0 };
+    struct token h = { NULL, 0, 0 };
+    int state = 0;  /* 1: read "EXEC_HOST" key, 2: read its colon too */
+    int c;
+    size_t i;
+
+    while ((c = getc(fp)) != EOF) {
+        if (isspace(c))
             continue;
-        
-        /* Extract hostname (first field) */
-        char *hostname = strtok(line_copy, " \t");
-        if (hostname == NULL || hostname[0] == '\0')
+        if (c == ':' && state == 1) {
+            state = 2;
             continue;
-        
-        /* Skip whitespace */
-        while (*hostname == ' ' || *hostname == '\t')
-            hostname++;
-        
-        if (*hostname == '\0')
+        }
+        if (c != '"') {
+            state = 0;
             continue;
-        
-        /* For jhosts -w output, each line is just a hostname (no type field) */
-        /* No need to check for UNKNOWN or other types */
-        
-        if (hl == NULL) {
-            hl = hostlist_create(hostname);
-            if (hl == NULL) {
-                err("%p: jhinno: Failed to create hostlist\n");
-                if (fp) pclose(fp);
-                return NULL;
+        }
+        if (_json_string(fp, &t) < 0)
+            break;
+        if (state == 2) {
+            for (i = 0; i < t.len; i++) {
+                if (t.buf[i] == ':')
+                    _exec_host_push(hl, &h);
+                else
+                    _token_add(&h, t.buf[i]);
             }
-        } else {
-            ret = hostlist_push_host(hl, hostname);
-            if (ret < 0) {
-                err("%p: jhinno: Failed to add host to list\n");
-                /* Continue with other hosts */
+            _exec_host_push(hl, &h);
+            state = 0;
+        } else
+            state = (t.len && strcmp(t.buf, "EXEC_HOST") == 0);
+    }
+
+    if (t.buf)
+        Free((void **) &t.buf);
+    if (h.buf)
+        Free((void **) &h.buf);
+}
+
+/*
+ * Parse jhosts -w output: a header line, then one line per host
+ *  with the hostname in the first column.
+ */
+static void _parse_jhosts(FILE *fp, hostlist_t hl)
+{
+    struct token t = { NULL, 0, 0 };
+    int lineno = 1;
+    int done = 0;   /* first column of this line already read */
+    int c;
+
+    while ((c = getc(fp)) != EOF) {
+        if (isspace(c)) {
+            if (t.len > 0 && lineno > 1) {
+                if (hostlist_push_host(hl, t.buf) < 0)
+                    err("%p: jhinno: Failed to add host to list\n");
             }
-        }
+            if (t.len > 0)
+                done = 1;
+            t.len = 0;
+            if (c == '\n') {
+                lineno++;
+                done = 0;
+            }
+        } else if (!done)
+            _token_add(&t, c);
     }
-    
-    if (fp) {
-        if (pclose(fp) != 0) {
-            err("%p: jhinno: jhosts command failed\n");
-        }
+    if (t.len > 0 && lineno > 1) {
+        if (hostlist_push_host(hl, t.buf) < 0)
+            err("%p: jhinno: Failed to add host to list\n");
     }
-    
-    if (hl)
-        hostlist_uniq(hl);
-    
-    return hl;
+
+    if (t.buf)
+        Free((void **) &t.buf);
 }
 
 /*
- * Parse jhosts output for all nodes (jhosts -w)
- * Format: skip header line, then read data rows
- * Extract first column (hostname)
- * Note: jhosts -w doesn't include type field; filtering is done via -R if specified
+ * Append " -R "expr"" to [cmd] if [expr] is set
  */
-static hostlist_t _jhinno_wcoll_all(void)
+static void _append_filter(char **cmd, const char *expr)
 {
-    FILE *fp = NULL;
-    char cmd[1024];
-    char line[8192];  /* Large buffer for long host lists */
-    char line_copy[8192];  /* Copy for strtok */
-    hostlist_t hl = NULL;
-    int line_num = 0;
-    int ret;
-    int cmd_len;
-    
-    /* Build command: jhosts -w [-R "filter"] */
-    if (filter_expression != NULL) {
-        cmd_len = snprintf(cmd, sizeof(cmd), 
-                          "jhosts -w -R \"%s\" 2>/dev/null", 
-                          filter_expression);
-    } else {
-        cmd_len = snprintf(cmd, sizeof(cmd), 
-                          "jhosts -w 2>/dev/null");
-    }
-    
-    if (cmd_len < 0 || (size_t)cmd_len >= sizeof(cmd)) {
-        err("%p: jhinno: command too long\n");
-        return NULL;
+    if (expr == NULL)
+        return;
+    xstrcat(cmd, " -R \"");
+    xstrcat(cmd, (char *) expr);
+    xstrcat(cmd, "\"");
+}
+
+/*
+ * Append each string in [l] to [cmd], separated by spaces
+ */
+static void _append_list(char **cmd, List l)
+{
+    ListIterator li = list_iterator_create(l);
+    char *s;
+
+    while ((s = list_next(li))) {
+        xstrcatchar(cmd, ' ');
+        xstrcat(cmd, s);
     }
-    
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        err("%p: jhinno: Failed to execute jhosts command: %s\n", strerror(errno));
-        return NULL;
+    list_iterator_destroy(li);
+}
+
+/*
+ * jjobs command for job ids [ids]
+ */
+static char *_jjobs_cmd(List ids)
+{
+    char *cmd = NULL;
+
+    xstrcat(&cmd, "jjobs -json -o exec_host");
+    _append_list(&cmd, ids);
+    return cmd;
+}
+
+/*
+ * jhosts command for node groups [groups], or all nodes if NULL
+ */
+static char *_jhosts_cmd(List groups)
+{
+    char *cmd = NULL;
+
+    xstrcat(&cmd, "jhosts -w");
+    if (groups)
+        _append_list(&cmd, groups);
+    _append_filter(&cmd, filter_expression);
+    return cmd;
+}
+
+/*
+ * Kind of scheduler command run by _query_run()
+ */
+struct jhinno_cmd {
+    const char *name;                       /* for error messages */
+    char     *(*create) (List args);
+    void      (*parse) (FILE *, hostlist_t);
+};
+
+static struct jhinno_cmd jjobs_cmd = { "jjobs", _jjobs_cmd, _parse_jjobs };
+static struct jhinno_cmd jhosts_cmd = { "jhosts", _jhosts_cmd, _parse_jhosts };
+
+/*
+ * One jjobs or jhosts command run by _query_run(). [args] holds the
+ *  job ids or node groups passed to the command, if any.
+ */
+struct jhinno_query {
+    struct jhinno_cmd *type;
+    char       *cmd;
+    List        args;
+    FILE       *fp;
+};
+
+static void _query_add(struct jhinno_query *q, int *n,
+                       struct jhinno_cmd *type, char *cmd, List args)
+{
+    xstrcat(&cmd, " 2>/dev/null");
+    q[*n].type = type;
+    q[*n].cmd = cmd;
+    q[*n].args = args;
+    q[*n].fp = NULL;
+    (*n)++;
+}
+
+/*
+ * Run the [n] queries in [q], adding the hosts found to [hl]. Every
+ *  command is started before any output is read so the scheduler
+ *  queries run concurrently.
+ *
+ * A batched query fails as a whole if one job id or node group in it
+ *  is bad, so a failed query with several arguments is run again with
+ *  one query per argument, and only the bad ones are reported.
+ */
+static void _query_run(struct jhinno_query *q, int n, hostlist_t hl)
+{
+    struct jhinno_query *retry;
+    int nretry = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if ((q[i].fp = popen(q[i].cmd, "r")) == NULL)
+            err("%p: jhinno: Failed to execute %s command: %m\n",
+                q[i].type->name);
     }
-    
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line_num++;
-        
-        /* Skip first line (header) */
-        if (line_num == 1)
-            continue;
-        
-        /* Make a copy for strtok since it modifies the string */
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        /* Remove newline */
-        line_copy[strcspn(line_copy, "\n")] = '\0';
-        
-        /* Skip empty lines */
-        if (strlen(line_copy) == 0)
-            continue;
-        
-        /* Extract hostname (first field) */
-        char *hostname = strtok(line_copy, " \t");
-        if (hostname == NULL || hostname[0] == '\0')
-            continue;
-        
-        /* Skip whitespace */
-        while (*hostname == ' ' || *hostname == '\t')
-            hostname++;
-        
-        if (*hostname == '\0')
+
+    for (i = 0; i < n; i++) {
+        hostlist_t found;
+
+        if (q[i].fp == NULL)
             continue;
-        
-        /* For jhosts -w output, each line is just a hostname (no type field) */
-        /* No need to check for UNKNOWN; use -F option for filtering instead */
-        
-        if (hl == NULL) {
-            hl = hostlist_create(hostname);
-            if (hl == NULL) {
-                err("%p: jhinno: Failed to create hostlist\n");
-                if (fp) pclose(fp);
-                return NULL;
-            }
-        } else {
-            ret = hostlist_push_host(hl, hostname);
-            if (ret < 0) {
-                err("%p: jhinno: Failed to add host to list\n");
-                /* Continue with other hosts */
-            }
+
+        found = hostlist_create(NULL);
+        q[i].type->parse(q[i].fp, found);
+        if (pclose(q[i].fp) == 0)
+            hostlist_push_list(hl, found);
+        else if (q[i].args && list_count(q[i].args) > 1)
+            nretry += list_count(q[i].args);
+        else if (q[i].args)
+            err("%p: jhinno: %s failed for %s\n", q[i].type->name,
+                list_peek(q[i].args));
+        else {
+            err("%p: jhinno: %s command failed\n", q[i].type->name);
+            hostlist_push_list(hl, found);
         }
+        hostlist_destroy(found);
     }
-    
-    if (fp) {
-        if (pclose(fp) != 0) {
-            err("%p: jhinno: jhosts command failed\n");
+
+    if (nretry == 0)
+        return;
+
+    retry = Malloc(nretry * sizeof(*retry));
+    nretry = 0;
+    for (i = 0; i < n; i++) {
+        ListIterator li;
+        char *arg;
+
+        if (q[i].fp == NULL || q[i].args == NULL
+            || list_count(q[i].args) < 2)
+            continue;
+
+        li = list_iterator_create(q[i].args);
+        while ((arg = list_next(li))) {
+            List one = list_create(NULL);
+            list_append(one, arg);
+            _query_add(retry, &nretry, q[i].type, q[i].type->create(one), one);
         }
+        list_iterator_destroy(li);
     }
-    
-    if (hl)
-        hostlist_uniq(hl);
-    
-    return hl;
+
+    _query_run(retry, nretry, hl);
+
+    for (i = 0; i < nretry; i++) {
+        Free((void **) &retry[i].cmd);
+        list_destroy(retry[i].args);
+    }
+    Free((void **) &retry);
 }
 
 /*
- * Parse using resource request string directly
- * Command: jhosts -w -R "expression"
-* Format: select[] order[] rusage[] span[]
-*/
-static hostlist_t _jhinno_wcoll_by_filter(const char *filter_expr)
+ * Get nodes for each entry in [entries], which may be a job id,
+ *  node group, resource request string or "all".
+ *
+ * All job ids are passed to a single jjobs command and all node groups
+ *  to a single jhosts command.
+ */
+static hostlist_t _jhinno_query(List entries)
 {
-    FILE *fp = NULL;
-    char cmd[1024];
-    char line[8192];  /* Large buffer for long host lists */
-    char line_copy[8192];  /* Copy for strtok */
-    hostlist_t hl = NULL;
-    int line_num = 0;
-    int ret;
-    int cmd_len;
-    
-    if (filter_expr == NULL || filter_expr[0] == '\0') {
-        err("%p: jhinno: resource request string is NULL or empty\n");
-        return NULL;
-    }
-    
-    /* Build command: jhosts -w -R "expression" */
-    cmd_len = snprintf(cmd, sizeof(cmd), 
-                      "jhosts -w -R \"%s\" 2>/dev/null", 
-                      filter_expr);
-    
-    if (cmd_len < 0 || (size_t)cmd_len >= sizeof(cmd)) {
-        err("%p: jhinno: resource request string too long\n");
-        return NULL;
-    }
-    
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        err("%p: jhinno: Failed to execute jhosts command: %s\n", strerror(errno));
-        return NULL;
-    }
-    
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line_num++;
-        
-        /* Skip first line (header) */
-        if (line_num == 1)
-            continue;
-        
-        /* Make a copy for strtok since it modifies the string */
-        strncpy(line_copy, line, sizeof(line_copy) - 1);
-        line_copy[sizeof(line_copy) - 1] = '\0';
-        
-        /* Remove newline */
-        line_copy[strcspn(line_copy, "\n")] = '\0';
-        
-        /* Skip empty lines */
-        if (strlen(line_copy) == 0)
-            continue;
-        
-        /* Extract hostname (first field) */
-        char *hostname = strtok(line_copy, " \t");
-        if (hostname == NULL || hostname[0] == '\0')
-            continue;
-        
-        /* Skip whitespace */
-        while (*hostname == ' ' || *hostname == '\t')
-            hostname++;
-        
-        if (*hostname == '\0')
+    struct jhinno_query *q;
+    ListIterator li;
+    hostlist_t hl;
+    List jobs = list_create(NULL);
+    List groups = list_create(NULL);
+    char *entry;
+    int all = 0;
+    int n = 0;
+    int i;
+
+    q = Malloc((list_count(entries) + 2) * sizeof(*q));
+
+    li = list_iterator_create(entries);
+    while ((entry = list_next(li))) {
+        if (entry[0] == '\0')
             continue;
-        
-        /* For jhosts -w output, each line is just a hostname */
-        
-        if (hl == NULL) {
-            hl = hostlist_create(hostname);
-            if (hl == NULL) {
-                err("%p: jhinno: Failed to create hostlist\n");
-                if (fp) pclose(fp);
-                return NULL;
-            }
+
+        /* Check for resource request string: select[], order[], rusage[], span[] */
+        if (_is_resource_request_string(entry)) {
+            char *cmd = NULL;
+            xstrcat(&cmd, "jhosts -w");
+            _append_filter(&cmd, entry);
+            _query_add(q, &n, &jhosts_cmd, cmd, NULL);
+        } else if (strcmp(entry, "all") == 0) {
+            all = 1;
+        } else if (_is_jobid_numeric(entry)) {
+            list_append(jobs, entry);
         } else {
-            ret = hostlist_push_host(hl, hostname);
-            if (ret < 0) {
-                err("%p: jhinno: Failed to add host to list\n");
-                /* Continue with other hosts */
-            }
+            list_append(groups, entry);
         }
     }
-    
-    if (fp) {
-        if (pclose(fp) != 0) {
-            err("%p: jhinno: jhosts command failed\n");
-        }
+    list_iterator_destroy(li);
+
+    if (!list_is_empty(jobs))
+        _query_add(q, &n, &jjobs_cmd, _jjobs_cmd(jobs), jobs);
+
+    /*
+     * Groups are a subset of all nodes, so only query them if "all"
+     *  was not also requested.
+     */
+    if (all)
+        _query_add(q, &n, &jhosts_cmd, _jhosts_cmd(NULL), NULL);
+    else if (!list_is_empty(groups))
+        _query_add(q, &n, &jhosts_cmd, _jhosts_cmd(groups), groups);
+
+    hl = hostlist_create(NULL);
+    _query_run(q, n, hl);
+
+    for (i = 0; i < n; i++)
+        Free((void **) &q[i].cmd);
+    Free((void **) &q);
+    list_destroy(jobs);
+    list_destroy(groups);
+
+    if (hostlist_count(hl) == 0) {
+        hostlist_destroy(hl);
+        return NULL;
     }
-    
-    if (hl)
-        hostlist_uniq(hl);
-    
+
+    hostlist_uniq(hl);
     return hl;
 }
 
@@ -706,96 +649,93 @@ static hostlist_t _jhinno_wcoll_from_jh_hosts(void)
 static int mod_jhinno_wcoll(opt_t *opt)
 {
     hostlist_t hl = NULL;
-    hostlist_t tmp_hl = NULL;
-    ListIterator li = NULL;
-    char *job = NULL;
-    int ret;
-    
-    (void)ret;  /* Suppress unused variable warning */
-    
+    List env_list = NULL;
+
     if (job_list && opt->wcoll) {
         errx("%p: do not specify -j with any other node selection option.\n");
     }
-    
-    /* 
+
+    /*
      * Priority:
      * 1. -j options
-     * 2. environment variable JOBS_JOBID
-     * 3. environment variable JH_HOSTS
+     * 2. environment variable JH_HOSTS
+     * 3. environment variable JOBS_JOBID
      */
-    
-    /* First, try JH_HOSTS environment variable */
     if (job_list == NULL) {
-        hl = _jhinno_wcoll_from_jh_hosts();
-        if (hl != NULL) {
+        char *env_var;
+
+        if ((hl = _jhinno_wcoll_from_jh_hosts()) != NULL) {
             opt->wcoll = hl;
             return 0;
         }
+
+        if ((env_var = getenv("JOBS_JOBID")) == NULL)
+            return 0;
+
+        /* Single jobid, group or resource request string */
+        env_list = list_create(NULL);
+        list_append(env_list, env_var);
     }
-    
-    /* Then try JOBS_JOBID or -j options */
-    if (job_list == NULL) {
-        char *env_var = getenv("JOBS_JOBID");
-        if (env_var != NULL) {
-            /* Parse single jobid from env var */
-            if (_is_resource_request_string(env_var)) {
-                hl = _jhinno_wcoll_by_filter(env_var);
-            } else if (_is_jobid_numeric(env_var)) {
-                hl = _jhinno_wcoll_from_jobid(env_var);
-            } else if (strcmp(env_var, "all") == 0) {
-                hl = _jhinno_wcoll_all();
-            } else {
-                hl = _jhinno_wcoll_from_group(env_var);
-            }
-        }
+
+    hl = _jhinno_query(job_list ? job_list : env_list);
+
+    if (env_list)
+        list_destroy(env_list);
+
+    if (hl)
+        opt->wcoll = hl;
+
+    return 0;
+}
+
+/*
+ *  Append "[tag] a,b,c" for list [l] to wcoll cache key [key]
+ */
+static void _key_append_list(char **key, const char *tag, List l)
+{
+    ListIterator i = list_iterator_create(l);
+    char *s;
+    char sep = ' ';
+
+    if (*key != NULL)
+        xstrcatchar(key, ' ');
+    xstrcat(key, (char *) tag);
+    while ((s = list_next(i))) {
+        xstrcatchar(key, sep);
+        xstrcat(key, s);
+        sep = ',';
+    }
+    list_iterator_destroy(i);
+}
+
+/*
+ * Describe the scheduler query mod_jhinno_wcoll() will make, for the
+ *  wcoll cache. Hosts from JH_HOSTS need no query and are not cached.
+ */
+static char *mod_jhinno_wcoll_key(opt_t *opt)
+{
+    char *key = NULL;
+    char *env_var;
+
+    if (job_list) {
+        if (opt->wcoll)
+            return NULL;    /* mod_jhinno_wcoll() reports the conflict */
+        _key_append_list(&key, "-j", job_list);
     } else {
-        /* Process list of jobs/groups */
-        li = list_iterator_create(job_list);
-        if (li == NULL) {
-            err("%p: jhinno: Failed to create iterator\n");
-            return -1;
-        }
-        
-        while ((job = list_next(li))) {
-            if (job == NULL || job[0] == '\0')
-                continue;
-            
-            /* Check for resource request string: select[], order[], rusage[], span[] */
-            if (_is_resource_request_string(job)) {
-                tmp_hl = _jhinno_wcoll_by_filter(job);
-            } else if (strcmp(job, "all") == 0) {
-                tmp_hl = _jhinno_wcoll_all();
-            } else if (_is_jobid_numeric(job)) {
-                tmp_hl = _jhinno_wcoll_from_jobid(job);
-            } else {
-                tmp_hl = _jhinno_wcoll_from_group(job);
-            }
-            
-            if (tmp_hl) {
-                if (hl == NULL) {
-                    hl = tmp_hl;
-                } else {
-                    ret = hostlist_push_list(hl, tmp_hl);
-                    if (ret < 0) {
-                        err("%p: jhinno: Failed to merge hostlists\n");
-                    }
-                    hostlist_destroy(tmp_hl);
-                    tmp_hl = NULL;
-                }
-            }
-        }
-        list_iterator_destroy(li);
+        if ((env_var = getenv("JH_HOSTS")) && *env_var != '\0')
+            return NULL;
+        if ((env_var = getenv("JOBS_JOBID")) == NULL)
+            return NULL;
+        xstrcat(&key, "JOBS_JOBID=");
+        xstrcat(&key, env_var);
     }
-    
-    if (hl) {
-        /* Final deduplication to handle overlapping nodes from multiple sources */
-        hostlist_uniq(hl);
-        opt->wcoll = hl;
+
+    if (filter_expression) {
+        xstrcat(&key, " -F ");
+        xstrcat(&key, filter_expression);
     }
-    
-    (void)ret;  /* Suppress unused variable warning */
-    
-    return 0;
+
+    return key;
 }
 
 /*
@@ -176,7 +176,7 @@ static int k4cmd_signal(int efd, void *arg, int signum)
 /*
  * The rcmd call itself.
  *      ahost (IN)      remote hostname
- *	addr (IN)	IP address
+ *	addr (IN)	IPv4 address (struct sockaddr_storage)
  *      locuser (IN)    local username
  *      remuser (IN)    remote username
  *      cmd (IN)        command to execute
@@ -199,13 +199,19 @@ k4cmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
     sigset_t oldset, blockme;
     struct sockaddr_in sin, from;
     char c;
-    int lport = IPPORT_RESERVED - 1;
+    int lport;
+    int inuse = 0;
     unsigned long krb_options = 0L;
     static pthread_mutex_t mylock = PTHREAD_MUTEX_INITIALIZER;
     int status;
     int rc, rv;
     struct xpollfd xpfds[2];
 
+    if (((struct sockaddr_storage *) addr)->ss_family != AF_INET) {
+        err("%p: %S: k4cmd: only IPv4 addresses are supported\n", ahost);
+        return (-1);
+    }
+
     pid = getpid();
 
     sigemptyset(&blockme);
@@ -223,7 +229,7 @@ k4cmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
         }
         fcntl(s, F_SETOWN, pid);
         sin.sin_family = AF_INET;
-        memcpy((caddr_t) & sin.sin_addr, addr, IP_ADDR_LEN);
+        sin.sin_addr = ((struct sockaddr_in *) addr)->sin_addr;
         sin.sin_port = htons(KCMD_PORT);
 
         rv = connect(s, (struct sockaddr *) &sin, sizeof(sin));
@@ -231,10 +237,12 @@ k4cmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
         if (rv >= 0)
             break;
         (void) close(s);
-        if (errno == EADDRINUSE) {
-            lport--;
+        /*
+         *  Each call to privsep_rresvport() binds a different port,
+         *   so just try again while the address is in use.
+         */
+        if (errno == EADDRINUSE && ++inuse < IPPORT_RESERVED / 2)
             continue;
-        }
         if (errno == EINTR)
             err("%p: %S: connect timed out\n", ahost);
         else
@@ -0,0 +1,1036 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  This module speaks the SSH protocol in-process using libssh2,
+ *   instead of running one ssh(1) process per target as the ssh
+ *   module does.
+ *
+ *  Each host thread connects, verifies the host key against the
+ *   known_hosts files (loaded once at init), authenticates with the
+ *   ssh-agent or with the default identity files (read once at init),
+ *   and starts the command on an exec channel. The session is then
+ *   handed to a single I/O thread which moves data for all sessions
+ *   between the ssh channels and the socketpairs read by pdsh.
+ *
+ *  Without -S, stderr is merged into stdout by libssh2 so that no
+ *   second socketpair is needed.
+ *
+ *  Environment:
+ *
+ *   PDSH_LIBSSH2_PORT  :  port of sshd on target hosts (default 22)
+ */
+
+#if     HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pwd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <libssh2.h>
+
+#include "src/common/xmalloc.h"
+#include "src/common/xstring.h"
+#include "src/common/err.h"
+#include "src/common/list.h"
+#include "src/common/fd.h"
+#include "src/pdsh/dsh.h"
+#include "src/pdsh/mod.h"
+#include "src/pdsh/rcmd.h"
+
+#if STATIC_MODULES
+#  define pdsh_module_info libssh2cmd_module_info
+#  define pdsh_module_priority libssh2cmd_module_priority
+#endif
+
+#define LIBSSH2_BUFSIZ  16384
+
+int pdsh_module_priority = DEFAULT_MODULE_PRIORITY;
+
+static int mod_libssh2_exit (void);
+
+static int libssh2cmd_init (opt_t *);
+static int libssh2cmd_signal (int, void *, int);
+static int libssh2cmd (char *, char *, char *, char *, char *, int, int *,
+        void **);
+static int libssh2cmd_destroy (void *);
+
+/*
+ *  Export generic pdsh module operations:
+ */
+struct pdsh_module_operations libssh2cmd_module_ops = {
+    (ModInitF)       NULL,
+    (ModExitF)       mod_libssh2_exit,
+    (ModReadWcollF)  NULL,
+    (ModPostOpF)     NULL,
+};
+
+/*
+ *  Export rcmd module operations
+ */
+struct pdsh_rcmd_operations libssh2cmd_rcmd_ops = {
+    (RcmdInitF)    libssh2cmd_init,
+    (RcmdSigF)     libssh2cmd_signal,
+    (RcmdF)        libssh2cmd,
+    (RcmdDestroyF) libssh2cmd_destroy
+};
+
+/*
+ * Export module options
+ */
+struct pdsh_module_option libssh2cmd_module_options[] =
+ {
+   PDSH_OPT_TABLE_END
+ };
+
+/*
+ * libssh2cmd module info
+ */
+struct pdsh_module pdsh_module_info = {
+  "rcmd",
+  "libssh2",
+  "Pdsh developers",
+  "in-process ssh rcmd connect method using libssh2",
+  DSH | PCP,
+
+  &libssh2cmd_module_ops,
+  &libssh2cmd_rcmd_ops,
+  &libssh2cmd_module_options[0],
+};
+
+typedef enum { CONN_RUNNING, CONN_CLOSING, CONN_DONE } conn_state_t;
+
+struct ssh2_buf {
+    char *data;
+    size_t len;
+    size_t off;
+};
+
+struct ssh2_conn {
+    char *host;
+    int sock;                   /* TCP connection to sshd              */
+    int fd;                     /* I/O thread end of stdin/out pair    */
+    int efd;                    /* I/O thread end of stderr pair or -1 */
+    LIBSSH2_SESSION *session;
+    LIBSSH2_CHANNEL *channel;
+    struct ssh2_buf in;         /* from pdsh, to be written to channel */
+    struct ssh2_buf out;        /* from channel stdout, to pdsh        */
+    struct ssh2_buf err;        /* from channel stderr, to pdsh        */
+    int in_eof;                 /* pdsh closed its end for writing     */
+    int eof_sent;               /* EOF has been sent on the channel    */
+    int out_eof;
+    int err_eof;
+    int killed;                 /* rcmd_signal() was called            */
+    int exit_status;
+    conn_state_t state;
+};
+
+struct ssh2_key {
+    char *priv;
+    size_t privlen;
+    char *pub;
+    size_t publen;
+};
+
+static const char *identity_files[] = {
+    "id_ed25519", "id_ecdsa", "id_rsa", NULL
+};
+
+static int connect_timeout = CONNECT_TIMEOUT;
+static char *dshpath = NULL;
+static char *sshd_port = "22";
+
+/*
+ *  known_hosts entries and identities shared by all sessions.
+ *   hosts_session only provides an allocator for known_hosts.
+ */
+static LIBSSH2_SESSION *hosts_session = NULL;
+static LIBSSH2_KNOWNHOSTS *known_hosts = NULL;
+static pthread_mutex_t known_hosts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static List identities = NULL;
+
+/*
+ *  State of the I/O thread
+ */
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  io_cond = PTHREAD_COND_INITIALIZER;
+static List io_conns = NULL;
+static int io_wakefd [2] = { -1, -1 };
+
+
+static void _key_destroy (struct ssh2_key *k)
+{
+    Free ((void **) &k->priv);
+    if (k->pub)
+        Free ((void **) &k->pub);
+    Free ((void **) &k);
+}
+
+/*
+ *  Read all of file [path] into a new buffer. Returns NULL if the
+ *   file cannot be read.
+ */
+static char * _read_file (const char *path, size_t *lenp)
+{
+    struct stat st;
+    char *buf;
+    int fd;
+    int n;
+
+    if ((fd = open (path, O_RDONLY)) < 0)
+        return (NULL);
+    if (fstat (fd, &st) < 0 || st.st_size <= 0) {
+        close (fd);
+        return (NULL);
+    }
+    buf = Malloc (st.st_size + 1);
+    if ((n = fd_read_n (fd, buf, st.st_size)) != st.st_size) {
+        Free ((void **) &buf);
+        close (fd);
+        return (NULL);
+    }
+    buf [n] = '\0';
+    close (fd);
+    *lenp = n;
+    return (buf);
+}
+
+static void _identities_load (const char *home)
+{
+    const char **p;
+    char path [4096];
+
+    identities = list_create ((ListDelF) _key_destroy);
+
+    for (p = identity_files; *p; p++) {
+        struct ssh2_key *k = Malloc (sizeof (*k));
+        snprintf (path, sizeof (path), "%s/.ssh/%s", home, *p);
+        if (!(k->priv = _read_file (path, &k->privlen))) {
+            Free ((void **) &k);
+            continue;
+        }
+        snprintf (path, sizeof (path), "%s/.ssh/%s.pub", home, *p);
+        if (!(k->pub = _read_file (path, &k->publen)))
+            k->publen = 0;
+        list_append (identities, k);
+    }
+}
+
+static void _known_hosts_load (const char *home)
+{
+    char path [4096];
+    int n = 0;
+
+    hosts_session = libssh2_session_init ();
+    if (!hosts_session
+        || !(known_hosts = libssh2_knownhost_init (hosts_session)))
+        errx ("%p: libssh2: unable to initialize known hosts\n");
+
+    snprintf (path, sizeof (path), "%s/.ssh/known_hosts", home);
+    if (libssh2_knownhost_readfile (known_hosts, path,
+                                    LIBSSH2_KNOWNHOST_FILE_OPENSSH) > 0)
+        n++;
+    if (libssh2_knownhost_readfile (known_hosts, "/etc/ssh/ssh_known_hosts",
+                                    LIBSSH2_KNOWNHOST_FILE_OPENSSH) > 0)
+        n++;
+    if (n == 0)
+        err ("%p: libssh2: warning: no known_hosts entries found\n");
+}
+
+static int libssh2cmd_init (opt_t *opt)
+{
+    struct passwd *pw;
+    const char *home;
+    char *val;
+
+    /*
+     * Drop privileges if running setuid root
+     */
+    if ((geteuid() == 0) && (getuid() != 0)) {
+        if (setuid (getuid ()) < 0)
+            errx ("%p: setuid: %m\n");
+    }
+
+    /*
+     *  Hostnames are resolved here with getaddrinfo(3)
+     */
+    if (rcmd_opt_set (RCMD_OPT_RESOLVE_HOSTS, 0) < 0)
+        errx ("%p: libssh2cmd_init: rcmd_opt_set: %m\n");
+
+    /*
+     *  Remote exit status is returned from libssh2cmd_destroy, so
+     *   pdsh does not need to echo it after the command output
+     */
+    if (rcmd_opt_set (RCMD_OPT_EXIT_STATUS, (void *) 1) < 0)
+        errx ("%p: libssh2cmd_init: rcmd_opt_set: %m\n");
+
+    if (libssh2_init (0) != 0)
+        errx ("%p: libssh2_init failed\n");
+
+    if ((val = getenv ("PDSH_LIBSSH2_PORT")))
+        sshd_port = val;
+
+    connect_timeout = opt->connect_timeout;
+    if (opt->dshpath)
+        dshpath = Strdup (opt->dshpath);
+
+    if (!(home = getenv ("HOME"))) {
+        if (!(pw = getpwuid (getuid ())))
+            errx ("%p: libssh2: unable to determine home directory\n");
+        home = pw->pw_dir;
+    }
+
+    _known_hosts_load (home);
+    _identities_load (home);
+
+    return (0);
+}
+
+static int mod_libssh2_exit (void)
+{
+    if (identities)
+        list_destroy (identities);
+    if (known_hosts)
+        libssh2_knownhost_free (known_hosts);
+    if (hosts_session)
+        libssh2_session_free (hosts_session);
+    if (dshpath)
+        Free ((void **) &dshpath);
+    return (0);
+}
+
+/*
+ *  Connect to sshd on [host], waiting at most connect_timeout seconds.
+ */
+static int _connect (const char *host)
+{
+    struct addrinfo hints, *res, *ai;
+    int sock = -1;
+    int rc;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rc = getaddrinfo (host, sshd_port, &hints, &res)) != 0) {
+        err ("%p: %S: libssh2: %s\n", host, gai_strerror (rc));
+        return (-1);
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        struct pollfd pfd;
+        socklen_t len = sizeof (rc);
+        int flags;
+
+        if ((sock = socket (ai->ai_family, ai->ai_socktype,
+                            ai->ai_protocol)) < 0)
+            continue;
+
+        flags = fcntl (sock, F_GETFL);
+        fcntl (sock, F_SETFL, flags | O_NONBLOCK);
+        fcntl (sock, F_SETFD, FD_CLOEXEC);
+
+        if (connect (sock, ai->ai_addr, ai->ai_addrlen) < 0) {
+            if (errno != EINPROGRESS)
+                goto next;
+            pfd.fd = sock;
+            pfd.events = POLLOUT;
+            if (poll (&pfd, 1, connect_timeout * 1000) <= 0) {
+                errno = ETIMEDOUT;
+                goto next;
+            }
+            if (getsockopt (sock, SOL_SOCKET, SO_ERROR, &rc, &len) < 0
+                || rc != 0) {
+                errno = rc;
+                goto next;
+            }
+        }
+        fcntl (sock, F_SETFL, flags);
+        break;
+    next:
+        close (sock);
+        sock = -1;
+    }
+    freeaddrinfo (res);
+
+    if (sock < 0)
+        err ("%p: %S: libssh2: connect: %m\n", host);
+    return (sock);
+}
+
+static int _knownhost_keytype (int type)
+{
+    switch (type) {
+    case LIBSSH2_HOSTKEY_TYPE_RSA:
+        return (LIBSSH2_KNOWNHOST_KEY_SSHRSA);
+    case LIBSSH2_HOSTKEY_TYPE_DSS:
+        return (LIBSSH2_KNOWNHOST_KEY_SSHDSS);
+#ifdef LIBSSH2_HOSTKEY_TYPE_ECDSA_256
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_256:
+        return (LIBSSH2_KNOWNHOST_KEY_ECDSA_256);
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_384:
+        return (LIBSSH2_KNOWNHOST_KEY_ECDSA_384);
+    case LIBSSH2_HOSTKEY_TYPE_ECDSA_521:
+        return (LIBSSH2_KNOWNHOST_KEY_ECDSA_521);
+#endif
+#ifdef LIBSSH2_HOSTKEY_TYPE_ED25519
+    case LIBSSH2_HOSTKEY_TYPE_ED25519:
+        return (LIBSSH2_KNOWNHOST_KEY_ED25519);
+#endif
+    }
+#ifdef LIBSSH2_KNOWNHOST_KEY_UNKNOWN
+    return (LIBSSH2_KNOWNHOST_KEY_UNKNOWN);
+#else
+    return (0);
+#endif
+}
+
+static int _check_hostkey (LIBSSH2_SESSION *s, const char *host)
+{
+    struct libssh2_knownhost *kh;
+    const char *key;
+    size_t len;
+    int type;
+    int rc;
+
+    if (!(key = libssh2_session_hostkey (s, &len, &type))) {
+        err ("%p: %S: libssh2: unable to get host key\n", host);
+        return (-1);
+    }
+
+    pthread_mutex_lock (&known_hosts_mutex);
+    rc = libssh2_knownhost_checkp (known_hosts, host, atoi (sshd_port),
+                                   key, len,
+                                   LIBSSH2_KNOWNHOST_TYPE_PLAIN
+                                   | LIBSSH2_KNOWNHOST_KEYENC_RAW
+                                   | _knownhost_keytype (type),
+                                   &kh);
+    pthread_mutex_unlock (&known_hosts_mutex);
+
+    switch (rc) {
+    case LIBSSH2_KNOWNHOST_CHECK_MATCH:
+        return (0);
+    case LIBSSH2_KNOWNHOST_CHECK_MISMATCH:
+        err ("%p: %S: libssh2: host key does not match known_hosts\n", host);
+        break;
+    case LIBSSH2_KNOWNHOST_CHECK_NOTFOUND:
+        err ("%p: %S: libssh2: host key not found in known_hosts\n", host);
+        break;
+    default:
+        err ("%p: %S: libssh2: host key check failed\n", host);
+        break;
+    }
+    return (-1);
+}
+
+static int _auth_agent (LIBSSH2_SESSION *s, const char *user)
+{
+    struct libssh2_agent_publickey *id, *prev = NULL;
+    LIBSSH2_AGENT *agent;
+    int rc = -1;
+
+    if (!getenv ("SSH_AUTH_SOCK") || !(agent = libssh2_agent_init (s)))
+        return (-1);
+
+    if (libssh2_agent_connect (agent) == 0
+        && libssh2_agent_list_identities (agent) == 0) {
+        while (libssh2_agent_get_identity (agent, &id, prev) == 0) {
+            if (libssh2_agent_userauth (agent, user, id) == 0) {
+                rc = 0;
+                break;
+            }
+            prev = id;
+        }
+    }
+    libssh2_agent_disconnect (agent);
+    libssh2_agent_free (agent);
+    return (rc);
+}
+
+static int _auth (LIBSSH2_SESSION *s, const char *host, const char *user)
+{
+    ListIterator i;
+    struct ssh2_key *k;
+    char *methods;
+    int rc = -1;
+
+    methods = libssh2_userauth_list (s, user, strlen (user));
+    if (methods == NULL)
+        return (libssh2_userauth_authenticated (s) ? 0 : -1);
+
+    if (strstr (methods, "publickey")) {
+        if (_auth_agent (s, user) == 0)
+            return (0);
+
+        i = list_iterator_create (identities);
+        while ((k = list_next (i))) {
+            if (libssh2_userauth_publickey_frommemory (s, user, strlen (user),
+                        k->pub, k->publen, k->priv, k->privlen, NULL) == 0) {
+                rc = 0;
+                break;
+            }
+        }
+        list_iterator_destroy (i);
+    }
+
+    if (rc < 0)
+        err ("%p: %S: libssh2: authentication failed for %s\n", host, user);
+    return (rc);
+}
+
+static void _conn_destroy (struct ssh2_conn *c)
+{
+    if (c->channel)
+        libssh2_channel_free (c->channel);
+    if (c->session) {
+        libssh2_session_set_blocking (c->session, 1);
+        if (!c->killed)
+            libssh2_session_disconnect (c->session, "pdsh done");
+        libssh2_session_free (c->session);
+    }
+    if (c->sock >= 0)
+        close (c->sock);
+    if (c->fd >= 0)
+        close (c->fd);
+    if (c->efd >= 0)
+        close (c->efd);
+    Free ((void **) &c->in.data);
+    Free ((void **) &c->out.data);
+    Free ((void **) &c->err.data);
+    Free ((void **) &c->host);
+    Free ((void **) &c);
+}
+
+static struct ssh2_conn * _conn_create (const char *host)
+{
+    struct ssh2_conn *c = Malloc (sizeof (*c));
+
+    memset (c, 0, sizeof (*c));
+    c->host = Strdup (host);
+    c->sock = c->fd = c->efd = -1;
+    c->in.data = Malloc (LIBSSH2_BUFSIZ);
+    c->out.data = Malloc (LIBSSH2_BUFSIZ);
+    c->err.data = Malloc (LIBSSH2_BUFSIZ);
+    c->state = CONN_RUNNING;
+    return (c);
+}
+
+/*
+ *  Close the pdsh side of connection [c] and wake its destroy.
+ *   Called with io_mutex held.
+ */
+static void _conn_done (struct ssh2_conn *c)
+{
+    if (c->fd >= 0)
+        close (c->fd);
+    if (c->efd >= 0)
+        close (c->efd);
+    c->fd = c->efd = -1;
+    c->state = CONN_DONE;
+    pthread_cond_broadcast (&io_cond);
+}
+
+/*
+ *  Move buffered data in [b] to local fd. Data is discarded if pdsh
+ *   has closed its end. Returns 1 if progress was made.
+ */
+static int _flush_local (struct ssh2_buf *b, int fd)
+{
+    ssize_t n;
+
+    if (b->len == 0)
+        return (0);
+    if ((n = send (fd, b->data + b->off, b->len, MSG_NOSIGNAL)) < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return (0);
+        b->len = 0;
+        return (1);
+    }
+    b->off += n;
+    b->len -= n;
+    return (1);
+}
+
+/*
+ *  Read from channel stream [id] into empty buffer [b].
+ *   Returns 1 if progress was made, -1 on error.
+ */
+static int _read_channel (struct ssh2_conn *c, int id, struct ssh2_buf *b,
+                          int *eofp)
+{
+    ssize_t n;
+
+    if (*eofp || b->len > 0)
+        return (0);
+
+    n = libssh2_channel_read_ex (c->channel, id, b->data, LIBSSH2_BUFSIZ);
+    if (n == LIBSSH2_ERROR_EAGAIN)
+        return (0);
+    if (n < 0) {
+        err ("%p: %S: libssh2: channel read: error %d\n", c->host, (int) n);
+        return (-1);
+    }
+    if (n == 0) {
+        if (!libssh2_channel_eof (c->channel))
+            return (0);
+        *eofp = 1;
+        return (1);
+    }
+    b->off = 0;
+    b->len = n;
+    return (1);
+}
+
+/*
+ *  Forward data from pdsh to the channel.
+ */
+static int _write_channel (struct ssh2_conn *c)
+{
+    ssize_t n;
+    int progress = 0;
+
+    if (!c->in_eof && c->in.len == 0) {
+        if ((n = read (c->fd, c->in.data, LIBSSH2_BUFSIZ)) > 0) {
+            c->in.off = 0;
+            c->in.len = n;
+            progress = 1;
+        }
+        else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            c->in_eof = 1;
+            progress = 1;
+        }
+    }
+
+    if (c->in.len > 0) {
+        n = libssh2_channel_write (c->channel, c->in.data + c->in.off,
+                                   c->in.len);
+        if (n == LIBSSH2_ERROR_EAGAIN)
+            return (progress);
+        if (n < 0) {
+            err ("%p: %S: libssh2: channel write: error %d\n",
+                 c->host, (int) n);
+            return (-1);
+        }
+        c->in.off += n;
+        c->in.len -= n;
+        progress = 1;
+    }
+
+    if (c->in_eof && c->in.len == 0 && !c->eof_sent) {
+        if (libssh2_channel_send_eof (c->channel) == LIBSSH2_ERROR_EAGAIN)
+            return (progress);
+        c->eof_sent = 1;
+        progress = 1;
+    }
+
+    return (progress);
+}
+
+/*
+ *  Signals that sshd may report in an exit-signal request (RFC 4254 6.10).
+ */
+static struct {
+    const char *name;
+    int signo;
+} exit_signals[] = {
+    { "ABRT", SIGABRT }, { "ALRM", SIGALRM }, { "FPE",  SIGFPE  },
+    { "HUP",  SIGHUP  }, { "ILL",  SIGILL  }, { "INT",  SIGINT  },
+    { "KILL", SIGKILL }, { "PIPE", SIGPIPE }, { "QUIT", SIGQUIT },
+    { "SEGV", SIGSEGV }, { "TERM", SIGTERM }, { "USR1", SIGUSR1 },
+    { "USR2", SIGUSR2 }, { NULL, 0 }
+};
+
+/*
+ *  Return the exit status of the remote command as a shell would:
+ *   128 + signal number if it was killed by a signal, 255 if by a
+ *   signal that is not known here.
+ */
+static int _channel_exit_status (struct ssh2_conn *c)
+{
+    char *name = NULL;
+    size_t len = 0;
+    int status, i;
+
+    if (libssh2_channel_get_exit_signal (c->channel, &name, &len,
+                                         NULL, NULL, NULL, NULL) < 0
+        || name == NULL)
+        return (libssh2_channel_get_exit_status (c->channel));
+
+    status = 255;
+    for (i = 0; exit_signals[i].name; i++) {
+        if (strcmp (exit_signals[i].name, name) == 0) {
+            status = 128 + exit_signals[i].signo;
+            break;
+        }
+    }
+    err ("%p: %S: remote command killed by signal %s\n", c->host, name);
+    libssh2_free (c->session, name);
+    return (status);
+}
+
+/*
+ *  Run connection [c] as far as possible without blocking.
+ *   Returns 1 if progress was made. Called with io_mutex held.
+ */
+static int _conn_step (struct ssh2_conn *c)
+{
+    int progress = 0;
+    int rc;
+
+    if (c->killed) {
+        _conn_done (c);
+        return (1);
+    }
+
+    if (c->state == CONN_RUNNING) {
+        if ((rc = _read_channel (c, 0, &c->out, &c->out_eof)) < 0)
+            goto fail;
+        progress |= rc;
+        progress |= _flush_local (&c->out, c->fd);
+
+        if (c->efd >= 0) {
+            if ((rc = _read_channel (c, SSH_EXTENDED_DATA_STDERR,
+                                     &c->err, &c->err_eof)) < 0)
+                goto fail;
+            progress |= rc;
+            progress |= _flush_local (&c->err, c->efd);
+        }
+        else
+            c->err_eof = 1;
+
+        if ((rc = _write_channel (c)) < 0)
+            goto fail;
+        progress |= rc;
+
+        if (c->out_eof && c->err_eof && !c->out.len && !c->err.len) {
+            c->state = CONN_CLOSING;
+            progress = 1;
+        }
+    }
+
+    if (c->state == CONN_CLOSING) {
+        if (libssh2_channel_close (c->channel) == LIBSSH2_ERROR_EAGAIN
+            || libssh2_channel_wait_closed (c->channel) == LIBSSH2_ERROR_EAGAIN)
+            return (progress);
+        c->exit_status = _channel_exit_status (c);
+        _conn_done (c);
+        progress = 1;
+    }
+
+    return (progress);
+
+fail:
+    c->exit_status = 255;
+    _conn_done (c);
+    return (1);
+}
+
+/*
+ *  Fill in pollfds for connection [c] and return the number used.
+ */
+static int _conn_pollfds (struct ssh2_conn *c, struct pollfd *pfds)
+{
+    int dirs = libssh2_session_block_directions (c->session);
+    int n = 0;
+
+    /*
+     *  Only wait for data from sshd while there is room for it, so a
+     *   slow reader in pdsh does not leave us spinning on the socket.
+     */
+    pfds[n].fd = c->sock;
+    pfds[n].events = 0;
+    if (c->state == CONN_CLOSING || (!c->out.len && !c->err.len))
+        pfds[n].events |= POLLIN;
+    if (dirs & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+        pfds[n].events |= POLLOUT;
+    n++;
+
+    /*
+     *  Once pdsh has closed its end and there is no output for it, the
+     *   fd only reports POLLHUP, so leave it out.
+     */
+    pfds[n].fd = (c->in_eof && !c->out.len) ? -1 : c->fd;
+    pfds[n].events = 0;
+    if (!c->in_eof && !c->in.len)
+        pfds[n].events |= POLLIN;
+    if (c->out.len)
+        pfds[n].events |= POLLOUT;
+    n++;
+
+    if (c->efd >= 0 && c->err.len) {
+        pfds[n].fd = c->efd;
+        pfds[n].events = POLLOUT;
+        n++;
+    }
+
+    return (n);
+}
+
+static int _conn_is_done (struct ssh2_conn *c, void *arg)
+{
+    return (c->state == CONN_DONE);
+}
+
+/*
+ *  The single I/O thread shared by all sessions.
+ */
+static void * _io_thread (void *arg)
+{
+    int size = 256;
+    struct pollfd *pfds = Malloc (size * sizeof (*pfds));
+
+    for (;;) {
+        ListIterator i;
+        struct ssh2_conn *c;
+        char buf [64];
+        int progress;
+        int n;
+
+        pthread_mutex_lock (&io_mutex);
+        do {
+            progress = 0;
+            i = list_iterator_create (io_conns);
+            while ((c = list_next (i)))
+                if (c->state != CONN_DONE && _conn_step (c) > 0)
+                    progress = 1;
+            list_iterator_destroy (i);
+        } while (progress);
+
+        if ((list_count (io_conns) * 3) + 1 > size) {
+            size = (list_count (io_conns) * 3) + 256;
+            Realloc ((void **) &pfds, size * sizeof (*pfds));
+        }
+        pfds[0].fd = io_wakefd[0];
+        pfds[0].events = POLLIN;
+        n = 1;
+        i = list_iterator_create (io_conns);
+        while ((c = list_next (i)))
+            if (c->state != CONN_DONE)
+                n += _conn_pollfds (c, pfds + n);
+        list_iterator_destroy (i);
+        pthread_mutex_unlock (&io_mutex);
+
+        if (poll (pfds, n, -1) < 0 && errno != EINTR)
+            err ("%p: libssh2: poll: %m\n");
+
+        if (pfds[0].revents)
+            while (read (io_wakefd[0], buf, sizeof (buf)) > 0)
+                ;
+    }
+
+    return (NULL);
+}
+
+static void _io_wake (void)
+{
+    if (write (io_wakefd[1], "", 1) < 0 && errno != EAGAIN)
+        err ("%p: libssh2: write: %m\n");
+}
+
+/*
+ *  Hand connection [c] to the I/O thread, starting it if necessary.
+ */
+static int _io_register (struct ssh2_conn *c)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    pthread_mutex_lock (&io_mutex);
+    if (io_conns == NULL) {
+        if (pipe (io_wakefd) < 0) {
+            err ("%p: libssh2: pipe: %m\n");
+            pthread_mutex_unlock (&io_mutex);
+            return (-1);
+        }
+        fcntl (io_wakefd[0], F_SETFL, O_NONBLOCK);
+        fcntl (io_wakefd[1], F_SETFL, O_NONBLOCK);
+        fcntl (io_wakefd[0], F_SETFD, FD_CLOEXEC);
+        fcntl (io_wakefd[1], F_SETFD, FD_CLOEXEC);
+
+        io_conns = list_create (NULL);
+
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create (&tid, &attr, _io_thread, NULL) != 0)
+            errx ("%p: libssh2: unable to create I/O thread\n");
+        pthread_attr_destroy (&attr);
+    }
+    list_append (io_conns, c);
+    _io_wake ();
+    pthread_mutex_unlock (&io_mutex);
+    return (0);
+}
+
+static int _socketpair (int sv[2])
+{
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        err ("%p: libssh2: socketpair: %m\n");
+        return (-1);
+    }
+    fcntl (sv[1], F_SETFL, O_NONBLOCK);
+    fcntl (sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl (sv[1], F_SETFD, FD_CLOEXEC);
+    return (0);
+}
+
+static int
+libssh2cmd (char *ahost, char *addr, char *luser, char *ruser, char *cmd,
+            int rank, int *fd2p, void **arg)
+{
+    struct ssh2_conn *c = _conn_create (ahost);
+    char *command = NULL;
+    int sp[2] = { -1, -1 };
+    int esp[2] = { -1, -1 };
+
+    if ((c->sock = _connect (ahost)) < 0)
+        goto fail;
+
+    if (!(c->session = libssh2_session_init ())) {
+        err ("%p: %S: libssh2: unable to create session\n", ahost);
+        goto fail;
+    }
+    libssh2_session_set_blocking (c->session, 1);
+    libssh2_session_set_timeout (c->session, connect_timeout * 1000L);
+
+    if (libssh2_session_handshake (c->session, c->sock) != 0) {
+        err ("%p: %S: libssh2: ssh handshake failed\n", ahost);
+        goto fail;
+    }
+    libssh2_session_set_timeout (c->session, 0);
+
+    if (_check_hostkey (c->session, ahost) < 0
+        || _auth (c->session, ahost, ruser) < 0)
+        goto fail;
+
+    if (!(c->channel = libssh2_channel_open_session (c->session))) {
+        err ("%p: %S: libssh2: unable to open channel\n", ahost);
+        goto fail;
+    }
+
+    /*
+     *  Without a separate stderr, let libssh2 merge it into stdout
+     */
+    if (!fd2p)
+        libssh2_channel_handle_extended_data2 (c->channel,
+                LIBSSH2_CHANNEL_EXTENDED_DATA_MERGE);
+
+    if (dshpath)
+        xstrcat (&command, dshpath);
+    xstrcat (&command, cmd);
+    if (libssh2_channel_exec (c->channel, command) != 0) {
+        err ("%p: %S: libssh2: unable to execute command\n", ahost);
+        goto fail;
+    }
+    Free ((void **) &command);
+
+    if (_socketpair (sp) < 0 || (fd2p && _socketpair (esp) < 0))
+        goto fail;
+
+    c->fd = sp[1];
+    if (fd2p) {
+        c->efd = esp[1];
+        *fd2p = esp[0];
+    }
+
+    libssh2_session_set_blocking (c->session, 0);
+    if (_io_register (c) < 0) {
+        if (fd2p)
+            close (esp[0]);
+        close (sp[0]);
+        _conn_destroy (c);
+        return (-1);
+    }
+
+    *arg = (void *) c;
+    return (sp[0]);
+
+fail:
+    if (command)
+        Free ((void **) &command);
+    if (sp[0] >= 0) {
+        close (sp[0]);
+        close (sp[1]);
+    }
+    if (esp[0] >= 0) {
+        close (esp[0]);
+        close (esp[1]);
+    }
+    _conn_destroy (c);
+    return (-1);
+}
+
+/*
+ *  Signals cannot be forwarded portably over libssh2 channels, so as
+ *   with the ssh module, any signal terminates the connection.
+ */
+static int libssh2cmd_signal (int fd, void *arg, int signum)
+{
+    struct ssh2_conn *c = arg;
+
+    if (c == NULL)
+        return (-1);
+
+    pthread_mutex_lock (&io_mutex);
+    c->killed = 1;
+    _io_wake ();
+    pthread_mutex_unlock (&io_mutex);
+    return (0);
+}
+
+static int libssh2cmd_destroy (void *arg)
+{
+    struct ssh2_conn *c = arg;
+    int status;
+
+    /*  Connection failed in libssh2cmd()
+     */
+    if (c == NULL)
+        return (0);
+
+    pthread_mutex_lock (&io_mutex);
+    while (c->state != CONN_DONE)
+        pthread_cond_wait (&io_cond, &io_mutex);
+    list_delete_all (io_conns, (ListFindF) _conn_is_done, NULL);
+    pthread_mutex_unlock (&io_mutex);
+
+    status = c->killed ? 255 : c->exit_status;
+    _conn_destroy (c);
+
+    return (status);
+}
+
+/*
+ * vi: ts=4 sw=4 expandtab
+ */
@@ -115,7 +115,7 @@ static char sccsid[] = "@(#)mcmd.c      Based from: 8.3 (Berkeley) 3/26/94";
 
 #include <munge.h>
 
-#include "src/common/macros.h"       /* LINEBUFSIZE && IP_ADDR_LEN */
+#include "src/common/macros.h"       /* LINEBUFSIZE */
 #include "src/common/err.h"
 #include "src/common/fd.h"
 #include "src/common/xpoll.h"
@@ -287,12 +287,109 @@ encode_localhost_string (const char *host, char *str, int maxlen)
     return (strlen (str));
 }
 
+/*
+ * Wait for non-blocking connect on socket [s] to complete, then
+ *  return the socket to blocking mode for the rest of the protocol.
+ *  Returns -1 with errno set if the connect failed.
+ */
+static int
+_connect_wait (int s)
+{
+    struct xpollfd xpfd;
+    int error = 0;
+    socklen_t len = sizeof (error);
+    int flags;
+
+    memset (&xpfd, 0, sizeof (xpfd));
+    xpfd.fd = s;
+    xpfd.events = XPOLLWRITE;
+
+    if (xpoll (&xpfd, 1, -1) < 0)
+        return (-1);
+    if (getsockopt (s, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+        return (-1);
+    if (error != 0) {
+        errno = error;
+        return (-1);
+    }
+    if ((flags = fcntl (s, F_GETFL)) < 0
+        || fcntl (s, F_SETFL, flags & ~O_NONBLOCK) < 0)
+        return (-1);
+
+    return (0);
+}
+
+/*
+ * Accept the stderr connection from mrshd on listening socket [s2],
+ *  let the daemon proceed over [s], and check the verification number
+ *  it sends back. Returns the stderr socket, or -1 on error.
+ */
+static int
+_stderr_accept (char *ahost, int s, int s2)
+{
+    struct sockaddr_in from;
+    socklen_t len = sizeof (from);
+    unsigned int rand, randl;
+    int s3;
+
+    if ((s3 = accept(s2, (struct sockaddr *)&from, &len)) < 0) {
+        err("%p: %S: mcmd: accept (stderr) failed: %m\n", ahost);
+        return (-1);
+    }
+
+    if (from.sin_family != AF_INET) {
+        err("%p: %S: mcmd: bad family type: %d\n", ahost, from.sin_family);
+        goto bad;
+    }
+
+    /*
+     * The following fixes a race condition between the daemon
+     * and the client.  The daemon is waiting for a null to
+     * proceed.  We do this to make sure that we have our
+     * socket is up prior to the daemon running the command.
+     */
+    if (write(s,"",1) < 0) {
+        err("%p: %S: mcmd: Could not communicate to daemon to proceed: %m\n", ahost);
+        goto bad;
+    }
+
+    /*
+     * Read from our stderr.  The server should have placed our
+     * random number we generated onto this socket.
+     */
+    if (fd_read_n(s3, &rand, sizeof(rand)) != (ssize_t) (sizeof(rand))) {
+        err("%p: %S: mcmd: Bad read of expected verification "
+                "number off of stderr socket: %m\n", ahost);
+        goto bad;
+    }
+
+    randl = ntohl(rand);
+    if (randl != randy) {
+        char tmpbuf[LINEBUFSIZE] = {0};
+        char *tptr = &tmpbuf[0];
+
+        memcpy(tptr,(char *) &rand,sizeof(rand));
+        tptr += sizeof(rand);
+        if (fd_read_line (s3, tptr, LINEBUFSIZE - sizeof(rand)) < 0)
+            err("%p: %S: mcmd: Read error from remote host: %m\n", ahost);
+        else
+            err("%p: %S: mcmd: Error: %s\n", ahost, &tmpbuf[0]);
+        goto bad;
+    }
+
+    return (s3);
+
+bad:
+    close(s3);
+    return (-1);
+}
+
 /*
  * Derived from the mcmd() libc call, with modified interface.
  * This version is MT-safe.  Errors are displayed in pdsh-compat format.
  * Connection can time out.
  *      ahost (IN)              target hostname
- *      addr (IN)               4 byte internet address
+ *      addr (IN)               IPv4 address (struct sockaddr_storage)
  *      locuser (IN)            local username
  *      remuser (IN)            remote username
  *      cmd (IN)                remote command to execute under shell
@@ -313,17 +410,15 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
 {
     struct sockaddr m_socket;
     struct sockaddr_in *getp;
-    struct sockaddr_in sin, from;
+    struct sockaddr_in sin;
     struct sockaddr_storage ss;
     struct in_addr m_in;
-    unsigned int rand, randl;
     unsigned char *hptr;
-    int s, s2, rv, mcount, lport;
+    int s, s2, s3, rv, mcount, lport;
     char c;
     char num[6] = {0};
     char *mptr;
     char *mbuf;
-    char *tmbuf;
     char *m;
     char *mpvers;
     char num_seq[12] = {0};
@@ -337,6 +432,11 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
     memset (xpfds, 0, sizeof (xpfds));
     memset (&sin, 0, sizeof (sin));
 
+    if (((struct sockaddr_storage *) addr)->ss_family != AF_INET) {
+        err("%p: %S: mcmd: only IPv4 addresses are supported\n", ahost);
+        return (-1);
+    }
+
     sigemptyset(&blockme);
     sigaddset(&blockme, SIGURG);
     sigaddset(&blockme, SIGPIPE);
@@ -348,40 +448,18 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
     else
         snprintf(num_seq, sizeof(num_seq),"%d",0);
 
-    /*
-     * Start setup of the stdin/stdout socket...
-     */
-    lport = 0;
-    len = sizeof(struct sockaddr_in);
-
-    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        err("%p: %S: mcmd: socket call stdout failed: %m\n", ahost);
-        EXIT_PTHREAD();
-    }
-
-    memset (&ss, '\0', sizeof(ss));
-    ss.ss_family = AF_INET;
-
-    if (bind(s, (struct sockaddr *)&ss, len) < 0) {
-        err("%p: %S: mcmd: bind failed: %m\n", ahost);
-        goto bad;
-    }
-
-    sin.sin_family = AF_INET;
-
-    memcpy(&sin.sin_addr.s_addr, addr, IP_ADDR_LEN);
-
-    sin.sin_port = htons(MRSH_PORT);
-    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
-        err("%p: %S: mcmd: connect failed: %m\n", ahost);
-        goto bad;
-    }
-
     lport = 0;
+    s = -1;
     s2 = -1;
+    s3 = -1;
+    m = NULL;
+    mbuf = NULL;
+
     if (fd2p != NULL) {
         /*
-         * Start the socket setup for the stderr.
+         * Start the socket setup for the stderr. This is done first
+         * so that the credential, which carries our stderr port, can
+         * be encoded while the stdin/stdout connection is in progress.
          */
         struct sockaddr_in sin2;
 
@@ -396,7 +474,6 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
         sin2.sin_port = 0;
         if (bind(s2,(struct sockaddr *)&sin2, sizeof(sin2)) < 0) {
             err("%p: %S: mcmd: bind failed: %m\n", ahost);
-            close(s2);
             goto bad;
         }
 
@@ -410,7 +487,6 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
         /* getsockname is thread safe */
         if (getsockname(s2,&m_socket,&len) < 0) {
             err("%p: %S: mcmd: getsockname failed: %m\n", ahost);
-            close(s2);
             goto bad;
         }
 
@@ -419,7 +495,6 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
 
         if (listen(s2, 5) < 0) {
             err("%p: %S: mcmd: listen() failed: %m\n", ahost);
-            close(s2);
             goto bad;
         }
     }
@@ -435,18 +510,14 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
         /* inet_ntoa is not thread safe, so we use the following,
          * which is more or less ripped from glibc
          */
-        memcpy(&m_in.s_addr, addr, IP_ADDR_LEN);
+        m_in = ((struct sockaddr_in *) addr)->sin_addr;
         hptr = (unsigned char *)&m_in;
         sprintf(haddrdot, "%u.%u.%u.%u", hptr[0], hptr[1], hptr[2], hptr[3]);
     }
 
     /*
-     * We call munge_encode which will take what we write in and return a
-     * pointer to an munged buffer.  What we get back is a null terminated
-     * string of encrypted characters.
-     *
-     * The format of the unmunged buffer is as follows (each a string terminated
-     * with a '\0' (null):
+     * The format of the unmunged buffer is as follows (each a string
+     * terminated with a '\0' (null):
      *
      * stderr_port_number & /dev/urandom_client_produce_number are 0
      * if user did not request stderr socket
@@ -476,10 +547,9 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
               (strlen(haddrdot)+1) + (strlen(num)+1) +
               (strlen(num_seq)+1) + strlen(cmd)+2);
 
-    tmbuf = mbuf = malloc(mcount);
-    if (tmbuf == NULL) {
+    mbuf = malloc(mcount);
+    if (mbuf == NULL) {
         err("%p: %S: mcmd: Error from malloc\n", ahost);
-        close(s2);
         goto bad;
     }
 
@@ -501,155 +571,130 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
     mptr += strlen(num_seq)+1;
     mptr = strcpy(mptr, cmd);
 
+    /*
+     * Start setup of the stdin/stdout socket. The connect is
+     * non-blocking so the TCP handshake overlaps munge_encode().
+     */
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        err("%p: %S: mcmd: socket call stdout failed: %m\n", ahost);
+        goto bad;
+    }
+
+    memset (&ss, '\0', sizeof(ss));
+    ss.ss_family = AF_INET;
+
+    if (bind(s, (struct sockaddr *)&ss, sizeof(struct sockaddr_in)) < 0) {
+        err("%p: %S: mcmd: bind failed: %m\n", ahost);
+        goto bad;
+    }
+
+    sin.sin_family = AF_INET;
+
+    sin.sin_addr = ((struct sockaddr_in *) addr)->sin_addr;
+
+    sin.sin_port = htons(MRSH_PORT);
+    fd_set_nonblocking(s);
+    if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0
+        && errno != EINPROGRESS) {
+        err("%p: %S: mcmd: connect failed: %m\n", ahost);
+        goto bad;
+    }
+
+    /*
+     * We call munge_encode which will take what we write in and return a
+     * pointer to an munged buffer.  What we get back is a null terminated
+     * string of encrypted characters.
+     *
+     * Each host gets its own credential, encoded here rather than in
+     * a batch ahead of time: libmunge has no multi-credential request,
+     * so a batch would cost the same number of round trips to munged,
+     * only serialized in one thread instead of spread across the host
+     * threads. The payload also carries the stderr port, which is not
+     * known until the listener above is bound. One credential cannot
+     * be shared either, since mrshd trusts the target address and port
+     * only because they are inside the credential; sent in the clear,
+     * a captured credential could be replayed to every other host.
+     */
     ctx = munge_ctx_create();
 
     if ((rv = munge_encode(&m,ctx,mbuf,mcount)) != EMUNGE_SUCCESS) {
         err("%p: %S: mcmd: munge_encode: %s\n", ahost, munge_ctx_strerror(ctx));
         munge_ctx_destroy(ctx);
-        if (s2 >= 0)
-            close(s2);
-        free(tmbuf);
+        m = NULL;
         goto bad;
     }
 
     munge_ctx_destroy(ctx);
+    free(mbuf);
+    mbuf = NULL;
 
-    mcount = (strlen(m)+1);
+    if (_connect_wait(s) < 0) {
+        err("%p: %S: mcmd: connect failed: %m\n", ahost);
+        goto bad;
+    }
 
     /*
      * Write stderr port in the clear in case we can't decode for
-     * some reason (i.e. bad credentials).  May be 0 if user
-     * doesn't want stderr
+     * some reason (i.e. bad credentials), followed by the munge
+     * encoded blob, in a single write. The port is replaced by an
+     * empty string if user doesn't want stderr.
      */
-    if (fd2p != NULL) {
-        rv = fd_write_n(s, num, strlen(num)+1);
-        if (rv != (strlen(num) + 1)) {
-            free(m);
-            free(tmbuf);
-            if (errno == EPIPE)
-                err("%p: %S: mcmd: Lost connection (EPIPE): %m", ahost);
-            else
-                err("%p: %S: mcmd: Write of stderr port failed: %m\n", ahost);
-            close(s2);
-            goto bad;
-        }
-    } else {
-        if (write(s, "", 1) != 1) {
-            err ("%p: %S: mcmd: write NUL stderr port: %m\n", ahost);
-            goto bad;
-        }
-        lport = 0;
+    if (fd2p == NULL)
+        num[0] = '\0';
+    mcount = strlen(num) + 1 + strlen(m) + 1;
+    if (!(mbuf = malloc(mcount))) {
+        err("%p: %S: mcmd: Error from malloc\n", ahost);
+        goto bad;
     }
+    memcpy(mbuf, num, strlen(num) + 1);
+    memcpy(mbuf + strlen(num) + 1, m, strlen(m) + 1);
+    free(m);
+    m = NULL;
 
-    /*
-     * Write the munge_encoded blob to the socket.
-     */
-    rv = fd_write_n(s, m, mcount);
+    rv = fd_write_n(s, mbuf, mcount);
     if (rv != mcount) {
-        free(m);
-        free(tmbuf);
         if (errno == EPIPE)
             err("%p: %S: mcmd: Lost connection: %m\n", ahost);
         else
             err("%p: %S: mcmd: Write to socket failed: %m\n", ahost);
-        close(s2);
         goto bad;
     }
 
-    free(m);
-    free(tmbuf);
+    free(mbuf);
+    mbuf = NULL;
 
     if (fd2p != NULL) {
         /*
-         * Wait for stderr connection from daemon.
+         * Wait for stderr connection from daemon. mrshd reports errors,
+         * such as a credential it could not decode, on the stdout
+         * socket instead of connecting back, so wait on both sockets
+         * and go straight to reading the error if it arrives first.
+         * Like connect(), the wait is ended by the connect timeout.
          */
-        int s3;
-
-        errno = 0;
         xpfds[0].fd = s;
         xpfds[1].fd = s2;
         xpfds[0].events = xpfds[1].events = XPOLLREAD;
-        if (  ((rv = xpoll(xpfds, 2, -1)) < 0)
-            || rv != 1
-            || (xpfds[0].revents > 0)) {
-            if (errno != 0)
-                err("%p: %S: mcmd: xpoll (setting up stderr): %m\n", ahost);
-            else
-                err("%p: %S: mcmd: xpoll: protocol failure in circuit setup\n",
-                     ahost);
-            (void) close(s2);
+        if (xpoll(xpfds, 2, -1) < 0) {
+            err("%p: %S: mcmd: xpoll (setting up stderr): %m\n", ahost);
             goto bad;
         }
 
-        errno = 0;
-        len = sizeof(from); /* arg to accept */
-
-        if ((s3 = accept(s2, (struct sockaddr *)&from, &len)) < 0) {
-            err("%p: %S: mcmd: accept (stderr) failed: %m\n", ahost);
-            close(s2);
+        if ((xpfds[1].revents & XPOLLREAD)
+            && (s3 = _stderr_accept(ahost, s, s2)) < 0)
             goto bad;
-        }
-
-        if (from.sin_family != AF_INET) {
-            err("%p: %S: mcmd: bad family type: %d\n", ahost, from.sin_family);
-            goto bad2;
-        }
 
         close(s2);
-
-        /*
-         * The following fixes a race condition between the daemon
-         * and the client.  The daemon is waiting for a null to
-         * proceed.  We do this to make sure that we have our
-         * socket is up prior to the daemon running the command.
-         */
-        if (write(s,"",1) < 0) {
-            err("%p: %S: mcmd: Could not communicate to daemon to proceed: %m\n", ahost);
-            close(s3);
-            goto bad;
-        }
-
-        /*
-         * Read from our stderr.  The server should have placed our
-         * random number we generated onto this socket.
-         */
-        rv = fd_read_n(s3, &rand, sizeof(rand));
-        if (rv != (ssize_t) (sizeof(rand))) {
-            err("%p: %S: mcmd: Bad read of expected verification "
-                    "number off of stderr socket: %m\n", ahost);
-            close(s3);
-            goto bad;
-        }
-
-        randl = ntohl(rand);
-        if (randl != randy) {
-            char tmpbuf[LINEBUFSIZE] = {0};
-            char *tptr = &tmpbuf[0];
-
-            memcpy(tptr,(char *) &rand,sizeof(rand));
-            tptr += sizeof(rand);
-            if (fd_read_line (s3, tptr, LINEBUFSIZE - sizeof(rand)) < 0)
-                err("%p: %S: mcmd: Read error from remote host: %m\n", ahost);
-            else
-                err("%p: %S: mcmd: Error: %s\n", ahost, &tmpbuf[0]);
-            close(s3);
-            goto bad;
-        }
-
-        /*
-         * Set the stderr file descriptor for the user...
-         */
-        *fd2p = s3;
+        s2 = -1;
     }
 
     if ((rv = read(s, &c, 1)) < 0) {
         err("%p: %S: mcmd: read: protocol failure: %m\n", ahost);
-        goto bad2;
+        goto bad;
     }
 
     if (rv != 1) {
         err("%p: %S: mcmd: read: protocol failure: invalid response\n", ahost);
-        goto bad2;
+        goto bad;
     }
 
     if (c != '\0') {
@@ -660,17 +705,35 @@ mcmd(char *ahost, char *addr, char *locuser, char *remuser, char *cmd,
             err("%p: %S: mcmd: Error from remote host\n", ahost);
         else
             err("%p: %S: mcmd: Error: %s\n", ahost, tmpbuf);
-        goto bad2;
+        goto bad;
+    }
+
+    if (fd2p != NULL) {
+        if (s3 < 0) {
+            err("%p: %S: mcmd: xpoll: protocol failure in circuit setup\n",
+                 ahost);
+            goto bad;
+        }
+        /*
+         * Set the stderr file descriptor for the user...
+         */
+        *fd2p = s3;
     }
     RESTORE_PTHREAD();
 
     return (s);
 
-bad2:
-    if (lport)
-        close(*fd2p);
 bad:
-    close(s);
+    if (m)
+        free(m);
+    if (mbuf)
+        free(mbuf);
+    if (s3 >= 0)
+        close(s3);
+    if (s2 >= 0)
+        close(s2);
+    if (s >= 0)
+        close(s);
     EXIT_PTHREAD();
 }
 
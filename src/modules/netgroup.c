@@ -34,11 +34,13 @@
 
 #include "src/pdsh/wcoll.h"
 #include "src/pdsh/mod.h"
+#include "src/pdsh/wcollcache.h"
 #include "src/common/hostlist.h"
 #include "src/common/xmalloc.h"
 #include "src/common/err.h"
 #include "src/common/list.h"
 #include "src/common/split.h"
+#include "src/common/xstring.h"
 
 #if STATIC_MODULES
 #  define pdsh_module_info netgroup_module_info
@@ -49,17 +51,25 @@ int pdsh_module_priority = DEFAULT_MODULE_PRIORITY;
 
 static hostlist_t read_netgroup(opt_t *opt);
 static int netgroup_postop (opt_t *);
+static int netgroup_exit (void);
 static int netgroup_process_opt(opt_t *, int, char *);
+static hostlist_t _cached_netgroup (const char *group, opt_t *opt);
 
 static List groups = NULL;
 static List exgroups = NULL;
 
+/*
+ *  Groups named with -g or -X. Each is looked up at most once per run,
+ *   however many times it is named.
+ */
+static wcoll_groups_t netgroups = NULL;
+
 /*
  * Export pdsh module operations structure
  */
 struct pdsh_module_operations netgroup_module_ops = {
     (ModInitF)       NULL,
-    (ModExitF)       NULL,
+    (ModExitF)       netgroup_exit,
     (ModReadWcollF)  read_netgroup,
     (ModPostOpF)     netgroup_postop,
 };
@@ -100,6 +110,9 @@ struct pdsh_module pdsh_module_info = {
 
 static int netgroup_process_opt(opt_t *pdsh_opt, int opt, char *arg)
 {
+    if (netgroups == NULL)
+        netgroups = wcoll_groups_create ((WcollGroupF) _cached_netgroup);
+
     switch (opt) {
     case 'g':
         groups = list_split_append (groups, ",", arg);
@@ -124,6 +137,8 @@ static hostlist_t _read_netgroup (const char *group)
 	setnetgrent (group);
 
 	while ((rc = getnetgrent (&host, &user, &domain))) {
+		if (host == NULL)
+			continue;
 		if (hl == NULL)
 			hl = hostlist_create (host);
 		else
@@ -135,60 +150,54 @@ static hostlist_t _read_netgroup (const char *group)
 	return (hl);
 }
 
-static hostlist_t _read_groups (List grouplist)
+/*
+ *  Expand [group], using the wcoll cache if it is enabled. On a miss,
+ *   wait for any other pdsh refreshing the same group and check again,
+ *   so that only one of them enumerates it.
+ */
+static hostlist_t _cached_netgroup (const char *group, opt_t *opt)
 {
-    ListIterator i  = NULL;
-    hostlist_t   hl = NULL;
-    char *group;
-
-    i = list_iterator_create (grouplist);
+    const char *dir = opt->wcoll_cache_dir;
+    int ttl = opt->wcoll_cache_ttl;
+    hostlist_t hl = NULL;
+    char *key = NULL;
+    int lockfd;
 
-    while ((group = list_next (i))) {
-        hostlist_t l = _read_netgroup (group);
+    if (ttl <= 0)
+        return (_read_netgroup (group));
 
-        if (l == NULL)
-            continue;
+    xstrcat (&key, "misc/netgroup group=");
+    xstrcat (&key, (char *) group);
 
-        if (hl == NULL) {
-            hl = l;
-        } else {
-            hostlist_push_list (hl, l);
-            hostlist_destroy (l);
+    if (!(hl = wcoll_cache_get (dir, key, ttl))) {
+        lockfd = wcoll_cache_lock (dir, key);
+        if (!(hl = wcoll_cache_get (dir, key, ttl))) {
+            if ((hl = _read_netgroup (group)) && hostlist_count (hl) > 0)
+                wcoll_cache_put (dir, key, hl, opt->wcoll_cache_ttl);
         }
+        wcoll_cache_unlock (dir, key, lockfd);
     }
 
-    list_iterator_destroy (i);
-
-    if (hl != NULL)
-        hostlist_uniq (hl);
-
+    Free ((void **) &key);
     return (hl);
 }
 
 static hostlist_t read_netgroup (opt_t *opt)
 {
-    if (!groups)
+    if (!groups && !exgroups)
         return NULL;
 
     if (opt->wcoll && groups)
         errx("Do not specify both -w and -g");
 
-    return _read_groups (groups);
-}
-
-static int
-_delete_all (hostlist_t hl, hostlist_t dl)
-{
-    int                 rc   = 0;
-    char *              host = NULL;
-    hostlist_iterator_t i    = hostlist_iterator_create (dl);
+    /*
+     *  Look up the -X groups here as well, so that all netgroups
+     *   are enumerated in one pass alongside the other modules.
+     */
+    wcoll_groups_read (netgroups, groups, opt);
+    wcoll_groups_read (netgroups, exgroups, opt);
 
-    while ((host = hostlist_next (i))) {
-        rc += hostlist_delete_host (hl, host);
-        free (host);
-    }
-    hostlist_iterator_destroy (i);
-    return (rc);
+    return wcoll_groups_hostlist (netgroups, groups, opt);
 }
 
 static int netgroup_postop (opt_t *opt)
@@ -198,14 +207,22 @@ static int netgroup_postop (opt_t *opt)
     if (!opt->wcoll || !exgroups)
         return (0);
 
-    if ((hl = _read_groups (exgroups)) == NULL)
+    if ((hl = wcoll_groups_hostlist (netgroups, exgroups, opt)) == NULL)
         return (0);
 
-    _delete_all (opt->wcoll, hl);
+    hostlist_delete_list (opt->wcoll, hl);
+    hostlist_destroy (hl);
 
     return 0;
 }
 
+static int netgroup_exit (void)
+{
+    wcoll_groups_destroy (netgroups);
+    netgroups = NULL;
+    return (0);
+}
+
 /*
  * vi: tabstop=4 shiftwidth=4 expandtab
  */
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "src/common/hostlist.h"
 #include "src/common/split.h"
@@ -66,11 +67,13 @@ typedef struct listIterator list_itr_t;
 #if STATIC_MODULES
 #  define pdsh_module_info slurm_module_info
 #  define pdsh_module_priority slurm_module_priority
+#  define pdsh_module_ops_version slurm_module_ops_version
 #endif
 /*
  *  Give this module low priority
  */
 int pdsh_module_priority = 10;
+int pdsh_module_ops_version = PDSH_MODULE_OPS_VERSION;
 
 
 /*
@@ -81,6 +84,7 @@ int pdsh_module_priority = 10;
  */
 static int mod_slurm_init(void);
 static int mod_slurm_wcoll(opt_t *opt);
+static char *mod_slurm_wcoll_key(opt_t *opt);
 static int mod_slurm_exit(void);
 static hostlist_t _slurm_wcoll(List jobids);
 static hostlist_t _slurm_wcoll_partition(List partitions);
@@ -98,7 +102,8 @@ struct pdsh_module_operations slurm_module_ops = {
     (ModInitF)       mod_slurm_init,
     (ModExitF)       mod_slurm_exit,
     (ModReadWcollF)  mod_slurm_wcoll,
-    (ModPostOpF)     NULL
+    (ModPostOpF)     NULL,
+    (ModWcollKeyF)   mod_slurm_wcoll_key
 };
 
 
@@ -246,6 +251,52 @@ static int mod_slurm_wcoll(opt_t *opt)
     return 0;
 }
 
+/*
+ *  Append "[tag] a,b,c" for list [l] to wcoll cache key [key]
+ */
+static void _key_append_list (char **key, const char *tag, List l)
+{
+    ListIterator i = list_iterator_create (l);
+    char *s;
+    char sep = ' ';
+
+    if (*key != NULL)
+        xstrcatchar (key, ' ');
+    xstrcat (key, (char *) tag);
+    while ((s = list_next (i))) {
+        xstrcatchar (key, sep);
+        xstrcat (key, s);
+        sep = ',';
+    }
+    list_iterator_destroy (i);
+}
+
+/*
+ *  Describe the query mod_slurm_wcoll() will make, for the wcoll cache
+ */
+static char * mod_slurm_wcoll_key (opt_t *opt)
+{
+    char *key = NULL;
+    char *jobid;
+
+    if (job_list)
+        _key_append_list (&key, "-j", job_list);
+    if (partition_list)
+        _key_append_list (&key, "-P", partition_list);
+    if (constraint_list)
+        _key_append_list (&key, "-C", constraint_list);
+
+    if (!job_list && !partition_list && !opt->wcoll
+        && (jobid = getenv ("SLURM_JOBID"))) {
+        if (key != NULL)
+            xstrcatchar (&key, ' ');
+        xstrcat (&key, "SLURM_JOBID=");
+        xstrcat (&key, jobid);
+    }
+
+    return (key);
+}
+
 static int32_t _slurm_jobid (void)
 {
     return (str2jobid (getenv ("SLURM_JOBID")));
@@ -323,6 +374,121 @@ static void _slurm_init() {
   _inited = true;
 }
 
+/*
+ *  Maximum number of concurrent job or node queries, and largest wcoll
+ *   for which -C queries nodes individually rather than loading the
+ *   whole node table.
+ */
+#define SLURM_QUERY_THREADS  16
+#define SLURM_NODE_QUERY_MAX 64
+
+/*
+ *  Run fn (arg, i) for i in [0, n), spreading the calls over up to
+ *   SLURM_QUERY_THREADS threads including the calling thread.
+ */
+struct query_pool {
+    pthread_mutex_t mutex;
+    int next;
+    int n;
+    void (*fn) (void *arg, int i);
+    void *arg;
+};
+
+static void * _query_thread (void *arg)
+{
+    struct query_pool *p = arg;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock (&p->mutex);
+        i = p->next++;
+        pthread_mutex_unlock (&p->mutex);
+        if (i >= p->n)
+            break;
+        (*p->fn) (p->arg, i);
+    }
+    return (NULL);
+}
+
+static void _run_queries (int n, void (*fn) (void *, int), void *arg)
+{
+    pthread_t tids [SLURM_QUERY_THREADS];
+    struct query_pool p;
+    int nthreads = 0;
+    int i;
+
+    pthread_mutex_init (&p.mutex, NULL);
+    p.next = 0;
+    p.n = n;
+    p.fn = fn;
+    p.arg = arg;
+
+    while (nthreads < SLURM_QUERY_THREADS - 1 && nthreads < n - 1) {
+        if (pthread_create (&tids[nthreads], NULL, _query_thread, &p) != 0)
+            break;
+        nthreads++;
+    }
+    _query_thread (&p);
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join (tids[i], NULL);
+    pthread_mutex_destroy (&p.mutex);
+}
+
+struct job_query {
+    uint32_t         jobid;
+    job_info_msg_t * msg;
+    int              errnum;
+};
+
+static void _load_job (void *arg, int i)
+{
+    struct job_query *q = (struct job_query *) arg + i;
+
+    if (slurm_load_job (&q->msg, q->jobid, SHOW_ALL) < 0) {
+        q->msg = NULL;
+        q->errnum = slurm_get_errno ();
+    }
+}
+
+/*
+ *  Look up each job in [jobids] individually and concurrently,
+ *   instead of loading the whole job table.
+ */
+static hostlist_t _slurm_wcoll_jobids (uint32_t *jobids, int n)
+{
+    struct job_query *q = Malloc (n * sizeof (*q));
+    hostlist_t hl = NULL;
+    int i, j;
+
+    memset (q, 0, n * sizeof (*q));
+    for (i = 0; i < n; i++)
+        q[i].jobid = jobids[i];
+
+    _run_queries (n, _load_job, q);
+
+    for (i = 0; i < n; i++) {
+        if (q[i].msg == NULL) {
+            /*
+             *  Unknown jobs are skipped, as when scanning the job table
+             */
+            if (q[i].errnum != ESLURM_INVALID_JOB_ID)
+                errx ("Unable to contact slurm controller: %s\n",
+                      slurm_strerror (q[i].errnum));
+            continue;
+        }
+        for (j = 0; j < q[i].msg->record_count; j++) {
+            job_info_t *job = &q[i].msg->job_array[j];
+            if (job->nodes)
+                hl = _hl_append (hl, job->nodes);
+        }
+        slurm_free_job_info_msg (q[i].msg);
+    }
+
+    Free ((void **) &q);
+    return (hl);
+}
+
 static hostlist_t _slurm_wcoll (List joblist)
 {
     int i;
@@ -335,36 +501,52 @@ static hostlist_t _slurm_wcoll (List joblist)
         return (NULL);
 
     _slurm_init();
-    if (slurm_load_jobs((time_t) NULL, &msg, SHOW_ALL) < 0)
-        errx ("Unable to contact slurm controller: %s\n",
-              slurm_strerror (errno));
 
     /*
      *  Check for "all" in joblist
      */
     alljobids = _alljobids_requested (joblist);
 
+    /*
+     *  Only "all" needs the whole job table. Otherwise query just
+     *   the requested jobs, or SLURM_JOBID if the user didn't
+     *   override it with -j.
+     */
+    if (!alljobids) {
+        uint32_t *ids;
+        ListIterator li;
+        char *str;
+        int n = 0;
+
+        if (!joblist)
+            return (_slurm_wcoll_jobids ((uint32_t *) &envjobid, 1));
+
+        ids = Malloc ((list_count (joblist) + 1) * sizeof (*ids));
+        li = list_iterator_create (joblist);
+        while ((str = list_next (li)))
+            ids[n++] = str2jobid (str);
+        list_iterator_destroy (li);
+
+        if (n > 0)
+            hl = _slurm_wcoll_jobids (ids, n);
+        Free ((void **) &ids);
+
+        if (hl)
+            hostlist_uniq (hl);
+        return (hl);
+    }
+
+    if (slurm_load_jobs((time_t) NULL, &msg, SHOW_ALL) < 0)
+        errx ("Unable to contact slurm controller: %s\n",
+              slurm_strerror (errno));
+
     for (i = 0; i < msg->record_count; i++) {
         job_info_t *j = &msg->job_array[i];
 
-        if (alljobids && j->job_state == JOB_RUNNING)
+        if (j->job_state == JOB_RUNNING)
             hl = _hl_append (hl, j->nodes);
-        else if (!joblist && (j->job_id == envjobid)) {
-            /*
-             *  Only use SLURM_JOBID environment variable if user
-             *   didn't override with -j option
-             */
-            hl = hostlist_create (j->nodes);
-            break;
-        }
-        else if (_jobid_requested (joblist, j->job_id)) {
+        else if (_jobid_requested (joblist, j->job_id))
             hl = _hl_append (hl, j->nodes);
-            /*
-             * Exit when there is no more jobids to search
-             */
-            if (list_count (joblist) == 0)
-                break;
-        }
     }
 
     slurm_free_job_info_msg (msg);
@@ -418,42 +600,120 @@ static hostlist_t _slurm_wcoll_partition (List partitionlist)
     return (hl);
 }
 
+/*
+ *  Add node [n] to [hl] if it has any of the features in [li]
+ */
+static void _node_match (hostlist_t hl, node_info_t *n, ListIterator li)
+{
+    char *f = n->features_act ? n->features_act : n->features;
+    char *c;
+
+    if (!f)
+        return;
+
+    list_iterator_reset(li);
+    while ((c = list_next(li))){
+        if (_features_include(f, c)) {
+            hostlist_push_host(hl, n->name);
+            break;
+        }
+    }
+}
+
+struct node_query {
+    char *            name;
+    node_info_msg_t * msg;
+    int               errnum;
+};
+
+static void _load_node (void *arg, int i)
+{
+    struct node_query *q = (struct node_query *) arg + i;
+
+    if (slurm_load_node_single (&q->msg, q->name, SHOW_ALL) < 0) {
+        q->msg = NULL;
+        q->errnum = slurm_get_errno ();
+    }
+}
+
+/*
+ *  Query each node in [wl] individually and concurrently, for a
+ *   wcoll small enough that this beats loading the node table.
+ */
+static void _slurm_constraint_nodes (hostlist_t hl, hostlist_t wl,
+                                     ListIterator li)
+{
+    int n = hostlist_count (wl);
+    struct node_query *q = Malloc (n * sizeof (*q));
+    hostlist_iterator_t hi = hostlist_iterator_create (wl);
+    char *host;
+    int i = 0, j;
+
+    memset (q, 0, n * sizeof (*q));
+    while ((host = hostlist_next (hi)) && i < n)
+        q[i++].name = host;
+    hostlist_iterator_destroy (hi);
+    n = i;
+
+    _run_queries (n, _load_node, q);
+
+    for (i = 0; i < n; i++) {
+        if (q[i].msg == NULL) {
+            /*
+             *  Hosts unknown to slurm never match, as when scanning
+             *   the node table
+             */
+            if (q[i].errnum != ESLURM_INVALID_NODE_NAME)
+                errx ("Unable to contact slurm controller: %s\n",
+                      slurm_strerror (q[i].errnum));
+        } else {
+            for (j = 0; j < q[i].msg->record_count; j++)
+                _node_match (hl, &q[i].msg->node_array[j], li);
+            slurm_free_node_info_msg (q[i].msg);
+        }
+        free (q[i].name);
+    }
+
+    Free ((void **) &q);
+}
+
 static hostlist_t _slurm_wcoll_constraint (hostlist_t wl, List constraintlist)
 {
     int i;
     hostlist_t hl;
     node_info_msg_t * msg;
     node_info_t * n;
-    char *f;
-    char *c;
     ListIterator li;
 
+    hl = hostlist_create("");
+    if (wl == NULL || hostlist_count(wl) == 0)
+        return (hl);
+
     _slurm_init();
+    li = list_iterator_create(constraintlist);
+
+    if (hostlist_count(wl) <= SLURM_NODE_QUERY_MAX) {
+        _slurm_constraint_nodes(hl, wl, li);
+        list_iterator_destroy(li);
+        return (hl);
+    }
+
     if (slurm_load_node((time_t) NULL, &msg, SHOW_ALL) < 0)
         errx ("Unable to contact slurm controller: %s\n",
               slurm_strerror (errno));
 
-    li = list_iterator_create(constraintlist);
-    hl = hostlist_create("");
     for (i = 0; i < msg->record_count; i++){
         n = &msg->node_array[i];
 
         if (hostlist_find(wl, n->name) < 0)
             continue;
 
-        f = n->features_act ? n->features_act : n->features;
-        if (!f)
-            continue;
-
-        list_iterator_reset(li);
-        while ((c = list_next(li))){
-            if (_features_include(f, c)) {
-                hostlist_push_host(hl, n->name);
-                continue;
-            }
-        }
+        _node_match(hl, n, li);
     }
 
+    list_iterator_destroy(li);
+    slurm_free_node_info_msg(msg);
+
     return (hl);
 }
 
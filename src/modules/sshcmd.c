@@ -44,6 +44,7 @@
 
 
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <errno.h>
 #include <netdb.h>
@@ -89,9 +90,16 @@ static int sshcmd(char *, char *, char *, char *, char *, int, int *, void **);
 static int sshcmd_destroy (pipecmd_t p);
 static int sshcmd_args_init (void);
 static int fixup_ssh_args (List ssh_args_list, int need_user);
+static int ssh_args_prepend_control (void);
 
 List ssh_args_list =     NULL;
 
+/*
+ *  Appended to the remote command so the remote shell reports a
+ *   command killed by a signal (with -S or -k)
+ */
+static const char *ssh_exit_status = NULL;
+
 /*
  *  Export generic pdsh module operations:
  */
@@ -147,7 +155,7 @@ static char **ssh_argv_create (List arg_list, const char **remote_argv)
     for (p = remote_argv; *p; p++)
         n++;
 
-    n += list_count (arg_list) + 2;
+    n += list_count (arg_list) + 3;
     argv = (char **) Malloc (n * sizeof (char *));
     memset (argv, 0, n);
 
@@ -161,6 +169,9 @@ static char **ssh_argv_create (List arg_list, const char **remote_argv)
     for (p = remote_argv; *p; p++)
         argv[n++] = Strdup (*p);
 
+    if (ssh_exit_status)
+        argv[n++] = Strdup (ssh_exit_status);
+
     return (argv);
 }
 
@@ -190,6 +201,7 @@ static int mod_ssh_postop(opt_t *opt)
 {
     sshcmd_args_init ();
     ssh_args_prepend_timeout (opt->connect_timeout);
+    ssh_args_prepend_control ();
 
     /*
      *  Append PATH=...; to ssh args if DSHPATH was set
@@ -197,6 +209,14 @@ static int mod_ssh_postop(opt_t *opt)
     if (opt->dshpath)
         list_append (ssh_args_list, Strdup (opt->dshpath));
 
+    /*
+     *  ssh exits 255 when the remote command is killed by a signal,
+     *   so with -S or -k have the remote shell exit with $? itself,
+     *   which is 128+signal in that case.
+     */
+    if (pdsh_personality () == DSH && (opt->ret_remote_rc || opt->kill_on_fail))
+        ssh_exit_status = ";exit $?";
+
     return 0;
 }
 
@@ -216,6 +236,12 @@ static int sshcmd_init(opt_t * opt)
     if (rcmd_opt_set (RCMD_OPT_RESOLVE_HOSTS, 0) < 0)
         errx ("%p: sshcmd_init: rcmd_opt_set: %m\n");
 
+    /*
+     *  Remote exit status is returned from sshcmd_destroy, so
+     *   pdsh does not need to echo it after the command output
+     */
+    if (rcmd_opt_set (RCMD_OPT_EXIT_STATUS, (void *) 1) < 0)
+        errx ("%p: sshcmd_init: rcmd_opt_set: %m\n");
     return 0;
 }
 
@@ -321,6 +347,14 @@ sshcmd_destroy (pipecmd_t p)
 
     pipecmd_destroy (p);
 
+    /*
+     *  A signal here killed the local ssh, not the remote command.
+     *   Report it the same way a shell would, so that -k and -S
+     *   treat it as a failure.
+     */
+    if (WIFSIGNALED (status))
+        return (128 + WTERMSIG (status));
+
     return WEXITSTATUS (status);
 }
 
@@ -404,6 +438,104 @@ static int sshcmd_args_init (void)
     return (0);
 }
 
+/*
+ *  Return the directory in which to keep ssh control sockets, creating
+ *   it if necessary.  The directory must be private to the user, since
+ *   anyone able to connect to a control socket can run commands as the
+ *   user on the remote host.
+ */
+static char * ssh_control_dir (void)
+{
+    char *dir = NULL;
+    char *val;
+    struct stat st;
+
+    if ((val = getenv ("PDSH_SSH_CONTROL_DIR")))
+        dir = Strdup (val);
+    else if ((val = getenv ("XDG_RUNTIME_DIR"))) {
+        dir = Strdup (val);
+        xstrcat (&dir, "/pdsh-ssh");
+    }
+    else {
+        char buf[64];
+        snprintf (buf, sizeof (buf), "/tmp/pdsh-ssh-%ld", (long) getuid ());
+        dir = Strdup (buf);
+    }
+
+    if ((mkdir (dir, 0700) < 0) && (errno != EEXIST)) {
+        err ("%p: ssh: mkdir %s: %m\n", dir);
+        goto fail;
+    }
+    if (lstat (dir, &st) < 0) {
+        err ("%p: ssh: %s: %m\n", dir);
+        goto fail;
+    }
+    if (!S_ISDIR (st.st_mode) || (st.st_uid != getuid ())
+        || (st.st_mode & (S_IRWXG|S_IRWXO))) {
+        err ("%p: ssh: %s: not a private directory owned by user\n", dir);
+        goto fail;
+    }
+    return (dir);
+fail:
+    Free ((void **) &dir);
+    return (NULL);
+}
+
+/*
+ *  If PDSH_SSH_CONTROL_PERSIST is set, have ssh share one persistent
+ *   master connection per host and user between pdsh runs, so that only
+ *   the first connection pays for key exchange and authentication.
+ *   Masters are started on first use and exit once they have been idle
+ *   for the time given (see ControlPersist in ssh_config(5)).
+ *
+ *  Does nothing if the user already passes ControlMaster or ControlPath
+ *   options in PDSH_SSH_ARGS or PDSH_SSH_ARGS_APPEND.
+ */
+static int ssh_args_prepend_control (void)
+{
+    char *persist = getenv ("PDSH_SSH_CONTROL_PERSIST");
+    char *dir, *arg = NULL, *p;
+    ListIterator i;
+
+    if (!persist || !*persist)
+        return (0);
+
+    i = list_iterator_create (ssh_args_list);
+    while ((p = list_next (i))) {
+        if (strstr (p, "ControlMaster") || strstr (p, "ControlPath"))
+            break;
+    }
+    list_iterator_destroy (i);
+    if (p)
+        return (0);
+
+    if (!(dir = ssh_control_dir ()))
+        return (-1);
+
+    /*
+     *  Escape '%' in the directory from pipecmd parameter substitution.
+     *   %C is expanded by ssh to a hash of the connection parameters,
+     *   which keeps socket paths short.
+     */
+    xstrcat (&arg, "-oControlPath=");
+    for (p = dir; *p; p++) {
+        if (*p == '%')
+            xstrcatchar (&arg, '%');
+        xstrcatchar (&arg, *p);
+    }
+    xstrcat (&arg, "/%C");
+    Free ((void **) &dir);
+
+    list_prepend (ssh_args_list, arg);
+    arg = NULL;
+    xstrcat (&arg, "-oControlPersist=");
+    xstrcat (&arg, persist);
+    list_prepend (ssh_args_list, arg);
+    list_prepend (ssh_args_list, Strdup ("-oControlMaster=auto"));
+
+    return (0);
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
@@ -57,11 +57,13 @@
 #if STATIC_MODULES
 #  define pdsh_module_info torque_module_info
 #  define pdsh_module_priority torque_module_priority
+#  define pdsh_module_ops_version torque_module_ops_version
 #endif
 /*
  *  Give this module low priority
  */
 int pdsh_module_priority = 10;
+int pdsh_module_ops_version = PDSH_MODULE_OPS_VERSION;
 
 
 /*
@@ -72,12 +74,20 @@ int pdsh_module_priority = 10;
  */
 static int mod_torque_init(void);
 static int mod_torque_wcoll(opt_t *opt);
+static char *mod_torque_wcoll_key(opt_t *opt);
 static int mod_torque_exit(void);
 static hostlist_t _torque_wcoll(List jobids);
 static int torque_process_opt(opt_t *, int opt, char *arg);
 
 static List job_list = NULL;
 
+/*
+ *  Fetch every job on the server in one query, rather than each
+ *   requested job by id, only if the server holds at most this many
+ *   jobs per requested job.
+ */
+#define TORQUE_BATCH_RATIO 4
+
 /*
  *  Export generic pdsh module options
  */
@@ -85,7 +95,8 @@ struct pdsh_module_operations torque_module_ops = {
     (ModInitF)       mod_torque_init,
     (ModExitF)       mod_torque_exit,
     (ModReadWcollF)  mod_torque_wcoll,
-    (ModPostOpF)     NULL
+    (ModPostOpF)     NULL,
+    (ModWcollKeyF)   mod_torque_wcoll_key
 };
 
 
@@ -178,6 +189,47 @@ static int mod_torque_wcoll(opt_t *opt)
     return 0;
 }
 
+/*
+ *  Append "[tag] a,b,c" for list [l] to wcoll cache key [key]
+ */
+static void _key_append_list (char **key, const char *tag, List l)
+{
+    ListIterator i = list_iterator_create (l);
+    char *s;
+    char sep = ' ';
+
+    if (*key != NULL)
+        xstrcatchar (key, ' ');
+    xstrcat (key, (char *) tag);
+    while ((s = list_next (i))) {
+        xstrcatchar (key, sep);
+        xstrcat (key, s);
+        sep = ',';
+    }
+    list_iterator_destroy (i);
+}
+
+/*
+ *  Describe the query mod_torque_wcoll() will make, for the wcoll cache
+ */
+static char * mod_torque_wcoll_key (opt_t *opt)
+{
+    char *key = NULL;
+    char *jobid;
+
+    if (opt->wcoll)
+        return (NULL);
+
+    if (job_list)
+        _key_append_list (&key, "-j", job_list);
+    else if ((jobid = getenv ("PBS_JOBID"))) {
+        xstrcat (&key, "PBS_JOBID=");
+        xstrcat (&key, jobid);
+    }
+
+    return (key);
+}
+
 static void _create_fq_jobid(char *dst, const char *jobid, const char *servername){
   /*
    *  Create fully qualified jobid, "<integer>.<servername>"
@@ -186,100 +238,189 @@ static void _create_fq_jobid(char *dst, const char *jobid, const char *servernam
         *dst = '\0';
         return;
     }
-    strncpy(dst, jobid, PBS_MAXSEQNUM);
-    strncat(dst, ".", 1);
-    strncat(dst, servername, PBS_MAXSERVERNAME);
+    snprintf(dst, PBS_MAXCLTJOBID, "%s.%s", jobid, servername);
 }
 
-static char *_next_hname(char *p){
-    /*
-     *   Find next hostname in a "exechost list".
-     *   Find next '/'-character, then find next '+'-character,
-     */
-
-    if( p == NULL ) return NULL;
-
-    while( *p != '/' )
-        if( *p++ == '\0' ) return NULL;
+/*
+ *  Return the next hostname in exec_host string *[p] and advance *[p]
+ *   past its entry. exec_host lists each host once per slot, as
+ *   "host/slot+host/slot+...". The string is split in place, so the
+ *   hostnames returned point into the job status.
+ */
+static char *_exec_host_next(char **p){
+    char *host = *p;
+    char *q;
 
-    while( *p != '+' )
-        if( *p++ == '\0' ) return NULL;
+    if( (host == NULL) || (*host == '\0') ) return NULL;
 
-    /* And finally step past the '+'-character */
-    if( *p++ == '\0' ) return NULL;
+    q = host + strcspn(host, "/+");
+    if( *q == '/' ){
+        *q++ = '\0';
+        q += strcspn(q, "+");
+    }
+    if( *q == '+' )
+        *q++ = '\0';
 
-    return p;
+    *p = q;
+    return host;
 }
 
-static void _copy_hname(char *dst, const char *src){
-    /* Copy at most PBS_MAXHOSTNAME-1 characters.
-       Hostname in src ends before a '/'-character.
+static void _push_exec_hosts(hostlist_t hl, char *exec_host){
+    /*
+     *  Append the hosts in exec_host to hl. Consecutive slots on the
+     *   same host are skipped here, and hostlist_uniq deals with any
+     *   other duplicates later on.
      */
-    const char *q = src;
+    char *host, *prev = NULL;
 
-    while( (*src != '\0') && \
-           (*src != '/') && \
-           (src - q) < (PBS_MAXHOSTNAME-2) ){
-        *dst++ = *src++;
+    while( (host = _exec_host_next(&exec_host)) ){
+        if( (*host == '\0') || (prev && (strcmp(prev, host) == 0)) )
+            continue;
+        hostlist_push_host(hl, host);
+        prev = host;
     }
-    *dst = '\0';
 }
 
-static hostlist_t _hl_append_host (hostlist_t hl, char *node)
-{
-    if (hl == NULL)
-        return (hostlist_create (node));
-    else
-        hostlist_push_host (hl, node);
-    return (hl);
+static void _add_status_hosts(hostlist_t hl, struct batch_status *status){
+    /*
+     *  Add the nodes in the exec_host attribute of one job status.
+     *  There is none e.g. if the job is not started.
+     */
+    struct attrl *a;
+
+    for( a = status->attribs; a != NULL; a = a->next ){
+        if( a->name && a->value && (strcmp(a->name, ATTR_exechost) == 0) )
+            _push_exec_hosts(hl, a->value);
+    }
 }
 
-static hostlist_t _add_jobnodes(hostlist_t hl, int connect, char *jobdesc){
+static void _add_jobnodes(hostlist_t hl, int connect, char *jobdesc){
     /*
      *  Add the nodes allocated by job jobdesc to hostlist hl.
      */
     struct batch_status *status;
     struct attrl a_exechost = {NULL, ATTR_exechost, NULL, NULL};
-    char *p, hname[PBS_MAXHOSTNAME];
 
     if( (status = pbs_statjob(connect, jobdesc, &a_exechost, EXECQUEONLY)) == NULL ){
         err ("%p: Failed to retrieve information for job %s: (%d) %s\n",
                 jobdesc, pbs_errno, pbs_strerror(pbs_errno));
+        return;
     }
-    else if ( status->attribs == NULL ){
-        /* We end up here e.g. if the job is not started.
-	 */
-        //errx("Job %s has no allocated nodes.\n", jobdesc);
-        ;
+    _add_status_hosts(hl, status);
+    pbs_statfree(status);
+}
+
+struct jobreq {
+    int32_t     id;
+    const char *arg;
+    int         found;
+};
+
+static int _jobreq_cmp(const void *x, const void *y){
+    int32_t a = ((const struct jobreq *) x)->id;
+    int32_t b = ((const struct jobreq *) y)->id;
+    return (a > b) - (a < b);
+}
+
+static void _stat_all_jobs(hostlist_t hl, int connect,
+                           struct jobreq *reqs, int n){
+    /*
+     *  Add the nodes allocated by the n jobs in sorted array reqs with
+     *   a single pbs_statjob call, fetching only the exec_host attribute
+     *   of every job and picking out the requested ones by sequence number.
+     */
+    struct batch_status *status, *s;
+    struct attrl a_exechost = {NULL, ATTR_exechost, NULL, NULL};
+    struct jobreq key, *r;
+    char *p;
+    int i;
+
+    pbs_errno = 0;
+    status = pbs_statjob(connect, NULL, &a_exechost, EXECQUEONLY);
+    if( (status == NULL) && (pbs_errno != 0) ){
+        err ("%p: Failed to retrieve job information: (%d) %s\n",
+                pbs_errno, pbs_strerror(pbs_errno));
+        return;
+    }
+
+    for( s = status; s != NULL; s = s->next ){
+        /* Job names are "<integer>.<servername>" */
+        key.id = (int32_t) strtoul(s->name, &p, 10);
+        if( (p == s->name) || ((*p != '.') && (*p != '\0')) )
+            continue;
+        if( (r = bsearch(&key, reqs, n, sizeof(*reqs), _jobreq_cmp)) == NULL )
+            continue;
+        r->found = 1;
+        _add_status_hosts(hl, s);
+    }
+    if( status )
+        pbs_statfree(status);
+
+    for( i = 0; i < n; i++ ){
+        if( !reqs[i].found )
+            err ("%p: Failed to retrieve information for job %s: (%d) %s\n",
+                    reqs[i].arg, PBSE_UNKJOBID, pbs_strerror(PBSE_UNKJOBID));
+    }
+}
+
+static void _add_jobs(hostlist_t hl, int connect, List joblist,
+                      const char *servername, long total){
+    /*
+     *  Add the nodes allocated by all jobs in joblist. pbs_selstat
+     *   cannot select on job id, so the choice is between one
+     *   pbs_statjob per job and one for every job on the server.
+     *   The latter is only used if the requested jobs are a large
+     *   share of the total jobs, as reported by pbs_statserver.
+     */
+    char jobid[PBS_MAXCLTJOBID];
+    struct jobreq *reqs;
+    ListIterator li;
+    char *p;
+    int i, m, n = 0;
+
+    reqs = Malloc(list_count(joblist) * sizeof(*reqs));
+    li = list_iterator_create(joblist);
+    while( (p = list_next(li)) ){
+        reqs[n].id = str2jobid(p);
+        reqs[n].arg = p;
+        reqs[n].found = 0;
+        n++;
     }
+    list_iterator_destroy(li);
+    qsort(reqs, n, sizeof(*reqs), _jobreq_cmp);
+
+    /* Drop repeated job ids */
+    for( i = 1, m = (n > 0); i < n; i++ ){
+        if( reqs[i].id != reqs[m-1].id )
+            reqs[m++] = reqs[i];
+    }
+    n = m;
+
+    if( (total >= 0) && (total <= (long) n * TORQUE_BATCH_RATIO) )
+        _stat_all_jobs(hl, connect, reqs, n);
     else {
-        /* An "exechost"-list is available for the job.
-         * exechosts are on the format
-         * host/slot+host/slot+host/slot+..., i.e. hostname slash integer plus ...
-         * Just ignore the slash-integer parts, split at the '+'-signs,
-         * and let hostlist_uniq deal with duplicates later on.
+        /* The provided jobids are expected to be "integer only" jobids
+         * so the fully qualified server name must be appended
          */
-
-        for(p = status->attribs->value; p != NULL; p = _next_hname(p)){
-            _copy_hname(hname, p);
-            hl = _hl_append_host(hl, hname);
+        for( i = 0; i < n; i++ ){
+            _create_fq_jobid(jobid, reqs[i].arg, servername);
+            _add_jobnodes(hl, connect, jobid);
         }
-        pbs_statfree(status);
     }
-    return(hl);
+    Free((void **) &reqs);
 }
 
 static hostlist_t _torque_wcoll (List joblist)
 {
     hostlist_t hl   = NULL;
-    ListIterator li = NULL;
-    char jobid[PBS_MAXCLTJOBID];
     char *envjobid  = NULL;
-    char *p;
 
     struct batch_status *status;
-    struct attrl a_servername = {NULL, ATTR_servername, NULL, NULL};
+    struct attrl a_total = {NULL, ATTR_total, NULL, NULL};
+    struct attrl a_servername = {&a_total, ATTR_servername, NULL, NULL};
+    struct attrl *a;
     char servername[PBS_MAXSERVERNAME];
+    long total = -1;
     int connect;
 
     /*
@@ -290,7 +431,7 @@ static hostlist_t _torque_wcoll (List joblist)
         return (NULL);
 
 
-    /* Connect to "default_server". */
+    /* Connect to "default_server", e.g. as set by PBS_DEFAULT. */
     if( (connect = pbs_connect(NULL)) < 0 ){
         const char msg[] = "Failed to connect to torque server";
         /*
@@ -305,41 +446,37 @@ static hostlist_t _torque_wcoll (List joblist)
              msg, pbs_server, pbs_errno, pbs_strerror(pbs_errno));
     }
 
-    /* However, fully qualified JobIDs need the fully qualified server name.
-     * We can get it by calling pbs_statserver.
-     */
-    if( (status = pbs_statserver(connect, &a_servername, NULL)) == NULL ){
-        errx("%p: Failed to retrieve fully qualified servername for torque server.\n");
-    }
-    else {
-        strncpy(servername, status->name, PBS_MAXSERVERNAME);
-        /* Some versions of torque will return server name as FQDN:PORT
-         * which ends up being in the JobID sent back to the pbs_server.
-         */
-        strtok(servername, ":");
-        pbs_statfree(status);
-    }
+    hl = hostlist_create(NULL);
 
     if( joblist != NULL ){
-        /* Add the nodes for the jobs provided with the -j flag.
+        /* Jobs provided with the -j flag. Fully qualified JobIDs
+         * need the fully qualified server name, and the number of
+         * jobs on the server decides how to query them.
+         * We can get both by calling pbs_statserver.
          */
-
-        li = list_iterator_create(joblist);
-
-        while( (p = list_next(li)) ){
-            /* The provided jobids are expected to be "integer only" jobids
-             * so the fully qualified server name must be appended
+        if( (status = pbs_statserver(connect, &a_servername, NULL)) == NULL ){
+            errx("%p: Failed to retrieve fully qualified servername for torque server.\n");
+        }
+        else {
+            snprintf(servername, sizeof(servername), "%s", status->name);
+            /* Some versions of torque will return server name as FQDN:PORT
+             * which ends up being in the JobID sent back to the pbs_server.
              */
-            _create_fq_jobid(jobid, p, servername);
-            hl = _add_jobnodes(hl, connect, jobid);
+            strtok(servername, ":");
+            for( a = status->attribs; a != NULL; a = a->next ){
+                if( a->name && a->value && (strcmp(a->name, ATTR_total) == 0) )
+                    total = strtol(a->value, NULL, 10);
+            }
+            pbs_statfree(status);
         }
-	list_iterator_destroy(li);
+
+        _add_jobs(hl, connect, joblist, servername, total);
     }
     else if( envjobid != NULL ) {
         /* The env variable PBS_JOBID is expected to be a fully qualified jobid,
          * hence _create_fq_jobid is not called.
 	 */
-        hl = _add_jobnodes(hl, connect, envjobid);
+        _add_jobnodes(hl, connect, envjobid);
     }
 
     if( pbs_disconnect(connect) ){
@@ -347,8 +484,11 @@ static hostlist_t _torque_wcoll (List joblist)
              pbs_server, pbs_errno, pbs_strerror(pbs_errno));
     }
 
-    if (hl)
-        hostlist_uniq (hl);
+    if (hostlist_count (hl) == 0) {
+        hostlist_destroy (hl);
+        return (NULL);
+    }
+    hostlist_uniq (hl);
     return (hl);
 }
 
@@ -192,10 +192,31 @@ static int xrcmd_signal(int efd, void *arg, int signum)
     return 0;
 }
 
+/*
+ * Set port of IPv4 or IPv6 address [ss] to [port], returning the length
+ *  of the address for connect(2).
+ */
+static socklen_t _set_port (struct sockaddr_storage *ss, int port)
+{
+    if (ss->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) ss)->sin6_port = htons (port);
+        return (sizeof (struct sockaddr_in6));
+    }
+    ((struct sockaddr_in *) ss)->sin_port = htons (port);
+    return (sizeof (struct sockaddr_in));
+}
+
+static int _get_port (struct sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET6)
+        return (ntohs (((struct sockaddr_in6 *) ss)->sin6_port));
+    return (ntohs (((struct sockaddr_in *) ss)->sin_port));
+}
+
 /*
  * The rcmd call itself.
  * 	ahost (IN)	remote hostname
- *	addr (IN)	4 byte internet address
+ *	addr (IN)	address (struct sockaddr_storage, IPv4 or IPv6)
  *	locuser (IN)	local username
  *	remuser (IN)	remote username
  *	cmd (IN)	command to execute
@@ -207,10 +228,13 @@ static int
 xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
       char *cmd, int rank, int *fd2p, void **arg)
 {
-    struct sockaddr_in sin, from;
+    struct sockaddr_storage sin, from;
+    socklen_t salen;
+    int family = ((struct sockaddr_storage *) addr)->ss_family;
     sigset_t oldset, blockme;
     pid_t pid;
     int s, lport, timo, rv;
+    int inuse = 0;
     char c;
     struct xpollfd xpfds[2];
 
@@ -221,8 +245,8 @@ xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
     sigemptyset(&blockme);
     sigaddset(&blockme, SIGURG);
     pthread_sigmask(SIG_BLOCK, &blockme, &oldset);
-    for (timo = 1, lport = IPPORT_RESERVED - 1;;) {
-        s = privsep_rresvport(&lport);
+    for (timo = 1;;) {
+        s = privsep_rresvport_af(&lport, family);
         if (s < 0) {
             if (errno == EAGAIN)
                 err("%p: %S: rcmd: socket: all ports in use\n", ahost);
@@ -232,18 +256,18 @@ xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
             return (-1);
         }
         fcntl(s, F_SETOWN, pid);
-        memset (&sin, 0, sizeof (sin));
-        sin.sin_family = AF_INET;
-        memcpy(&sin.sin_addr, addr, IP_ADDR_LEN);
-        sin.sin_port = htons(RSH_PORT);
-        rv = connect(s, (struct sockaddr *) &sin, sizeof(sin));
+        memcpy (&sin, addr, sizeof (sin));
+        salen = _set_port (&sin, RSH_PORT);
+        rv = connect(s, (struct sockaddr *) &sin, salen);
         if (rv >= 0)
             break;
         (void) close(s);
-        if (errno == EADDRINUSE) {
-            lport--;
+        /*
+         *  Each call to privsep_rresvport_af() binds a different port,
+         *   so just try again while the address is in use.
+         */
+        if (errno == EADDRINUSE && ++inuse < IPPORT_RESERVED / 2)
             continue;
-        }
         if (errno == ECONNREFUSED && timo <= 16) {
             (void) sleep(timo);
             timo *= 2;
@@ -256,7 +280,6 @@ xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
         pthread_sigmask(SIG_SETMASK, &oldset, NULL);
         return (-1);
     }
-    lport--;
     if (fd2p == 0) {
         if (write(s, "", 1) != 1) {
             err ("%p: %S: write: %m\n", ahost);
@@ -265,7 +288,7 @@ xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
         lport = 0;
     } else {
         char num[8];
-        int s2 = privsep_rresvport(&lport), s3;
+        int s2 = privsep_rresvport_af(&lport, family), s3;
         socklen_t len = sizeof(from);   /* arg to accept */
 
         if (s2 < 0)
@@ -297,10 +320,10 @@ xrcmd(char *ahost, char *addr, char *locuser, char *remuser,
             goto bad;
         }
         *fd2p = s3;
-        from.sin_port = ntohs((u_short) from.sin_port);
-        if (from.sin_family != AF_INET ||
-            from.sin_port >= IPPORT_RESERVED ||
-            from.sin_port < IPPORT_RESERVED / 2) {
+        rv = _get_port (&from);
+        if (from.ss_family != family ||
+            rv >= IPPORT_RESERVED ||
+            rv < IPPORT_RESERVED / 2) {
             err("%p: %S: socket: protocol failure in circuit setup\n",
                 ahost);
             goto bad2;
@@ -0,0 +1,381 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  Binary host address cache.
+ *
+ *  The file is written by pdsh-addrcache from hosts(5) format input and
+ *   mapped read-only by pdsh when PDSH_ADDR_CACHE is set, so that
+ *   looking up a host is a binary search with no resolver traffic.
+ *
+ *  Layout, in native byte order:
+ *
+ *    struct addrcache_header
+ *    struct addrcache_entry [count]   sorted by name, IPv4 first
+ *    char strtab [strsize]            NUL terminated lowercase names
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "src/common/err.h"
+#include "src/common/fd.h"
+#include "src/common/xmalloc.h"
+#include "src/common/xstring.h"
+#include "addrcache.h"
+
+#define ADDRCACHE_MAGIC      "pdshaddr"
+#define ADDRCACHE_VERSION    1
+#define ADDRCACHE_MAXNAME    1024
+
+struct addrcache_header {
+    char     magic[8];
+    uint32_t version;       /* also detects a foreign byte order */
+    uint32_t count;         /* number of entries */
+    uint32_t strsize;       /* size of string table */
+    uint32_t reserved;
+};
+
+struct addrcache_entry {
+    uint32_t      name;     /* offset of name in string table */
+    uint16_t      family;   /* 4 or 6 */
+    uint16_t      reserved;
+    unsigned char addr[16];
+};
+
+struct addrcache {
+    void                         *map;
+    size_t                        size;
+    const struct addrcache_entry *entries;
+    uint32_t                      count;
+    const char                   *strtab;
+    uint32_t                      strsize;
+};
+
+addrcache_t addrcache_open (const char *path)
+{
+    struct addrcache_header *h;
+    struct addrcache *ac;
+    struct stat st;
+    void *map;
+    size_t need;
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0) {
+        err ("%p: %s: %m\n", path);
+        return (NULL);
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < sizeof (*h)) {
+        err ("%p: %s: not an address cache file\n", path);
+        close (fd);
+        return (NULL);
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        err ("%p: %s: mmap: %m\n", path);
+        return (NULL);
+    }
+
+    h = map;
+    need = sizeof (*h) + (size_t) h->count * sizeof (struct addrcache_entry)
+         + h->strsize;
+    if (memcmp (h->magic, ADDRCACHE_MAGIC, sizeof (h->magic)) != 0
+        || h->version != ADDRCACHE_VERSION
+        || need != st.st_size
+        || h->strsize == 0
+        || ((char *) map)[st.st_size - 1] != '\0') {
+        err ("%p: %s: invalid address cache file\n", path);
+        munmap (map, st.st_size);
+        return (NULL);
+    }
+
+    ac = Malloc (sizeof (*ac));
+    ac->map = map;
+    ac->size = st.st_size;
+    ac->entries = (struct addrcache_entry *) (h + 1);
+    ac->count = h->count;
+    ac->strtab = (const char *) (ac->entries + h->count);
+    ac->strsize = h->strsize;
+
+    return (ac);
+}
+
+void addrcache_close (addrcache_t ac)
+{
+    if (ac == NULL)
+        return;
+    munmap (ac->map, ac->size);
+    Free ((void **) &ac);
+}
+
+static void _lowercase (char *dst, const char *src, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len - 1 && src[i]; i++)
+        dst[i] = tolower ((unsigned char) src[i]);
+    dst[i] = '\0';
+}
+
+int addrcache_lookup (addrcache_t ac, const char *host,
+                      struct sockaddr_storage *ss)
+{
+    char key [ADDRCACHE_MAXNAME];
+    const struct addrcache_entry *e;
+    uint32_t lo = 0;
+    uint32_t hi = ac->count;
+
+    if (strlen (host) >= sizeof (key))
+        return (-1);
+    _lowercase (key, host, sizeof (key));
+
+    /*
+     *  Find the first entry for key. Entries for the same name are
+     *   sorted with IPv4 first.
+     */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t off = ac->entries[mid].name;
+
+        if (off >= ac->strsize)
+            return (-1);
+        if (strcmp (ac->strtab + off, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == ac->count)
+        return (-1);
+
+    e = &ac->entries[lo];
+    if (e->name >= ac->strsize || strcmp (ac->strtab + e->name, key) != 0)
+        return (-1);
+
+    memset (ss, 0, sizeof (*ss));
+    if (e->family == 4) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+        sin->sin_family = AF_INET;
+        memcpy (&sin->sin_addr, e->addr, sizeof (sin->sin_addr));
+    } else if (e->family == 6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy (&sin6->sin6_addr, e->addr, sizeof (sin6->sin6_addr));
+    } else
+        return (-1);
+
+    return (0);
+}
+
+/*
+ *  Entry under construction in addrcache_write().
+ */
+struct build_entry {
+    char          *name;
+    int            family;
+    int            line;    /* input order, to keep the first duplicate */
+    unsigned char  addr[16];
+};
+
+static int _build_cmp (const void *x, const void *y)
+{
+    const struct build_entry *a = x;
+    const struct build_entry *b = y;
+    int rc;
+
+    if ((rc = strcmp (a->name, b->name)))
+        return (rc);
+    if (a->family != b->family)
+        return (a->family - b->family);
+    return (a->line - b->line);
+}
+
+static void _build_free (struct build_entry *v, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        Free ((void **) &v[i].name);
+    Free ((void **) &v);
+}
+
+/*
+ *  Write [len] bytes of [buf] to [fd], returning -1 with an error
+ *   message naming [path] on failure.
+ */
+static int _write (int fd, const char *path, void *buf, size_t len)
+{
+    if (fd_write_n (fd, buf, len) < 0) {
+        err ("%p: %s: write: %m\n", path);
+        return (-1);
+    }
+    return (0);
+}
+
+int addrcache_write (const char *path, FILE *fp)
+{
+    struct addrcache_header h;
+    struct build_entry *v;
+    int nalloc = 1024;
+    int n = 0;
+    int nout = 0;
+    int lineno = 0;
+    uint32_t strsize = 0;
+    char line [4096];
+    char *tmp = NULL;
+    int fd = -1;
+    int i;
+
+    v = Malloc (nalloc * sizeof (*v));
+
+    while (fgets (line, sizeof (line), fp)) {
+        unsigned char addr[16];
+        char *p, *name, *save;
+        int family;
+
+        lineno++;
+        if ((p = strchr (line, '#')))
+            *p = '\0';
+        if (!(p = strtok_r (line, " \t\r\n", &save)))
+            continue;
+        if (inet_pton (AF_INET, p, addr) == 1)
+            family = 4;
+        else if (inet_pton (AF_INET6, p, addr) == 1)
+            family = 6;
+        else {
+            err ("%p: line %d: invalid address \"%s\"\n", lineno, p);
+            continue;
+        }
+
+        while ((name = strtok_r (NULL, " \t\r\n", &save))) {
+            if (strlen (name) >= ADDRCACHE_MAXNAME)
+                continue;
+            if (n == nalloc) {
+                nalloc *= 2;
+                Realloc ((void **) &v, nalloc * sizeof (*v));
+            }
+            v[n].name = Malloc (strlen (name) + 1);
+            _lowercase (v[n].name, name, strlen (name) + 1);
+            v[n].family = family;
+            v[n].line = n;
+            memcpy (v[n].addr, addr, sizeof (addr));
+            n++;
+        }
+    }
+
+    qsort (v, n, sizeof (*v), _build_cmp);
+
+    /*
+     *  Drop later duplicates of the same name and family, and
+     *   assign string table offsets.
+     */
+    for (i = 0; i < n; i++) {
+        if (nout > 0
+            && strcmp (v[nout-1].name, v[i].name) == 0
+            && v[nout-1].family == v[i].family) {
+            Free ((void **) &v[i].name);
+            continue;
+        }
+        v[nout++] = v[i];
+        strsize += strlen (v[i].name) + 1;
+    }
+    n = nout;
+
+    if (strsize == 0)
+        strsize = 1;   /* keep the file NUL terminated */
+
+    xstrcat (&tmp, (char *) path);
+    xstrcat (&tmp, ".XXXXXX");
+    if ((fd = mkstemp (tmp)) < 0) {
+        err ("%p: %s: %m\n", tmp);
+        goto fail;
+    }
+
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, ADDRCACHE_MAGIC, sizeof (h.magic));
+    h.version = ADDRCACHE_VERSION;
+    h.count = n;
+    h.strsize = strsize;
+    if (_write (fd, tmp, &h, sizeof (h)) < 0)
+        goto fail;
+
+    for (i = 0, strsize = 0; i < n; i++) {
+        struct addrcache_entry e;
+
+        memset (&e, 0, sizeof (e));
+        e.name = strsize;
+        e.family = v[i].family;
+        memcpy (e.addr, v[i].addr, sizeof (e.addr));
+        if (_write (fd, tmp, &e, sizeof (e)) < 0)
+            goto fail;
+        strsize += strlen (v[i].name) + 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (_write (fd, tmp, v[i].name, strlen (v[i].name) + 1) < 0)
+            goto fail;
+    }
+    if (n == 0 && _write (fd, tmp, "", 1) < 0)
+        goto fail;
+
+    if (fchmod (fd, 0644) < 0 || close (fd) < 0) {
+        fd = -1;
+        err ("%p: %s: %m\n", tmp);
+        goto fail;
+    }
+    fd = -1;
+
+    if (rename (tmp, path) < 0) {
+        err ("%p: rename %s: %m\n", tmp);
+        goto fail;
+    }
+
+    Free ((void **) &tmp);
+    _build_free (v, n);
+    return (n);
+
+  fail:
+    if (fd >= 0)
+        close (fd);
+    if (tmp) {
+        unlink (tmp);
+        Free ((void **) &tmp);
+    }
+    _build_free (v, n);
+    return (-1);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
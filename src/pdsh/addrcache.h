@@ -0,0 +1,58 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+#ifndef _ADDRCACHE_H
+#define _ADDRCACHE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+typedef struct addrcache * addrcache_t;
+
+/*
+ * Map the address cache file [path] read-only.
+ *  Returns NULL with an error message if the file is missing or invalid.
+ */
+addrcache_t addrcache_open (const char *path);
+
+/*
+ * Look up [host] in cache [ac], copying its address into [ss].
+ *  An IPv4 address is returned in preference to IPv6.
+ *  Returns 0 if found, -1 if the host is not in the cache.
+ */
+int addrcache_lookup (addrcache_t ac, const char *host,
+                      struct sockaddr_storage *ss);
+
+/*
+ * Unmap and free cache [ac].
+ */
+void addrcache_close (addrcache_t ac);
+
+/*
+ * Write a new address cache to [path] from hosts(5) format lines
+ *  ("address name [alias ...]", e.g. "getent hosts" output) read
+ *  from [fp]. The file is replaced atomically, so running pdsh
+ *  processes keep using the old copy. Returns the number of entries
+ *  written, or -1 on error.
+ */
+int addrcache_write (const char *path, FILE *fp);
+
+#endif /* !_ADDRCACHE_H */
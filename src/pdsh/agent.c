@@ -0,0 +1,527 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  Persistent pdsh agent.
+ *
+ *  "pdsh -U path" loads modules once and then serves requests on a
+ *   unix socket. A pdsh run with PDSH_AGENT_SOCKET=path sends its
+ *   stdin, stdout and stderr descriptors, working directory, environment
+ *   and argv to the agent instead of loading modules itself. The agent
+ *   forks a child for each request, which runs the command as pdsh would
+ *   have, writing directly to the client's stdout and stderr, so output
+ *   is streamed and labelled exactly as for a local run.
+ *
+ *  Protocol (client -> agent):
+ *
+ *    one byte carrying descriptors 0, 1 and 2 in SCM_RIGHTS
+ *    working directory, argv and environment, each string as
+ *      "<length>\n<bytes>" and each vector preceded by "<count>\n"
+ *
+ *  Protocol (agent -> client):
+ *
+ *    "<pid>\n"     pid of the process running the request, to which
+ *                  the client forwards SIGINT, SIGTERM and SIGHUP
+ *    "<status>\n"  exit code of the request
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE    /* struct ucred */
+#endif
+
+#include <sys/types.h>
+#if HAVE_SYS_UIO_H
+#  include <sys/uio.h>
+#endif
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/param.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/common/err.h"
+#include "src/common/xmalloc.h"
+#include "src/common/fd.h"
+#include "dsh.h"
+#include "privsep.h"
+#include "agent.h"
+
+#define AGENT_NFDS        3
+#define AGENT_CONTROLLEN  (sizeof (struct cmsghdr) + AGENT_NFDS * sizeof (int))
+#define AGENT_MAXSTR      (1024 * 1024)
+#define AGENT_MAXCOUNT    65536
+
+extern char **environ;
+
+static const char *agent_path = NULL;
+static volatile pid_t agent_request_pid = 0;
+
+
+static int _write_int (int fd, long val)
+{
+    char buf [32];
+    int n = snprintf (buf, sizeof (buf), "%ld\n", val);
+    return (fd_write_n (fd, buf, n) == n ? 0 : -1);
+}
+
+static int _read_int (int fd, long *valp)
+{
+    char buf [32];
+    char *end;
+
+    if (fd_read_line (fd, buf, sizeof (buf)) <= 0)
+        return (-1);
+    *valp = strtol (buf, &end, 10);
+    if (end == buf || *end != '\n')
+        return (-1);
+    return (0);
+}
+
+static int _write_string (int fd, const char *s)
+{
+    size_t len = strlen (s);
+    if (_write_int (fd, len) < 0 || fd_write_n (fd, (void *) s, len) != len)
+        return (-1);
+    return (0);
+}
+
+static char * _read_string (int fd)
+{
+    long len;
+    char *s;
+
+    if (_read_int (fd, &len) < 0 || len < 0 || len > AGENT_MAXSTR)
+        return (NULL);
+    s = Malloc (len + 1);
+    if (fd_read_n (fd, s, len) != len) {
+        Free ((void **) &s);
+        return (NULL);
+    }
+    s [len] = '\0';
+    return (s);
+}
+
+static int _write_vector (int fd, char **v, int n)
+{
+    int i;
+    if (_write_int (fd, n) < 0)
+        return (-1);
+    for (i = 0; i < n; i++)
+        if (_write_string (fd, v[i]) < 0)
+            return (-1);
+    return (0);
+}
+
+/*
+ *  Read a NULL terminated vector of strings. Strings are not freed on
+ *   error since the request process exits anyway.
+ */
+static char ** _read_vector (int fd, int *countp)
+{
+    long n;
+    char **v;
+    int i;
+
+    if (_read_int (fd, &n) < 0 || n < 0 || n > AGENT_MAXCOUNT)
+        return (NULL);
+    v = Malloc ((n + 1) * sizeof (char *));
+    for (i = 0; i < n; i++) {
+        if (!(v[i] = _read_string (fd)))
+            return (NULL);
+    }
+    v[n] = NULL;
+    if (countp)
+        *countp = n;
+    return (v);
+}
+
+static int _send_fds (int fd, int fds[AGENT_NFDS])
+{
+    struct iovec   iov[1];
+    struct msghdr  msg;
+    char           c = 'F';
+#if !HAVE_MSGHDR_ACCRIGHTS
+    union {
+        struct cmsghdr cm;
+        char           buf [AGENT_CONTROLLEN];
+    } control;
+    struct cmsghdr *cmsg = &control.cm;
+#endif
+
+    memset (&msg, 0, sizeof (msg));
+
+    iov->iov_base  = (void *) &c;
+    iov->iov_len   = 1;
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 1;
+
+#if HAVE_MSGHDR_ACCRIGHTS
+    msg.msg_accrights = (caddr_t) fds;
+    msg.msg_accrightslen = AGENT_NFDS * sizeof (int);
+#else
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = AGENT_CONTROLLEN;
+    msg.msg_control    = (caddr_t) cmsg;
+    msg.msg_controllen = AGENT_CONTROLLEN;
+    memcpy (CMSG_DATA (cmsg), fds, AGENT_NFDS * sizeof (int));
+#endif
+
+    if (sendmsg (fd, &msg, 0) != 1)
+        return (-1);
+    return (0);
+}
+
+static int _recv_fds (int fd, int fds[AGENT_NFDS])
+{
+    struct iovec   iov[1];
+    struct msghdr  msg;
+    char           c;
+#if !HAVE_MSGHDR_ACCRIGHTS
+    union {
+        struct cmsghdr cm;
+        char           buf [AGENT_CONTROLLEN];
+    } control;
+    struct cmsghdr *cmsg = &control.cm;
+#endif
+
+    memset (&msg, 0, sizeof (msg));
+
+    iov->iov_base  = (void *) &c;
+    iov->iov_len   = 1;
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 1;
+
+#if HAVE_MSGHDR_ACCRIGHTS
+    msg.msg_accrights = (caddr_t) fds;
+    msg.msg_accrightslen = AGENT_NFDS * sizeof (int);
+#else
+    msg.msg_control    = (caddr_t) cmsg;
+    msg.msg_controllen = AGENT_CONTROLLEN;
+#endif
+
+    if (recvmsg (fd, &msg, 0) != 1)
+        return (-1);
+
+#if HAVE_MSGHDR_ACCRIGHTS
+    if (msg.msg_accrightslen != AGENT_NFDS * sizeof (int))
+        return (-1);
+#else
+    if (msg.msg_controllen < AGENT_CONTROLLEN
+        || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS)
+        return (-1);
+    memcpy (fds, CMSG_DATA (cmsg), AGENT_NFDS * sizeof (int));
+#endif
+    return (0);
+}
+
+/*
+ *  Only serve requests from our own user.
+ */
+static int _peer_ok (int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof (cred);
+
+    if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        err ("%p: agent: SO_PEERCRED: %m\n");
+        return (-1);
+    }
+    if (cred.uid != getuid ()) {
+        err ("%p: agent: rejecting request from uid %d\n", (int) cred.uid);
+        return (-1);
+    }
+#endif
+    return (0);
+}
+
+/*
+ *  Run one request in a child of the agent. Returns exit code.
+ */
+static int _agent_request (int fd, AgentRunF run)
+{
+    char **argv, **env;
+    char *cwd;
+    int fds [AGENT_NFDS];
+    int argc;
+    int status;
+    int i;
+    char c;
+
+    signal (SIGCHLD, SIG_DFL);
+    signal (SIGTERM, SIG_DFL);
+    signal (SIGINT, SIG_DFL);
+    signal (SIGHUP, SIG_DFL);
+
+    /*
+     *  Keep the connection clear of the stdio descriptors replaced below
+     */
+    if (fd < AGENT_NFDS) {
+        int nfd = fcntl (fd, F_DUPFD, AGENT_NFDS);
+        close (fd);
+        if ((fd = nfd) < 0)
+            return (1);
+    }
+
+    /*
+     *  A connection closed without a request is another agent
+     *   checking whether this one is running.
+     */
+    if (recv (fd, &c, 1, MSG_PEEK) == 0)
+        return (0);
+
+    if (_recv_fds (fd, fds) < 0
+        || !(cwd = _read_string (fd))
+        || !(argv = _read_vector (fd, &argc))
+        || !(env = _read_vector (fd, NULL))) {
+        err ("%p: agent: invalid request\n");
+        return (1);
+    }
+
+    for (i = 0; i < AGENT_NFDS; i++) {
+        if (dup2 (fds[i], i) < 0) {
+            err ("%p: agent: dup2: %m\n");
+            return (1);
+        }
+        if (fds[i] != i)
+            close (fds[i]);
+    }
+
+    environ = env;
+
+    if (_write_int (fd, getpid ()) < 0)
+        return (1);
+
+    if (chdir (cwd) < 0) {
+        err ("%p: agent: chdir %s: %m\n", cwd);
+        status = 1;
+    }
+    else
+        status = (*run) (argc, argv);
+
+    fflush (NULL);
+    _write_int (fd, status);
+    return (status);
+}
+
+static void _agent_exit (int signum)
+{
+    if (agent_path)
+        unlink (agent_path);
+    _exit (0);
+}
+
+/*
+ *  Remove a stale socket at [sa] left by an agent that did not exit
+ *   cleanly. A socket nobody listens on refuses connections. Returns
+ *   -1 if an agent is still listening there.
+ */
+static int _remove_stale (struct sockaddr_un *sa)
+{
+    struct stat st;
+    int fd;
+    int rc = 0;
+
+    if (lstat (sa->sun_path, &st) < 0 || !S_ISSOCK (st.st_mode))
+        return (0);
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return (0);
+    if (connect (fd, (struct sockaddr *) sa, sizeof (*sa)) == 0)
+        rc = -1;
+    else if (errno == ECONNREFUSED)
+        unlink (sa->sun_path);
+    close (fd);
+
+    return (rc);
+}
+
+int agent_serve (const char *path, AgentRunF run)
+{
+    struct sockaddr_un sa;
+    struct sigaction act;
+    mode_t mask;
+    int lfd;
+
+    if (strlen (path) >= sizeof (sa.sun_path)) {
+        err ("%p: agent: socket path too long: %s\n", path);
+        return (1);
+    }
+
+    if ((lfd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        err ("%p: agent: socket: %m\n");
+        return (1);
+    }
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sun_family = AF_UNIX;
+    strcpy (sa.sun_path, path);
+
+    if (_remove_stale (&sa) < 0) {
+        err ("%p: agent: agent already running on %s\n", path);
+        close (lfd);
+        return (1);
+    }
+
+    mask = umask (0077);
+    if (bind (lfd, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+        err ("%p: agent: bind %s: %m\n", path);
+        umask (mask);
+        close (lfd);
+        return (1);
+    }
+    umask (mask);
+
+    if (listen (lfd, 128) < 0) {
+        err ("%p: agent: listen: %m\n");
+        close (lfd);
+        unlink (path);
+        return (1);
+    }
+
+    agent_path = path;
+
+    memset (&act, 0, sizeof (act));
+    act.sa_handler = _agent_exit;
+    sigaction (SIGTERM, &act, NULL);
+    sigaction (SIGINT, &act, NULL);
+    sigaction (SIGHUP, &act, NULL);
+
+    /*
+     *  Request processes are never waited for
+     */
+    act.sa_handler = SIG_DFL;
+    act.sa_flags = SA_NOCLDWAIT;
+    sigaction (SIGCHLD, &act, NULL);
+
+    for (;;) {
+        int fd;
+
+        if ((fd = accept (lfd, NULL, NULL)) < 0) {
+            if (errno != EINTR)
+                err ("%p: agent: accept: %m\n");
+            continue;
+        }
+
+        if (_peer_ok (fd) == 0) {
+            pid_t pid = privsep_fork ();
+            if (pid == 0) {
+                close (lfd);
+                _exit (_agent_request (fd, run));
+            }
+            else if (pid < 0)
+                err ("%p: agent: fork: %m\n");
+        }
+        close (fd);
+    }
+
+    return (0);
+}
+
+static void _forward_signal (int signum)
+{
+    if (agent_request_pid > 0)
+        kill (agent_request_pid, signum);
+}
+
+int agent_submit (int argc, char *argv[])
+{
+    const char *path = getenv ("PDSH_AGENT_SOCKET");
+    struct sockaddr_un sa;
+    struct sigaction act;
+    char cwd [MAXPATHLEN];
+    int fds [AGENT_NFDS] = { 0, 1, 2 };
+    long val;
+    int n;
+    int fd;
+
+    if (!path || !*path || pdsh_personality () != DSH)
+        return (-1);
+
+    /*
+     *  Never hand off a setuid pdsh
+     */
+    if (getuid () != geteuid () || strlen (path) >= sizeof (sa.sun_path))
+        return (-1);
+
+    if (!getcwd (cwd, sizeof (cwd)))
+        return (-1);
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return (-1);
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sun_family = AF_UNIX;
+    strcpy (sa.sun_path, path);
+
+    if (connect (fd, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+        close (fd);
+        return (-1);
+    }
+
+    for (n = 0; environ[n]; n++)
+        ;
+
+    if (_send_fds (fd, fds) < 0
+        || _write_string (fd, cwd) < 0
+        || _write_vector (fd, argv, argc) < 0
+        || _write_vector (fd, environ, n) < 0
+        || _read_int (fd, &val) < 0) {
+        /*
+         *  The agent has not started the command, so run it locally.
+         */
+        close (fd);
+        return (-1);
+    }
+
+    agent_request_pid = (pid_t) val;
+
+    memset (&act, 0, sizeof (act));
+    act.sa_handler = _forward_signal;
+    act.sa_flags = SA_RESTART;
+    sigaction (SIGINT, &act, NULL);
+    sigaction (SIGTERM, &act, NULL);
+    sigaction (SIGHUP, &act, NULL);
+
+    if (_read_int (fd, &val) < 0) {
+        err ("%p: agent: lost connection to agent at %s\n", path);
+        val = 1;
+    }
+
+    close (fd);
+    return ((int) val);
+}
+
+/*
+ * vi: ts=4 sw=4 expandtab
+ */
@@ -0,0 +1,47 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+#ifndef _AGENT_H
+#define _AGENT_H
+
+/*
+ *  Function run by the agent for each request, with the argv of the
+ *   requesting pdsh. Returns the exit code for the request.
+ */
+typedef int (*AgentRunF) (int argc, char *argv[]);
+
+/*
+ * Listen on unix socket [path] and run each submitted request with
+ *  [run] in a child of the agent, which inherits the modules already
+ *  loaded by this process. Does not return unless setup fails.
+ */
+int agent_serve (const char *path, AgentRunF run);
+
+/*
+ * If PDSH_AGENT_SOCKET is set and an agent is listening there, hand
+ *  this pdsh command to the agent along with our stdin, stdout, stderr,
+ *  environment and working directory, and wait for it to complete.
+ *
+ * Returns the exit code of the request, or -1 if no agent could be used
+ *  and the command should be run locally.
+ */
+int agent_submit (int argc, char *argv[]);
+
+#endif /* !_AGENT_H */
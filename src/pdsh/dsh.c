@@ -75,6 +75,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
 #if	HAVE_STRINGS_H
 #include <strings.h>            /* FD_SET calls bzero on aix */
@@ -116,6 +117,7 @@
 #include "pcp_server.h"
 #include "wcoll.h"
 #include "rcmd.h"
+#include "resolve.h"
 
 static int debug = 0;
 
@@ -148,6 +150,12 @@ static int connect_timeout, command_timeout;
  */
 static int sigint_terminates = 0;
 
+/*
+ * Command with RC_MAGIC trailer appended, for rcmd modules that cannot
+ *  return the remote exit status from rcmd_destroy (e.g. rsh, mrsh).
+ */
+static char *rc_cmd = NULL;
+
 /*
  *  Buffered output prototypes:
  */
@@ -326,19 +334,22 @@ static void *_wdog(void *args)
 }
 
 /*
- * Return the h_addr of a hostname, exiting if there is a lookup failure.
- *	name (IN)	hostname
- *	addr (OUT)	pointer to location where address will be written
+ * Wait for the background resolver to look up the address of the host
+ *  for thread [a], if its rcmd module needs one. Returns -1 if the host
+ *  could not be resolved, in which case only this host fails.
  */
-static void _gethost(char *name, char *addr)
+static int _gethost(thd_t *a)
 {
-    struct hostent *hp;
+    int rc;
+
+    if (!a->rcmd->opts->resolve_hosts)
+        return (0);
 
-    if (!(hp = gethostbyname(name)))
-            errx("%p: gethostbyname(\"%S\") failed\n", name);
-    /* assert(hp->h_addrtype == AF_INET); */
-    assert(IP_ADDR_LEN == hp->h_length);
-    memcpy(addr, hp->h_addr_list[0], IP_ADDR_LEN);
+    if ((rc = resolve_wait(a->host, &a->addr)) != 0) {
+        err("%p: %S: %s\n", a->host, resolve_strerror(rc));
+        return (-1);
+    }
+    return (0);
 }
 
 /*
@@ -372,6 +383,11 @@ static int _pcp_server (thd_t *th)
     svr->outfd =         svr->infd;
     svr->preserve =      th->pcp_popt;
     svr->target_is_dir = th->pcp_yopt;
+    svr->compress =      th->pcp_copt;
+    svr->sync =          th->pcp_sopt;
+    svr->atomic =        th->pcp_Wopt;
+    svr->direct =        th->pcp_Dopt;
+    svr->resume =        th->pcp_oopt;
     svr->outfile =       th->outfile_name;
 
     return (pcp_server (svr));
@@ -385,6 +401,9 @@ static int _pcp_client (thd_t *th)
     pcp->outfd =      pcp->infd;
 
     pcp->preserve =   th->pcp_popt;
+    pcp->compress =   th->pcp_copt;
+    pcp->sync =       th->pcp_sopt;
+    pcp->resume =     th->pcp_oopt;
     pcp->pcp_client = th->pcp_Zopt;
     pcp->host =       th->host;
     pcp->infiles =    th->pcp_infiles;
@@ -452,12 +471,12 @@ static void *_rcp_thread(void *args)
     thd_t *a = (thd_t *) args;
     int result = DSH_DONE;      /* the desired outcome */
     int rc;
+    int copied = 0;
     char *rcpycmd = NULL;
 
-#if	HAVE_MTSAFE_GETHOSTBYNAME
-    if (a->rcmd->opts->resolve_hosts)
-        _gethost(a->host, a->addr);
-#endif
+    if (_gethost(a) < 0)
+        goto done;
+
     a->start = time(NULL);
     dsh_mutex_lock(&thd_mutex);
     a->state = DSH_RCMD;
@@ -470,16 +489,28 @@ static void *_rcp_thread(void *args)
         xstrcat(&rcpycmd, a->host);
     }
 
-    rcmd_connect (a->rcmd, a->host, a->addr, a->luser, a->ruser,
+    rcmd_connect (a->rcmd, a->host, (char *) &a->addr, a->luser, a->ruser,
                   (rcpycmd) ? rcpycmd : a->cmd, a->nodeid, a->dsh_sopt);
 
     if (rcpycmd)
         Free((void **) &rcpycmd);
 
+  done:
     if (a->rcmd->fd == -1)
         result = DSH_FAILED;
-    else if (_update_connect_state(a) != DSH_CANCELED)
-        _parallel_copy(a);
+    else if (_update_connect_state(a) != DSH_CANCELED) {
+        /*
+         *  With -n, a host where some or all files were not copied
+         *   is failed so that it is retried.
+         */
+        if (_parallel_copy(a) != 0 && a->pcp_nopt)
+            result = DSH_FAILED;
+        copied = 1;
+    }
+
+    /* files this connection never got to must not hold shared data */
+    if (!copied && a->pcp_infiles)
+        pcp_release_files(a->pcp_infiles);
 
     /* update status */
     dsh_mutex_lock(&thd_mutex);
@@ -501,24 +532,80 @@ static void *_rcp_thread(void *args)
 }
 
 /*
- * Extract a remote command return code embedded in output, returning
- * the code as an integer and truncating the line.
+ * Return a pointer to the RC_MAGIC trailer ending line [buf] (before
+ * any newline), or NULL if the line does not end with one. Only the
+ * tail of the line is examined, since the trailer is always the last
+ * thing written by the remote shell.
+ */
+static char * _find_rc(char *buf)
+{
+    int len = strlen(buf);
+    int magiclen = strlen(RC_MAGIC);
+    char *end = buf + len;
+    char *digits;
+    char *p;
+
+    if (len > 0 && end[-1] == '\n')
+        end--;
+
+    digits = end;
+    while (digits > buf && isdigit ((unsigned char) digits[-1]))
+        digits--;
+    if (digits == end || digits - buf < magiclen)
+        return (NULL);
+
+    p = digits - magiclen;
+    if (strncmp (p, RC_MAGIC, magiclen) != 0)
+        return (NULL);
+
+    return (p);
+}
+
+/*
+ * Extract a remote command return code echoed at the end of a line of
+ * output, returning the code as an integer and truncating the line.
  */
 static int _extract_rc(char *buf)
 {
-    int ret = 0;
-    char *p = strstr(buf, RC_MAGIC);
-
-    if (p) {
-        if (buf[strlen(buf) - 1] == '\n' && p != buf)
-            *p++ = '\n';
-        *p = '\0';
-        p += strlen(RC_MAGIC);
-        ret = atoi(p);
+    char *p = _find_rc(buf);
+    bool newline;
+    int ret;
+
+    if (p == NULL)
+        return (0);
+
+    newline = (buf[strlen(buf) - 1] == '\n');
+    ret = atoi (p + strlen(RC_MAGIC));
+
+    if (newline && p != buf)
+        *p++ = '\n';
+    *p = '\0';
+
+    return (ret);
+}
+
+static void _write_line (const char *buf, out_f outf, thd_t *th)
+{
+    if (strlen (buf) > 0) {
+        /*
+         *  We are careful to use a single call to write the line
+         *   to the output stream to avoid interleaved lines of
+         *   output.
+         */
+        if (th->labels)
+            outf ("%S: %s", th->host, buf);
+        else
+            outf ("%s", buf);
+        fflush (NULL);
     }
-    return ret;
 }
 
+/*
+ *  Write each complete line in [cb]. If [read_rc] is set and the last
+ *   complete line ends with an RC_MAGIC trailer, it is held back: the
+ *   trailer is always the final line of the stream, so only EOF shows
+ *   whether that line is the trailer or ordinary output.
+ */
 static void _flush_lines (cbuf_t cb, out_f outf, bool read_rc, thd_t *th)
 {
     char c;
@@ -541,31 +628,46 @@ static void _flush_lines (cbuf_t cb, out_f outf, bool read_rc, thd_t *th)
          *   then actually read line data into buffer:
          */
         buf = Malloc (n + 1);
+
+        if (read_rc && n == cbuf_used (cb)
+            && cbuf_peek_line (cb, buf, n + 1, 1) == n && _find_rc (buf)) {
+            Free ((void **)&buf);
+            break;
+        }
+
         if ((n = cbuf_read (cb, buf, n))) {
             if (n < 0) {
                 err ("%p: %S: Failed to read line from buffer: %m\n", th->host);
                 break;
             }
-            if (read_rc)
-                th->rc = _extract_rc (buf);
-            if (strlen (buf) > 0) {
-                /*
-                 *  We are careful to use a single call to write the line
-                 *   to the output stream to avoid interleaved lines of
-                 *   output.
-                 */
-                if (th->labels)
-                    outf ("%S: %s", th->host, buf);
-                else
-                    outf ("%s", buf);
-                fflush (NULL);
-            }
+            _write_line (buf, outf, th);
         }
         Free ((void **)&buf);
     }
 
 }
 
+/*
+ *  At EOF on stdout, take the remote exit status from the line held
+ *   back by _flush_lines() and write what remains of it.
+ */
+static void _flush_rc_line (cbuf_t cb, out_f outf, thd_t *th)
+{
+    char c;
+    char *buf;
+    int n;
+
+    if ((n = cbuf_peek_line (cb, &c, 1, 1)) <= 0)
+        return;
+
+    buf = Malloc (n + 1);
+    if (cbuf_read (cb, buf, n) > 0) {
+        th->rc = _extract_rc (buf);
+        _write_line (buf, outf, th);
+    }
+    Free ((void **)&buf);
+}
+
 static int _do_output (int fd, cbuf_t cb, out_f outf, bool read_rc, thd_t *t)
 {
     int rc;
@@ -621,9 +723,12 @@ static int _die_if_signalled (thd_t *th)
 
 static int _handle_rcmd_stdout (thd_t *th)
 {
-    int rc = _do_output (th->rcmd->fd, th->outbuf, (out_f) out, true, th);
+    int rc = _do_output (th->rcmd->fd, th->outbuf, (out_f) out,
+                         th->read_rc, th);
 
     if (rc <= 0) {
+        if (th->read_rc)
+            _flush_rc_line (th->outbuf, (out_f) out, th);
         close (th->rcmd->fd);
         th->rcmd->fd = -1;
     }
@@ -657,19 +762,17 @@ static void *_rsh_thread(void *args)
 
     a->start = time(NULL);
 
-#if	HAVE_MTSAFE_GETHOSTBYNAME
-    if (a->rcmd->opts->resolve_hosts)
-        _gethost(a->host, a->addr);
-#endif
     _xsignal (SIGPIPE, SIG_IGN);
 
     /* establish the connection */
-    dsh_mutex_lock(&thd_mutex);
-    a->state = DSH_RCMD;
-    dsh_mutex_unlock(&thd_mutex);
+    if (_gethost(a) == 0) {
+        dsh_mutex_lock(&thd_mutex);
+        a->state = DSH_RCMD;
+        dsh_mutex_unlock(&thd_mutex);
 
-    rcmd_connect (a->rcmd, a->host, a->addr, a->luser, a->ruser,
-                  a->cmd, a->nodeid, a->dsh_sopt);
+        rcmd_connect (a->rcmd, a->host, (char *) &a->addr, a->luser,
+                      a->ruser, a->cmd, a->nodeid, a->dsh_sopt);
+    }
 
     if (a->rcmd->fd == -1) {
         result = DSH_FAILED;    /* connect failed */
@@ -870,10 +973,17 @@ static int _thd_init (thd_t *th, opt_t *opt, List pcp_infiles, int i)
     th->cmd = opt->cmd;
     th->dsh_sopt = opt->separate_stderr;  /* dsh-specific */
     th->rc = 0;
+    th->read_rc = false;
     th->pcp_infiles = pcp_infiles;        /* pcp-specific */
     th->pcp_outfile = opt->outfile_name;
     th->pcp_popt = opt->preserve;
     th->pcp_ropt = opt->recursive;
+    th->pcp_copt = opt->compress;
+    th->pcp_sopt = opt->sync;
+    th->pcp_Wopt = opt->atomic;
+    th->pcp_Dopt = opt->direct;
+    th->pcp_oopt = opt->resume;
+    th->pcp_nopt = (opt->retries > 0);
     th->pcp_yopt = opt->target_is_directory;
     th->pcp_Popt = opt->reverse_copy;
     th->pcp_Zopt = opt->pcp_client;
@@ -888,12 +998,14 @@ static int _thd_init (thd_t *th, opt_t *opt, List pcp_infiles, int i)
         return (-1);
     }
 
-#if	!HAVE_MTSAFE_GETHOSTBYNAME
-    /* if MT-safe, do it in parallel in rsh/rcp threads */
-    /* gethostbyname_r is not very portable so skip it */
+    if (rc_cmd && !th->rcmd->opts->exit_status) {
+        th->cmd = rc_cmd;
+        th->read_rc = true;
+    }
+
+    /* start looking up the address in the background */
     if (th->rcmd->opts->resolve_hosts)
-        _gethost(th->host, th->addr);
-#endif
+        resolve_queue(th->host);
 
     return (0);
 
@@ -993,6 +1105,90 @@ _signals_thread (void *arg)
     return NULL;
 }
 
+/*
+ * Start a thread for each host in state DSH_NEW (at most 'fanout' active
+ * at once) and wait for all of them to terminate.
+ */
+static void _run_threads(opt_t * opt, int rshcount)
+{
+    int i, rv;
+
+    for (i = 0; i < rshcount; i++) {
+
+        /* wait until "room" for another thread */
+        dsh_mutex_lock(&threadcount_mutex);
+
+        if (opt->fanout == threadcount)
+            pthread_cond_wait(&threadcount_cond, &threadcount_mutex);
+
+        /*
+         *  Advance past any canceled (or, on retry, completed) threads
+         */
+        while ((i < rshcount) && (t[i].state != DSH_NEW))
+            ++i;
+        /*
+         *  Abort if no more threads
+         */
+        if (i >= rshcount) {
+            dsh_mutex_unlock(&threadcount_mutex);
+            break;
+        }
+
+        /* create thread */
+        _dsh_attr_init (&t[i].attr, DSH_THREAD_STACKSIZE);
+#ifdef 	PTHREAD_SCOPE_SYSTEM
+        /* we want 1:1 threads if there is a choice */
+        pthread_attr_setscope(&t[i].attr, PTHREAD_SCOPE_SYSTEM);
+#endif
+        rv = pthread_create(&t[i].thread, &t[i].attr,
+                            pdsh_personality() == DSH
+                            ? _rsh_thread : _rcp_thread, (void *) &t[i]);
+        if (rv != 0) {
+            if (opt->kill_on_fail)
+                _fwd_signal(SIGTERM);
+            errx("%p: pthread_create %S: %S\n", t[i].host, strerror(rv));
+        }
+        threadcount++;
+
+        dsh_mutex_unlock(&threadcount_mutex);
+    }
+
+    /* wait for termination of remaining threads */
+    dsh_mutex_lock(&threadcount_mutex);
+    while (threadcount > 0)
+        pthread_cond_wait(&threadcount_cond, &threadcount_mutex);
+    dsh_mutex_unlock(&threadcount_mutex);
+}
+
+/*
+ * Prepare hosts that failed to be run again.
+ * Returns the number of hosts to be retried.
+ */
+static int _reset_failed_threads(List pcp_infiles)
+{
+    int i, n = 0;
+
+    dsh_mutex_lock(&thd_mutex);
+    for (i = 0; t[i].host != NULL; i++) {
+        if (t[i].state != DSH_FAILED)
+            continue;
+        if (!(t[i].rcmd = rcmd_create(t[i].host)))
+            continue;
+        t[i].state = DSH_NEW;
+        t[i].rc = 0;
+        t[i].start = t[i].connect = t[i].finish = 0;
+        n++;
+    }
+    dsh_mutex_unlock(&thd_mutex);
+
+    /*  Data shared between connections was sized for the first run
+     */
+    if (n > 0 && pcp_infiles)
+        pcp_reset_files(pcp_infiles, n);
+
+    return n;
+}
+
 /*
  * Run command on a list of hosts, keeping 'fanout' number of connections
  * active concurrently.
@@ -1000,7 +1196,7 @@ _signals_thread (void *arg)
 int dsh(opt_t * opt)
 {
     int i, rc = 0;
-    int rv, rshcount;
+    int rshcount;
     pthread_t thread_wdog;
     pthread_t thread_sig;
     pthread_attr_t attr_wdog;
@@ -1043,13 +1239,13 @@ int dsh(opt_t * opt)
     if (opt->kill_on_fail || opt->ret_remote_rc)
         opt->getstat = ";echo " RC_MAGIC "$?";
 
-    /* append echo $? to command */
+    /*
+     * Build command with echo $? appended. This is only used for hosts
+     *  whose rcmd module can't return the remote exit status itself.
+     */
     if (pdsh_personality() == DSH && opt->getstat) {
-        char *cmd = Strdup(opt->cmd);
-
-        xstrcat(&cmd, opt->getstat);
-        Free((void **) &opt->cmd);
-        opt->cmd = cmd;
+        rc_cmd = Strdup(opt->cmd);
+        xstrcat(&rc_cmd, opt->getstat);
     }
 
     /* build PCP command */
@@ -1061,12 +1257,23 @@ int dsh(opt_t * opt)
             err("%p: unable to build file copy list\n");
             exit(1);
         }
+        pcp_reset_files(pcp_infiles, rshcount);
 
         xstrcat(&cmd, opt->remote_program_path);
         if (opt->recursive)
             xstrcat(&cmd, " -r");
         if (opt->preserve)
             xstrcat(&cmd, " -p");
+        if (opt->compress)
+            xstrcat(&cmd, " -c");
+        if (opt->sync)
+            xstrcat(&cmd, " -s");
+        if (opt->atomic)
+            xstrcat(&cmd, " -W");
+        if (opt->direct)
+            xstrcat(&cmd, " -D");
+        if (opt->resume)
+            xstrcat(&cmd, " -o");
         if (list_count(pcp_infiles) > 1)     /* outfile must be directory */
             xstrcat(&cmd, " -y");
         xstrcat(&cmd, " -z ");               /* invoke pcp server */
@@ -1086,6 +1293,12 @@ int dsh(opt_t * opt)
             xstrcat(&cmd, " -r");
         if (opt->preserve)
             xstrcat(&cmd, " -p");
+        if (opt->compress)
+            xstrcat(&cmd, " -c");
+        if (opt->sync)
+            xstrcat(&cmd, " -s");
+        if (opt->resume)
+            xstrcat(&cmd, " -o");
         xstrcat(&cmd, " -Z ");               /* invoke pcp client */
 
         i = list_iterator_create(opt->infile_names);
@@ -1103,6 +1316,11 @@ int dsh(opt_t * opt)
     if (opt->debug)
         debug = 1;
 
+    /* look up rsh-style hosts in the address cache file if one is set */
+    if (opt->addr_cache && resolve_cache_open(opt->addr_cache) < 0)
+        err("%p: not using address cache %s, resolving hosts directly\n",
+            opt->addr_cache);
+
     /* build thread array--terminated with t[i].host == NULL */
     t = (thd_t *) Malloc(sizeof(thd_t) * (rshcount + 1));
 
@@ -1141,59 +1359,26 @@ int dsh(opt_t * opt)
 
     /* start the watchdog thread */
     _dsh_attr_init (&attr_wdog, DSH_THREAD_STACKSIZE);
-    rv = pthread_create(&thread_wdog, &attr_wdog, _wdog, (void *) t);
+    pthread_create(&thread_wdog, &attr_wdog, _wdog, (void *) t);
 
     /* start the signals thread */
     _dsh_attr_init (&attr_sig, DSH_THREAD_STACKSIZE);
-    rv = pthread_create(&thread_sig, &attr_sig, _signals_thread, (void *) t);
+    pthread_create(&thread_sig, &attr_sig, _signals_thread, (void *) t);
 
     /* start all the other threads (at most 'fanout' active at once) */
-    for (i = 0; i < rshcount; i++) {
+    _run_threads(opt, rshcount);
 
-        /* wait until "room" for another thread */
-        dsh_mutex_lock(&threadcount_mutex);
+    /* run failed hosts again if requested */
+    for (i = 0; i < opt->retries; i++) {
+        int nfailed = _reset_failed_threads(pcp_infiles);
 
-        if (opt->fanout == threadcount)
-            pthread_cond_wait(&threadcount_cond, &threadcount_mutex);
-
-        /*
-         *  Advance past any canceled threads
-         */
-        while ((t[i].state == DSH_CANCELED) && (i < rshcount))
-            ++i;
-        /*
-         *  Abort if no more threads
-         */
-        if (i >= rshcount) {
-            dsh_mutex_unlock(&threadcount_mutex);
+        if (nfailed == 0)
             break;
-        }
-
-        /* create thread */
-        _dsh_attr_init (&t[i].attr, DSH_THREAD_STACKSIZE);
-#ifdef 	PTHREAD_SCOPE_SYSTEM
-        /* we want 1:1 threads if there is a choice */
-        pthread_attr_setscope(&t[i].attr, PTHREAD_SCOPE_SYSTEM);
-#endif
-        rv = pthread_create(&t[i].thread, &t[i].attr,
-                            pdsh_personality() == DSH
-                            ? _rsh_thread : _rcp_thread, (void *) &t[i]);
-        if (rv != 0) {
-            if (opt->kill_on_fail)
-                _fwd_signal(SIGTERM);
-            errx("%p: pthread_create %S: %S\n", t[i].host, strerror(rv));
-        }
-        threadcount++;
-
-        dsh_mutex_unlock(&threadcount_mutex);
+        err("%p: retrying %d failed host%s\n", nfailed,
+            nfailed > 1 ? "s" : "");
+        _run_threads(opt, rshcount);
     }
 
-    /* wait for termination of remaining threads */
-    dsh_mutex_lock(&threadcount_mutex);
-    while (threadcount > 0)
-        pthread_cond_wait(&threadcount_cond, &threadcount_mutex);
-    dsh_mutex_unlock(&threadcount_mutex);
-
     if (debug)
         _dump_debug_stats(rshcount);
 
@@ -1224,6 +1409,7 @@ int dsh(opt_t * opt)
     }
 
     Free((void **) &t);         /* cleanup */
+    Free((void **) &rc_cmd);
 
     return rc;
 }
@@ -35,6 +35,8 @@
 #include <pthread.h>
 #endif
 
+#include <sys/socket.h>          /* struct sockaddr_storage */
+
 #include "src/common/macros.h"
 #include "src/common/list.h"
 #include "src/pdsh/opt.h"
@@ -74,12 +76,19 @@ typedef struct thd {
     char *pcp_outfile;          /* name of output file/dir */
     bool pcp_popt;              /* preserve mtime/mode */
     bool pcp_ropt;              /* recursive */
+    bool pcp_copt;              /* compress file data */
+    bool pcp_sopt;              /* skip unchanged files */
+    bool pcp_Wopt;              /* write files atomically */
+    bool pcp_Dopt;              /* write files with direct I/O */
+    bool pcp_oopt;              /* resume partial copies */
+    bool pcp_nopt;              /* retry failed hosts */
     bool pcp_yopt;              /* target is directory */
     bool pcp_Popt;              /* reverse copy */
     bool pcp_Zopt;              /* pcp client */
     char *pcp_progname;         /* program name */
     char *outfile_name;         /* outfile name */
     int rc;                     /* remote return code (-S) */
+    bool read_rc;               /* rc is echoed at end of stdout */
     int nodeid;                 /* node index */
     int nnodes;                 /* number of nodes in job */
 
@@ -89,7 +98,7 @@ typedef struct thd {
     cbuf_t errbuf;              /* stderr buffer  */
 
     bool labels;                /* display host: labels */
-    char addr[IP_ADDR_LEN];     /* IP address */
+    struct sockaddr_storage addr;  /* IP address (resolve_hosts only) */
 } thd_t;
 
 int dsh(opt_t *);
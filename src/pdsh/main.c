@@ -57,12 +57,18 @@
 #include "pcp_client.h"
 #include "pcp_server.h"
 #include "privsep.h"
+#include "agent.h"
 
 extern const char *pdsh_module_dir;
 
 static void _interactive_dsh(opt_t *);
 static int _pcp_remote_client (opt_t *);
 static int _pcp_remote_server (opt_t *);
+static int _pdsh (opt_t *, int, char **);
+static int _agent_run (int, char **);
+
+/* misc modules chosen when the agent was started */
+static char *agent_misc_modules = NULL;
 
 int main(int argc, char *argv[])
 {
@@ -101,6 +107,16 @@ int main(int argc, char *argv[])
      */
     opt_args_early(&opt, argc, argv);
 
+    /*
+     *  Let a running pdsh agent do the work if there is one
+     */
+    if (!opt.agent_socket && (retval = agent_submit(argc, argv)) >= 0) {
+        privsep_fini();
+        opt_free(&opt);
+        err_cleanup();
+        return retval;
+    }
+
     /*
      *  Load static or dynamic pdsh modules
      */
@@ -116,39 +132,76 @@ int main(int argc, char *argv[])
     if (mod_load_modules(m, &opt) < 0)
         errx("%p: Couldn't load any pdsh modules\n");
 
+    if (opt.agent_socket) {
+        agent_misc_modules = opt.misc_modules;
+        retval = agent_serve(opt.agent_socket, _agent_run);
+    }
+    else
+        retval = _pdsh(&opt, argc, argv);
+
+    mod_exit();
+
+    /*
+     * Clean up.
+     */
+    privsep_fini();
+    opt_free(&opt);             /* free heap storage in opt struct */
+    err_cleanup();
+
+    return retval;
+}
+
+static int _pdsh(opt_t *opt, int argc, char *argv[])
+{
+    int retval = 0;
+
     /*
      * Handle options.
      */
-    opt_args(&opt, argc, argv); /* override with command line           */
+    opt_args(opt, argc, argv);  /* override with command line           */
 
-    if (opt_verify(&opt)) {     /* verify options, print errors         */
+    if (opt_verify(opt)) {      /* verify options, print errors         */
         /*
          * Do the work.
          */
-        if (opt.info_only)      /* display info only */
-            opt_list(&opt);
-        else if (pdsh_personality() == PCP && opt.pcp_server)
-            retval = (_pcp_remote_server (&opt) < 0);
-        else if (pdsh_personality() == PCP && opt.pcp_client)
-            retval = (_pcp_remote_client (&opt) < 0);
-        else if (pdsh_personality() == PCP || opt.cmd != NULL)
-            retval = dsh(&opt); /* single dsh/pcp command */
+        if (opt->info_only)     /* display info only */
+            opt_list(opt);
+        else if (pdsh_personality() == PCP && opt->pcp_server)
+            retval = (_pcp_remote_server (opt) < 0);
+        else if (pdsh_personality() == PCP && opt->pcp_client)
+            retval = (_pcp_remote_client (opt) < 0);
+        else if (pdsh_personality() == PCP || opt->cmd != NULL)
+            retval = dsh(opt);  /* single dsh/pcp command */
         else                    /* prompt loop */
-            _interactive_dsh(&opt);
+            _interactive_dsh(opt);
     } else {
         retval = 1;
     }
 
-    mod_exit();
+    return retval;
+}
 
-    /*
-     * Clean up.
-     */
-    privsep_fini();
-    opt_free(&opt);             /* free heap storage in opt struct */
-    err_cleanup();
+/*
+ *  Run a request submitted to the agent. Called in a child of the
+ *   agent, with modules already loaded and initialized.
+ */
+static int _agent_run(int argc, char *argv[])
+{
+    extern int optind;
+    opt_t opt;
 
-    return retval;
+    optind = 1;
+    opt_default(&opt, argv[0]);
+    opt_env(&opt);
+    opt_args_early(&opt, argc, argv);
+
+    if ((opt.misc_modules || agent_misc_modules)
+        && (!opt.misc_modules || !agent_misc_modules
+            || strcmp(opt.misc_modules, agent_misc_modules) != 0))
+        err("%p: agent: ignoring -M and PDSH_MISC_MODULES, "
+            "modules were chosen when the agent started\n");
+
+    return _pdsh(&opt, argc, argv);
 }
 
 #if	HAVE_READLINE
@@ -411,6 +464,11 @@ static int _pcp_remote_server (opt_t *opt)
     svr->outfd =         STDOUT_FILENO;
     svr->preserve =      opt->preserve;
     svr->target_is_dir = opt->target_is_directory;
+    svr->compress =      opt->compress;
+    svr->sync =          opt->sync;
+    svr->atomic =        opt->atomic;
+    svr->direct =        opt->direct;
+    svr->resume =        opt->resume;
     svr->outfile =       opt->outfile_name;
 
     return (pcp_server (svr));
@@ -424,9 +482,13 @@ static int _pcp_remote_client (opt_t *opt)
     pcp->outfd = STDOUT_FILENO;
 
     pcp->infiles = pcp_expand_dirs (opt->infile_names);
+    pcp_reset_files (pcp->infiles, 1);
 
     pcp->host =       opt->pcp_client_host;
     pcp->preserve =   opt->preserve;
+    pcp->compress =   opt->compress;
+    pcp->sync =       opt->sync;
+    pcp->resume =     opt->resume;
     pcp->pcp_client = opt->pcp_client;
 
     return (pcp_client (pcp));
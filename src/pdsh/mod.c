@@ -33,6 +33,7 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <assert.h>
@@ -51,6 +52,7 @@
 #include "src/common/list.h"
 #include "src/common/split.h"
 #include "mod.h"
+#include "wcollcache.h"
 
 /*
  * pdsh/322: Workaround apparent bug in glibc 2.2.4 which
@@ -77,6 +79,7 @@ struct module_components {
     char *filename;
 
     int priority;
+    int ops_version;        /* PDSH_MODULE_OPS_VERSION module was built with */
     int initialized;
 
     struct pdsh_module *pmod;
@@ -167,6 +170,60 @@ _mod_postop(mod_t mod, opt_t *pdsh_opts)
 }
 
 
+/*
+ *  Return the wcoll_key routine of [mod], or NULL if it has none or
+ *   was built before wcoll_key was added to its operations structure.
+ */
+static ModWcollKeyF
+_mod_wcoll_key_f(mod_t mod)
+{
+    struct pdsh_module_operations *ops = mod->pmod->mod_ops;
+
+    if (!ops || !ops->read_wcoll || mod->ops_version < 1)
+        return (NULL);
+    return (ops->wcoll_key);
+}
+
+/*
+ *  Return the wcoll cache key for module [mod], or NULL if the module
+ *   does not want its result cached. The wcoll as it stands before the
+ *   module runs is part of the key, since modules may filter or extend
+ *   it, so a cache hit replaces opt->wcoll with the stored result.
+ */
+static char *
+_mod_wcoll_key(mod_t mod, opt_t *opt)
+{
+    ModWcollKeyF wcoll_key = _mod_wcoll_key_f(mod);
+    char *modkey;
+    char *key = NULL;
+
+    if (!wcoll_key || !(modkey = (*wcoll_key) (opt)))
+        return (NULL);
+
+    xstrcat(&key, mod->pmod->type);
+    xstrcat(&key, "/");
+    xstrcat(&key, mod->pmod->name);
+    xstrcat(&key, " ");
+    xstrcat(&key, modkey);
+    Free((void **) &modkey);
+
+    if (opt->wcoll && hostlist_count(opt->wcoll) > 0) {
+        size_t n = 4096;
+        char *s = Malloc(n);
+
+        while (hostlist_ranged_string(opt->wcoll, n - 1, s) < 0) {
+            n *= 2;
+            Realloc((void **) &s, n);
+        }
+        xstrcat(&key, " wcoll=");
+        xstrcat(&key, s);
+        Free((void **) &s);
+    }
+
+    return (key);
+}
+
+
 /*
  *  Like list_next (i), but skip over inactive modules
  */
@@ -183,6 +240,25 @@ static mod_t _mod_next_active (ListIterator i)
 }
 
 
+/*
+ *  Return milliseconds elapsed since [tv]
+ */
+static int _msec_since(struct timeval *tv)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return ((now.tv_sec - tv->tv_sec) * 1000
+            + (now.tv_usec - tv->tv_usec) / 1000);
+}
+
+static void _mod_debug_time(opt_t *opt, mod_t mod, const char *op, int msec)
+{
+    if (opt->debug)
+        err("%p: %s/%s: %s took %d ms\n", mod->pmod->type,
+            mod->pmod->name, op, msec);
+}
+
 /*
  *  Call any "read wcoll" functions exported by modules. The module
  *    is responsible for deciding when to generate a new wcoll,
@@ -210,15 +286,57 @@ mod_read_wcoll(opt_t *opt)
 
     while ((mod = _mod_next_active (module_itr))) {
         hostlist_t hl = NULL;
+        char *key = NULL;
+        int lockfd = -1;
+        struct timeval tv;
+
+        if (opt->wcoll_cache_ttl > 0)
+            key = _mod_wcoll_key(mod, opt);
+
+        if (key) {
+            const char *dir = opt->wcoll_cache_dir;
+            int ttl = opt->wcoll_cache_ttl;
+
+            /*
+             *  On a miss, wait for any other pdsh refreshing the same
+             *   entry and check again, so that only one of them queries
+             *   the scheduler.
+             */
+            if (!(hl = wcoll_cache_get(dir, key, ttl))) {
+                lockfd = wcoll_cache_lock(dir, key);
+                hl = wcoll_cache_get(dir, key, ttl);
+            }
+
+            if (hl) {
+                if (opt->wcoll)
+                    hostlist_destroy(opt->wcoll);
+                opt->wcoll = hl;
+                wcoll_cache_unlock(dir, key, lockfd);
+                Free((void **) &key);
+                continue;
+            }
+        }
 
-        if (!(hl = _mod_read_wcoll(mod, opt)))
-            continue;
+        gettimeofday(&tv, NULL);
+        hl = _mod_read_wcoll(mod, opt);
+        if (mod->pmod->mod_ops && mod->pmod->mod_ops->read_wcoll)
+            _mod_debug_time(opt, mod, "read_wcoll", _msec_since(&tv));
+
+        if (hl) {
+            if (opt->wcoll != NULL) {
+                hostlist_push_list(opt->wcoll, hl);
+                hostlist_destroy(hl);
+            } else
+                opt->wcoll = hl;
+        }
 
-        if (opt->wcoll != NULL) {
-            hostlist_push_list(opt->wcoll, hl);
-            hostlist_destroy(hl);
-        } else
-            opt->wcoll = hl;
+        if (key) {
+            if (opt->wcoll && hostlist_count(opt->wcoll) > 0)
+                wcoll_cache_put(opt->wcoll_cache_dir, key, opt->wcoll,
+                                opt->wcoll_cache_ttl);
+            wcoll_cache_unlock(opt->wcoll_cache_dir, key, lockfd);
+            Free((void **) &key);
+        }
     }
 
     list_iterator_destroy(module_itr);
@@ -241,8 +359,14 @@ mod_postop(opt_t *pdsh_opts)
         return 1;
     }
 
-    while ((mod = _mod_next_active (module_itr)))
+    while ((mod = _mod_next_active (module_itr))) {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
         errors += _mod_postop(mod, pdsh_opts);
+        if (mod->pmod->mod_ops && mod->pmod->mod_ops->postop)
+            _mod_debug_time(pdsh_opts, mod, "postop", _msec_since(&tv));
+    }
 
     list_iterator_destroy(module_itr);
 
@@ -260,6 +384,7 @@ mod_create(void)
     mod->filename = NULL;
 
     mod->priority = DEFAULT_MODULE_PRIORITY;
+    mod->ops_version = 0;
     mod->initialized = 0;
     assert(mod->magic = MOD_MAGIC);
     return mod;
@@ -765,6 +890,7 @@ _mod_load_static(int idx)
 
     mod->pmod = static_mods[idx];
     mod->priority = *priority[idx];
+    mod->ops_version = PDSH_MODULE_OPS_VERSION;
     mod->filename = Strdup("static");
 
     _mod_register(mod, static_mod_names[idx]);
@@ -799,6 +925,7 @@ _mod_load_dynamic(const char *fq_path, opt_t *pdsh_opts)
 {
     mod_t mod = NULL;
     int *priority;
+    int *ops_version;
     assert(fq_path != NULL);
 
     mod = mod_create();
@@ -835,6 +962,9 @@ _mod_load_dynamic(const char *fq_path, opt_t *pdsh_opts)
     if ((priority = dlsym(mod->handle, "pdsh_module_priority")))
         mod->priority = *priority;
 
+    if ((ops_version = dlsym(mod->handle, "pdsh_module_ops_version")))
+        mod->ops_version = *ops_version;
+
     if (_mod_register(mod, mod->filename) < 0)
         goto fail;
 
@@ -85,6 +85,13 @@ int mod_process_opt(opt_t *pdsh_opts, int opt, char *arg);
  *  Traverses list of loaded modules, calling any exported "read_wcoll"
  *    routines. Appends any returned results onto opt->wcoll.
  *
+ *  If opt->wcoll_cache_ttl is set, the wcoll produced by modules that
+ *    export a "wcoll_key" routine is cached on disk and reused for
+ *    that many seconds instead of calling read_wcoll.
+ *
+ *  Time taken by each read_wcoll (and postop) is reported if
+ *    opt->debug is set.
+ *
  *  This routine should only be called from within pdsh/opt.c after
  *    option processing is complete, but before mod_postop().
  *
@@ -147,6 +154,7 @@ typedef int        (*ModInitF)      (void);
 typedef int        (*ModExitF)      (void);
 typedef hostlist_t (*ModReadWcollF) (opt_t *);
 typedef int        (*ModPostOpF)    (opt_t *);
+typedef char *     (*ModWcollKeyF)  (opt_t *);
 
 /*
  * Functions that may be exported by any rcmd module
@@ -173,6 +181,16 @@ RcmdF        mod_get_rcmd(mod_t mod);
 RcmdDestroyF mod_get_rcmd_destroy(mod_t mod);
 
 
+/*
+ *  Version of struct pdsh_module_operations. Fields after postop are
+ *   only used from modules exporting "int pdsh_module_ops_version" set
+ *   to at least the version that added them, so modules built against
+ *   an older mod.h, whose structure ends earlier, still load.
+ *
+ *   1: wcoll_key
+ */
+#define PDSH_MODULE_OPS_VERSION 1
+
 /*
  * Store all module operations of a module
  */
@@ -185,6 +203,12 @@ struct pdsh_module_operations {
                                    returned by a module will be used.      */
 
     ModPostOpF    postop;       /* Called after argv option processing     */
+
+    ModWcollKeyF  wcoll_key;    /* Version 1, optional. Returns a string
+                                   built with xstrcat() describing the
+                                   query that read_wcoll will make, so its
+                                   result can be cached, or NULL to bypass
+                                   the cache.                              */
 };
 
 /*
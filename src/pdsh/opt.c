@@ -57,6 +57,7 @@
 #include "wcoll.h"
 #include "mod.h"
 #include "rcmd.h"
+#include "wcollcache.h"
 
 /*
  *  Fallback maximum username length if sysconf(_SC_LOGIN_NAME_MAX) not
@@ -67,7 +68,8 @@
 #define OPT_USAGE_DSH "\
 Usage: pdsh [-options] command ...\n\
 -S                return largest of remote command return values\n\
--k                fail fast on connect failure or non-zero return code\n"
+-k                fail fast on connect failure or non-zero return code\n\
+-U path           run as a persistent agent listening on socket path\n"
 
 /* -s option only useful on AIX */
 #if	HAVE_MAGIC_RSHELL_CLEANUP
@@ -80,6 +82,12 @@ Usage: pdsh [-options] command ...\n\
 Usage: pdcp [-options] src [src2...] dest\n\
 -r                recursively copy files\n\
 -p                preserve modification time and modes\n\
+-c                compress file data in transit\n\
+-s                skip files that are unchanged on the target\n\
+-W                write files atomically via a temporary file\n\
+-D                write files with direct I/O where possible\n\
+-o                resume copying partially copied files\n\
+-n count          retry failed hosts up to count times\n\
 -e PATH           specify the path to pdcp on the remote machine\n"
 /* undocumented "-y"  target must be directory option */
 /* undocumented "-z"  run pdcp server option */
@@ -88,7 +96,13 @@ Usage: pdcp [-options] src [src2...] dest\n\
 #define OPT_USAGE_RPCP "\
 Usage: rpdcp [-options] src [src2...] dir\n\
 -r                recursively copy files\n\
--p                preserve modification time and modes\n"
+-p                preserve modification time and modes\n\
+-c                compress file data in transit\n\
+-s                skip files that are unchanged on the target\n\
+-W                write files atomically via a temporary file\n\
+-D                write files with direct I/O where possible\n\
+-o                resume copying partially copied files\n\
+-n count          retry failed hosts up to count times\n"
 /* undocumented "-y"  target must be directory option */
 /* undocumented "-z"  run pdcp server option */
 /* undocumented "-Z"  run pdcp client option */
@@ -98,6 +112,7 @@ Usage: rpdcp [-options] src [src2...] dir\n\
 -V                output version information and quit\n\
 -q                list the option settings and quit\n\
 -b                disable ^C status feature (batch mode)\n\
+-B                bypass the working collective cache\n\
 -d                enable extra debug information from ^C status\n\
 -l user           execute remote commands as user\n\
 -t seconds        set connect timeout (default is 10 sec)\n\
@@ -114,12 +129,12 @@ Usage: rpdcp [-options] src [src2...] dir\n\
 /* undocumented "-K" option -  keep domain name in output */
 
 #if	HAVE_MAGIC_RSHELL_CLEANUP
-#define DSH_ARGS	"sSk"
+#define DSH_ARGS	"sSkU:"
 #else
-#define DSH_ARGS    "Sk"
+#define DSH_ARGS    "SkU:"
 #endif
-#define PCP_ARGS	"pryzZe:"
-#define GEN_ARGS	"hLNKR:M:t:cqf:w:x:l:u:bI:dVT:Q"
+#define PCP_ARGS	"prcsWDon:yzZe:"
+#define GEN_ARGS	"hLNKR:M:t:qf:w:x:l:u:bBI:dVT:Q"
 
 
 /*
@@ -397,6 +412,13 @@ void opt_default(opt_t * opt, char *argv0)
      *  Resolve hostnames by default
      */
     opt->resolve_hosts = true;
+    opt->addr_cache = NULL;
+
+    /*
+     *  Working collective cache is disabled unless a TTL is set
+     */
+    opt->wcoll_cache_ttl = 0;
+    opt->wcoll_cache_dir = NULL;
 
     /*
      *  Do not kill all tasks on single failure by default
@@ -405,6 +427,7 @@ void opt_default(opt_t * opt, char *argv0)
 
     /* DSH specific */
     opt->dshpath = NULL;
+    opt->agent_socket = NULL;
     opt->getstat = NULL;
     opt->ret_remote_rc = false;
     opt->cmd = NULL;
@@ -427,6 +450,12 @@ void opt_default(opt_t * opt, char *argv0)
     opt->outfile_name = NULL;
     opt->recursive = false;
     opt->preserve = false;
+    opt->compress = false;
+    opt->sync = false;
+    opt->atomic = false;
+    opt->direct = false;
+    opt->resume = false;
+    opt->retries = 0;
     opt->pcp_server = false;
     opt->target_is_directory = false;
     opt->pcp_client = false;
@@ -476,6 +505,17 @@ void opt_env(opt_t * opt)
     if ((rhs = getenv("PDSH_MISC_MODULES")) != NULL)
         opt->misc_modules = Strdup(rhs);
 
+    if ((rhs = getenv("PDSH_ADDR_CACHE")) != NULL && *rhs != '\0')
+        opt->addr_cache = Strdup(rhs);
+
+    if ((rhs = getenv("PDSH_WCOLL_CACHE_TTL")) != NULL)
+        if (string_to_int (rhs, &opt->wcoll_cache_ttl) < 0)
+            errx ("%p: Invalid environment variable PDSH_WCOLL_CACHE_TTL=%s\n",
+                  rhs);
+
+    if ((rhs = getenv("PDSH_WCOLL_CACHE_DIR")) != NULL && *rhs != '\0')
+        opt->wcoll_cache_dir = Strdup(rhs);
+
     if ((rhs = getenv("DSHPATH")) != NULL) {
         struct passwd *pw = getpwnam(opt->luser);
         char *shell = "sh";
@@ -546,6 +586,11 @@ void opt_args_early (opt_t * opt, int argc, char *argv[])
                  */
                 debug = true;
                 break;
+            case 'U':              /* run as agent */
+                if (opt->agent_socket)
+                    Free ((void **) &opt->agent_socket);
+                opt->agent_socket = Strdup (optarg);
+                break;
         }
     }
 #ifdef __linux
@@ -603,6 +648,8 @@ void opt_args(opt_t * opt, int argc, char *argv[])
          *  The following options were handled in opt_args_early() :
          */
         case 'M':
+        case 'U':
+        case 'd':
             break;
 
         /*  Continue processing regular options...
@@ -617,6 +664,9 @@ void opt_args(opt_t * opt, int argc, char *argv[])
         case 'R':
             opt->rcmd_name = Strdup(optarg);
             break;
+        case 'B':              /* bypass wcoll cache */
+            opt->wcoll_cache_ttl = 0;
+            break;
         case 'S':              /* get remote command status */
             opt->ret_remote_rc = true;
             break;
@@ -636,12 +686,18 @@ void opt_args(opt_t * opt, int argc, char *argv[])
         case 'q':              /* display fanout and wcoll then quit */
             opt->info_only = true;
             break;
+        case 's':              /* rcp: skip unchanged files */
+            if (pdsh_personality() == PCP)
+                opt->sync = true;
 /* -s option only useful on AIX */
 #if	HAVE_MAGIC_RSHELL_CLEANUP
-        case 's':              /* split stderr and stdout */
-            opt->separate_stderr = true;
-            break;
+            else               /* split stderr and stdout */
+                opt->separate_stderr = true;
+#else
+            else
+                goto test_module_option;
 #endif
+            break;
         case 't':              /* set connect timeout */
             opt->connect_timeout = atoi(optarg);
             break;
@@ -666,6 +722,39 @@ void opt_args(opt_t * opt, int argc, char *argv[])
             else
                 goto test_module_option;
             break;
+        case 'c':              /* rcp: compress file data */
+            if (pdsh_personality() == PCP)
+                opt->compress = true;
+            else
+                goto test_module_option;
+            break;
+        case 'W':              /* rcp: write to temp file and rename */
+            if (pdsh_personality() == PCP)
+                opt->atomic = true;
+            else
+                goto test_module_option;
+            break;
+        case 'D':              /* rcp: write with O_DIRECT */
+            if (pdsh_personality() == PCP)
+                opt->direct = true;
+            else
+                goto test_module_option;
+            break;
+        case 'o':              /* rcp: resume partial copies */
+            if (pdsh_personality() == PCP)
+                opt->resume = true;
+            else
+                goto test_module_option;
+            break;
+        case 'n':              /* rcp: retry failed hosts */
+            if (pdsh_personality() == PCP) {
+                if (string_to_int (optarg, &opt->retries) < 0)
+                    errx ("%p: Invalid retry count `%s' passed to -n.\n",
+                          optarg);
+            }
+            else
+                goto test_module_option;
+            break;
         case 'e':
             if (pdsh_personality() == PCP) {
                 Free ((void **) &opt->remote_program_path);
@@ -765,6 +854,17 @@ void opt_args(opt_t * opt, int argc, char *argv[])
     if (opt->pcp_server)
         return;
 
+    /*
+     *  Disable the wcoll cache if there is no usable cache directory
+     */
+    if (opt->wcoll_cache_ttl > 0) {
+        if (opt->wcoll_cache_dir == NULL)
+            opt->wcoll_cache_dir = wcoll_cache_default_dir ();
+        if (opt->wcoll_cache_dir == NULL
+            || wcoll_cache_dir_check (opt->wcoll_cache_dir) < 0)
+            opt->wcoll_cache_ttl = 0;
+    }
+
     /*
      *  Give modules a chance to fill in wcoll if it hasn't been already:
      */
@@ -804,16 +904,26 @@ void opt_args(opt_t * opt, int argc, char *argv[])
 static void wcoll_expand (opt_t *opt)
 {
     hostlist_t hl = opt->wcoll;
+    hostlist_iterator_t i;
     char *hosts;
 
     /*
-     *  Create new hostlist for wcoll
+     *  Create new hostlist for wcoll. Iterate rather than shift hosts
+     *   off the old list, since hostlist_shift() is linear in the
+     *   number of ranges.
      */
     opt->wcoll = hostlist_create ("");
-    while ((hosts = hostlist_shift (hl))) {
-        hostlist_push (opt->wcoll, hosts);
+    i = hostlist_iterator_create (hl);
+    while ((hosts = hostlist_next (i))) {
+#if !WANT_RECKLESS_HOSTRANGE_EXPANSION
+        if (strchr (hosts, '[') == NULL)
+            hostlist_push_host (opt->wcoll, hosts);
+        else
+#endif
+            hostlist_push (opt->wcoll, hosts);
         free (hosts);
     }
+    hostlist_iterator_destroy (i);
 
     hostlist_destroy (hl);
 }
@@ -924,6 +1034,28 @@ bool opt_verify(opt_t * opt)
         }
     }
 
+    if (personality == PCP && opt->resume && opt->atomic) {
+        err("%p: resume (-o) cannot be used with atomic writes (-W)\n");
+        verified = false;
+    }
+
+    if (personality == PCP && opt->resume && opt->compress) {
+        err("%p: resume (-o) cannot be used with compression (-c)\n");
+        verified = false;
+    }
+
+    if (personality == PCP && opt->retries < 0) {
+        err("%p: retry count must be >= 0\n");
+        verified = false;
+    }
+
+#if	!HAVE_LIBZ
+    if (personality == PCP && opt->compress) {
+        err("%p: compression (-c) not supported: pdcp built without zlib\n");
+        verified = false;
+    }
+#endif
+
     /* PCP: server and client sanity check */
     if (personality == PCP && opt->pcp_server && opt->pcp_client) {
         err("%p: pcp server and pcp client cannot both be set\n");
@@ -1015,6 +1147,12 @@ void opt_list(opt_t * opt)
         out("Outfile			%s\n", STRORNULL(opt->outfile_name));
         out("Recursive		%s\n", BOOLSTR(opt->recursive));
         out("Preserve mod time/mode	%s\n", BOOLSTR(opt->preserve));
+        out("Compress data		%s\n", BOOLSTR(opt->compress));
+        out("Skip unchanged		%s\n", BOOLSTR(opt->sync));
+        out("Atomic write		%s\n", BOOLSTR(opt->atomic));
+        out("Direct I/O		%s\n", BOOLSTR(opt->direct));
+        out("Resume partial copies	%s\n", BOOLSTR(opt->resume));
+        out("Retry failed hosts	%d\n", opt->retries);
         if (opt->pcp_server) {
             out("pcp server         	%s\n", BOOLSTR(opt->pcp_server));
             out("target is directory	%s\n", BOOLSTR(opt->target_is_directory));
@@ -1030,6 +1168,8 @@ void opt_list(opt_t * opt)
         out("Local uid     		%d\n", opt->luid);
         out("Remote username		%s\n", opt->ruser);
         out("Rcmd type		%s\n", STRORNULL(opt->rcmd_name));
+        out("Address cache file	%s\n", STRORNULL(opt->addr_cache));
+        out("Wcoll cache TTL (secs)	%d\n", opt->wcoll_cache_ttl);
         out("one ^C will kill pdsh   %s\n", BOOLSTR(opt->sigint_terminates));
         out("Connect timeout (secs)	%d\n", opt->connect_timeout);
         out("Command timeout (secs)	%d\n", opt->command_timeout);
@@ -1071,6 +1211,12 @@ void opt_free(opt_t * opt)
         Free((void **) &pdsh_options);
     if (opt->dshpath)
         Free((void **) &opt->dshpath);
+    if (opt->agent_socket)
+        Free((void **) &opt->agent_socket);
+    if (opt->addr_cache)
+        Free((void **) &opt->addr_cache);
+    if (opt->wcoll_cache_dir)
+        Free((void **) &opt->wcoll_cache_dir);
     if (opt->local_program_path)
         Free((void **) &opt->local_program_path);
     if (opt->remote_program_path)
@@ -1433,18 +1579,23 @@ static void wcoll_apply_regex (opt_t *opt, List regexs)
 static void wcoll_apply_excluded (opt_t *opt, List excludes)
 {
     ListIterator i;
+    hostlist_t hl;
     char *arg;
 
     if (!opt->wcoll || !excludes)
         return;
 
     /*
-     *  filter explicitly excluded hosts:
+     *  filter explicitly excluded hosts, all in one pass over wcoll:
      */
+    hl = hostlist_create (NULL);
     i = list_iterator_create (excludes);
     while ((arg = list_next (i)))
-        hostlist_delete (opt->wcoll, arg);
+        hostlist_push (hl, arg);
     list_iterator_destroy (i);
+
+    hostlist_delete_list (opt->wcoll, hl);
+    hostlist_destroy (hl);
 }
 
 /*
@@ -68,6 +68,9 @@ typedef struct {
     char *rcmd_name;            /* -R name   */
     char *misc_modules;         /* Explicit list of misc modules to load */
     bool resolve_hosts;         /* Set optionally by rcmd modules */
+    char *addr_cache;           /* host address cache (PDSH_ADDR_CACHE) */
+    int wcoll_cache_ttl;        /* PDSH_WCOLL_CACHE_TTL, 0 if disabled (-B) */
+    char *wcoll_cache_dir;      /* PDSH_WCOLL_CACHE_DIR */
 
     bool kill_on_fail;
 
@@ -76,6 +79,7 @@ typedef struct {
     bool stdin_unavailable;     /* set if stdin used for WCOLL */
     char *cmd;
     char *dshpath;              /* optional PATH command prepended to cmd */
+    char *agent_socket;         /* -U: serve requests on this socket */
     char *getstat;              /* optional echo $? appended to cmd */
     bool ret_remote_rc;         /* -S: return largest remote return val */
     bool labels;                /* display host: before output */
@@ -83,6 +87,12 @@ typedef struct {
     /* PCP-specific options */
     bool preserve;              /* -p */
     bool recursive;             /* -r */
+    bool compress;              /* -c */
+    bool sync;                  /* -s */
+    bool atomic;                /* -W */
+    bool direct;                /* -D */
+    bool resume;                /* -o */
+    int retries;                /* -n */
     List infile_names;          /* -I or pcp source spec */
     char *outfile_name;         /* pcp dest spec */
     bool pcp_server;            /* undocument pdcp server option */
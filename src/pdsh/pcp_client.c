@@ -76,6 +76,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include "src/common/err.h"
 #include "src/common/fd.h"
@@ -83,6 +87,7 @@
 #include "src/common/xstring.h"
 #include "src/common/err.h"
 #include "src/common/xmalloc.h"
+#include "src/common/hash64.h"
 #include "pcp_client.h"
 #include "wcoll.h"
 
@@ -90,6 +95,41 @@
 #define MAXPATHNAMELEN MAXPATHLEN
 #endif
 
+/*
+ * Files larger than this are never compressed, since the compressed
+ * copy of a file is held in memory while it is being sent.
+ */
+#define PCP_ZMAXSIZE	(1024 * 1024 * 1024)
+#define PCP_ZBUFSIZ	(64 * 1024)
+
+/*
+ * Size of the buffer used to read file data, and the limits on how far
+ * ahead of the file being sent the kernel is asked to read files into
+ * the page cache.
+ */
+#define PCP_BUFSIZ	(256 * 1024)
+#define PCP_READAHEAD_FILES	64
+#define PCP_READAHEAD_BYTES	(32 * 1024 * 1024)
+
+/*
+ * Read-ahead state of one connection.  len[] holds the number of bytes
+ * prefetched for each file between the file being sent and `next'.
+ */
+struct pcp_readahead {
+    ListIterator itr;           /* iterator positioned at file `next' */
+    int next;                   /* index of next file to prefetch     */
+    off_t bytes;                /* bytes prefetched and not yet sent  */
+    off_t len[PCP_READAHEAD_FILES];
+};
+
+/*
+ * Mutex and condition variable protecting the data shared between
+ * connections (zstate, zbuf, zrefs, hstate, hash, prefetched, bstate,
+ * bhash, nblocks) of all pcp_filename structures.
+ */
+static pthread_mutex_t pf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_cond = PTHREAD_COND_INITIALIZER;
+
 
 static void _rexpand_dir(List list, char *name)
 {
@@ -202,10 +242,11 @@ static int _pcp_write(int fd, char *buf, int size)
  *	host (IN)	name of remote host for error messages
  *	RETURN		-1 on failure, 0 on success.
  */
-static int _pcp_send_file_data(int outfd, char *filename, char *host)
+static int _pcp_send_file_data(int outfd, char *filename, off_t offset,
+                               off_t size, char *host)
 {
-    int filefd, inbytes, total = 0;
-    char tmpbuf[BUFSIZ];
+    int filefd, inbytes, bufsize, rc = -1;
+    char *tmpbuf;
 
     filefd = open(filename, O_RDONLY);
     /* checked ahead of time - shouldn't happen */
@@ -213,22 +254,217 @@ static int _pcp_send_file_data(int outfd, char *filename, char *host)
         err("%S: _pcp_send_file_data: open %s: %m\n", host, filename);
         return -1;
     }
+    if (offset > 0 && lseek(filefd, offset, SEEK_SET) < 0) {
+        err("%S: _pcp_send_file_data: lseek %s: %m\n", host, filename);
+        close(filefd);
+        return -1;
+    }
+#if HAVE_POSIX_FADVISE
+    posix_fadvise(filefd, offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /*  Don't allocate more than needed to read small files in one go
+     *   (with room to see EOF), since this is done for every file.
+     */
+    size -= offset;
+    bufsize = size < PCP_BUFSIZ ? size + 1 : PCP_BUFSIZ;
+    tmpbuf = Malloc(bufsize);
+
     do {
-        inbytes = read(filefd, tmpbuf, BUFSIZ);
+        inbytes = read(filefd, tmpbuf, bufsize);
         if (inbytes < 0) {
             err("%S: _pcp_send_file_data: read %s: %m\n", host, filename);
-            return -1;
+            goto out;
         }
         if (inbytes > 0) {
-            total += inbytes;
             if (_pcp_write(outfd, tmpbuf, inbytes) < 0) {
                 err("%S: _pcp_send_file_data: write: %m\n", host);
-                return -1;
+                goto out;
             }
         }
     } while (inbytes > 0);      /* until EOF */
+    rc = 0;
+  out:
+    Free((void **) &tmpbuf);
     close(filefd);
-    return 0;
+    return rc;
+}
+
+/*
+ * Ask the kernel to start reading the first `max' bytes of a regular
+ * file into the page cache, unless another connection already has.
+ *	pf (IN/OUT)	file to prefetch
+ *	max (IN)	maximum number of bytes to prefetch
+ *	RETURN		number of bytes prefetched
+ */
+static off_t _pcp_prefetch(struct pcp_filename *pf, off_t max)
+{
+    off_t len = 0;
+#if HAVE_POSIX_FADVISE
+    struct stat sb;
+    int fd;
+
+    pthread_mutex_lock(&pf_mutex);
+    if (pf->prefetched) {
+        pthread_mutex_unlock(&pf_mutex);
+        return 0;
+    }
+    pf->prefetched = 1;
+    pthread_mutex_unlock(&pf_mutex);
+
+    if (strcmp(pf->filename, EXIT_SUBDIR_FILENAME) == 0
+        || stat(pf->filename, &sb) < 0 || !S_ISREG(sb.st_mode)
+        || sb.st_size == 0)
+        return 0;
+    if ((fd = open(pf->filename, O_RDONLY)) < 0)
+        return 0;
+    len = sb.st_size < max ? sb.st_size : max;
+    if (posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED) != 0)
+        len = 0;
+    close(fd);
+#endif
+    return len;
+}
+
+/*
+ * Keep the page cache filled ahead of the file about to be sent, so
+ * that reading small files does not stall the connection, bounded by
+ * PCP_READAHEAD_FILES and PCP_READAHEAD_BYTES.
+ *	ra (IN/OUT)	read-ahead state of this connection
+ *	n (IN)		index of the file about to be sent
+ *	skip (IN)	files not to be sent, or NULL
+ */
+static void _pcp_readahead(struct pcp_readahead *ra, int n, char *skip)
+{
+    struct pcp_filename *pf;
+
+    while (ra->next < n + PCP_READAHEAD_FILES
+           && ra->bytes < PCP_READAHEAD_BYTES
+           && (pf = list_next(ra->itr))) {
+        off_t len = 0;
+
+        if (!skip || !skip[ra->next])
+            len = _pcp_prefetch(pf, PCP_READAHEAD_BYTES - ra->bytes);
+        ra->len[ra->next++ % PCP_READAHEAD_FILES] = len;
+        ra->bytes += len;
+    }
+}
+
+#if HAVE_LIBZ
+/*
+ * Compress the contents of a file into pf->zbuf.  Compression is
+ * abandoned as soon as the output would not be smaller than the file.
+ *	pf (IN/OUT)	file to compress
+ *	size (IN)	size of file when last stat'd
+ *	RETURN		PCP_DONE if pf->zbuf is valid, else PCP_FAILED
+ */
+static pcp_state_t _pcp_deflate_file(struct pcp_filename *pf, off_t size)
+{
+    z_stream zs;
+    char *inbuf = NULL;
+    int filefd, inbytes, flush, rc;
+
+    if (size == 0 || size > PCP_ZMAXSIZE)
+        return PCP_FAILED;
+
+    /* errors are reported when the file is sent uncompressed */
+    if ((filefd = open(pf->filename, O_RDONLY)) < 0)
+        return PCP_FAILED;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, Z_BEST_SPEED) != Z_OK) {
+        close(filefd);
+        return PCP_FAILED;
+    }
+
+    if (!(inbuf = malloc(PCP_ZBUFSIZ)) || !(pf->zbuf = malloc(size)))
+        goto raw;
+
+    pf->zsize = 0;
+    zs.next_out = (Bytef *) pf->zbuf;
+    zs.avail_out = size;
+    do {
+        if ((inbytes = read(filefd, inbuf, PCP_ZBUFSIZ)) < 0)
+            goto raw;
+        pf->zsize += inbytes;
+        flush = (inbytes == 0) ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = (Bytef *) inbuf;
+        zs.avail_in = inbytes;
+        rc = deflate(&zs, flush);
+        if (rc == Z_STREAM_ERROR || zs.avail_in > 0)
+            goto raw;           /* error or output buffer full */
+    } while (flush != Z_FINISH);
+
+    if (rc != Z_STREAM_END)
+        goto raw;
+
+    pf->zlen = size - zs.avail_out;
+    deflateEnd(&zs);
+    free(inbuf);
+    close(filefd);
+    return PCP_DONE;
+
+  raw:
+    deflateEnd(&zs);
+    if (inbuf)
+        free(inbuf);
+    if (pf->zbuf)
+        free(pf->zbuf);
+    pf->zbuf = NULL;
+    close(filefd);
+    return PCP_FAILED;
+}
+#endif /* HAVE_LIBZ */
+
+/*
+ * Get the compressed data for a file, compressing it if this is the
+ * first connection to send it.  Other connections wait for the result.
+ * pf->zbuf stays valid until this connection calls _pcp_zdata_put().
+ *	pcp (IN)	client connection
+ *	pf (IN/OUT)	file to be sent
+ *	size (IN)	size of file when last stat'd
+ *	RETURN		1 if pf->zbuf may be sent, 0 if file must be sent raw
+ */
+static int _pcp_zdata_get(struct pcp_client *pcp, struct pcp_filename *pf,
+                          off_t size)
+{
+    pcp_state_t state = PCP_FAILED;
+
+    if (!pcp->compress)
+        return 0;
+
+    pthread_mutex_lock(&pf_mutex);
+    while (pf->zstate == PCP_BUSY)
+        pthread_cond_wait(&pf_cond, &pf_mutex);
+    if (pf->zstate == PCP_NONE) {
+        pf->zstate = PCP_BUSY;
+        pthread_mutex_unlock(&pf_mutex);
+#if HAVE_LIBZ
+        state = _pcp_deflate_file(pf, size);
+#endif
+        pthread_mutex_lock(&pf_mutex);
+        pf->zstate = state;
+        pthread_cond_broadcast(&pf_cond);
+    }
+    state = pf->zstate;
+    pthread_mutex_unlock(&pf_mutex);
+
+    return (state == PCP_DONE);
+}
+
+/*
+ * Release a connection's reference to compressed file data, freeing it
+ * once every connection has sent, skipped or failed to send the file.
+ * Called exactly once per file by each connection, see pcp_reset_files().
+ */
+static void _pcp_zdata_put(struct pcp_filename *pf)
+{
+    pthread_mutex_lock(&pf_mutex);
+    if (--pf->zrefs == 0 && pf->zbuf) {
+        free(pf->zbuf);
+        pf->zbuf = NULL;
+    }
+    pthread_mutex_unlock(&pf_mutex);
 }
 
 /*
@@ -283,11 +519,118 @@ static int pcp_response(int infd, char *host)
     return result;
 }
 
+/*
+ * Get the hash of each whole PCP_RESUME_BLKSIZ block of a file, computing
+ * them if no other connection has done so yet.
+ *	pf (IN/OUT)	file to hash
+ *	RETURN		PCP_DONE if pf->bhash is valid, else PCP_FAILED
+ */
+static pcp_state_t _pcp_blocks_get(struct pcp_filename *pf)
+{
+    pcp_state_t state;
+    uint64_t *bhash = NULL;
+    char *buf = NULL;
+    struct stat sb;
+    int fd, i, n = 0;
+
+    pthread_mutex_lock(&pf_mutex);
+    while (pf->bstate == PCP_BUSY)
+        pthread_cond_wait(&pf_cond, &pf_mutex);
+    if (pf->bstate == PCP_NONE) {
+        pf->bstate = PCP_BUSY;
+        pthread_mutex_unlock(&pf_mutex);
+
+        state = PCP_FAILED;
+        if ((fd = open(pf->filename, O_RDONLY)) >= 0) {
+            if (fstat(fd, &sb) == 0
+                && (n = sb.st_size / PCP_RESUME_BLKSIZ) > 0) {
+                bhash = Malloc(n * sizeof(uint64_t));
+                buf = Malloc(PCP_RESUME_BLKSIZ);
+                for (i = 0; i < n; i++) {
+                    if (fd_read_n(fd, buf, PCP_RESUME_BLKSIZ)
+                        != PCP_RESUME_BLKSIZ)
+                        break;
+                    bhash[i] = hash64(buf, PCP_RESUME_BLKSIZ, 0);
+                }
+                n = i;
+                Free((void **) &buf);
+            }
+            state = PCP_DONE;
+            close(fd);
+        }
+
+        pthread_mutex_lock(&pf_mutex);
+        pf->bhash = bhash;
+        pf->nblocks = n;
+        pf->bstate = state;
+        pthread_cond_broadcast(&pf_cond);
+    }
+    state = pf->bstate;
+    pthread_mutex_unlock(&pf_mutex);
+
+    return state;
+}
+
+/*
+ * Find where to resume copying a file to a target that may hold a
+ * partial copy of it.  The target reports a hash of each whole block of
+ * its copy, and copying resumes after the blocks that match the file.
+ *	pcp (IN)	client connection
+ *	pf (IN/OUT)	file being sent
+ *	size (IN)	size of file when last stat'd
+ *	RETURN		offset at which to resume, or -1 on failure
+ */
+static off_t _pcp_resume_offset(struct pcp_client *pcp,
+                                struct pcp_filename *pf, off_t size)
+{
+    char line[64], *hashes;
+    int k = 0, n, blksize;
+    off_t offset;
+
+    /*
+     * 4a: RECV number and size of blocks: "%d %d\n"
+     *     followed by the hash of each block: "%016llx\n"
+     */
+    if (fd_read_line(pcp->infd, line, sizeof(line)) <= 0
+        || sscanf(line, "%d %d", &n, &blksize) != 2 || n < 0
+        || blksize <= 0 || n > size / blksize) {
+        /* the target never reports blocks past the end of the file */
+        err("%p: %S: invalid resume response\n", pcp->host);
+        return -1;
+    }
+    if (n > 0) {
+        hashes = Malloc(n * 17 + 1);
+        if (fd_read_n(pcp->infd, hashes, n * 17) != n * 17) {
+            err("%p: %S: lost connection\n", pcp->host);
+            Free((void **) &hashes);
+            return -1;
+        }
+        if (blksize == PCP_RESUME_BLKSIZ && _pcp_blocks_get(pf) == PCP_DONE) {
+            while (k < n && k < pf->nblocks
+                   && strtoull(hashes + k * 17, NULL, 16) == pf->bhash[k])
+                k++;
+        }
+        Free((void **) &hashes);
+    }
+    offset = (off_t) k * blksize;
+
+    /* 4b: SEND offset at which to resume: "%lld\n" */
+    snprintf(line, sizeof(line), "%lld\n", (long long) offset);
+    if (pcp_sendstr(pcp->outfd, line, pcp->host) < 0)
+        return -1;
+    return offset;
+}
+
 #define RCP_MODEMASK (S_ISUID|S_ISGID|S_ISVTX|S_IRWXU|S_IRWXG|S_IRWXO)
 
-int pcp_sendfile(struct pcp_client *pcp, char *file, char *output_file)
+static int pcp_sendfile(struct pcp_client *pcp, struct pcp_filename *pf,
+                        char *output_file)
 {
+    char *file = pf->filename;
     int result = 0;
+    int zdata = 0;
+    int resume = 0;
+    off_t offset = 0;
     char tmpstr[BUFSIZ], *template;
     struct stat sb;
 
@@ -325,9 +668,30 @@ int pcp_sendfile(struct pcp_client *pcp, char *file, char *output_file)
                  sb.st_mode & RCP_MODEMASK, 0, xbasename(output_file));
         if (pcp_sendstr(pcp->outfd, tmpstr, pcp->host) < 0)
             goto fail;
+    } else if ((zdata = _pcp_zdata_get(pcp, pf, sb.st_size))) {
+        /*
+         * 3b: SEND compressed file mode: "Z%04o %lld %lld %s\n"
+         *    (st_mode & MODE_MASK, size, compressed size, basename(filename))
+         */
+        snprintf(tmpstr, sizeof(tmpstr), "Z%04o %lld %lld %s\n",
+                 sb.st_mode & RCP_MODEMASK, (long long) pf->zsize,
+                 (long long) pf->zlen, xbasename(output_file));
+        if (pcp_sendstr(pcp->outfd, tmpstr, pcp->host) < 0)
+            goto fail;
+    } else if (pcp->resume && S_ISREG(sb.st_mode)) {
+        /*
+         * 3c: SEND resumable file mode: "R%04o %lld %s\n"
+         *    (st_mode & MODE_MASK, st_size, basename(filename))
+         */
+        snprintf(tmpstr, sizeof(tmpstr), "R%04o %lld %s\n",
+                 sb.st_mode & RCP_MODEMASK, (long long) sb.st_size,
+                 xbasename(output_file));
+        if (pcp_sendstr(pcp->outfd, tmpstr, pcp->host) < 0)
+            goto fail;
+        resume = 1;
     } else {
         /*
-         * 3b: SEND file mode: "C%04o %lld %s\n" or "C%04o %ld %s\n"
+         * 3d: SEND file mode: "C%04o %lld %s\n" or "C%04o %ld %s\n"
          *    (st_mode & MODE_MASK, st_size, basename(filename))
          *    Use second template if sizeof(st_size) > sizeof(long).
          */
@@ -343,9 +707,19 @@ int pcp_sendfile(struct pcp_client *pcp, char *file, char *output_file)
     if (pcp_response(pcp->infd, pcp->host) < 0)
         goto fail;
 
+    if (resume && (offset = _pcp_resume_offset(pcp, pf, sb.st_size)) < 0)
+        goto fail;
+
     if (S_ISREG(sb.st_mode)) {
         /* 5: SEND data */
-        if (_pcp_send_file_data(pcp->outfd, file, pcp->host) < 0)
+        if (zdata) {
+            if (_pcp_write(pcp->outfd, pf->zbuf, pf->zlen) < 0) {
+                err("%S: pcp_sendfile: write: %m\n", pcp->host);
+                goto fail;
+            }
+        }
+        else if (_pcp_send_file_data(pcp->outfd, file, offset, sb.st_size,
+                                     pcp->host) < 0)
             goto fail;
 
         /* 6: SEND NULL byte */
@@ -362,9 +736,215 @@ int pcp_sendfile(struct pcp_client *pcp, char *file, char *output_file)
     return result;
 }
 
+/*
+ * Get the hash of a file's contents, computing it if no other connection
+ * has done so yet.  If another connection is computing it and `wait' is
+ * false, return PCP_BUSY at once so the caller may hash other files.
+ *	pf (IN/OUT)	file to hash
+ *	wait (IN)	wait for the result if busy
+ *	RETURN		PCP_DONE if pf->hash is valid, PCP_FAILED, or PCP_BUSY
+ */
+static pcp_state_t _pcp_hash_get(struct pcp_filename *pf, int wait)
+{
+    pcp_state_t state;
+    uint64_t hash = 0;
+    int fd;
+
+    pthread_mutex_lock(&pf_mutex);
+    while (wait && pf->hstate == PCP_BUSY)
+        pthread_cond_wait(&pf_cond, &pf_mutex);
+    if (pf->hstate == PCP_NONE) {
+        pf->hstate = PCP_BUSY;
+        pthread_mutex_unlock(&pf_mutex);
+
+        state = PCP_FAILED;
+        if ((fd = open(pf->filename, O_RDONLY)) >= 0) {
+            if (hash64_fd(fd, &hash) == 0)
+                state = PCP_DONE;
+            close(fd);
+        }
+
+        pthread_mutex_lock(&pf_mutex);
+        pf->hash = hash;
+        pf->hstate = state;
+        pthread_cond_broadcast(&pf_cond);
+    }
+    state = pf->hstate;
+    pthread_mutex_unlock(&pf_mutex);
+
+    return state;
+}
+
+struct pcp_sync_file {
+    int index;                  /* index of file in pcp->infiles */
+    struct pcp_filename *pf;
+    struct pcp_filename *top;   /* user specified file or dir above pf */
+    struct stat sb;
+    int hash_needed;            /* target size matches, compare hashes */
+    uint64_t hash;              /* hash of target file */
+    long mtime;                 /* mtime of target file */
+};
+
+#define PCP_QUERYBUFSIZ (64 * 1024)
+
+/*
+ * Parse the server's reply line for one file of a sync query.
+ */
+static int _pcp_sync_reply(struct pcp_client *pcp, struct pcp_sync_file *f,
+                           char *line)
+{
+    long long size;
+    unsigned long long hash;
+
+    if (line[0] == '\01' || line[0] == '\02') {
+        err("%p: %S: fatal: %s\n", pcp->host, line + 1);
+        return -1;
+    }
+    if (line[0] == '-')
+        return 0;
+    if (sscanf(line, "%lld %ld %llx", &size, &f->mtime, &hash) == 3
+        && size == f->sb.st_size) {
+        f->hash_needed = 1;
+        f->hash = hash;
+    }
+    return 0;
+}
+
+/*
+ * Ask the server which regular files are already identical on the target,
+ * so that only changed files need be sent.  File paths are sent relative
+ * to the copy target, as the server would construct them.
+ *	1: SEND "S<count>\n" and "<size> <path>\n" for each regular file
+ *	2: RECV "<size> <mtime> <hash>\n" for each file, hash is "-" if the
+ *	   size did not match, or "-\n" if the target file does not exist
+ *
+ *	pcp (IN)	client connection
+ *	RETURN		array with a nonzero entry for each file in
+ *			pcp->infiles that may be skipped, or NULL on failure
+ */
+static char *_pcp_sync_query(struct pcp_client *pcp)
+{
+    struct pcp_sync_file *files;
+    struct pcp_filename *pf, *top = NULL, *wait_pf;
+    char *unchanged, *query;
+    char line[BUFSIZ];
+    int i, len, qlen, n = 0, index = 0;
+    ListIterator itr;
+
+    unchanged = Malloc(list_count(pcp->infiles) + 1);
+    files = Malloc((list_count(pcp->infiles) + 1) * sizeof(*files));
+    query = Malloc(PCP_QUERYBUFSIZ);
+
+    itr = list_iterator_create(pcp->infiles);
+    while ((pf = list_next(itr))) {
+        struct pcp_sync_file *f = &files[n];
+
+        index++;
+        if (pf->file_specified_by_user)
+            top = pf;
+        if (strcmp(pf->filename, EXIT_SUBDIR_FILENAME) == 0)
+            continue;
+        if (stat(pf->filename, &f->sb) < 0 || !S_ISREG(f->sb.st_mode))
+            continue;
+        f->index = index - 1;
+        f->pf = pf;
+        f->top = top;
+        n++;
+    }
+    list_iterator_destroy(itr);
+
+    snprintf(line, sizeof(line), "S%d\n", n);
+    if (pcp_sendstr(pcp->outfd, line, pcp->host) < 0)
+        goto fail;
+
+    for (i = 0, qlen = 0; i < n; i++) {
+        struct pcp_sync_file *f = &files[i];
+
+        /* "<top output name><path below top>" (see _pcp_sendfile()) */
+        len = snprintf(line, sizeof(line), "%lld %s%s%s%s\n",
+                       (long long) f->sb.st_size, xbasename(f->top->filename),
+                       pcp->pcp_client ? "." : "",
+                       pcp->pcp_client ? pcp->host : "",
+                       f->pf->filename + strlen(f->top->filename));
+        if (len >= sizeof(line))
+            goto fail;
+        if (qlen + len > PCP_QUERYBUFSIZ) {
+            if (_pcp_write(pcp->outfd, query, qlen) < 0)
+                goto fail;
+            qlen = 0;
+        }
+        memcpy(query + qlen, line, len);
+        qlen += len;
+    }
+    if (qlen > 0 && _pcp_write(pcp->outfd, query, qlen) < 0)
+        goto fail;
+
+    /*
+     * The server sends nothing else until it receives the next record,
+     * so the reply may safely be read in large chunks.
+     */
+    for (i = 0, qlen = 0; i < n; ) {
+        char *p, *nl;
+
+        if ((len = read(pcp->infd, query + qlen, PCP_QUERYBUFSIZ - qlen - 1)) <= 0)
+            goto fail;
+        qlen += len;
+        query[qlen] = '\0';
+
+        for (p = query; i < n && (nl = strchr(p, '\n')); p = nl + 1) {
+            *nl = '\0';
+            if (_pcp_sync_reply(pcp, &files[i++], p) < 0)
+                goto fail;
+        }
+        qlen -= p - query;
+        memmove(query, p, qlen);
+        if (qlen == PCP_QUERYBUFSIZ - 1)
+            goto fail;
+    }
+
+    /*
+     * Compare hashes, computing those of local files as needed.  Files
+     * being hashed by another connection are deferred to a later pass,
+     * so that concurrent connections hash different files in parallel.
+     */
+    do {
+        wait_pf = NULL;
+        for (i = 0; i < n; i++) {
+            struct pcp_sync_file *f = &files[i];
+            pcp_state_t state;
+
+            if (!f->hash_needed)
+                continue;
+            if ((state = _pcp_hash_get(f->pf, 0)) == PCP_BUSY) {
+                if (!wait_pf)
+                    wait_pf = f->pf;
+                continue;
+            }
+            f->hash_needed = 0;
+            if (state == PCP_DONE && f->pf->hash == f->hash
+                && (!pcp->preserve || f->mtime == (long) f->sb.st_mtime))
+                unchanged[f->index] = 1;
+        }
+        if (wait_pf)
+            _pcp_hash_get(wait_pf, 1);
+    } while (wait_pf);
+
+    Free((void **) &files);
+    Free((void **) &query);
+    return unchanged;
+
+  fail:
+    err("%p: %S: failed to query target for unchanged files\n", pcp->host);
+    Free((void **) &files);
+    Free((void **) &query);
+    Free((void **) &unchanged);
+    return NULL;
+}
+
 static int _pcp_sendfile (struct pcp_filename *pf, struct pcp_client *pcp)
 {
 	char *output_filename = NULL;
+	int rc;
 
 	if (strcmp(pf->filename, EXIT_SUBDIR_FILENAME) == 0) {
 		if (pcp_sendstr(pcp->outfd, EXIT_SUBDIR_FLAG, pcp->host) < 0)
@@ -384,9 +964,39 @@ static int _pcp_sendfile (struct pcp_filename *pf, struct pcp_client *pcp)
 		xstrcat(&output_filename, pcp->host);
 	}
 
-	pcp_sendfile (pcp, pf->filename, output_filename);
+	rc = pcp_sendfile (pcp, pf, output_filename) ? 0 : -1;
+
+	if (output_filename)
+		Free ((void **) &output_filename);
+	return (rc);
+}
+
+void pcp_reset_files (List infiles, int nhosts)
+{
+    struct pcp_filename *pf;
+    ListIterator i;
+
+    i = list_iterator_create (infiles);
+    while ((pf = list_next (i))) {
+        if (pf->zbuf)
+            free (pf->zbuf);
+        pf->zbuf = NULL;
+        pf->zstate = PCP_NONE;
+        pf->zrefs = nhosts;
+        pf->prefetched = 0;
+    }
+    list_iterator_destroy (i);
+}
+
+void pcp_release_files (List infiles)
+{
+    struct pcp_filename *pf;
+    ListIterator i;
 
-	return (0);
+    i = list_iterator_create (infiles);
+    while ((pf = list_next (i)))
+        _pcp_zdata_put (pf);
+    list_iterator_destroy (i);
 }
 
 int pcp_client(struct pcp_client *pcp)
@@ -394,11 +1004,36 @@ int pcp_client(struct pcp_client *pcp)
     /* 0: RECV response code */
     if (pcp_response(pcp->infd, pcp->host) >= 0) {
         struct pcp_filename *pf;
-        ListIterator i = list_iterator_create (pcp->infiles);
-        while ((pf = list_next (i)))
-            _pcp_sendfile (pf, pcp);
+        struct pcp_readahead *ra;
+        char *unchanged = NULL;
+        ListIterator i;
+        int n = 0, nfailed = 0;
+
+        if (pcp->sync && !(unchanged = _pcp_sync_query (pcp))) {
+            pcp_release_files (pcp->infiles);
+            return -1;
+        }
+
+        ra = Malloc (sizeof (*ra));
+        ra->itr = list_iterator_create (pcp->infiles);
+
+        i = list_iterator_create (pcp->infiles);
+        while ((pf = list_next (i))) {
+            _pcp_readahead (ra, n, unchanged);
+            if ((!unchanged || !unchanged[n])
+                && _pcp_sendfile (pf, pcp) < 0)
+                nfailed++;
+            _pcp_zdata_put (pf);
+            ra->bytes -= ra->len[n % PCP_READAHEAD_FILES];
+            n++;
+        }
         list_iterator_destroy (i);
-        return 0;
+        list_iterator_destroy (ra->itr);
+        Free ((void **) &ra);
+        if (unchanged)
+            Free ((void **) &unchanged);
+        return (nfailed ? 1 : 0);
     }
+    pcp_release_files (pcp->infiles);
     return -1;
 }
@@ -31,6 +31,9 @@
 #  include <config.h>
 #endif
 
+#include <sys/types.h>
+#include <stdint.h>
+
 #include "src/pdsh/opt.h"
 
 #include "src/common/list.h"
@@ -39,29 +42,65 @@
 #define EXIT_SUBDIR_FILENAME    "a!b@c#d$"
 #define EXIT_SUBDIR_FLAG        "E\n"
 
+/* State of data computed once per file and shared by all connections */
+typedef enum { PCP_NONE, PCP_BUSY, PCP_DONE, PCP_FAILED } pcp_state_t;
+
 /* Store the file that should be copied and if it was a
  * file specified by the user or if it is a file found due to
  * recursively moving down a directory (-r option).  This flag
  * is needed so the right output filename can be determined
  * on reverse copies.
+ *
+ * With compression enabled, the file data is compressed once and
+ * the result is shared by all connections sending this file.  Likewise
+ * the hash of the file contents used to skip unchanged files (-s), and
+ * read-ahead of the file, which is started by the first connection
+ * to get near it.
  */
 struct pcp_filename {
     char *filename;
     int file_specified_by_user;
+    pcp_state_t zstate;         /* state of compressed data below      */
+    char *zbuf;                 /* compressed file data                */
+    size_t zlen;                /* length of compressed data           */
+    off_t zsize;                /* uncompressed length of zbuf data    */
+    int zrefs;                  /* connections that have yet to pass it */
+    pcp_state_t hstate;         /* state of hash below                 */
+    uint64_t hash;              /* hash64 of file contents             */
+    int prefetched;             /* read-ahead of file has been started */
+    pcp_state_t bstate;         /* state of block hashes below         */
+    uint64_t *bhash;            /* hash64 of each PCP_RESUME_BLKSIZ    */
+    int nblocks;                /*  block of file, used to resume (-o) */
 };
 
+/* Size of the blocks compared to resume copying a partial target file */
+#define PCP_RESUME_BLKSIZ       (4 * 1024 * 1024)
+
 /* expand directories, if any, and verify access for all files */
 List pcp_expand_dirs (List infile_names);
 
+/* discard data shared between connections before copying files to
+ * nhosts connections, each of which must pass every file once: by
+ * pcp_client(), or by pcp_release_files() if it never runs pcp_client()
+ */
+void pcp_reset_files (List infiles, int nhosts);
+
+/* release files that a connection will not send */
+void pcp_release_files (List infiles);
+
 struct pcp_client {
 	int infd;
 	int outfd;
 	bool preserve;
+	bool compress;
+	bool sync;
+	bool resume;
 	bool pcp_client;
 	char *host;
 	List infiles;
 };
 
+/* copy files: returns -1 if the connection failed, 1 if any file failed */
 int pcp_client (struct pcp_client *cli);
 
 #endif /* _PCP_CLIENT_H */
@@ -69,6 +69,10 @@ char rcsid[] = "$Id$";
 # include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE    /* fallocate(), sync_file_range(), O_DIRECT */
+#endif
+
 #include <sys/param.h>     /* roundup() */
 #if HAVE_SYS_SYSMACROS_H
 # include <sys/sysmacros.h>
@@ -93,8 +97,14 @@ char rcsid[] = "$Id$";
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <pthread.h>
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
 
 #include "src/common/err.h"
+#include "src/common/fd.h"
+#include "src/common/hash64.h"
 #include "pcp_server.h"
 #include "opt.h"
 
@@ -118,11 +128,60 @@ typedef struct _buf {
     char  *buf;
 } BUF;
 
+typedef enum { YES, NO, DISPLAYED } wrerr_t;
+
+/*
+ * File data is received into a buffer of at least SINK_BUFSIZ bytes,
+ * aligned to SINK_ALIGN so it may be written with O_DIRECT.  Files of
+ * SINK_WRITEBEHIND_MIN bytes or more are written behind: see _sink_write().
+ */
+#define SINK_BUFSIZ          (4 * 1024 * 1024)
+#define SINK_ALIGN           4096
+#define SINK_WRITEBEHIND_MIN (64 * 1024 * 1024)
+#define SINK_WRITEBEHIND     (16 * 1024 * 1024)
+
+/*
+ * Size of the blocks of a partial target file compared to resume (-o).
+ * This must be no larger than SINK_BUFSIZ.
+ */
+#define SINK_RESUME_BLKSIZ   (4 * 1024 * 1024)
+
+/*
+ * Target file state reported for one file of a sync (-s) query
+ */
+struct sync_entry {
+    char *path;             /* target path                       */
+    off_t size;             /* size of source file               */
+    struct stat st;         /* target file stat, if exists       */
+    int exists;             /* target exists and is regular file */
+    int hashed;             /* hash below is valid               */
+    uint64_t hash;          /* hash64 of target file             */
+};
+
+struct sync_work {
+    pthread_mutex_t lock;
+    struct sync_entry *ents;
+    int count;
+    int next;               /* next entry to be examined         */
+};
+
+#define SYNC_MAX_THREADS    8
+#define SYNC_BUFSIZ         (64 * 1024)
+
 static int  _verifydir(struct pcp_server *s, const char *cp);
 static int  _response(struct pcp_server *s);
 static BUF *_allocbuf(struct pcp_server *s, BUF *bp, int fd, int blksize);
 static void _error(struct pcp_server *s, const char *fmt, ...);
 static void _sink(struct pcp_server *s, char *targ, BUF *bufp);
+static int  _sink_write(int ofd, char *buf, int n, off_t off, off_t size);
+static int  _sink_resume(struct pcp_server *s, int ofd, BUF *bp, off_t size,
+                         off_t *offp);
+static int  _sink_sync(struct pcp_server *s, char *targ, int targisdir,
+                       int count);
+#if HAVE_LIBZ
+static int  _sink_inflate(struct pcp_server *s, int ofd, const char *np,
+                          BUF *bp, off_t size, off_t zsize, wrerr_t *wrerr);
+#endif
 
 static int
 _verifydir(struct pcp_server *s, const char *cp)
@@ -177,7 +236,12 @@ _allocbuf(struct pcp_server *s, BUF *bp, int fd, int blksize)
     if (bp->cnt < size) {
         if (bp->buf != 0)
             free(bp->buf);
+#if HAVE_POSIX_MEMALIGN
+        if (posix_memalign((void **) &bp->buf, SINK_ALIGN, size) != 0)
+            bp->buf = NULL;
+#else
         bp->buf = malloc(size);
+#endif
         if (!bp->buf) {
             _error(s, "malloc: out of memory\n");
             bp->cnt = 0;
@@ -210,19 +274,339 @@ _error(struct pcp_server *s, const char *fmt, ...)
     fflush(fp);
 }
 
+#if HAVE_LIBZ
+/*
+ * Read `zsize' bytes of compressed file data and write the inflated
+ * result, which must be `size' bytes long, to `ofd' using buffer `bp'.
+ * As with uncompressed data, all input is consumed even after a write
+ * or decompression error so that the protocol stays in sync.
+ */
+static int
+_sink_inflate(struct pcp_server *svr, int ofd, const char *np, BUF *bp,
+              off_t size, off_t zsize, wrerr_t *wrerr)
+{
+    z_stream zs;
+    char zin[BUFSIZ];
+    int amt, n, rc;
+
+    memset(&zs, 0, sizeof(zs));
+    rc = inflateInit(&zs);
+
+    while (zsize > 0) {
+        amt = (zsize > sizeof(zin)) ? sizeof(zin) : zsize;
+        if ((n = read(svr->infd, zin, amt)) <= 0) {
+            _error(svr, "%m\n");
+            inflateEnd(&zs);
+            return -1;
+        }
+        zsize -= n;
+        if (rc != Z_OK)
+            continue;           /* bad stream: just drain input */
+
+        zs.next_in = (Bytef *) zin;
+        zs.avail_in = n;
+        do {
+            zs.next_out = (Bytef *) bp->buf;
+            zs.avail_out = bp->cnt;
+            if ((rc = inflate(&zs, Z_NO_FLUSH)) == Z_BUF_ERROR)
+                rc = Z_OK;      /* no progress possible, need input */
+            if (rc != Z_OK && rc != Z_STREAM_END)
+                break;
+            n = bp->cnt - zs.avail_out;
+            if (n > 0 && *wrerr == NO
+                && _sink_write(ofd, bp->buf, n, zs.total_out - n, size) < 0)
+                *wrerr = YES;
+        } while (zs.avail_out == 0 && rc == Z_OK);
+    }
+
+    if ((rc != Z_STREAM_END || zs.total_out != size) && *wrerr != YES) {
+        _error(svr, "%s: corrupt compressed data\n", np);
+        *wrerr = DISPLAYED;
+    }
+
+    inflateEnd(&zs);
+    return 0;
+}
+#endif /* HAVE_LIBZ */
+
+/*
+ * Write `n' bytes of buffer `buf' at offset `off' of the `size' byte
+ * file being received on `ofd'.  If the file was opened with O_DIRECT,
+ * a final partial block is written through the page cache instead.
+ *
+ * Large files are written behind: writeback of each write is started
+ * at once, and the data written SINK_WRITEBEHIND bytes earlier is waited
+ * for and dropped from the page cache.  This keeps a single copy from
+ * filling memory with dirty pages and stalling in one large flush.
+ */
+static int
+_sink_write(int ofd, char *buf, int n, off_t off, off_t size)
+{
+#ifdef O_DIRECT
+    if (n % SINK_ALIGN) {
+        int flags = fcntl(ofd, F_GETFL);
+        if (flags >= 0 && (flags & O_DIRECT))
+            (void)fcntl(ofd, F_SETFL, flags & ~O_DIRECT);
+    }
+#endif
+    if (write(ofd, buf, n) != n)
+        return -1;
+#if HAVE_SYNC_FILE_RANGE
+    if (size >= SINK_WRITEBEHIND_MIN) {
+        (void)sync_file_range(ofd, off, n, SYNC_FILE_RANGE_WRITE);
+        if (off >= SINK_WRITEBEHIND) {
+            off -= SINK_WRITEBEHIND;
+            (void)sync_file_range(ofd, off, n, SYNC_FILE_RANGE_WAIT_BEFORE
+                                             | SYNC_FILE_RANGE_WRITE
+                                             | SYNC_FILE_RANGE_WAIT_AFTER);
+# if HAVE_POSIX_FADVISE
+            (void)posix_fadvise(ofd, off, n, POSIX_FADV_DONTNEED);
+# endif
+        }
+    }
+#endif
+    return 0;
+}
+
+/*
+ * Tell the client how much of a file being received (R record) is
+ * already present in the target `ofd', as the hash of each whole block
+ * within the file size, and read back the offset the client has chosen
+ * to resume from into `offp'.
+ */
+static int
+_sink_resume(struct pcp_server *svr, int ofd, BUF *bp, off_t size,
+             off_t *offp)
+{
+    struct stat stb;
+    char line[64], *hashes, *p;
+    off_t offset;
+    int i, len, n = 0;
+
+    if (fstat(ofd, &stb) == 0 && S_ISREG(stb.st_mode))
+        n = (stb.st_size < size ? stb.st_size : size) / SINK_RESUME_BLKSIZ;
+    if (!(hashes = malloc(n * 17 + 1)))
+        n = 0;
+    for (i = 0; i < n; i++) {
+        if (pread(ofd, bp->buf, SINK_RESUME_BLKSIZ,
+                  (off_t) i * SINK_RESUME_BLKSIZ) != SINK_RESUME_BLKSIZ)
+            break;
+        sprintf(hashes + i * 17, "%016llx\n", (unsigned long long)
+                hash64(bp->buf, SINK_RESUME_BLKSIZ, 0));
+    }
+    n = i;
+
+    /*  Reply "<nblocks> <blksize>\n" then "<hash>\n" for each block
+     */
+    len = sprintf(line, "%d %d\n", n, SINK_RESUME_BLKSIZ);
+    if (fd_write_n(svr->outfd, line, len) < 0
+        || (n > 0 && fd_write_n(svr->outfd, hashes, n * 17) < 0)) {
+        free(hashes);
+        _error(svr, "write failed: %m\n");
+        return -1;
+    }
+    free(hashes);
+
+    if (fd_read_line(svr->infd, line, sizeof(line)) <= 0) {
+        _error(svr, "lost connection\n");
+        return -1;
+    }
+    offset = strtoll(line, &p, 10);
+    if (*p != '\n' || offset < 0 || offset % SINK_RESUME_BLKSIZ
+        || offset > (off_t) n * SINK_RESUME_BLKSIZ) {
+        _error(svr, "protocol screwup: bad resume offset\n");
+        return -1;
+    }
+    if (lseek(ofd, offset, SEEK_SET) < 0) {
+        _error(svr, "lseek: %m\n");
+        return -1;
+    }
+    *offp = offset;
+    return 0;
+}
+
+/*
+ * Open a temporary file in the directory of `np' to receive its data
+ * when writing atomically (-W).  The temporary file name is returned
+ * in `tmpp' and must be renamed to `np' once the data is complete.
+ */
+static int
+_sink_open_tmp(const char *np, char **tmpp)
+{
+    const char *base = strrchr(np, '/');
+    int dirlen = base ? base - np + 1 : 0;
+    char *tmp;
+    int fd;
+
+    base = base ? base + 1 : np;
+    if (!(tmp = malloc(strlen(np) + 16)))
+        return -1;
+    sprintf(tmp, "%.*s.%s.pdcpXXXXXX", dirlen, np, base);
+    if ((fd = mkstemp(tmp)) < 0) {
+        free(tmp);
+        return -1;
+    }
+    *tmpp = tmp;
+    return fd;
+}
+
+/*
+ * Thread that stats, and if the size matches, hashes target files of
+ * a sync query until none remain.
+ */
+static void *
+_sync_worker(void *arg)
+{
+    struct sync_work *w = arg;
+    struct sync_entry *e;
+    int i, fd;
+
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        i = w->next++;
+        pthread_mutex_unlock(&w->lock);
+        if (i >= w->count)
+            break;
+
+        e = &w->ents[i];
+        if (stat(e->path, &e->st) < 0 || !S_ISREG(e->st.st_mode))
+            continue;
+        e->exists = 1;
+        if (e->st.st_size != e->size)
+            continue;
+        if ((fd = open(e->path, O_RDONLY)) >= 0) {
+            if (hash64_fd(fd, &e->hash) == 0)
+                e->hashed = 1;
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Answer a sync query of `count' files (see _pcp_sync_query() in
+ * pcp_client.c) with the size, mtime and hash of each target file.
+ * Target files are examined in parallel.
+ */
+static int
+_sink_sync(struct pcp_server *svr, char *targ, int targisdir, int count)
+{
+    struct sync_work w;
+    pthread_t threads[SYNC_MAX_THREADS];
+    char *rbuf = NULL, *p, *nl;
+    int i, n, len, nthreads, rc = -1;
+
+    memset(&w, 0, sizeof(w));
+    pthread_mutex_init(&w.lock, NULL);
+    w.count = count;
+    if (!(w.ents = calloc(count + 1, sizeof(*w.ents)))
+        || !(rbuf = malloc(SYNC_BUFSIZ))) {
+        _error(svr, "out of memory\n");
+        goto out;
+    }
+
+    /*
+     * Read the "<size> <path>" lines.  The client sends nothing more
+     * until it has our reply, so read in large chunks.
+     */
+    for (i = 0, len = 0; i < count; ) {
+        if ((n = read(svr->infd, rbuf + len, SYNC_BUFSIZ - len - 1)) <= 0) {
+            _error(svr, "lost connection\n");
+            goto out;
+        }
+        len += n;
+        rbuf[len] = '\0';
+        for (p = rbuf; i < count && (nl = strchr(p, '\n')); p = nl + 1) {
+            struct sync_entry *e = &w.ents[i++];
+            char *name;
+
+            *nl = '\0';
+            e->size = strtoll(p, &name, 10);
+            if (*name++ != ' ') {
+                _error(svr, "protocol screwup: bad sync record\n");
+                goto out;
+            }
+            if (targisdir) {
+                e->path = malloc(strlen(targ) + strlen(name) + 2);
+                if (e->path)
+                    sprintf(e->path, "%s%s%s", targ, *targ ? "/" : "", name);
+            } else
+                e->path = strdup(targ);
+            if (!e->path) {
+                _error(svr, "out of memory\n");
+                goto out;
+            }
+        }
+        len -= p - rbuf;
+        memmove(rbuf, p, len);
+        if (len == SYNC_BUFSIZ - 1) {
+            _error(svr, "protocol screwup: sync record too long\n");
+            goto out;
+        }
+    }
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > SYNC_MAX_THREADS)
+        nthreads = SYNC_MAX_THREADS;
+    if (nthreads > count)
+        nthreads = count;
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, _sync_worker, &w) != 0)
+            break;
+    }
+    nthreads = i;
+    _sync_worker(&w);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    /*  Reply with "<size> <mtime> <hash|->" or "-" for each file
+     */
+    for (i = 0, len = 0; i < count; i++) {
+        struct sync_entry *e = &w.ents[i];
+
+        if (len > SYNC_BUFSIZ - 64) {
+            if (write(svr->outfd, rbuf, len) != len)
+                goto out;
+            len = 0;
+        }
+        if (!e->exists)
+            len += sprintf(rbuf + len, "-\n");
+        else if (!e->hashed)
+            len += sprintf(rbuf + len, "%lld %ld -\n",
+                           (long long) e->st.st_size, (long) e->st.st_mtime);
+        else
+            len += sprintf(rbuf + len, "%lld %ld %016llx\n",
+                           (long long) e->st.st_size, (long) e->st.st_mtime,
+                           (unsigned long long) e->hash);
+    }
+    if (len > 0 && write(svr->outfd, rbuf, len) != len)
+        goto out;
+    rc = 0;
+
+out:
+    if (w.ents) {
+        for (i = 0; i < count; i++)
+            free(w.ents[i].path);
+        free(w.ents);
+    }
+    free(rbuf);
+    pthread_mutex_destroy(&w.lock);
+    return rc;
+}
+
 static void
 _sink(struct pcp_server *svr, char *targ, BUF *bufp) {
     register char *cp;
     struct stat stb;
     struct timeval tv[2];
-    enum { YES, NO, DISPLAYED } wrerr;
+    wrerr_t wrerr;
     BUF *bp;
-    off_t i, j, size;
+    off_t i, j, size, offset, zsize = 0;
     char ch;
     const char *why = "failed to set 'why' string";
     int amt, count, exists, mask, mode;
     int ofd, setimes, targisdir, cursize = 0;
-    char *np, *buf = NULL, *namebuf = NULL;
+    char *np, *buf = NULL, *namebuf = NULL, *tmpname = NULL;
 
 #define	atime	tv[0]
 #define	mtime	tv[1]
@@ -280,6 +664,17 @@ _sink(struct pcp_server *svr, char *targ, BUF *bufp) {
 
 #define getnum(t) (t) = 0; while (isdigit(*cp)) (t) = (t) * 10 + (*cp++ - '0');
         cp = buf;
+        if (*cp == 'S' && svr->sync) {
+            int count;
+
+            cp++;
+            getnum(count);
+            if (*cp != '\0')
+                SCREWUP("sync count not delimited");
+            if (_sink_sync(svr, targ, targisdir, count) < 0)
+                goto end_server;
+            continue;
+        }
         if (*cp == 'T') {
             setimes++;
             cp++;
@@ -299,7 +694,8 @@ _sink(struct pcp_server *svr, char *targ, BUF *bufp) {
                 SCREWUP("write failed");
             continue;
         }
-        if (*cp != 'C' && *cp != 'D')
+        if (*cp != 'C' && *cp != 'D' && (*cp != 'Z' || !svr->compress)
+            && (*cp != 'R' || !svr->resume))
             SCREWUP("expected control record");
 
         mode = 0;
@@ -315,6 +711,11 @@ _sink(struct pcp_server *svr, char *targ, BUF *bufp) {
             size = size * 10 + (*cp++ - '0');
         if (*cp++ != ' ')
             SCREWUP("size not delimited");
+        if (buf[0] == 'Z') {
+            getnum(zsize);
+            if (*cp++ != ' ')
+                SCREWUP("compressed size not delimited");
+        }
 
         /* filename is "retrieved" in this if/else block */
         if (targisdir) {
@@ -377,7 +778,26 @@ _sink(struct pcp_server *svr, char *targ, BUF *bufp) {
             continue;
         }
 
-        if ((ofd = open(np, O_WRONLY|O_CREAT, mode)) < 0) {
+        if (svr->atomic) {
+            /*
+             *  Write to a temporary file renamed over the target once
+             *   complete.  Keep the mode of an existing target unless
+             *   preserving modes, as when writing the target in place.
+             */
+            if (exists && S_ISDIR(stb.st_mode)) {
+                errno = EISDIR;
+                goto bad;
+            }
+            if (exists && !svr->preserve)
+                mode = stb.st_mode & 07777;
+            else if (!svr->preserve)
+                mode &= ~mask;
+            if ((ofd = _sink_open_tmp(np, &tmpname)) < 0)
+                goto bad;
+            (void)fchmod(ofd, mode);
+        }
+        else if ((ofd = open(np, (buf[0] == 'R' ? O_RDWR : O_WRONLY)|O_CREAT,
+                             mode)) < 0) {
 bad:	
             _error(svr, "%s: %m\n", np);
             continue;
@@ -387,41 +807,86 @@ bad:
 
         if (write(svr->outfd, "", 1) != 1)
             _error(svr, "failed to write to outfd: %m\n");
-        if ((bp = _allocbuf(svr, bufp, ofd, BUFSIZ)) == NULL) {
+        if ((bp = _allocbuf(svr, bufp, ofd, SINK_BUFSIZ)) == NULL) {
             (void)close(ofd);
+            if (tmpname) {
+                (void)unlink(tmpname);
+                free(tmpname);
+                tmpname = NULL;
+            }
             continue;
         }
+        offset = 0;
+        if (buf[0] == 'R' && _sink_resume(svr, ofd, bp, size, &offset) < 0) {
+            (void)close(ofd);
+            goto end_server;
+        }
+#if HAVE_FALLOCATE && defined(FALLOC_FL_KEEP_SIZE)
+        /*  Preallocate so the file is laid out contiguously.  Not all
+         *   filesystems support this, which is not an error.  Keep the
+         *   size, so a partial file only appears as long as its data.
+         */
+        if (size > offset)
+            (void)fallocate(ofd, FALLOC_FL_KEEP_SIZE, offset, size - offset);
+#endif
+#ifdef O_DIRECT
+        /*  Bypass the page cache if requested and possible.
+         */
+        if (svr->direct && buf[0] == 'C' && size >= bp->cnt) {
+            int flags = fcntl(ofd, F_GETFL);
+            if (flags >= 0)
+                (void)fcntl(ofd, F_SETFL, flags | O_DIRECT);
+        }
+#endif
         cp = bp->buf;
         count = 0;
         wrerr = NO;
-        for (i = 0; i < size; i += BUFSIZ) {
-            amt = BUFSIZ;
+        i = offset;
+#if HAVE_LIBZ
+        if (buf[0] == 'Z') {
+            if (_sink_inflate(svr, ofd, np, bp, size, zsize, &wrerr) < 0) {
+                (void)close(ofd);
+                goto end_server;
+            }
+            i = size;           /* all data consumed */
+        }
+#endif
+        for (; i < size; i += j) {
+            amt = bp->cnt - count;
             if (i + amt > size)
                 amt = size - i;
-            count += amt;
-            do {
-                j = read(svr->infd, cp, amt);
-                if (j <= 0) {
-                    _error(svr, "%m\n");
-                    goto end_server;
-                }
-                amt -= j;
-                cp += j;
-            } while (amt > 0);
+            j = read(svr->infd, cp, amt);
+            if (j <= 0) {
+                _error(svr, "%m\n");
+                (void)close(ofd);
+                goto end_server;
+            }
+            cp += j;
+            count += j;
             if (count == bp->cnt) {
-                if (wrerr == NO && write(ofd, bp->buf, count) != count)
+                if (wrerr == NO
+                    && _sink_write(ofd, bp->buf, count, i + j - count, size) < 0)
                     wrerr = YES;
                 count = 0;
                 cp = bp->buf;
             }
         }
-        if (count != 0 && wrerr == NO && write(ofd, bp->buf, count) != count)
+        if (count != 0 && wrerr == NO
+            && _sink_write(ofd, bp->buf, count, size - count, size) < 0)
             wrerr = YES;
         if (ftruncate(ofd, size)) {
             _error(svr, "can't truncate %s: %m\n", np);
             wrerr = DISPLAYED;
         }
         (void)close(ofd);
+        if (tmpname) {
+            if (wrerr == NO && rename(tmpname, np) < 0)
+                wrerr = YES;
+            if (wrerr != NO)
+                (void)unlink(tmpname);
+            free(tmpname);
+            tmpname = NULL;
+        }
         if (_response(svr) < 0)
             goto end_server;
         if (setimes && wrerr == NO) {
@@ -448,6 +913,10 @@ screwup:
     _error(svr, "protocol screwup: %s\n", why);
 
 end_server:
+    if (tmpname) {
+        (void)unlink(tmpname);
+        free(tmpname);
+    }
     if (buf)
         free(buf);
     if (namebuf)
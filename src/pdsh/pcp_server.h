@@ -38,6 +38,11 @@ struct pcp_server {
 	int outfd;
 	bool preserve;
 	bool target_is_dir;
+	bool compress;
+	bool sync;
+	bool atomic;
+	bool direct;
+	bool resume;
 	char *outfile;
 };
 
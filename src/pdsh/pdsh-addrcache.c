@@ -0,0 +1,67 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  pdsh-addrcache: write a host address cache file for PDSH_ADDR_CACHE
+ *   from hosts(5) format lines on stdin, e.g.
+ *
+ *     getent hosts | pdsh-addrcache /var/cache/pdsh/hosts
+ */
+
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/common/err.h"
+#include "src/common/xstring.h"
+#include "addrcache.h"
+
+static void _usage (void)
+{
+    err ("Usage: pdsh-addrcache path < hosts\n");
+    err ("Write a pdsh address cache to path from hosts(5) lines on stdin\n");
+}
+
+int main (int argc, char *argv[])
+{
+    int rc = 0;
+
+    err_init (xbasename (argv[0]));
+
+    if (argc == 2 && strcmp (argv[1], "-h") == 0)
+        _usage ();
+    else if (argc != 2 || argv[1][0] == '-') {
+        _usage ();
+        rc = 1;
+    }
+    else if (addrcache_write (argv[1], stdin) < 0)
+        rc = 1;
+
+    err_cleanup ();
+    return (rc);
+}
+
+/*
+ * vi: tabstop=4 shiftwidth=4 expandtab
+ */
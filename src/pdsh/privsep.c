@@ -35,10 +35,11 @@
 
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <netinet/in.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <netdb.h>  /* rresvport */
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
@@ -46,41 +47,63 @@
 #include "src/common/err.h"
 #include "src/common/fd.h"
 
-#define CONTROLLEN sizeof (struct cmsghdr) + sizeof (int)
+/*
+ *  Reserved ports are handed out by the privileged child in batches of
+ *   up to PRIVSEP_BATCH bound sockets per request. The client keeps the
+ *   spare sockets of each batch in a per-family pool for later callers.
+ */
+#define PRIVSEP_BATCH    16
+
+#define PRIVSEP_PORT_MAX (IPPORT_RESERVED - 1)
+#define PRIVSEP_PORT_MIN (IPPORT_RESERVED / 2)
+#define PRIVSEP_NPORTS   (PRIVSEP_PORT_MAX - PRIVSEP_PORT_MIN + 1)
+
+/*
+ *  Request count asking for a new connection to the privileged child,
+ *   served by a process of its own (see privsep_fork()).
+ */
+#define PRIVSEP_CHANNEL  (-1)
+
+struct privsep_request {
+	int family;
+	int count;
+};
+
+struct privsep_reply {
+	int n;                          /* number of fds in SCM_RIGHTS */
+	int errnum;                     /* errno if n == 0 */
+	int ports [PRIVSEP_BATCH];
+};
+
+struct port_pool {
+	int family;
+	int n;
+	int fds [PRIVSEP_BATCH];
+	int ports [PRIVSEP_BATCH];
+};
 
 static pthread_mutex_t privsep_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pid_t cpid;
 static int client_fd = -1;
 static int server_fd = -1;
 
-uid_t user_uid = -1;
-gid_t user_gid = -1;
-uid_t priv_uid = -1;
-gid_t priv_gid = -1;
+static struct port_pool pools[] = {
+	{ AF_INET,  0 },
+	{ AF_INET6, 0 },
+};
 
 /*
- *  Top 16 bits of port sent to privsep server is used to encode
- *   the address family (for rresvport_af()). Currently, value is
- *   either AF_INET AF_INET6 (if zero, then AF_INET).
+ *  Next reserved port to try. Ports are handed out in a descending
+ *   cycle over the whole reserved range, so that a port is not tried
+ *   again until every other one has been, giving recently closed
+ *   connections the most time to leave TIME_WAIT.
  */
-static int privsep_get_family (int *lport)
-{
-	int family = (*lport>>16) & 0xffff;
-	/*
-	 *  Mask out family from lport:
-	 */
-	*lport &= 0xffff;
-
-	return (family ? family : AF_INET);
-}
+static int next_port = PRIVSEP_PORT_MAX;
 
-static int privsep_set_family (int *lport, int family)
-{
-	if (family > 0xffff)
-		return (-1);
-	*lport |= (family<<16);
-	return (0);
-}
+uid_t user_uid = -1;
+gid_t user_gid = -1;
+uid_t priv_uid = -1;
+gid_t priv_gid = -1;
 
 static int create_socketpair (void)
 {
@@ -114,48 +137,88 @@ static void drop_privileges (void)
 #endif
 }
 
-static int send_rresvport (int pipefd, int fd, int lport)
+/*
+ *  Return a socket of [family] bound to the next free reserved port
+ *   in the cycle, with the port in [lport], or -1 with errno set
+ *   (EAGAIN if all reserved ports are in use).
+ */
+static int bind_reserved (int family, int *lport)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int i;
+	int s;
+
+	if ((s = socket (family, SOCK_STREAM, 0)) < 0)
+		return (-1);
+
+	for (i = 0; i < PRIVSEP_NPORTS; i++) {
+		int port = next_port;
+
+		if (--next_port < PRIVSEP_PORT_MIN)
+			next_port = PRIVSEP_PORT_MAX;
+
+		memset (&ss, 0, sizeof (ss));
+		ss.ss_family = family;
+		if (family == AF_INET6) {
+			((struct sockaddr_in6 *) &ss)->sin6_port = htons (port);
+			len = sizeof (struct sockaddr_in6);
+		} else {
+			((struct sockaddr_in *) &ss)->sin_port = htons (port);
+			len = sizeof (struct sockaddr_in);
+		}
+
+		if (bind (s, (struct sockaddr *) &ss, len) == 0) {
+			*lport = port;
+			return (s);
+		}
+		if (errno != EADDRINUSE)
+			break;
+	}
+
+	if (errno == EADDRINUSE)
+		errno = EAGAIN;
+	i = errno;
+	close (s);
+	errno = i;
+	return (-1);
+}
+
+static int send_ports (int pipefd, struct privsep_reply *r, int *fds)
 {
 	struct iovec   iov[1];
 	struct msghdr  msg;
 #if !HAVE_MSGHDR_ACCRIGHTS
+	union {
+		struct cmsghdr hdr;
+		char buf [CMSG_SPACE (PRIVSEP_BATCH * sizeof (int))];
+	} ctl;
 	struct cmsghdr *cmsg;
-	char *         buf[CONTROLLEN];
-
-	cmsg = (struct cmsghdr *) &buf;
 #endif
 
 	memset (&msg, 0, sizeof (msg));
 
-	iov->iov_base  = (void *) &lport;
-	iov->iov_len   = sizeof (lport);
+	iov->iov_base  = (void *) r;
+	iov->iov_len   = sizeof (*r);
 	msg.msg_iov    = iov;
 	msg.msg_iovlen = 1;
 
+	if (r->n > 0) {
 #if HAVE_MSGHDR_ACCRIGHTS
-	if (fd < 0) {
-		msg.msg_accrights = NULL;
-		msg.msg_accrightslen = 0;
-	} else {
-		msg.msg_accrights = (caddr_t) &fd;
-		msg.msg_accrightslen = sizeof (int);
-	}
+		msg.msg_accrights = (caddr_t) fds;
+		msg.msg_accrightslen = r->n * sizeof (int);
 #else
-	if (fd < 0) {
-		msg.msg_control = NULL;
-		msg.msg_controllen = 0;
-		lport = -1;
-	} else {
+		msg.msg_control    = (caddr_t) ctl.buf;
+		msg.msg_controllen = CMSG_SPACE (r->n * sizeof (int));
+		cmsg = CMSG_FIRSTHDR (&msg);
 		cmsg->cmsg_level   = SOL_SOCKET;
 		cmsg->cmsg_type    = SCM_RIGHTS;
-		cmsg->cmsg_len     = CONTROLLEN;
-		msg.msg_control    = (caddr_t) cmsg;
-		msg.msg_controllen = CONTROLLEN;
-		* (int *) CMSG_DATA(cmsg) = fd;
-	}
+		cmsg->cmsg_len     = CMSG_LEN (r->n * sizeof (int));
+		memcpy (CMSG_DATA (cmsg), fds, r->n * sizeof (int));
 #endif
+	}
 
-	if (sendmsg (pipefd, &msg, 0) != sizeof (int)) {
+	if (sendmsg (pipefd, &msg, 0) != sizeof (*r)) {
 		err ("%p: privsep: sendmsg: %m\n");
 		return (-1);
 	}
@@ -163,89 +226,166 @@ static int send_rresvport (int pipefd, int fd, int lport)
 	return (0);
 }
 
-static int recv_rresvport (int pipefd, int *lptr)
+/*
+ *  Receive a batch of reserved port sockets into [pool].
+ */
+static int recv_ports (int pipefd, struct port_pool *pool)
 {
-	int            fd = -1;
+	struct privsep_reply r;
 	struct iovec   iov[1];
 	struct msghdr  msg;
+	int            fds [PRIVSEP_BATCH];
+	int            i;
 #if !HAVE_MSGHDR_ACCRIGHTS
+	union {
+		struct cmsghdr hdr;
+		char buf [CMSG_SPACE (PRIVSEP_BATCH * sizeof (int))];
+	} ctl;
 	struct cmsghdr *cmsg;
-	char *         buf[CONTROLLEN];
-
-	cmsg = (struct cmsghdr *) &buf;
 #endif
 	memset (&msg, 0, sizeof (msg));
 
-	iov->iov_base  = (void *) lptr;
-	iov->iov_len   = sizeof (int);
+	iov->iov_base  = (void *) &r;
+	iov->iov_len   = sizeof (r);
 	msg.msg_iov    = iov;
 	msg.msg_iovlen = 1;
 
 #if HAVE_MSGHDR_ACCRIGHTS
-	msg.msg_accrights = (caddr_t) &fd;
-	msg.msg_accrightslen = sizeof (int);
+	msg.msg_accrights = (caddr_t) fds;
+	msg.msg_accrightslen = sizeof (fds);
 #else /* !HAVE_MSGHDR_ACCRIGHTS */
-	cmsg->cmsg_level   = SOL_SOCKET;
-	cmsg->cmsg_type    = SCM_RIGHTS;
-	cmsg->cmsg_len     = CONTROLLEN;
-	msg.msg_control    = (caddr_t) cmsg;
-	msg.msg_controllen = CONTROLLEN;
+	msg.msg_control    = (caddr_t) ctl.buf;
+	msg.msg_controllen = sizeof (ctl.buf);
 #endif
 
-	if (recvmsg (pipefd, &msg, 0) < 0)
+	if (recvmsg (pipefd, &msg, 0) != sizeof (r)) {
 		err ("%p: privsep: recvmsg: %m\n");
+		return (-1);
+	}
 
-	if (*lptr < 0)
+	if (r.n <= 0 || r.n > PRIVSEP_BATCH) {
+		errno = r.errnum;
 		return (-1);
+	}
 
 #if !HAVE_MSGHDR_ACCRIGHTS
-	fd = *(int *) CMSG_DATA (cmsg);
+	if (!(cmsg = CMSG_FIRSTHDR (&msg))
+	    || cmsg->cmsg_type != SCM_RIGHTS
+	    || cmsg->cmsg_len != CMSG_LEN (r.n * sizeof (int))) {
+		err ("%p: privsep: bad reply from privileged server\n");
+		errno = EPROTO;
+		return (-1);
+	}
+	memcpy (fds, CMSG_DATA (cmsg), r.n * sizeof (int));
 #endif
 
-	return (fd);
+	for (i = 0; i < r.n; i++) {
+		pool->fds [pool->n] = fds [i];
+		pool->ports [pool->n] = r.ports [i];
+		pool->n++;
+	}
+
+	return (0);
 }
 
+static int privsep_serve (int fd);
 
-static int p_rresvport_af (int *port, int family)
+/*
+ *  Create a new connection to the privileged server, served by a child
+ *   of this server, and send the client end to the requester.
+ */
+static void privsep_serve_channel (int fd)
 {
-#if HAVE_RRESVPORT_AF
-	return rresvport_af (port, family);
-#else
-	/*  Family must be AF_INET
-	 */
-	if (family != AF_INET)
-		err ("%p: rresvport called with family != AF_INET!\n");
-	/* ignore family != AF_INET */
-	return rresvport (port);
-#endif
+	struct privsep_reply r;
+	int sv[2];
+	pid_t pid;
+
+	memset (&r, 0, sizeof (r));
+
+	if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		r.errnum = errno;
+		send_ports (fd, &r, NULL);
+		return;
+	}
+
+	if ((pid = fork ()) == 0) {
+		close (fd);
+		close (sv[0]);
+		privsep_serve (sv[1]);
+		exit (0);
+	}
+
+	if (pid < 0)
+		r.errnum = errno;
+	else
+		r.n = 1;
+	send_ports (fd, &r, sv);
+
+	close (sv[0]);
+	close (sv[1]);
 }
 
-static int privsep_server (void)
+static int privsep_serve (int fd)
 {
+	struct privsep_request req;
 	int rc;
-	int lport;
-	close (client_fd);
 
 	/*
-	 * for each request on server_fd create a reserved port and
-	 *   send the created fd back to the client.
+	 * for each request on fd create up to req.count sockets
+	 *   bound to reserved ports and send them back to the client.
 	 */
-	while ((rc = read (server_fd, &lport, sizeof (lport))) > 0) {
-		int family = privsep_get_family (&lport);
-		int s = p_rresvport_af (&lport, family);
-
-		send_rresvport (server_fd, s, lport);
-
-		close (s);
+	while ((rc = fd_read_n (fd, &req, sizeof (req))) == sizeof (req)) {
+		struct privsep_reply r;
+		int fds [PRIVSEP_BATCH];
+		int i;
+
+		if (req.count == PRIVSEP_CHANNEL) {
+			privsep_serve_channel (fd);
+			continue;
+		}
+
+		memset (&r, 0, sizeof (r));
+		if (req.count > PRIVSEP_BATCH)
+			req.count = PRIVSEP_BATCH;
+
+		while (r.n < req.count) {
+			int s = bind_reserved (req.family, &r.ports [r.n]);
+			if (s < 0) {
+				r.errnum = errno;
+				break;
+			}
+			fds [r.n++] = s;
+		}
+
+		send_ports (fd, &r, fds);
+
+		for (i = 0; i < r.n; i++)
+			close (fds [i]);
 	}
 
 	if (rc < 0)
 		err ("%p: privsep: server read failed: %m\n");
 
-	close (server_fd);
+	close (fd);
 
 	return (0);
+}
+
+static int privsep_server (void)
+{
+	struct sigaction act;
+
+	close (client_fd);
 
+	/*
+	 * Servers of connections made by privsep_fork() are not waited for
+	 */
+	memset (&act, 0, sizeof (act));
+	act.sa_handler = SIG_DFL;
+	act.sa_flags = SA_NOCLDWAIT;
+	sigaction (SIGCHLD, &act, NULL);
+
+	return (privsep_serve (server_fd));
 }
 
 static int create_privileged_child (void)
@@ -287,9 +427,15 @@ int privsep_init (void)
 int privsep_fini (void)
 {
 	int status;
+	int i;
 	if (client_fd < 0 || cpid < 0)
 		return (0);
 
+	for (i = 0; i < sizeof (pools) / sizeof (pools[0]); i++) {
+		while (pools[i].n > 0)
+			close (pools[i].fds [--pools[i].n]);
+	}
+
 	close (client_fd);
 
 	if (waitpid (cpid, &status, 0) < 0) {
@@ -303,14 +449,23 @@ int privsep_fini (void)
 	return (0);
 }
 
+static struct port_pool * get_pool (int family)
+{
+	int i;
+	for (i = 0; i < sizeof (pools) / sizeof (pools[0]); i++) {
+		if (pools[i].family == family)
+			return (&pools[i]);
+	}
+	return (NULL);
+}
+
 int privsep_rresvport_af (int *lport, int family)
 {
+	struct port_pool *pool;
+	int saved_errno;
 	int s = -1;
 
-	if (client_fd < 0)
-		return (p_rresvport_af (lport, family));
-
-	if (privsep_set_family (lport, family) < 0) {
+	if (!(pool = get_pool (family))) {
 		err ("%p: privsep_rresvport_af: Invalid family %d\n", family);
 		errno = EINVAL;
 		return (-1);
@@ -319,20 +474,82 @@ int privsep_rresvport_af (int *lport, int family)
 	if ((errno = pthread_mutex_lock (&privsep_mutex)))
 		errx ("%p: %s:%d: mutex_lock: %m\n", __FILE__, __LINE__);
 
-	if (write (client_fd, lport, sizeof (*lport)) < 0) {
-		err ("%p: privsep: client write: %m\n");
+	if (client_fd < 0) {
+		s = bind_reserved (family, lport);
 		goto out;
 	}
 
-	s = recv_rresvport (client_fd, lport);
+	if (pool->n == 0) {
+		struct privsep_request req;
+
+		req.family = family;
+		req.count = PRIVSEP_BATCH;
+
+		if (fd_write_n (client_fd, &req, sizeof (req)) < 0) {
+			err ("%p: privsep: client write: %m\n");
+			goto out;
+		}
+		if (recv_ports (client_fd, pool) < 0)
+			goto out;
+	}
+
+	pool->n--;
+	s = pool->fds [pool->n];
+	*lport = pool->ports [pool->n];
 
 out:
+	saved_errno = errno;
 	if ((errno = pthread_mutex_unlock (&privsep_mutex)))
 		errx ("%p: %s:%d: mutex_unlock: %m\n", __FILE__, __LINE__);
+	errno = saved_errno;
 
 	return (s);
 }
 
+pid_t privsep_fork (void)
+{
+	struct privsep_request req;
+	struct port_pool channel = { AF_UNIX, 0 };
+	int fd = -1;
+	pid_t pid;
+
+	if (client_fd >= 0) {
+		req.family = AF_UNIX;
+		req.count = PRIVSEP_CHANNEL;
+
+		pthread_mutex_lock (&privsep_mutex);
+		if (fd_write_n (client_fd, &req, sizeof (req)) < 0)
+			err ("%p: privsep: client write: %m\n");
+		else if (recv_ports (client_fd, &channel) == 0)
+			fd = channel.fds [0];
+		pthread_mutex_unlock (&privsep_mutex);
+
+		if (fd < 0)
+			return (-1);
+	}
+
+	if ((pid = fork ()) == 0 && fd >= 0) {
+		/*
+		 * Child: talk to the privileged server over its own connection.
+		 *  The privileged child is not ours to reap.
+		 */
+		int i;
+
+		close (client_fd);
+		client_fd = fd;
+		cpid = -1;
+		for (i = 0; i < sizeof (pools) / sizeof (pools[0]); i++) {
+			while (pools[i].n > 0)
+				close (pools[i].fds [--pools[i].n]);
+		}
+		return (0);
+	}
+
+	if (fd >= 0)
+		close (fd);
+	return (pid);
+}
+
 int privsep_rresvport (int *lport)
 {
 	return privsep_rresvport_af (lport, AF_INET);
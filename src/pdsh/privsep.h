@@ -26,6 +26,8 @@
 #ifndef _PRIVSEP_H
 #define _PRIVSEP_H
 
+#include <sys/types.h>
+
 /*
  * Initialize privilege separation: fork off privileged child
  *  if we're running setuid.
@@ -37,6 +39,13 @@ int privsep_init (void);
  */
 int privsep_fini (void);
 
+/*
+ * fork(2), giving the child its own connection to the privileged
+ *  server so that it can request ports concurrently with this process
+ *  and its other children.
+ */
+pid_t privsep_fork (void);
+
 /*
  * Request privilege server to bind to reserved port.
  */
@@ -44,6 +53,11 @@ int privsep_rresvport (int *lport);
 
 /*
  * Request privilege server to bind to reserved port (Including family).
+ *  Returns a bound socket with its port in *lport. Unlike rresvport_af(3),
+ *  the value passed in *lport is not a starting point and is ignored:
+ *  ports are handed out in turn from the upper half of the reserved range
+ *  (taken in batches from the privileged server when running setuid), so
+ *  a caller retrying after EADDRINUSE simply calls again for another port.
  */
 int privsep_rresvport_af (int *lport, int family);
 
@@ -36,6 +36,7 @@
 #include "src/common/xmalloc.h"
 #include "src/common/xstring.h"
 #include "src/common/list.h"
+#include "src/common/hash.h"
 #include "opt.h"
 #include "mod.h"
 #include "rcmd.h"
@@ -67,7 +68,15 @@ struct node_rcmd_info {
     struct rcmd_module *rmod;
 };
 
+#define HOST_INFO_MIN_BUCKETS 256
+
+/*
+ *  Per-host rcmd info is kept in host_info_list, and indexed by
+ *   hostname in host_info_table, since misc modules may register
+ *   an rcmd type for every host in a very large wcoll.
+ */
 static List host_info_list = NULL;
+static hash_t host_info_table = NULL;
 static List rcmd_module_list = NULL;
 
 static struct rcmd_module *default_rcmd_module = NULL;
@@ -130,6 +139,7 @@ struct rcmd_module * rcmd_module_create (mod_t mod)
     rmod->rcmd_destroy = (RcmdDestroyF) mod_get_rcmd_destroy (mod);
 
     rmod->options.resolve_hosts = 1;
+    rmod->options.exit_status = 0;
 
     return (rmod);
 
@@ -148,17 +158,11 @@ static int find_rcmd_module (struct rcmd_module *x, char *name)
     return (strcmp (x->name, name) == 0);
 }
 
-static int find_host (struct node_rcmd_info *x, char *hostname)
-{
-    return (strcmp (x->hostname, hostname) == 0);
-}
-
 static struct node_rcmd_info * host_rcmd_info (char *host)
 {
-    if (host_info_list == NULL)
+    if (host_info_table == NULL)
         return (NULL);
-
-    return (list_find_first (host_info_list, (ListFindF) find_host, host));
+    return (hash_find (host_info_table, host));
 }
 
 static struct rcmd_module * rcmd_module_register (char *name)
@@ -201,8 +205,11 @@ static int hostlist_register_rcmd (const char *hosts, struct rcmd_module *rmod,
     if (hl == NULL)
         return (-1);
 
-    if (host_info_list == NULL)
+    if (host_info_list == NULL) {
         host_info_list = list_create ((ListDelF) node_rcmd_info_destroy);
+        host_info_table = hash_create (HOST_INFO_MIN_BUCKETS, hash_key_string,
+                                       hash_cmp_string, NULL);
+    }
 
     while ((host = hostlist_pop (hl))) {
         struct node_rcmd_info *n = NULL;
@@ -212,13 +219,16 @@ static int hostlist_register_rcmd (const char *hosts, struct rcmd_module *rmod,
          *   rcmd type for a host wins. This allows command line to override
          *   everything else.
          */
-        if (list_find_first (host_info_list, (ListFindF) find_host, host))
+        if (host_rcmd_info (host)) {
+            free (host);
             continue;
+        }
 
         if ((n = node_rcmd_info_create (host, user, rmod)) == NULL)
             errx ("Failed to create rcmd info for host \"%s\"\n", host);
 
         list_append (host_info_list, n);
+        hash_insert (host_info_table, n->hostname, n);
 
         free (host);
 
@@ -402,6 +412,8 @@ int rcmd_exit (void)
 {
     if (host_info_list)
         list_destroy (host_info_list);
+    if (host_info_table)
+        hash_destroy (host_info_table);
     if (rcmd_module_list)
         list_destroy (rcmd_module_list);
 
@@ -419,6 +431,9 @@ int rcmd_opt_set (int id, void * value)
         case RCMD_OPT_RESOLVE_HOSTS:
             current_rcmd_module->options.resolve_hosts = (long int) value;
             break;
+        case RCMD_OPT_EXIT_STATUS:
+            current_rcmd_module->options.exit_status = (long int) value;
+            break;
         default:
             errno = EINVAL;
             return (-1);
@@ -31,9 +31,11 @@
 
 struct rcmd_options {
 	bool resolve_hosts;
+	bool exit_status;
 };
 
 #define RCMD_OPT_RESOLVE_HOSTS 0x1
+#define RCMD_OPT_EXIT_STATUS   0x2  /* rcmd_destroy returns remote status */
 
 struct rcmd_info {
 	int                   fd;
@@ -75,7 +77,8 @@ char * rcmd_get_default_module (void);
 struct rcmd_info * rcmd_create (char *host);
 
 /*
- *  Connect using rcmd_info rcmd
+ *  Connect using rcmd_info rcmd. For modules that set resolve_hosts,
+ *   addr points to the struct sockaddr_storage of host.
  */
 int rcmd_connect (struct rcmd_info *rcmd, char *host, char *addr,
                   char *locuser, char *remuser, char *cmd, int nodeid,
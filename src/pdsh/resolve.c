@@ -0,0 +1,264 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  Background host address resolution.
+ *
+ *  Hosts are queued as the thread array is built in dsh(), and a pool
+ *   of up to RESOLVE_MAX_THREADS threads looks them up with getaddrinfo(3)
+ *   while connections to hosts resolved earlier are already under way.
+ *   Each rsh/rcp thread then waits only for its own host.
+ *
+ *  Results are kept in a hash table for the life of the process, so
+ *   repeated commands in interactive mode do not resolve hosts again.
+ *   Hosts found in the address cache file (see addrcache.c) are never
+ *   passed to the resolver threads at all.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+
+#include "src/common/err.h"
+#include "src/common/xmalloc.h"
+#include "src/common/hash.h"
+#include "addrcache.h"
+#include "resolve.h"
+
+#define RESOLVE_MAX_THREADS    32
+#define RESOLVE_MIN_BUCKETS    256
+
+typedef enum {
+    RESOLVE_QUEUED,
+    RESOLVE_BUSY,
+    RESOLVE_DONE
+} resolve_state_t;
+
+struct host_entry {
+    struct host_entry      *qnext;       /* next entry in lookup queue  */
+    char                   *host;
+    resolve_state_t         state;
+    int                     errnum;      /* getaddrinfo(3) error or 0   */
+    struct sockaddr_storage ss;
+};
+
+static pthread_mutex_t resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  resolve_cond = PTHREAD_COND_INITIALIZER;
+
+static hash_t table = NULL;
+
+static struct host_entry *qhead = NULL;
+static struct host_entry *qtail = NULL;
+static int qlen = 0;
+
+static int nthreads = 0;
+
+static addrcache_t cache = NULL;
+
+static struct host_entry * _insert (const char *host)
+{
+    struct host_entry *e = Malloc (sizeof (*e));
+
+    if (table == NULL)
+        table = hash_create (RESOLVE_MIN_BUCKETS, hash_key_string,
+                             hash_cmp_string, NULL);
+
+    memset (e, 0, sizeof (*e));
+    e->host = Strdup (host);
+    e->state = RESOLVE_DONE;
+    hash_insert (table, e->host, e);
+
+    return (e);
+}
+
+/*
+ *  Look up [host], preferring an IPv4 address since not all rcmd
+ *   protocols support IPv6. Returns 0 or a getaddrinfo(3) error.
+ */
+static int _lookup (const char *host, struct sockaddr_storage *ss)
+{
+    struct addrinfo hints;
+    struct addrinfo *res, *ai;
+    struct addrinfo *pick = NULL;
+    int rc;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((rc = getaddrinfo (host, NULL, &hints, &res)) != 0)
+        return (rc);
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            pick = ai;
+            break;
+        }
+        if (ai->ai_family == AF_INET6 && pick == NULL)
+            pick = ai;
+    }
+
+    if (pick == NULL)
+        rc = EAI_FAMILY;
+    else {
+        memset (ss, 0, sizeof (*ss));
+        memcpy (ss, pick->ai_addr, pick->ai_addrlen);
+    }
+
+    freeaddrinfo (res);
+    return (rc);
+}
+
+static void * _resolver (void *arg)
+{
+    pthread_mutex_lock (&resolve_mutex);
+    while (qhead) {
+        struct host_entry *e = qhead;
+        struct sockaddr_storage ss;
+        int rc;
+
+        if (!(qhead = e->qnext))
+            qtail = NULL;
+        qlen--;
+        e->qnext = NULL;
+        e->state = RESOLVE_BUSY;
+
+        /*
+         *  Entries are never freed, so e->host is safe to use unlocked.
+         */
+        pthread_mutex_unlock (&resolve_mutex);
+        rc = _lookup (e->host, &ss);
+        pthread_mutex_lock (&resolve_mutex);
+
+        e->errnum = rc;
+        if (rc == 0)
+            e->ss = ss;
+        e->state = RESOLVE_DONE;
+        pthread_cond_broadcast (&resolve_cond);
+    }
+    nthreads--;
+    pthread_mutex_unlock (&resolve_mutex);
+    return (NULL);
+}
+
+/*
+ *  Queue entry [e] for lookup, starting another resolver thread if
+ *   there are more queued hosts than threads. Called with resolve_mutex.
+ */
+static void _enqueue (struct host_entry *e)
+{
+    e->state = RESOLVE_QUEUED;
+    e->errnum = 0;
+    if (qtail)
+        qtail->qnext = e;
+    else
+        qhead = e;
+    qtail = e;
+    qlen++;
+
+    if (nthreads < RESOLVE_MAX_THREADS && nthreads < qlen) {
+        pthread_attr_t attr;
+        pthread_t tid;
+        int rc;
+
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        if ((rc = pthread_create (&tid, &attr, _resolver, NULL)) == 0)
+            nthreads++;
+        else if (nthreads == 0)
+            errx ("%p: unable to start resolver thread: %s\n", strerror (rc));
+        pthread_attr_destroy (&attr);
+    }
+}
+
+/*
+ *  Add a table entry for [host], taking its address from the address
+ *   cache if possible. Called with resolve_mutex.
+ */
+static struct host_entry * _add (const char *host)
+{
+    struct host_entry *e = _insert (host);
+
+    if (cache && addrcache_lookup (cache, host, &e->ss) == 0)
+        e->state = RESOLVE_DONE;
+    else
+        _enqueue (e);
+
+    return (e);
+}
+
+int resolve_cache_open (const char *path)
+{
+    int rc = 0;
+
+    pthread_mutex_lock (&resolve_mutex);
+    if (cache == NULL && !(cache = addrcache_open (path)))
+        rc = -1;
+    pthread_mutex_unlock (&resolve_mutex);
+
+    return (rc);
+}
+
+void resolve_queue (const char *host)
+{
+    struct host_entry *e;
+
+    pthread_mutex_lock (&resolve_mutex);
+    if (!table || !(e = hash_find (table, host)))
+        _add (host);
+    else if (e->state == RESOLVE_DONE && e->errnum != 0)
+        _enqueue (e);
+    pthread_mutex_unlock (&resolve_mutex);
+}
+
+int resolve_wait (const char *host, struct sockaddr_storage *ss)
+{
+    struct host_entry *e;
+    int rc;
+
+    pthread_mutex_lock (&resolve_mutex);
+    if (!table || !(e = hash_find (table, host)))
+        e = _add (host);
+    while (e->state != RESOLVE_DONE)
+        pthread_cond_wait (&resolve_cond, &resolve_mutex);
+    if ((rc = e->errnum) == 0)
+        *ss = e->ss;
+    pthread_mutex_unlock (&resolve_mutex);
+
+    return (rc);
+}
+
+const char * resolve_strerror (int errnum)
+{
+    return (gai_strerror (errnum));
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
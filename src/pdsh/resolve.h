@@ -0,0 +1,56 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+#ifndef _RESOLVE_H
+#define _RESOLVE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Use the address cache file [path] (see addrcache.h) before the
+ *  system resolver. Only the first successfully opened cache is used.
+ *  Returns -1 if the file could not be used.
+ */
+int resolve_cache_open (const char *path);
+
+/*
+ * Queue [host] for address lookup by the background resolver threads.
+ *  Lookups already completed or in progress are not repeated.
+ */
+void resolve_queue (const char *host);
+
+/*
+ * Wait for the lookup of [host] to complete, queueing it first if
+ *  necessary, and copy the address into [ss]. An IPv4 address is
+ *  returned in preference to IPv6 if the host has both.
+ *
+ * Returns 0 on success, or a nonzero error code for resolve_strerror().
+ *  A failed lookup is retried when the host is next passed to
+ *  resolve_queue().
+ */
+int resolve_wait (const char *host, struct sockaddr_storage *ss);
+
+/*
+ * Return a string describing resolve_wait() error [errnum].
+ */
+const char * resolve_strerror (int errnum);
+
+#endif /* !_RESOLVE_H */
@@ -34,18 +34,27 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "src/common/err.h"
 #include "src/common/xmalloc.h"
 #include "src/common/xstring.h"
 #include "src/common/pipecmd.h"
 #include "src/common/fd.h"
+#include "src/common/hash64.h"
+#include "src/common/hostlist.h"
 #include "dsh.h"
+#include "addrcache.h"
+#include "privsep.h"
 
 typedef enum { FAIL, PASS } testresult_t;
 typedef testresult_t((*testfun_t) (void));
@@ -56,10 +65,20 @@ typedef struct {
 
 static testresult_t _test_xstrerrorcat(void);
 static testresult_t _test_pipecmd(void);
+static testresult_t _test_hash64(void);
+static testresult_t _test_pipecmd_wait(void);
+static testresult_t _test_addrcache(void);
+static testresult_t _test_privsep(void);
+static testresult_t _test_hostlist_delete_list(void);
 
 static testcase_t testcases[] = {
     /* 0 */ {"xstrerrorcat", &_test_xstrerrorcat},
     /* 1 */ {"pipecmd",      &_test_pipecmd},
+    /* 2 */ {"hash64",       &_test_hash64},
+    /* 3 */ {"pipecmd_wait", &_test_pipecmd_wait},
+    /* 4 */ {"addrcache",    &_test_addrcache},
+    /* 5 */ {"privsep",      &_test_privsep},
+    /* 6 */ {"hostlist_delete_list", &_test_hostlist_delete_list},
 };
 
 static void _testmsg(int testnum, testresult_t result)
@@ -116,6 +135,279 @@ static testresult_t _test_pipecmd(void)
     return PASS;
 }
 
+static testresult_t _test_hash64(void)
+{
+    static const struct {
+        const char *str;
+        uint64_t hash;
+    } vectors[] = {
+        { "",    0xef46db3751d8e999ULL },
+        { "abc", 0x44bc2cf5ad770999ULL },
+    };
+    char buf [1000];
+    hash64_t h;
+    uint64_t expected;
+    testresult_t result = PASS;
+    int i;
+
+    for (i = 0; i < sizeof (vectors) / sizeof (vectors[0]); i++) {
+        uint64_t v = hash64 (vectors[i].str, strlen (vectors[i].str), 0);
+        if (v != vectors[i].hash) {
+            char got [32], want [32];
+            snprintf (got, sizeof (got), "%016llx", (unsigned long long) v);
+            snprintf (want, sizeof (want), "%016llx",
+                      (unsigned long long) vectors[i].hash);
+            err ("testcase: hash64 (\"%s\") = %s (should be %s)\n",
+                 vectors[i].str, got, want);
+            result = FAIL;
+        }
+    }
+
+    /*  Hashing in pieces of varying size must match a single pass
+     */
+    for (i = 0; i < sizeof (buf); i++)
+        buf [i] = i * 7 + 3;
+    expected = hash64 (buf, sizeof (buf), 17);
+    hash64_init (&h, 17);
+    for (i = 0; i < sizeof (buf); ) {
+        size_t n = (i % 37) + 1;
+        if (i + n > sizeof (buf))
+            n = sizeof (buf) - i;
+        hash64_update (&h, buf + i, n);
+        i += n;
+    }
+    if (hash64_final (&h) != expected) {
+        err ("testcase: hash64: incremental hash does not match\n");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+/*
+ *  Reap children in the reverse order they exit, so that each status
+ *   must be handed back to the right pipecmd.
+ */
+static testresult_t _test_pipecmd_wait(void)
+{
+    const char *args[] = { "-c", "sleep 0.%n; exit %n", NULL };
+    testresult_t result = PASS;
+    pipecmd_t p [8];
+    char host [16];
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        snprintf (host, sizeof (host), "foo%d", i);
+        if (!(p[i] = pipecmd ("/bin/sh", args, host, "foouser", i)))
+            return FAIL;
+    }
+
+    for (i = 7; i >= 0; i--) {
+        int status = -1;
+        pipecmd_wait (p[i], &status);
+        if (!WIFEXITED (status) || WEXITSTATUS (status) != i) {
+            err ("testcase: pipecmd_wait: %s: status %d\n",
+                 pipecmd_target (p[i]), status);
+            result = FAIL;
+        }
+        pipecmd_destroy (p[i]);
+    }
+
+    return result;
+}
+
+static int _addrcache_check(addrcache_t ac, const char *host,
+                            const char *expected)
+{
+    struct sockaddr_storage ss;
+    char buf [INET6_ADDRSTRLEN];
+    const void *addr;
+
+    if (addrcache_lookup (ac, host, &ss) < 0) {
+        if (expected == NULL)
+            return (0);
+        err ("testcase: addrcache: %s: not found\n", host);
+        return (-1);
+    }
+
+    if (ss.ss_family == AF_INET)
+        addr = &((struct sockaddr_in *) &ss)->sin_addr;
+    else
+        addr = &((struct sockaddr_in6 *) &ss)->sin6_addr;
+
+    if (!inet_ntop (ss.ss_family, addr, buf, sizeof (buf))
+        || expected == NULL || strcmp (buf, expected) != 0) {
+        err ("testcase: addrcache: %s: got %s, expected %s\n",
+             host, buf, expected ? expected : "none");
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ *  Build an address cache from hosts(5) lines and look every name up.
+ */
+static testresult_t _test_addrcache(void)
+{
+    char path[] = "/tmp/pdsh-addrcache.XXXXXX";
+    testresult_t result = PASS;
+    addrcache_t ac;
+    char host [64];
+    char addr [64];
+    FILE *fp;
+    int fd;
+    int i;
+
+    if ((fd = mkstemp (path)) < 0 || !(fp = tmpfile ()))
+        return FAIL;
+    close (fd);
+
+    fprintf (fp, "# comment line\n");
+    fprintf (fp, "fe80::1   both\n");
+    fprintf (fp, "10.1.1.1  both both-alias  # trailing comment\n");
+    fprintf (fp, "::1       v6only\n");
+    fprintf (fp, "10.2.2.2  Dup\n");
+    fprintf (fp, "10.3.3.3  dup\n");
+    fprintf (fp, "bogus     ignored\n");
+    for (i = 0; i < 5000; i++)
+        fprintf (fp, "10.0.%d.%d node%d\n", i / 256, i % 256, i);
+    rewind (fp);
+
+    if (addrcache_write (path, fp) != 5005 || !(ac = addrcache_open (path))) {
+        unlink (path);
+        return FAIL;
+    }
+    fclose (fp);
+    unlink (path);
+
+    for (i = 0; i < 5000; i++) {
+        snprintf (host, sizeof (host), "node%d", i);
+        snprintf (addr, sizeof (addr), "10.0.%d.%d", i / 256, i % 256);
+        if (_addrcache_check (ac, host, addr) < 0)
+            result = FAIL;
+    }
+    if (_addrcache_check (ac, "both", "10.1.1.1") < 0
+        || _addrcache_check (ac, "BOTH-alias", "10.1.1.1") < 0
+        || _addrcache_check (ac, "v6only", "::1") < 0
+        || _addrcache_check (ac, "dup", "10.2.2.2") < 0
+        || _addrcache_check (ac, "ignored", NULL) < 0
+        || _addrcache_check (ac, "node", NULL) < 0
+        || _addrcache_check (ac, "node50000", NULL) < 0
+        || _addrcache_check (ac, "zzz", NULL) < 0)
+        result = FAIL;
+
+    addrcache_close (ac);
+    return result;
+}
+
+/*
+ *  Run as root with the real uid set to nobody, as a setuid pdsh would
+ *   be, and take several batches of reserved ports from the privileged
+ *   server. Each port must be reserved, bound to the socket returned
+ *   with it, and not handed out twice.
+ */
+static testresult_t _test_privsep(void)
+{
+    testresult_t result = PASS;
+    int fds [100];
+    char seen [IPPORT_RESERVED];
+    int n = sizeof (fds) / sizeof (fds[0]);
+    int i;
+
+    if (getuid () != 0 || setreuid (65534, 0) < 0) {
+        err ("testcase: privsep: must be run as root\n");
+        return FAIL;
+    }
+    if (privsep_init () < 0 || geteuid () == 0) {
+        err ("testcase: privsep: privileged server not started\n");
+        return FAIL;
+    }
+
+    memset (seen, 0, sizeof (seen));
+    for (i = 0; i < n; i++) {
+        struct sockaddr_in sin;
+        socklen_t len = sizeof (sin);
+        int lport = 0;
+
+        if ((fds[i] = privsep_rresvport_af (&lport, AF_INET)) < 0) {
+            err ("testcase: privsep: port %d: %m\n", i);
+            n = i;
+            result = FAIL;
+            break;
+        }
+        if (getsockname (fds[i], (struct sockaddr *) &sin, &len) < 0
+            || ntohs (sin.sin_port) != lport
+            || lport <= 0 || lport >= IPPORT_RESERVED
+            || seen [lport]++) {
+            err ("testcase: privsep: bad port %d\n", lport);
+            result = FAIL;
+        }
+    }
+
+    for (i = 0; i < n; i++)
+        close (fds[i]);
+    privsep_fini ();
+
+    return result;
+}
+
+/*
+ *  Compare [hl] against [expect] with hostlist_ranged_string().
+ */
+static int _hostlist_check (hostlist_t hl, const char *expect)
+{
+    char buf [65536];
+
+    if (hostlist_ranged_string (hl, sizeof (buf), buf) < 0
+        || strcmp (buf, expect) != 0) {
+        err ("testcase: hostlist_delete_list: got \"%s\", expected \"%s\"\n",
+             buf, expect);
+        return (-1);
+    }
+    return (0);
+}
+
+/*
+ *  hostlist_delete_list() must leave the same hosts, in the same order,
+ *   as calling hostlist_delete_host() for each host to be deleted.
+ */
+static testresult_t _test_hostlist_delete_list(void)
+{
+    testresult_t result = PASS;
+    hostlist_t hl, dl, ref;
+    hostlist_iterator_t i;
+    char buf [65536];
+    char *host;
+    int n = 0;
+
+    hl = hostlist_create ("foo[1-5],bar,foo3,baz[01-03]");
+    dl = hostlist_create ("foo3,baz02,foo3,nothere,foo3");
+    if (hostlist_delete_list (hl, dl) != 3
+        || _hostlist_check (hl, "foo[1-2,4-5],bar,baz[01,03]") < 0)
+        result = FAIL;
+    hostlist_destroy (dl);
+    hostlist_destroy (hl);
+
+    hl = hostlist_create ("node[0-2999],login[1-4],node[500-1499]");
+    dl = hostlist_create ("node[0-99,200-260,1000-1100],login2,node[1000-1010]");
+    ref = hostlist_copy (hl);
+    i = hostlist_iterator_create (dl);
+    while ((host = hostlist_next (i))) {
+        n += hostlist_delete_host (ref, host);
+        free (host);
+    }
+    hostlist_iterator_destroy (i);
+    if (hostlist_ranged_string (ref, sizeof (buf), buf) < 0
+        || hostlist_delete_list (hl, dl) != n
+        || _hostlist_check (hl, buf) < 0)
+        result = FAIL;
+    hostlist_destroy (ref);
+    hostlist_destroy (dl);
+    hostlist_destroy (hl);
+
+    return result;
+}
+
 void testcase(int testnum)
 {
     testresult_t result;
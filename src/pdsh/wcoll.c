@@ -37,6 +37,10 @@
 #include <errno.h>
 #include <ctype.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "src/common/err.h"
 #include "src/common/list.h"
@@ -44,24 +48,63 @@
 #include "src/common/xstring.h"
 #include "src/common/hostlist.h"
 #include "src/common/split.h"
-#include "src/common/xstring.h"
+#include "src/common/hash64.h"
+#include "src/common/hash.h"
 #include "dsh.h"
 #include "wcoll.h"
+#include "wcollcache.h"
+
+#define INCLUDE_MIN_BUCKETS    16
+
+struct include_entry {
+    dev_t dev;
+    ino_t ino;
+};
 
 struct wcoll_ctx {
     hostlist_t hl;
     List path_list;
-    List include_cache;
+
+    /*
+     *  Set of files (by device and inode) already read, used to
+     *   detect recursive #include
+     */
+    hash_t include_table;
+
+    /*
+     *  If not NULL, the files read and the paths searched before
+     *   each was found, for wcoll_cache_put_files()
+     */
+    List files;
+
+    /*
+     *  Scratch buffer holding the current line
+     */
+    char *line;
+    size_t linesize;
 };
 
-static void free_f (void *x)
+static uint64_t include_key (const void *x)
 {
-    Free (&x);
+    const struct include_entry *e = x;
+    uint64_t key[2];
+
+    key[0] = (uint64_t) e->dev;
+    key[1] = (uint64_t) e->ino;
+    return (hash64 (key, sizeof (key), 0));
 }
 
-static int strcmp_f (char *a, char *b)
+static int include_cmp (const void *x, const void *y)
 {
-    return (strcmp (a, b) == 0);
+    const struct include_entry *a = x;
+    const struct include_entry *b = y;
+
+    return (a->dev != b->dev || a->ino != b->ino);
+}
+
+static void include_free (struct include_entry *e)
+{
+    Free ((void **) &e);
 }
 
 static struct wcoll_ctx * wcoll_ctx_create (const char *path)
@@ -72,9 +115,11 @@ static struct wcoll_ctx * wcoll_ctx_create (const char *path)
     if (!copy || !ctx)
         errx ("%p: wcoll_ctx_create: Out of memory\n");
 
+    memset (ctx, 0, sizeof (*ctx));
     ctx->hl = hostlist_create ("");
+    ctx->include_table = hash_create (INCLUDE_MIN_BUCKETS, include_key,
+                                      include_cmp, (HashDelF) include_free);
     ctx->path_list = list_split (":", copy);
-    ctx->include_cache = list_create ((ListDelF) free_f);
 
     Free ((void **) &copy);
     return (ctx);
@@ -83,7 +128,10 @@ static struct wcoll_ctx * wcoll_ctx_create (const char *path)
 static void wcoll_ctx_destroy (struct wcoll_ctx *ctx)
 {
     list_destroy (ctx->path_list);
-    list_destroy (ctx->include_cache);
+    hash_destroy (ctx->include_table);
+    if (ctx->line)
+        Free ((void **) &ctx->line);
+
     /*
      * Do not destroy hostlist, it is pulled out of ctx and returned
      *  to caller of read_wcoll()
@@ -92,12 +140,22 @@ static void wcoll_ctx_destroy (struct wcoll_ctx *ctx)
     Free ((void **)&ctx);
 }
 
-
-static int wcoll_ctx_file_is_cached (struct wcoll_ctx *ctx, char *file)
+/*
+ *  Return 1 if the file described by [st] has already been read,
+ *   otherwise remember it and return 0.
+ */
+static int wcoll_ctx_file_is_cached (struct wcoll_ctx *ctx, struct stat *st)
 {
-    if (list_find_first (ctx->include_cache, (ListFindF) strcmp_f, file))
+    struct include_entry key = { st->st_dev, st->st_ino };
+    struct include_entry *e;
+
+    if (hash_find (ctx->include_table, &key))
         return 1;
-    list_push (ctx->include_cache, Strdup (file));
+
+    e = Malloc (sizeof (*e));
+    *e = key;
+    hash_insert (ctx->include_table, e, e);
+
     return 0;
 }
 
@@ -127,6 +185,11 @@ static int wcoll_ctx_path_lookup (struct wcoll_ctx *ctx,
             rc = 0;
             break;
         }
+        if (ctx->files) {
+            struct stat st;
+            wcoll_cache_files_add (ctx->files, buf,
+                                   stat (buf, &st) == 0 ? &st : NULL);
+        }
     }
     list_iterator_destroy (i);
 
@@ -200,40 +263,162 @@ static char * wcoll_ctx_resolve_path (struct wcoll_ctx *ctx,
 
 static int wcoll_ctx_read_file (struct wcoll_ctx *ctx, const char *f);
 
-static int wcoll_ctx_read_line (struct wcoll_ctx *ctx, char *line)
+/*
+ *  Return nonzero if [host] may be appended to the hostlist directly,
+ *   i.e. hostlist_push() would treat it as a single hostname anyway.
+ */
+static int is_single_host (const char *host)
 {
+#if WANT_RECKLESS_HOSTRANGE_EXPANSION
+    /*  Unbracketed ranges like "foo1-10" are expanded here */
+    return (0);
+#else
+    return (strpbrk (host, "[], \t") == NULL && strlen (host) < 1024);
+#endif
+}
+
+static int wcoll_ctx_read_line (struct wcoll_ctx *ctx,
+        const char *s, size_t len)
+{
+    char *line;
     char *p;
     char *included;
 
+    /*
+     *  Copy the line into the scratch buffer so it may be modified
+     */
+    if (len + 1 > ctx->linesize) {
+        size_t n = ctx->linesize ? ctx->linesize : LINEBUFSIZE;
+        while (n < len + 1)
+            n *= 2;
+        if (ctx->line)
+            Realloc ((void **) &ctx->line, n);
+        else
+            ctx->line = Malloc (n);
+        ctx->linesize = n;
+    }
+    line = ctx->line;
+    memcpy (line, s, len);
+    line[len] = '\0';
+
     /*
      *  Check for comment. Zap the comment and the rest of the line
      *   unless this is an include statement '#include foo'
      */
-    if ((p = strchr(line, '#')) != NULL) {
-        if (p == line && (included = include_file (p)) != NULL)
+    if ((p = strchr (line, '#')) != NULL) {
+        if (p == line && (included = include_file (p)) != NULL) {
+            /*
+             *  The scratch buffer is reused by the included file
+             */
+            included = Strdup (included);
             wcoll_ctx_read_file (ctx, included);
+            Free ((void **) &included);
+            return 0;
+        }
         *p = '\0';
     }
     xstrcln(line, NULL);
 
-    if ((line[0] != '\0') && (hostlist_push(ctx->hl, line) == 0))
+    if (line[0] == '\0')
+        return 0;
+
+    if (is_single_host (line))
+        hostlist_push_host (ctx->hl, line);
+    else if (hostlist_push(ctx->hl, line) == 0)
         err("%p: warning: target '%s' not parsed\n", line);
 
     return 0;
 }
 
+/*
+ *  Read all lines from the [len] bytes at [buf]. The final line
+ *   need not be newline terminated.
+ */
+static int wcoll_ctx_read_buf (struct wcoll_ctx *ctx,
+        const char *buf, size_t len)
+{
+    const char *end = buf + len;
+
+    while (buf < end) {
+        const char *nl = memchr (buf, '\n', end - buf);
+        size_t n = nl ? (size_t) (nl - buf) : (size_t) (end - buf);
+        wcoll_ctx_read_line (ctx, buf, n);
+        buf += n + 1;
+    }
+    return 0;
+}
+
 static int wcoll_ctx_read_stream (struct wcoll_ctx *ctx, FILE *fp)
 {
-    char buf [LINEBUFSIZE];
+    char *buf;
+    size_t size = LINEBUFSIZE;
+    size_t len = 0;
+    size_t n;
 
     assert (ctx != NULL);
     assert (fp != NULL);
 
-    while (fgets(buf, LINEBUFSIZE, fp) != NULL)
-        wcoll_ctx_read_line (ctx, buf);
+    buf = Malloc (size);
+    while ((n = fread (buf + len, 1, size - len, fp)) > 0) {
+        len += n;
+        if (len == size) {
+            size *= 2;
+            Realloc ((void **) &buf, size);
+        }
+    }
+    wcoll_ctx_read_buf (ctx, buf, len);
+    Free ((void **) &buf);
     return 0;
 }
 
+/*
+ *  Read the open file descriptor [fd] with status [st], mapping it
+ *   into memory if it is a regular file. Closes [fd].
+ */
+static int wcoll_ctx_read_fd (struct wcoll_ctx *ctx, int fd, struct stat *st)
+{
+    void *map;
+    FILE *fp;
+
+    if (S_ISREG (st->st_mode)) {
+        if (st->st_size == 0) {
+            close (fd);
+            return 0;
+        }
+        map = mmap (NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            close (fd);
+            wcoll_ctx_read_buf (ctx, map, st->st_size);
+            munmap (map, st->st_size);
+            return 0;
+        }
+    }
+
+    /*
+     *  Not a regular file (e.g. a pipe), or mmap(2) failed
+     */
+    if (!(fp = fdopen (fd, "r"))) {
+        close (fd);
+        return -1;
+    }
+    wcoll_ctx_read_stream (ctx, fp);
+    fclose (fp);
+    return 0;
+}
+
+/*
+ *  Open [path] for reading and fill in [st], exiting with an error
+ *   message naming [name] on failure.
+ */
+static int wcoll_open (const char *path, const char *name, struct stat *st)
+{
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, st) < 0)
+        errx("%p: %s: %m\n", name);
+    return (fd);
+}
+
 
 /*
  *  Append the contents of file [f], optionally searching [path], to
@@ -249,7 +434,8 @@ static int wcoll_ctx_read_stream (struct wcoll_ctx *ctx, FILE *fp)
 static int wcoll_ctx_read_file (struct wcoll_ctx *ctx, const char *f)
 {
     char fq_path [4096];
-    FILE *fp = NULL;
+    struct stat st;
+    int fd;
 
     assert (ctx != NULL);
     assert (f != NULL);
@@ -260,27 +446,31 @@ static int wcoll_ctx_read_file (struct wcoll_ctx *ctx, const char *f)
     /*
      *  Detect recursive #include:
      */
-    if (wcoll_ctx_file_is_cached (ctx, fq_path)) {
+    fd = wcoll_open (fq_path, f, &st);
+    if (ctx->files)
+        wcoll_cache_files_add (ctx->files, fq_path, &st);
+    if (wcoll_ctx_file_is_cached (ctx, &st)) {
         err("%p: warning: file '%s' included multiple times\n", f);
+        close (fd);
         return -1;
     }
 
-    if (access(fq_path, R_OK) == -1 || !(fp = fopen(fq_path, "r")))
-        errx("%p: %s: %m\n", f);
-
-    wcoll_ctx_read_stream (ctx, fp);
-
-    fclose(fp);
-
-    return 0;
+    return (wcoll_ctx_read_fd (ctx, fd, &st));
 }
 
 hostlist_t read_wcoll_path (const char *path, const char *file)
+{
+    return (read_wcoll_path_files (path, file, NULL));
+}
+
+hostlist_t read_wcoll_path_files (const char *path, const char *file,
+                                  List files)
 {
     struct wcoll_ctx *ctx;
     hostlist_t hl;
 
     ctx = wcoll_ctx_create (path);
+    ctx->files = files;
     wcoll_ctx_read_file (ctx, file);
     hl = ctx->hl;
     wcoll_ctx_destroy (ctx);
@@ -288,6 +478,98 @@ hostlist_t read_wcoll_path (const char *path, const char *file)
     return hl;
 }
 
+#define GROUPS_MIN_BUCKETS     16
+
+struct wcoll_groups {
+    hash_t      table;          /* group name -> struct group_entry */
+    WcollGroupF read_f;
+};
+
+struct group_entry {
+    char       *name;
+    hostlist_t  hl;             /* NULL if group is empty or unknown */
+};
+
+static void group_entry_free (struct group_entry *e)
+{
+    if (e->hl)
+        hostlist_destroy (e->hl);
+    Free ((void **) &e->name);
+    Free ((void **) &e);
+}
+
+wcoll_groups_t wcoll_groups_create (WcollGroupF read_f)
+{
+    wcoll_groups_t g = Malloc (sizeof (*g));
+
+    g->table = hash_create (GROUPS_MIN_BUCKETS, hash_key_string,
+                            hash_cmp_string, (HashDelF) group_entry_free);
+    g->read_f = read_f;
+    return (g);
+}
+
+void wcoll_groups_destroy (wcoll_groups_t g)
+{
+    if (g == NULL)
+        return;
+    hash_destroy (g->table);
+    Free ((void **) &g);
+}
+
+void wcoll_groups_read (wcoll_groups_t g, List names, void *arg)
+{
+    ListIterator i;
+    char *name;
+
+    if (names == NULL)
+        return;
+
+    i = list_iterator_create (names);
+    while ((name = list_next (i))) {
+        struct group_entry *e;
+
+        if (hash_find (g->table, name))
+            continue;
+
+        e = Malloc (sizeof (*e));
+        e->name = Strdup (name);
+        e->hl = (*g->read_f) (name, arg);
+        hash_insert (g->table, e->name, e);
+    }
+    list_iterator_destroy (i);
+}
+
+hostlist_t wcoll_groups_hostlist (wcoll_groups_t g, List names, void *arg)
+{
+    ListIterator i;
+    hostlist_t hl = NULL;
+    char *name;
+
+    if (names == NULL)
+        return (NULL);
+
+    wcoll_groups_read (g, names, arg);
+
+    i = list_iterator_create (names);
+    while ((name = list_next (i))) {
+        struct group_entry *e = hash_find (g->table, name);
+
+        if (e == NULL || e->hl == NULL)
+            continue;
+
+        if (hl == NULL)
+            hl = hostlist_copy (e->hl);
+        else
+            hostlist_push_list (hl, e->hl);
+    }
+    list_iterator_destroy (i);
+
+    if (hl != NULL)
+        hostlist_uniq (hl);
+
+    return (hl);
+}
+
 /*
  *  Get the dirname for the file path [file] and copy into the buffer
  *   [dir] of length [len]. If [file] is NULL then return ".".
@@ -327,7 +609,8 @@ hostlist_t read_wcoll(char *file, FILE * f)
     char path[4096];
     hostlist_t new;
     struct wcoll_ctx *ctx;
-    FILE *fp = NULL;
+    struct stat st;
+    int fd = -1;
 
     assert(f != NULL || file != NULL);
 
@@ -336,16 +619,18 @@ hostlist_t read_wcoll(char *file, FILE * f)
         file = NULL;
     }
 
-    if (f == NULL) {            /* read_wcoll("file", NULL) */
-        if (access(file, R_OK) == -1 || !(fp = fopen(file, "r")))
-            errx("%p: %s: %m\n", file);
-    } else                      /* read_wcoll(NULL, fp) */
-        fp = f;
+    if (f == NULL)              /* read_wcoll("file", NULL) */
+        fd = wcoll_open (file, file, &st);
 
     get_file_path (file, path, sizeof (path));
 
     ctx = wcoll_ctx_create (path);
-    wcoll_ctx_read_stream (ctx, fp);
+    if (fd >= 0) {
+        /*  Catch a file that #includes itself */
+        wcoll_ctx_file_is_cached (ctx, &st);
+        wcoll_ctx_read_fd (ctx, fd, &st);
+    } else                      /* read_wcoll(NULL, fp) */
+        wcoll_ctx_read_stream (ctx, f);
     new = ctx->hl;
     wcoll_ctx_destroy (ctx);
 
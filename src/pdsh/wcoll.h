@@ -35,6 +35,7 @@
 
 #include "src/common/macros.h"
 #include "src/common/hostlist.h"
+#include "src/common/list.h"
 
 hostlist_t read_wcoll(char *, FILE *);
 
@@ -46,6 +47,36 @@ hostlist_t read_wcoll(char *, FILE *);
  */
 hostlist_t read_wcoll_path (const char *path, const char *file);
 
+/*
+ *  As read_wcoll_path(), also adding to [files] (see wcollcache.h) each
+ *   file read and each path in [path] searched before a file was found,
+ *   so a cached result can be checked against just those files.
+ */
+hostlist_t read_wcoll_path_files (const char *path, const char *file,
+                                  List files);
+
+/*
+ *  Set of named host groups (e.g. the dsh groups or netgroups named
+ *   with -g and -X), each expanded at most once per run by calling
+ *   [read_f] with the group name and the [arg] passed in.
+ */
+typedef struct wcoll_groups * wcoll_groups_t;
+typedef hostlist_t (*WcollGroupF) (const char *name, void *arg);
+
+wcoll_groups_t wcoll_groups_create (WcollGroupF read_f);
+void wcoll_groups_destroy (wcoll_groups_t g);
+
+/*
+ *  Expand each group in [names] not yet expanded.
+ */
+void wcoll_groups_read (wcoll_groups_t g, List names, void *arg);
+
+/*
+ *  Return the union of the groups in [names], expanding any not yet
+ *   expanded, or NULL if they are all empty or unknown.
+ */
+hostlist_t wcoll_groups_hostlist (wcoll_groups_t g, List names, void *arg);
+
 #endif
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
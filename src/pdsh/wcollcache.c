@@ -0,0 +1,479 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/*
+ *  Working collective cache.
+ *
+ *  Results of scheduler queries made by wcoll modules are kept in
+ *   one file per query, named by a hash of the query key. Each file
+ *   holds the NUL terminated key, to detect hash collisions, then a
+ *   NUL terminated path and status for each file the entry depends
+ *   on, an empty string, and finally the ranged hostlist string.
+ *   Entries are ignored once any such file changes. They expire by
+ *   file mtime, and expired ones are removed whenever an entry is
+ *   refreshed. A refresh is serialized by a lock file next to the
+ *   entry, which is removed again when the lock is released.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "src/common/err.h"
+#include "src/common/fd.h"
+#include "src/common/hash64.h"
+#include "src/common/list.h"
+#include "src/common/xmalloc.h"
+#include "src/common/xstring.h"
+#include "wcollcache.h"
+
+char * wcoll_cache_default_dir (void)
+{
+    char *home = getenv ("HOME");
+    char *dir = NULL;
+
+    if (home == NULL || *home == '\0')
+        return (NULL);
+
+    xstrcat (&dir, home);
+    xstrcat (&dir, "/.cache/pdsh");
+    return (dir);
+}
+
+static int _mkdir (const char *dir)
+{
+    if (mkdir (dir, 0700) < 0 && errno != EEXIST) {
+        err ("%p: wcoll cache: mkdir %s: %m\n", dir);
+        return (-1);
+    }
+    return (0);
+}
+
+int wcoll_cache_dir_check (const char *dir)
+{
+    struct stat st;
+    char *parent = Strdup ((char *) dir);
+    char *p = strrchr (parent, '/');
+
+    /*
+     *  Create the parent too, so the default $HOME/.cache/pdsh
+     *   works on a fresh account.
+     */
+    if (p && p != parent) {
+        *p = '\0';
+        if (stat (parent, &st) < 0 && _mkdir (parent) < 0) {
+            Free ((void **) &parent);
+            return (-1);
+        }
+    }
+    Free ((void **) &parent);
+
+    if (_mkdir (dir) < 0)
+        return (-1);
+
+    /*
+     *  Cached hostlists decide where commands run, so refuse a
+     *   directory that anyone else could write to.
+     */
+    if (lstat (dir, &st) < 0) {
+        err ("%p: wcoll cache: %s: %m\n", dir);
+        return (-1);
+    }
+    if (!S_ISDIR (st.st_mode)) {
+        err ("%p: wcoll cache: %s: not a directory\n", dir);
+        return (-1);
+    }
+    if (st.st_uid != geteuid ()) {
+        err ("%p: wcoll cache: %s: not owned by current user\n", dir);
+        return (-1);
+    }
+    if (st.st_mode & (S_IWGRP | S_IWOTH)) {
+        err ("%p: wcoll cache: %s: writable by group or other\n", dir);
+        return (-1);
+    }
+    return (0);
+}
+
+static char * _path (const char *dir, const char *key, const char *suffix)
+{
+    char name [64];
+    char *path = NULL;
+
+    snprintf (name, sizeof (name), "/%016llx%s",
+              (unsigned long long) hash64 (key, strlen (key), 0), suffix);
+    xstrcat (&path, (char *) dir);
+    xstrcat (&path, name);
+    return (path);
+}
+
+/*
+ * Return the suffix of cache file [name] after its 16 digit hash, or
+ *  NULL if [name] is not a cache file.
+ */
+static const char * _suffix (const char *name)
+{
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        if (!isxdigit ((unsigned char) name[i]))
+            return (NULL);
+    }
+    return (name + 16);
+}
+
+/*
+ * Return nonzero if [fd] is still open on the file at [path], i.e. the
+ *  lock file has not been removed and recreated since [fd] was opened.
+ */
+static int _is_current (int fd, const char *path)
+{
+    struct stat st, sp;
+
+    return (fstat (fd, &st) == 0 && stat (path, &sp) == 0
+            && st.st_dev == sp.st_dev && st.st_ino == sp.st_ino);
+}
+
+/*
+ * Remove the lock file [path] if no process holds it. The lock file of
+ *  a pdsh that was killed while refreshing an entry is left behind.
+ *  Must not be called on a lock file this process holds, since closing
+ *  [fd] would release that lock.
+ */
+static void _remove_stale_lock (const char *path)
+{
+    int fd;
+
+    if ((fd = open (path, O_RDWR)) < 0)
+        return;
+    if (fd_get_write_lock (fd) == 0 && _is_current (fd, path))
+        unlink (path);
+    close (fd);
+}
+
+/*
+ * Current time in seconds, for comparison with file mtimes. time(2)
+ *  may read a coarse clock that lags the timestamp just given to a
+ *  new file, which would make a fresh entry look like it is from the
+ *  future.
+ */
+static time_t _now (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (tv.tv_sec);
+}
+
+/*
+ * Remove files in [dir] older than [ttl] seconds: expired entries,
+ *  temporary files left by an interrupted wcoll_cache_put(), and lock
+ *  files no process holds, except the lock for [key] held by the caller.
+ *  An entry refreshed by another process between the age check and
+ *  unlink() is lost, which only costs that process a cache miss.
+ */
+static void _expire (const char *dir, const char *key, int ttl)
+{
+    DIR *dirp;
+    struct dirent *d;
+    time_t now = _now ();
+    char *lock = _path (dir, key, ".lock");
+    char *path = NULL;
+
+    if (!(dirp = opendir (dir)))
+        return;
+
+    while ((d = readdir (dirp))) {
+        const char *suffix = _suffix (d->d_name);
+        struct stat st;
+
+        if (suffix == NULL)
+            continue;
+
+        xstrcat (&path, (char *) dir);
+        xstrcatchar (&path, '/');
+        xstrcat (&path, d->d_name);
+
+        if (strcmp (path, lock) != 0
+            && lstat (path, &st) == 0 && S_ISREG (st.st_mode)
+            && (st.st_mtime > now || now - st.st_mtime >= ttl)) {
+            if (strcmp (suffix, ".lock") == 0)
+                _remove_stale_lock (path);
+            else
+                unlink (path);
+        }
+
+        Free ((void **) &path);
+    }
+    closedir (dirp);
+    Free ((void **) &lock);
+}
+
+/*
+ * A file an entry depends on, with its status when it was read.
+ */
+struct wcoll_cache_file {
+    char *path;
+    char  stamp [128];
+};
+
+/*
+ * Format the parts of [st] that change when a file is modified or
+ *  replaced into [buf]. A file that does not exist has stamp "-".
+ */
+static void _stamp (const struct stat *st, char *buf, size_t len)
+{
+    if (st == NULL) {
+        snprintf (buf, len, "-");
+        return;
+    }
+    snprintf (buf, len, "%llu %llu %llu %o %lld.%09ld",
+              (unsigned long long) st->st_dev,
+              (unsigned long long) st->st_ino,
+              (unsigned long long) st->st_size,
+              (unsigned int) st->st_mode,
+              (long long) st->st_mtim.tv_sec,
+              (long) st->st_mtim.tv_nsec);
+}
+
+/*
+ * Return nonzero if [path] still has the status recorded in [stamp].
+ */
+static int _file_is_current (const char *path, const char *stamp)
+{
+    struct stat st;
+    char buf [128];
+
+    _stamp (stat (path, &st) == 0 ? &st : NULL, buf, sizeof (buf));
+    return (strcmp (buf, stamp) == 0);
+}
+
+static void _file_destroy (struct wcoll_cache_file *f)
+{
+    Free ((void **) &f->path);
+    Free ((void **) &f);
+}
+
+List wcoll_cache_files_create (void)
+{
+    return (list_create ((ListDelF) _file_destroy));
+}
+
+void wcoll_cache_files_add (List files, const char *path,
+                            const struct stat *st)
+{
+    struct wcoll_cache_file *f = Malloc (sizeof (*f));
+
+    f->path = Strdup ((char *) path);
+    _stamp (st, f->stamp, sizeof (f->stamp));
+    list_append (files, f);
+}
+
+/*
+ * Check the file records in the entry at [p], ending before [end].
+ *  Returns a pointer to the hostlist string that follows them, or
+ *  NULL if the records are malformed or any file has changed.
+ */
+static char * _check_files (char *p, char *end)
+{
+    while (p < end && *p != '\0') {
+        char *path = p;
+        char *stamp = p + strlen (p) + 1;
+
+        if (stamp >= end || !_file_is_current (path, stamp))
+            return (NULL);
+        p = stamp + strlen (stamp) + 1;
+    }
+    return (p < end ? p + 1 : NULL);
+}
+
+hostlist_t wcoll_cache_get (const char *dir, const char *key, int ttl)
+{
+    char *path = _path (dir, key, "");
+    size_t keylen = strlen (key) + 1;
+    hostlist_t hl = NULL;
+    struct stat st;
+    time_t now = _now ();
+    char *buf = NULL;
+    char *hosts;
+    int fd;
+
+    if ((fd = open (path, O_RDONLY)) < 0)
+        goto out;
+
+    if (fstat (fd, &st) < 0
+        || st.st_mtime > now
+        || now - st.st_mtime >= ttl
+        || (size_t) st.st_size <= keylen)
+        goto out;
+
+    buf = Malloc (st.st_size + 1);
+    if (fd_read_n (fd, buf, st.st_size) != st.st_size)
+        goto out;
+    buf[st.st_size] = '\0';
+
+    if (memcmp (buf, key, keylen) == 0
+        && (hosts = _check_files (buf + keylen, buf + st.st_size)))
+        hl = hostlist_create (hosts);
+
+  out:
+    if (fd >= 0)
+        close (fd);
+    if (buf)
+        Free ((void **) &buf);
+    Free ((void **) &path);
+    return (hl);
+}
+
+int wcoll_cache_put (const char *dir, const char *key, hostlist_t hl,
+                     int ttl)
+{
+    return (wcoll_cache_put_files (dir, key, hl, ttl, NULL));
+}
+
+/*
+ * Write the file records for [files] to [fd], ending with an empty
+ *  string.
+ */
+static int _write_files (int fd, List files)
+{
+    struct wcoll_cache_file *f;
+    ListIterator i;
+    int rc = 0;
+
+    if (files) {
+        i = list_iterator_create (files);
+        while (rc == 0 && (f = list_next (i))) {
+            if (fd_write_n (fd, f->path, strlen (f->path) + 1) < 0
+                || fd_write_n (fd, f->stamp, strlen (f->stamp) + 1) < 0)
+                rc = -1;
+        }
+        list_iterator_destroy (i);
+    }
+    if (rc == 0 && fd_write_n (fd, "", 1) < 0)
+        rc = -1;
+    return (rc);
+}
+
+int wcoll_cache_put_files (const char *dir, const char *key, hostlist_t hl,
+                           int ttl, List files)
+{
+    size_t n = 4096;
+    char *s = Malloc (n);
+    char *path = _path (dir, key, "");
+    char *tmp = NULL;
+    int rc = -1;
+    int fd;
+
+    while (hostlist_ranged_string (hl, n - 1, s) < 0) {
+        n *= 2;
+        Realloc ((void **) &s, n);
+    }
+
+    xstrcat (&tmp, path);
+    xstrcat (&tmp, ".XXXXXX");
+    if ((fd = mkstemp (tmp)) < 0) {
+        err ("%p: wcoll cache: %s: %m\n", tmp);
+        goto out;
+    }
+
+    if (fd_write_n (fd, (char *) key, strlen (key) + 1) < 0
+        || _write_files (fd, files) < 0
+        || fd_write_n (fd, s, strlen (s)) < 0) {
+        err ("%p: wcoll cache: %s: %m\n", tmp);
+        close (fd);
+        unlink (tmp);
+        goto out;
+    }
+    if (close (fd) < 0) {
+        err ("%p: wcoll cache: %s: %m\n", tmp);
+        unlink (tmp);
+        goto out;
+    }
+
+    if (rename (tmp, path) < 0) {
+        err ("%p: wcoll cache: rename %s: %m\n", tmp);
+        unlink (tmp);
+        goto out;
+    }
+    rc = 0;
+
+    _expire (dir, key, ttl);
+
+  out:
+    Free ((void **) &tmp);
+    Free ((void **) &path);
+    Free ((void **) &s);
+    return (rc);
+}
+
+int wcoll_cache_lock (const char *dir, const char *key)
+{
+    char *path = _path (dir, key, ".lock");
+    int fd;
+
+    /*
+     *  The previous holder removes the lock file before releasing it,
+     *   so if the file we locked is no longer at [path], start over.
+     */
+    while ((fd = open (path, O_RDWR | O_CREAT, 0600)) >= 0) {
+        if (fd_get_writew_lock (fd) < 0) {
+            close (fd);
+            fd = -1;
+            break;
+        }
+        if (_is_current (fd, path))
+            break;
+        close (fd);
+    }
+
+    Free ((void **) &path);
+    return (fd);
+}
+
+void wcoll_cache_unlock (const char *dir, const char *key, int fd)
+{
+    char *path;
+
+    if (fd < 0)
+        return;
+    path = _path (dir, key, ".lock");
+    unlink (path);
+    fd_release_lock (fd);
+    close (fd);
+    Free ((void **) &path);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,92 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  This file is part of Pdsh, a parallel remote shell program.
+ *  For details, see <http://www.llnl.gov/linux/pdsh/>.
+ *
+ *  Pdsh is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *
+ *  Pdsh is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with Pdsh; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+#ifndef _WCOLLCACHE_H
+#define _WCOLLCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "src/common/hostlist.h"
+#include "src/common/list.h"
+
+/*
+ * Return the default cache directory, $HOME/.cache/pdsh, in a
+ *  newly allocated string, or NULL if HOME is not set.
+ */
+char * wcoll_cache_default_dir (void);
+
+/*
+ * Check that cache directory [dir] exists and is private to the
+ *  current user, creating it if necessary. Returns -1 with an error
+ *  message if the directory cannot be used.
+ */
+int wcoll_cache_dir_check (const char *dir);
+
+/*
+ * Return the hostlist stored under [key] in cache directory [dir],
+ *  or NULL if there is no entry, it is older than [ttl] seconds, or
+ *  a file it depends on has changed.
+ */
+hostlist_t wcoll_cache_get (const char *dir, const char *key, int ttl);
+
+/*
+ * Store [hl] under [key] in cache directory [dir]. The entry is
+ *  replaced atomically, so concurrent readers see either the old
+ *  or the new hostlist. Entries older than [ttl] seconds are removed
+ *  from [dir] at the same time. Returns -1 on failure.
+ */
+int wcoll_cache_put (const char *dir, const char *key, hostlist_t hl,
+                     int ttl);
+
+/*
+ * Create an empty list of the files a cache entry depends on.
+ */
+List wcoll_cache_files_create (void);
+
+/*
+ * Add [path] to [files] with status [st], taken when it was read, or
+ *  NULL if [path] did not exist.
+ */
+void wcoll_cache_files_add (List files, const char *path,
+                            const struct stat *st);
+
+/*
+ * Like wcoll_cache_put(), but wcoll_cache_get() ignores the entry
+ *  once any path in [files] no longer has the status recorded.
+ *  [files] may be NULL.
+ */
+int wcoll_cache_put_files (const char *dir, const char *key, hostlist_t hl,
+                           int ttl, List files);
+
+/*
+ * Take an exclusive lock on the entry for [key], waiting for any other
+ *  process refreshing the same entry. Returns a descriptor to pass to
+ *  wcoll_cache_unlock(), or -1 if the lock could not be taken.
+ */
+int wcoll_cache_lock (const char *dir, const char *key);
+
+/*
+ * Release a lock taken by wcoll_cache_lock() for [key], removing the
+ *  lock file. [fd] may be -1.
+ */
+void wcoll_cache_unlock (const char *dir, const char *key, int fd);
+
+#endif /* !_WCOLLCACHE_H */
@@ -12,4 +12,20 @@ test_expect_success 'working xstrerrorcat' '
 test_expect_success 'working pipecmd' '
 	pdsh -T1
 '
+test_expect_success 'working hash64' '
+	pdsh -T2 | grep "hash64: PASS"
+'
+test_expect_success 'working pipecmd_wait' '
+	pdsh -T3 | grep "pipecmd_wait: PASS"
+'
+test_expect_success 'working addrcache' '
+	pdsh -T4 | grep "addrcache: PASS"
+'
+test_expect_success 'working hostlist_delete_list' '
+	pdsh -T6 | grep "hostlist_delete_list: PASS"
+'
+test "$(id -u)" = 0 && test_set_prereq ROOT
+test_expect_success ROOT 'working privsep port batching' '
+	pdsh -T5 | grep "privsep: PASS"
+'
 test_done
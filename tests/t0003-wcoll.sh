@@ -170,4 +170,43 @@ test_expect_success 'wcoll: #include alone fails' '
 	pdsh -w^testdir/C -q 2>&1 | grep -q warning
 '
 
+mkdir nested
+printf "foo1\n#include B\nfoo5" >nested/A
+cat >nested/B <<EOF
+foo2
+#include C
+#include D
+EOF
+cat >nested/C <<EOF
+foo3
+#include D
+EOF
+cat >nested/D <<EOF
+foo4
+#include A
+EOF
+
+test_expect_success 'wcoll nested #include reads each file once' '
+    test_output_is_expected "$(WCOLL=nested/A pdsh -q 2>/dev/null | tail -1)" \
+                            "foo[1-5]" &&
+	WCOLL=nested/A pdsh -q 2>&1 | grep -q "included multiple times"
+'
+test_expect_success 'wcoll file without trailing newline' '
+	printf "foo1\nfoo2" >wcoll &&
+	test_pdsh_wcoll "^wcoll" "foo1,foo2"
+'
+test_expect_success 'wcoll lines longer than 2048 characters' '
+	i=1 && while test $i -le 600; do printf "foo$i,"; i=$((i+1)); done >wcoll &&
+	test_output_is_expected "$(WCOLL=wcoll pdsh -q | tail -1)" "foo[1-600]"
+'
+test_expect_success 'wcoll file with many lines' '
+	i=1 && while test $i -le 5000; do echo foo$i; i=$((i+1)); done >wcoll &&
+	test_output_is_expected "$(WCOLL=wcoll pdsh -q | tail -1)" "foo[1-5000]"
+'
+test_expect_success 'wcoll file read from a pipe' '
+	test_output_is_expected \
+	    "$(printf "foo1\nfoo2\n" | WCOLL=/dev/stdin pdsh -q | tail -1)" \
+	    "foo[1-2]"
+'
+
 test_done
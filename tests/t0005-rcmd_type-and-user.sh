@@ -22,4 +22,40 @@ test_expect_success 'Can set rcmd_type and user via rcmd_type:user@hosts' '
     PDSH_RCMD_TYPE=ssh
 	pdsh -S -w exec:bar@foo[1-10] test "%u" = bar
 '
+test_expect_success MOD_RCMD_RSH 'unresolvable host fails only that host' '
+	test_must_fail pdsh -S -w rsh:foo.invalid,exec:bar echo ok >output 2>&1 &&
+	grep "^bar: ok" output &&
+	grep "foo" output | grep -v "^bar"
+'
+test_debug '
+	cat output
+'
+test "$(id -u)" = 0 && test_set_prereq ROOT
+test_expect_success 'pdsh-addrcache writes an address cache' '
+	echo "192.0.2.1 cached.invalid" | pdsh-addrcache addrs &&
+	test -s addrs
+'
+test_expect_success 'pdsh-addrcache rejects bad usage' '
+	test_must_fail pdsh-addrcache </dev/null 2>output &&
+	grep "Usage:" output
+'
+test_expect_success MOD_RCMD_RSH,ROOT 'PDSH_ADDR_CACHE is used to resolve hosts' '
+	echo "127.0.0.1 cached.invalid" | pdsh-addrcache addrs-local &&
+	test_must_fail env PDSH_ADDR_CACHE=addrs-local \
+	    pdsh -S -t1 -Rrsh -w cached.invalid true >output 2>&1 &&
+	! grep -i "resolution\|not known" output &&
+	grep "cached: connect: Connection refused" output
+'
+test_debug '
+	cat output
+'
+test_expect_success MOD_RCMD_RSH 'unusable PDSH_ADDR_CACHE is reported' '
+	echo junk >addrs-bad &&
+	test_must_fail env PDSH_ADDR_CACHE=addrs-bad \
+	    pdsh -S -t1 -Rrsh -w cached.invalid true >output 2>&1 &&
+	grep "not using address cache addrs-bad" output
+'
+test_debug '
+	cat output
+'
 test_done
@@ -72,6 +72,31 @@ test_expect_success '-u sets command timeout' '
 test_expect_success 'command timeout 0 by default' '
     pdcp -w foo -q * /tmp | grep -q "Command timeout (secs)[ 	]*0$"
 '
+pdcp -c -w foo -q * /tmp >/dev/null 2>&1 && test_set_prereq ZLIB
+test_expect_success ZLIB '-c enables compression' '
+	check_pdcp_option c "Compress data" Yes
+'
+test_expect_success '-s enables skipping unchanged files' '
+	check_pdcp_option s "Skip unchanged" Yes
+'
+test_expect_success '-W enables atomic writes' '
+	check_pdcp_option W "Atomic write" Yes
+'
+test_expect_success '-D enables direct I/O' '
+	check_pdcp_option D "Direct I/O" Yes
+'
+test_expect_success '-o enables resume' '
+	check_pdcp_option o "Resume partial copies" Yes
+'
+test_expect_success '-n sets retry count' '
+	check_pdcp_option n "Retry failed hosts" 3
+'
+test_expect_success '-o and -W are incompatible' '
+	test_must_fail pdcp -o -W -w foo -q * /tmp 2>&1 | grep "cannot be used"
+'
+test_expect_success '-o and -c are incompatible' '
+	test_must_fail pdcp -o -c -w foo -q * /tmp 2>&1 | grep "cannot be used"
+'
 
 export T="$TEST_DIRECTORY/test-modules/.libs"
 
@@ -145,5 +170,184 @@ test_expect_success DYNAMIC_MODULES,NOTROOT 'rpdcp -r works' '
 	PDSH_MODULE_DIR=$T rpdcp -Rpcptest -w "$HOSTS" -r tree output/ &&
 	pdsh -SRexec -w "$HOSTS" diff -r tree output/tree.%h >/dev/null
 '
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -r works with many files' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* many" &&
+	mkdir many &&
+	for i in $(seq 1 200); do echo $i >many/f$i || return 1; done &&
+	create_random_file many/large 4096 &&
+	create_random_file many/f100 64 &&
+	PDSH_MODULE_DIR=$T pdcp -Rpcptest -w "$HOSTS" -r many . &&
+	pdsh -SRexec -w "$HOSTS" diff -r many %h/many >/dev/null
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp works with large files' '
+	HOSTS="host[0-1]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* large" &&
+	create_random_file large 70000 &&
+	PDSH_MODULE_DIR=$T pdcp -Rpcptest -w "$HOSTS" large large &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP large %h/large
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -D works' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	create_random_file testfile 9001 &&
+	PDSH_MODULE_DIR=$T pdcp -D -Rpcptest -w "$HOSTS" -r testfile tree . &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/testfile &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -W works' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	create_random_file testfile 100 &&
+	pdsh -SRexec -w "$HOSTS" cp tree/foo %h/testfile &&
+	chmod 640 host0/testfile &&
+	PDSH_MODULE_DIR=$T pdcp -W -Rpcptest -w "$HOSTS" -r testfile tree . &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/testfile &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null &&
+	test "$(stat -c %a host0/testfile)" = 640 &&
+	test -z "$(find host* -name "*pdcp*")"
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -W leaves no file behind on error' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	create_random_file testfile 100 &&
+	pdsh -SRexec -w "$HOSTS" mkdir %h/testfile &&
+	PDSH_MODULE_DIR=$T pdcp -W -Rpcptest -w "$HOSTS" testfile tree/foo . \
+	    2>&1 | grep "testfile: Is a directory" &&
+	pdsh -SRexec -w "$HOSTS" test -d %h/testfile &&
+	test -z "$(find host* -name "*pdcp*")"
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -o resumes partial copies' '
+	HOSTS="host[0-5]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	create_random_file testfile 20000 &&
+	pdsh -SRexec -w "host[0-1]" dd if=testfile of=%h/testfile bs=1024 count=9000 &&
+	pdsh -SRexec -w "host2" dd if=testfile of=%h/testfile bs=1024 count=3000 &&
+	pdsh -SRexec -w "host3" dd if=/dev/zero of=%h/testfile bs=1024 count=9000 &&
+	pdsh -SRexec -w "host4" cp testfile %h/testfile &&
+	dd if=/dev/zero of=host1/testfile bs=1024 seek=5000 count=1 conv=notrunc &&
+	cat testfile testfile >host4/testfile &&
+	PDSH_MODULE_DIR=$T pdcp -o -Rpcptest -w "$HOSTS" -r testfile tree . &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/testfile &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -o does not rewrite matching blocks' '
+	HOSTS="host[0-1]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	dd if=/dev/zero of=testfile bs=1024 count=8192 &&
+	create_random_file random 2048 &&
+	cat random >>testfile && rm random &&
+	pdsh -SRexec -w "$HOSTS" truncate -s 8M %h/testfile &&
+	PDSH_MODULE_DIR=$T pdcp -o -Rpcptest -w "$HOSTS" testfile testfile &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/testfile &&
+	test $(du -k host0/testfile | cut -f1) -lt 4096
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'rpdcp -o works' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile output" &&
+	create_random_file testfile 10000 &&
+	pdsh -SRexec -w "$HOSTS" cp testfile %h/testfile &&
+	mkdir output &&
+	dd if=testfile of=output/testfile.host0 bs=1024 count=5000 &&
+	PDSH_MODULE_DIR=$T rpdcp -o -Rpcptest -w "$HOSTS" testfile output/ &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile output/testfile.%h
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -n retries only failed hosts' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile output" &&
+	create_random_file testfile 10 &&
+	pdsh -SRexec -w "host[0-1]" mkdir %h/dir &&
+	PDSH_MODULE_DIR=$T pdcp -n 2 -Rpcptest -w "$HOSTS" testfile dir/testfile \
+	    >output 2>&1 &&
+	test $(grep -c "retrying 2 failed hosts" output) -eq 2 &&
+	test $(grep -c "host2.*No such file" output) -eq 3 &&
+	pdsh -SRexec -w "host[0-1]" $GIT_TEST_CMP testfile %h/dir/testfile
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -n does not retry successful hosts' '
+	HOSTS="host[0-3]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile output" &&
+	create_random_file testfile 10 &&
+	PDSH_MODULE_DIR=$T pdcp -n 2 -Rpcptest -w "$HOSTS" testfile testfile \
+	    >output 2>&1 &&
+	test_must_fail grep retrying output &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/testfile
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT,ZLIB 'pdcp -c works' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* ctree" &&
+	mkdir ctree &&
+	create_random_file ctree/random 512 &&
+	seq 1 100000 >ctree/text &&
+	: >ctree/empty &&
+	PDSH_MODULE_DIR=$T pdcp -c -Rpcptest -w "$HOSTS" -r ctree tree . &&
+	pdsh -SRexec -w "$HOSTS" diff -r ctree %h/ctree >/dev/null &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT,ZLIB 'rpdcp -c works' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* output" &&
+	pdsh -SRexec -w "$HOSTS" cp -r tree %h/ &&
+	mkdir output &&
+	PDSH_MODULE_DIR=$T rpdcp -c -Rpcptest -w "$HOSTS" -r tree output/ &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree output/tree.%h >/dev/null
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -s works' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* stamp" &&
+	PDSH_MODULE_DIR=$T pdcp -s -Rpcptest -w "$HOSTS" -r tree . &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null &&
+	pdsh -SRexec -w "$HOSTS" touch -t 200001010000 %h/tree/foo %h/tree/dir/data &&
+	touch stamp &&
+	pdsh -SRexec -w "host[0-3]" cp tree/foo %h/tree/bar/zzz &&
+	pdsh -SRexec -w "host[4-7]" rm %h/tree/dir/a/b/c/d/e/file &&
+	PDSH_MODULE_DIR=$T pdcp -s -Rpcptest -w "$HOSTS" -r tree . &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree %h/tree >/dev/null &&
+	test -z "$(find host* -name foo -newer stamp)" &&
+	test -z "$(find host* -name data -newer stamp)"
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -s -p copies files with changed mtime' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* old" &&
+	PDSH_MODULE_DIR=$T pdcp -s -p -Rpcptest -w "$HOSTS" -r tree . &&
+	pdsh -SRexec -w "$HOSTS" touch -t 200001010000 %h/tree/foo &&
+	touch -t 200101010000 old &&
+	PDSH_MODULE_DIR=$T pdcp -s -p -Rpcptest -w "$HOSTS" -r tree . &&
+	test -z "$(find host* -name foo ! -newer old)"
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'pdcp -s to single file target' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* testfile" &&
+	create_random_file testfile 10 &&
+	pdsh -SRexec -w "host[0-5]" cp testfile %h/newfile &&
+	PDSH_MODULE_DIR=$T pdcp -s -Rpcptest -w "$HOSTS" testfile newfile &&
+	pdsh -SRexec -w "$HOSTS" $GIT_TEST_CMP testfile %h/newfile
+'
+test_expect_success DYNAMIC_MODULES,NOTROOT 'rpdcp -s works' '
+	HOSTS="host[0-10]"
+	setup_host_dirs "$HOSTS" &&
+	test_when_finished "rm -rf host* output" &&
+	pdsh -SRexec -w "$HOSTS" cp -r tree %h/ &&
+	mkdir output &&
+	PDSH_MODULE_DIR=$T rpdcp -s -Rpcptest -w "$HOSTS" -r tree output/ &&
+	pdsh -SRexec -w "$HOSTS" diff -r tree output/tree.%h >/dev/null &&
+	echo changed >host3/tree/foo &&
+	PDSH_MODULE_DIR=$T rpdcp -s -Rpcptest -w "$HOSTS" -r tree output/ &&
+	pdsh -SRexec -w "$HOSTS" diff -r %h/tree output/tree.%h >/dev/null
+'
 
 test_done
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='pdsh agent
+
+Test running commands through a persistent pdsh agent (-U).'
+
+. ${srcdir:-.}/test-lib.sh
+
+if ! test_have_prereq MOD_RCMD_EXEC; then
+	skip_all='skipping agent tests, exec module not available'
+	test_done
+fi
+
+AGENT_SOCKET=$(pwd)/agent.sock
+unset PDSH_AGENT_SOCKET
+
+test_expect_success 'start agent' '
+	pdsh -U "$AGENT_SOCKET" >agent.log 2>&1 &
+	echo $! >agent.pid &&
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		test -S "$AGENT_SOCKET" && break
+		sleep 0.2
+	done &&
+	test -S "$AGENT_SOCKET"
+'
+test_expect_success 'agent socket is private' '
+	ls -l "$AGENT_SOCKET" | grep "^srwx------"
+'
+test_expect_success 'command is run by agent' '
+	AGENT_PID=$(cat agent.pid) &&
+	OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -Rexec -w foo[1-3] \
+	    sh -c "awk \"/^PPid/ {print \\\$2}\" /proc/\$PPID/status") &&
+	test $(echo "$OUTPUT" | grep -c "foo[1-3]: $AGENT_PID$") -eq 3
+'
+test_expect_success 'second agent on the same socket fails' '
+	test_must_fail pdsh -U "$AGENT_SOCKET" 2>stderr &&
+	grep "agent already running on $AGENT_SOCKET" stderr &&
+	kill -0 $(cat agent.pid) &&
+	OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -Rexec -w foo1 echo hi) &&
+	test "$OUTPUT" = "foo1: hi" &&
+	! grep "invalid request" agent.log
+'
+test_expect_success 'agent returns remote exit status' '
+	PDSH_AGENT_SOCKET="$AGENT_SOCKET" \
+	    test_expect_code 5 pdsh -S -Rexec -w foo1 sh -c "exit 5"
+'
+test_expect_success 'agent uses working directory and environment' '
+	mkdir subdir &&
+	OUTPUT=$(cd subdir && PDSH_AGENT_SOCKET="$AGENT_SOCKET" FOO=bar \
+	    pdsh -Rexec -w foo1 sh -c "echo \$(pwd) \$FOO") &&
+	test "$OUTPUT" = "foo1: $(pwd)/subdir bar"
+'
+test_expect_success 'agent reads WCOLL file for each command' '
+	echo foo1 >hosts &&
+	OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" WCOLL=hosts \
+	    pdsh -Rexec echo %h) &&
+	test "$OUTPUT" = "foo1: foo1" &&
+	echo foo2 >hosts &&
+	OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" WCOLL=hosts \
+	    pdsh -Rexec echo %h) &&
+	test "$OUTPUT" = "foo2: foo2"
+'
+test_expect_success 'agent warns that -M is fixed at startup' '
+	PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -M foo -Rexec -w foo1 true \
+	    2>stderr &&
+	grep "modules were chosen when the agent started" stderr
+'
+test_expect_success 'agent output goes to stderr' '
+	PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -Rexec -w foo1 \
+	    sh -c "echo err >&2" 2>stderr >stdout &&
+	grep "foo1: err" stderr &&
+	test ! -s stdout
+'
+test_expect_success 'agent exits and removes socket on SIGTERM' '
+	kill $(cat agent.pid) &&
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		test -S "$AGENT_SOCKET" || break
+		sleep 0.2
+	done &&
+	test ! -S "$AGENT_SOCKET"
+'
+test_expect_success 'command runs locally without agent' '
+	OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -Rexec -w foo1 echo hi) &&
+	test "$OUTPUT" = "foo1: hi"
+'
+test_expect_success 'killed agent leaves a stale socket' '
+	pdsh -U "$AGENT_SOCKET" >agent.log 2>&1 &
+	echo $! >agent.pid &&
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		test -S "$AGENT_SOCKET" && break
+		sleep 0.2
+	done &&
+	kill -9 $(cat agent.pid) &&
+	test -S "$AGENT_SOCKET"
+'
+test_expect_success 'agent replaces a stale socket' '
+	pdsh -U "$AGENT_SOCKET" >agent.log 2>&1 &
+	echo $! >agent.pid &&
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		OUTPUT=$(PDSH_AGENT_SOCKET="$AGENT_SOCKET" pdsh -Rexec -w foo1 \
+		    sh -c "awk \"/^PPid/ {print \\\$2}\" /proc/\$PPID/status") &&
+		test "$OUTPUT" = "foo1: $(cat agent.pid)" && break
+		sleep 0.2
+	done &&
+	test "$OUTPUT" = "foo1: $(cat agent.pid)"
+'
+kill $(cat agent.pid) 2>/dev/null
+test_done
@@ -128,6 +128,21 @@ test_expect_success 'pdsh -X option supports genders_query' '
 	test_output_is_expected "$OUTPUT" "n[0-5,8-10]"
 '
 
+test_expect_success 'pdsh -g filter matches hosts by altname' '
+	OUTPUT=$(pdsh -F genders.B -w en[1-3],n4,x1 -g foo -q | tail -1)
+	test_output_is_expected "$OUTPUT" "en[1-3],n4"
+'
+
+test_expect_success 'pdsh -X excludes hosts given by altname' '
+	OUTPUT=$(pdsh -F genders.B -w en[1-3],n4,x1 -X foo -q | tail -1)
+	test_output_is_expected "$OUTPUT" "x1"
+'
+
+test_expect_success 'pdsh -i maps altnames back to canonical names' '
+	OUTPUT=$(pdsh -F genders.B -w en[1-3],x1 -i -q | tail -1)
+	test_output_is_expected "$OUTPUT" "n[1-3],x1"
+'
+
 test_expect_success 'pdsh -x excludes hosts selected by genders' '
 	OUTPUT=$(pdsh -F genders.A -AX "os=fedora&&foo" -x n5 -q | tail -1)
 	test_output_is_expected "$OUTPUT" "n[0-4,8-10]"
@@ -154,6 +169,13 @@ test_expect_success MOD_RCMD_EXEC 'genders pdsh_rcmd_type attribute' '
     PDSH_RCMD_TYPE=ssh
 	pdsh -S -Fgenders.C -A true
 '
+cat >genders.D <<EOF
+node[0-10] pdsh_rcmd_type=exec,altname=a%n
+EOF
+test_expect_success MOD_RCMD_EXEC 'genders pdsh_rcmd_type applies to altnames' '
+    PDSH_RCMD_TYPE=ssh
+	pdsh -S -Fgenders.D -w anode[0-3] true
+'
 test_expect_success 'missing genders file is not an error' '
 	PDSH_GENDERS_FILE=doesnotexist
 	if pdsh -w host[0-10] -q 2>&1 | grep -q error; then
@@ -184,6 +206,56 @@ EOF
 test_expect_success 'genders query is slow' '
 	run_timeout 1 pdsh -F ./genders.is.slow -g test -q
 '
+
+cat >genders.cache <<EOF
+n[1-3] foo,altname=c%n
+n[4-6] bar,pdsh_rcmd_type=exec
+EOF
+test_expect_success 'genders cache is written and reused' '
+	PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -g foo -q | tail -1 >out1 &&
+	test $(ls gcache | wc -l) -eq 1 &&
+	OUTPUT=$(PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -g foo -q | tail -1) &&
+	test_output_is_expected "$OUTPUT" "$(cat out1)" &&
+	test_output_is_expected "$OUTPUT" "cn[1-3]" &&
+	OUTPUT=$(PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -w cn1,n4,x1 -X bar -i -q | tail -1) &&
+	test_output_is_expected "$OUTPUT" "n1,x1"
+'
+test_expect_success 'genders cache supports genders_query' '
+	OUTPUT=$(PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -g "foo||bar" -q | tail -1) &&
+	test_output_is_expected "$OUTPUT" "cn[1-3],n[4-6]"
+'
+test_expect_success MOD_RCMD_EXEC 'genders cache keeps pdsh_rcmd_type' '
+	PDSH_RCMD_TYPE=ssh PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -S -F ./genders.cache -g bar true
+'
+test_expect_success 'genders cache is rebuilt when genders file changes' '
+	cp -p genders.cache genders.cache.orig &&
+	sed "s/foo/baz/" genders.cache.orig >genders.cache &&
+	touch -r genders.cache.orig genders.cache &&
+	OUTPUT=$(PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -g baz -q | tail -1) &&
+	test_output_is_expected "$OUTPUT" "cn[1-3]" &&
+	cp -p genders.cache.orig genders.cache
+'
+test_expect_success 'damaged genders cache is ignored' '
+	for f in gcache/*; do echo garbage >$f; done &&
+	OUTPUT=$(PDSH_GENDERS_CACHE_DIR=$(pwd)/gcache \
+		pdsh -F ./genders.cache -g foo -q | tail -1) &&
+	test_output_is_expected "$OUTPUT" "cn[1-3]" &&
+	test $(wc -c <gcache/*) -gt 8
+'
+test_expect_success 'genders cache directory must be private' '
+	mkdir -p badgcache && chmod 777 badgcache &&
+	PDSH_GENDERS_CACHE_DIR=$(pwd)/badgcache \
+		pdsh -F ./genders.cache -g foo -q 2>err | tail -1 >out &&
+	grep "not a private directory" err &&
+	test_output_is_expected "$(cat out)" "cn[1-3]" &&
+	test $(ls badgcache | wc -l) -eq 0
+'
 test_expect_success 'genders filter is slow' '
 	run_timeout 1 pdsh -F ./genders.is.slow -w foo[0-10000] -g test2 -q
 '
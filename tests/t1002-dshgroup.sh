@@ -78,4 +78,73 @@ test_expect_success 'dshgroup #include syntax detects loops' '
     pdsh -g groupX -q 2>&1 | grep -q "warning:"
 '
 
+test_expect_success 'dshgroup read_wcoll time is reported with -d' '
+	pdsh -d -g groupA -q 2>&1 | \
+	    grep -q "misc/dshgroup: read_wcoll took [0-9]* ms$"
+'
+test_expect_success 'dshgroup -g conflicts with -w' '
+	! pdsh -w foo1 -g groupA -q >/dev/null 2>&1 &&
+	pdsh -w foo1 -g groupA -q 2>&1 | grep -q "Do not specify both -w and -g"
+'
+
+#
+#  300 groups, each with one host and including the previous group
+#
+mkdir -p many/.dsh/group
+i=1
+while test $i -le 300; do
+	echo "bar$i" >many/.dsh/group/many$i
+	test $i -gt 1 && echo "#include many$((i-1))" >>many/.dsh/group/many$i
+	i=$((i+1))
+done
+test_expect_success 'dshgroup -g and -X with hundreds of groups' '
+	G=$(i=1; while test $i -le 300; do printf "many$i,"; i=$((i+1)); done) &&
+	O=$(HOME=$(pwd)/many pdsh -g $G -X many100 -q | tail -1) &&
+	test_output_is_expected "$O" "bar[101-300]"
+'
+#
+#  Replace the hosts in the cache entry for group $1 with $2, keeping
+#   the key and file records, so that a cache hit can be told apart
+#   from reading the group file
+#
+cache_set_hosts() {
+	f=$(grep -l "group=$1" cache/*) &&
+	s=$(tr "\000" "\n" <$f | tail -n 1) &&
+	head -c $(($(wc -c <$f) - ${#s})) $f >cache.tmp &&
+	printf "%s" "$2" >>cache.tmp &&
+	mv cache.tmp $f
+}
+test_expect_success 'dshgroup groups are cached until a group file changes' '
+	mkdir emptydir &&
+	export PDSH_WCOLL_CACHE_DIR=$(pwd)/cache &&
+	export PDSH_WCOLL_CACHE_TTL=600 &&
+	export DSHGROUP_PATH=$(pwd)/emptydir &&
+	touch -d "2001-01-01 00:00:00" .dsh/group/groupB &&
+	O=$(pdsh -g groupAB -X groupB -q | tail -1) &&
+	test_output_is_expected "$O" "foo[0-2,8,10]" &&
+	test $(ls cache | wc -l) -eq 2 &&
+	cache_set_hosts groupB "foo[8-9]" &&
+	O=$(pdsh -g groupAB -X groupB -q | tail -1) &&
+	test_output_is_expected "$O" "foo[0-5,10]" &&
+	echo foo3 >.dsh/group/groupB &&
+	touch -d "2002-01-01 00:00:00" .dsh/group/groupB &&
+	O=$(pdsh -g groupAB -X groupB -q | tail -1) &&
+	test_output_is_expected "$O" "foo[0-2,8,10]"
+'
+test_expect_success 'dshgroup cache only checks the group files read' '
+	echo foo20 >emptydir/groupE &&
+	touch -d "2001-01-01 00:00:00" emptydir/groupE &&
+	O=$(pdsh -g groupE -q | tail -1) &&
+	test_output_is_expected "$O" "foo20" &&
+	cache_set_hosts groupE foo99 &&
+	echo foo30 >.dsh/group/groupF &&
+	echo foo31 >emptydir/groupF &&
+	O=$(pdsh -g groupE -q | tail -1) &&
+	test_output_is_expected "$O" "foo99" &&
+	echo foo21 >.dsh/group/groupE &&
+	touch -d "2002-01-01 00:00:00" .dsh/group/groupE &&
+	O=$(pdsh -g groupE -q | tail -1) &&
+	test_output_is_expected "$O" "foo21"
+'
+
 test_done
@@ -1,96 +1,230 @@
-#!/bin/bash
+#!/bin/sh
 #
-#  Test jhinno module functionality
-#
-#  This test requires jjobs and jhosts commands to be available
+#  Test jhinno module using stand-in jjobs and jhosts commands
 #
 
-test_description="jhinno module integration tests"
+test_description='jhinno module'
 
-. ${test_srcdir:-.}/test-lib.sh
+. ${srcdir:-.}/test-lib.sh
 
-# Check if jjobs and jhosts are available
-if ! command -v jjobs &> /dev/null; then
-    echo "jjobs command not found, skipping jhinno tests"
-    exit 0
+if ! test_have_prereq MOD_MISC_JHINNO; then
+	skip_all='skipping jhinno tests, jhinno module not available'
+	test_done
 fi
 
-if ! command -v jhosts &> /dev/null; then
-    echo "jhosts command not found, skipping jhinno tests"
-    exit 0
+#
+#  Stand-in jjobs: "jjobs [-json] -o exec_host[:WIDTH] ID..." prints
+#   the exec_host of each job. Without -json the column is cut to WIDTH
+#   characters, 12 by default. Job 103 spans 2000 hosts so its exec_host
+#   is much longer than 8 KB. As with the real command, an unknown job id
+#   makes the whole command fail. Each invocation is logged.
+#
+mkdir bin
+cat >bin/jjobs <<'EOF'
+#!/bin/sh
+echo "jjobs $*" >>"$JHINNO_LOG"
+json= width=12 rc=0
+while :; do
+	case $1 in
+	-json) json=1; shift ;;
+	-o)    case $2 in exec_host:*) width=${2#exec_host:} ;; esac; shift 2 ;;
+	*)     break ;;
+	esac
+done
+exec_host() {
+	case $1 in
+	101) echo "64*c1:64*c2" ;;
+	102) echo "32*c2:32*c3" ;;
+	103) i=0; sep=
+	     while test $i -lt 2000; do
+	         printf "%s1*bignode%d" "$sep" $i; sep=:; i=$((i+1))
+	     done; echo ;;
+	104) echo "-" ;;
+	*)   return 1 ;;
+	esac
+}
+if test -n "$json"; then
+	printf '{\n  "COMMAND":"jjobs",\n  "JOBS":%d,\n  "RECORDS":[\n' $#
+	sep=
+	for id; do
+		printf '%s    {\n' "$sep"; sep=,
+		if h=$(exec_host $id); then
+			printf '      "EXEC_HOST":"%s"\n' "$h"
+		else
+			printf '      "JOBID":"%s",\n' $id
+			printf '      "ERROR":"Job <%s> is not found"\n' $id
+			rc=255
+		fi
+		printf '    }\n'
+	done
+	printf '  ]\n}\n'
+else
+	echo "EXEC_HOST"
+	for id; do
+		if h=$(exec_host $id); then
+			echo "$h" | cut -c1-$width
+		else
+			echo "Job <$id> is not found" >&2
+			rc=255
+		fi
+	done
 fi
+exit $rc
+EOF
 
-# Test 1: Test with numeric jobid if jjobs command works
-test_expect_success "jhinno: numeric jobid query" '
-    # Get a sample jobid from system
-    jobid=$(jjobs | head -1 | awk "{print \$1}")
-    if [ -n "$jobid" ] && [[ "$jobid" =~ ^[0-9]+$ ]]; then
-        pdsh -j $jobid -n hostname 2>&1
-    else
-        echo "No valid jobid found, skipping test"
-        true
-    fi
-'
+#
+#  Stand-in jhosts: "jhosts -w [GROUP...] [-R EXPR]". An unknown group
+#   makes the whole command fail without output.
+#
+cat >bin/jhosts <<'EOF'
+#!/bin/sh
+echo "jhosts $*" >>"$JHINNO_LOG"
+shift
+case $1 in
+-R) echo "HOST_NAME          STATUS"; echo "r1                 ok"; exit 0 ;;
+"") set -- groupA groupB ;;
+esac
+for g; do
+	case $g in
+	groupA|groupB) ;;
+	-R)     break ;;
+	*)      echo "$g: No such user/host group" >&2; exit 255 ;;
+	esac
+done
+echo "HOST_NAME          STATUS"
+for g; do
+	case $g in
+	groupA) echo "a1                 ok"; echo "a2                 ok" ;;
+	groupB) echo "b1                 ok" ;;
+	-R)     break ;;
+	esac
+done
+EOF
+chmod +x bin/jjobs bin/jhosts
+PATH="$(pwd)/bin:$PATH"
+JHINNO_LOG="$(pwd)/jhinno.log"
+export PATH JHINNO_LOG
+unset JOBS_JOBID JH_HOSTS
 
-# Test 2: Test with job group if jhosts command works
-test_expect_success "jhinno: job group query" '
-    # Try to query all nodes
-    pdsh -j all -n hostname 2>&1 | grep -q "pdsh@"
-'
+#
+#  Ensure jhinno module is loaded
+#
+export PDSH_MISC_MODULES=jhinno
 
-# Test 3: Test --jhinno-include-unknown option
-test_expect_success "jhinno: include unknown nodes option" '
-    pdsh -j all --jhinno-include-unknown -n hostname 2>&1 | grep -q "pdsh@"
+test_expect_success 'jhinno: single jobid' '
+	O=$(pdsh -j 101 -q | tail -1) &&
+	test_output_is_expected "$O" "c[1-2]"
 '
-
-# Test 4: Test environment variable JOBS_JOBID
-test_expect_success "jhinno: JOBS_JOBID environment variable" '
-    # Try to query all nodes via environment variable
-    JOBS_JOBID=all pdsh -n hostname 2>&1 | grep -q "pdsh@"
+test_expect_success 'jhinno: multiple jobids use one jjobs command' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j 101,102,104 -q | tail -1) &&
+	test_output_is_expected "$O" "c[1-3]" &&
+	test_output_is_expected "$(cat jhinno.log)" "jjobs -json -o exec_host 101 102 104"
 '
-
-# Test 5: Test with 'all' special value
-test_expect_success "jhinno: all nodes query" '
-    pdsh -j all -n "echo test" 2>&1 | head -5
+test_expect_success 'jhinno: exec_host longer than 8 KB' '
+	O=$(pdsh -j 103 -q | tail -1) &&
+	test_output_is_expected "$O" "bignode[0-1999]"
 '
-
-# Test 6: Verify UNKNOWN nodes are filtered by default
-test_expect_success "jhinno: UNKNOWN nodes filtered by default" '
-    # Get count of all nodes (including UNKNOWN)
-    all_nodes=$(jhosts attrib -w 2>/dev/null | awk "NR>2 {print \$1}" | wc -l)
-    # Get count of normal nodes (excluding UNKNOWN)
-    normal_nodes=$(jhosts attrib -w 2>/dev/null | awk "NR>2 && \$2!=\42UNKNOWN\42 {print \$1}" | wc -l)
-    
-    # Get node count from pdsh -j all
-    pdsh_nodes=$(pdsh -j all -n 2>&1 | grep -c "^.*:" || echo 0)
-    
-    # Count from jjobs should match or be close to normal_nodes
-    echo "All nodes: $all_nodes, Normal nodes: $normal_nodes, pdsh nodes: $pdsh_nodes"
-    test "$pdsh_nodes" -gt 0 -o "$normal_nodes" -eq 0
+test_expect_success 'jhinno: bad job id does not fail the other ids' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j 101,999,102 -q 2>err | tail -1) &&
+	test_output_is_expected "$O" "c[1-3]" &&
+	grep "jjobs failed for 999" err &&
+	test $(grep -c . err) -eq 1 &&
+	test_output_is_expected "$(head -1 jhinno.log)" \
+		"jjobs -json -o exec_host 101 999 102" &&
+	test_output_is_expected "$(tail -n +2 jhinno.log | sort)" \
+		"jjobs -json -o exec_host 101
+jjobs -json -o exec_host 102
+jjobs -json -o exec_host 999"
 '
-
-# Test 7: Test with --jhinno-include-unknown (should include more nodes)
-test_expect_success "jhinno: include unknown nodes increases count" '
-    # Get count with filter
-    filtered_count=$(pdsh -j all -n 2>&1 | grep -c "^.*:" || echo 0)
-    # Get count without filter
-    all_count=$(pdsh -j all --jhinno-include-unknown -n 2>&1 | grep -c "^.*:" || echo 0)
-    
-    # With --jhinno-include-unknown, we should get >= filtered count
-    echo "Filtered: $filtered_count, All: $all_count"
-    test "$all_count" -ge "$filtered_count"
+test_expect_success 'jhinno: bad node group does not fail the other groups' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j groupA,nogroup,groupB -q 2>err | tail -1) &&
+	test_output_is_expected "$O" "a[1-2],b1" &&
+	grep "jhosts failed for nogroup" err &&
+	test $(wc -l <jhinno.log) -eq 4
 '
-
-# Test 8: Test command execution on nodes
-test_expect_success "jhinno: execute command on nodes" '
-    # Ensure we can execute a simple command
-    pdsh -j all -q "date +%s" 2>&1 | head -5
+test_expect_success 'jhinno: multiple groups use one jhosts command' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j groupA,groupB -q | tail -1) &&
+	test_output_is_expected "$O" "a[1-2],b1" &&
+	test_output_is_expected "$(cat jhinno.log)" "jhosts -w groupA groupB"
 '
-
-# Test 9: Verify module is loaded
-test_expect_success "jhinno: verify module is loaded" '
-    # The module should be listed with -L if working
-    pdsh -L 2>&1 | grep -q "jhinno" || true
+test_expect_success 'jhinno: jobs and groups together' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j 101,groupB,102 -q | tail -1) &&
+	test_output_is_expected "$O" "b1,c[1-3]" &&
+	test $(wc -l <jhinno.log) -eq 2
+'
+test_expect_success 'jhinno: all' '
+	O=$(pdsh -j all -q | tail -1) &&
+	test_output_is_expected "$O" "a[1-2],b1"
+'
+test_expect_success 'jhinno: resource request string' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j "select[mem>1000]" -q | tail -1) &&
+	test_output_is_expected "$O" "r1" &&
+	test_output_is_expected "$(cat jhinno.log)" "jhosts -w -R select[mem>1000]"
+'
+test_expect_success 'jhinno: -F filter applies to groups' '
+	rm -f jhinno.log &&
+	O=$(pdsh -j groupA -F "select[mem>1000]" -q | tail -1) &&
+	test_output_is_expected "$O" "a[1-2]" &&
+	test_output_is_expected "$(cat jhinno.log)" "jhosts -w groupA -R select[mem>1000]"
+'
+test_expect_success 'jhinno: JOBS_JOBID environment variable' '
+	O=$(JOBS_JOBID=102 pdsh -q | tail -1) &&
+	test_output_is_expected "$O" "c[2-3]"
+'
+test_expect_success 'jhinno: JH_HOSTS environment variable' '
+	rm -f jhinno.log &&
+	O=$(JH_HOSTS="h1 128 h2 128" pdsh -q | tail -1) &&
+	test_output_is_expected "$O" "h[1-2]" &&
+	! test -f jhinno.log
+'
+test_expect_success 'jhinno: wcoll cache avoids repeated queries' '
+	export PDSH_WCOLL_CACHE_TTL=300 PDSH_WCOLL_CACHE_DIR="$(pwd)/cache" &&
+	rm -f jhinno.log &&
+	O=$(pdsh -j 101,groupB -q | tail -1) &&
+	test_output_is_expected "$O" "b1,c[1-2]" &&
+	test $(wc -l <jhinno.log) -eq 2 &&
+	rm -f jhinno.log &&
+	O=$(pdsh -j 101,groupB -q | tail -1) &&
+	test_output_is_expected "$O" "b1,c[1-2]" &&
+	! test -f jhinno.log &&
+	O=$(pdsh -j 102 -q | tail -1) &&
+	test_output_is_expected "$O" "c[2-3]" &&
+	test_output_is_expected "$(cat jhinno.log)" \
+		"jjobs -json -o exec_host 102"
+'
+test_expect_success 'jhinno: wcoll cache removes expired files on refresh' '
+	export PDSH_WCOLL_CACHE_TTL=300 PDSH_WCOLL_CACHE_DIR="$(pwd)/cache" &&
+	rm -rf cache &&
+	pdsh -j 101 -q >/dev/null &&
+	old=$(ls cache) &&
+	test $(echo "$old" | wc -l) -eq 1 &&
+	touch -d "2001-01-01" cache/$old cache/0123456789abcdef.lock \
+		cache/0123456789abcdef.Ab12Cd &&
+	pdsh -j 102 -q >/dev/null &&
+	test $(ls cache | wc -l) -eq 1 &&
+	! test -f cache/$old
+'
+test_expect_success 'jhinno: -B bypasses wcoll cache' '
+	export PDSH_WCOLL_CACHE_TTL=300 PDSH_WCOLL_CACHE_DIR="$(pwd)/cache" &&
+	rm -f jhinno.log &&
+	O=$(pdsh -B -j 101,groupB -q | tail -1) &&
+	test_output_is_expected "$O" "b1,c[1-2]" &&
+	test $(wc -l <jhinno.log) -eq 2
+'
+test_expect_success 'jhinno: wcoll cache directory must be private' '
+	mkdir -p badcache && chmod 777 badcache &&
+	rm -f jhinno.log &&
+	PDSH_WCOLL_CACHE_TTL=300 PDSH_WCOLL_CACHE_DIR="$(pwd)/badcache" \
+		pdsh -j 101 -q 2>err | tail -1 >out &&
+	grep "writable by group or other" err &&
+	test_output_is_expected "$(cat out)" "c[1-2]" &&
+	test -f jhinno.log
 '
 
 test_done
@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+#  Test netgroup module against the local netgroup database. The tests
+#   need "netgroup: files" in /etc/nsswitch.conf and these netgroups in
+#   /etc/netgroup, and are skipped otherwise:
+#
+#   pdshtesta  (foo1,,) (foo2,,) (foo3,,)
+#   pdshtestb  (foo3,,) (foo4,,) (,user,)
+#   pdshtestc  pdshtesta (bar1,,)
+#
+
+test_description='netgroup module'
+
+. ${srcdir:-.}/test-lib.sh
+
+if ! test_have_prereq MOD_MISC_NETGROUP; then
+	skip_all='skipping netgroup tests, netgroup module not available'
+	test_done
+fi
+
+if ! getent netgroup pdshtestc 2>/dev/null | grep -q "(bar1,,)"; then
+	skip_all='skipping netgroup tests, test netgroups not defined'
+	test_done
+fi
+
+#
+#  Ensure netgroup module is loaded
+#
+export PDSH_MISC_MODULES=netgroup
+
+test_expect_success 'netgroup -g works' '
+	O=$(pdsh -g pdshtesta -Q | tail -1) &&
+	test_output_is_expected "$O" "foo1,foo2,foo3"
+'
+test_expect_success 'netgroup -g expands nested netgroups' '
+	O=$(pdsh -g pdshtestc -Q | tail -1) &&
+	test_output_is_expected "$O" "bar1,foo1,foo2,foo3"
+'
+test_expect_success 'netgroup -g with multiple groups' '
+	O=$(pdsh -g pdshtesta,pdshtestb -Q | tail -1) &&
+	test_output_is_expected "$O" "foo1,foo2,foo3,foo4"
+'
+test_expect_success 'netgroup -X works' '
+	O=$(pdsh -w foo[1-9] -X pdshtestc -Q | tail -1) &&
+	test_output_is_expected "$O" "foo4,foo5,foo6,foo7,foo8,foo9"
+'
+test_expect_success 'netgroup -X works with -g' '
+	O=$(pdsh -g pdshtestc,pdshtestb -X pdshtestb -Q | tail -1) &&
+	test_output_is_expected "$O" "bar1,foo1,foo2"
+'
+test_expect_success 'netgroup -X with many hosts' '
+	i=0 && while test $i -lt 5000; do echo foo$i; i=$((i+1)); done >hosts &&
+	O=$(pdsh -w ^hosts -X pdshtestc -x foo[10-4999] -Q | tail -1) &&
+	test_output_is_expected "$O" "foo0,foo4,foo5,foo6,foo7,foo8,foo9"
+'
+test_expect_success 'netgroup -g with -w fails' '
+	pdsh -w foo1 -g pdshtesta -q 2>&1 | grep "Do not specify both -w and -g"
+'
+test_expect_success 'netgroup expansions are cached' '
+	export PDSH_WCOLL_CACHE_DIR=$(pwd)/cache &&
+	export PDSH_WCOLL_CACHE_TTL=60 &&
+	O=$(pdsh -g pdshtestc -X pdshtesta -Q | tail -1) &&
+	test_output_is_expected "$O" "bar1" &&
+	test $(ls cache | wc -l) -eq 2 &&
+	f=$(grep -l "group=pdshtesta" cache/*) &&
+	printf "misc/netgroup group=pdshtesta\000\000foo[2-3]" >$f &&
+	O=$(pdsh -g pdshtestc -X pdshtesta -Q | tail -1) &&
+	test_output_is_expected "$O" "bar1,foo1" &&
+	O=$(pdsh -B -g pdshtestc -X pdshtesta -Q | tail -1) &&
+	test_output_is_expected "$O" "bar1"
+'
+
+test_done
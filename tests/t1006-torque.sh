@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+#  Run tests of the torque module if a torque server is available and
+#   has running jobs. The server is the one qstat(1) and the module use
+#   by default, so PBS_DEFAULT may point both at a local stand-in server.
+#
+
+test_description='torque module'
+
+. ${srcdir:-.}/test-lib.sh
+
+if ! test_have_prereq MOD_MISC_TORQUE; then
+	skip_all='skipping torque tests, torque module not available'
+	test_done
+fi
+
+if ! qstat -B >/dev/null 2>&1; then
+	skip_all='skipping torque tests, torque server not available'
+	test_done
+fi
+
+export PDSH_MISC_MODULES=torque
+
+#
+#  Print the fully qualified ids of up to 3 running jobs
+#
+running_jobs() {
+	qstat -f -1 | awk '
+	    /^Job Id:/           { id = $3 }
+	    /job_state = R$/     { if (n++ < 3) print id }'
+}
+
+#
+#  Print the fully qualified ids of all jobs on the server
+#
+all_jobs() {
+	qstat -f -1 | awk '/^Job Id:/ { print $3 }'
+}
+
+#
+#  Print the hosts in the exec_host attribute of jobs [ids...], one per line
+#
+exec_hosts() {
+	qstat -f -1 "$@" | sed -n "s/^ *exec_host = //p" | tr "+" "\n" |
+	    sed "s|/.*||"
+}
+
+#
+#  Print the expected wcoll for the jobs in [ids...] as pdsh -q would.
+#   Hosts are sorted by prefix, then numeric suffix, as in the module.
+#
+expected_wcoll() {
+	hosts=$(exec_hosts "$@" | sed "s/\([0-9]*\)$/ \1/" |
+	    sort -u -k1,1 -k2,2n | tr -d " " | tr "\n" ",")
+	pdsh -w "$hosts" -q | tail -1
+}
+
+JOBS=$(running_jobs)
+test -n "$JOBS" && test_set_prereq RUNNINGJOBS
+
+test_expect_success RUNNINGJOBS 'torque -j works' '
+	id=$(echo $JOBS | cut -d" " -f1) &&
+	O=$(pdsh -j ${id%%.*} -q | tail -1) &&
+	test_output_is_expected "$O" "$(expected_wcoll $id)"
+'
+test_expect_success RUNNINGJOBS 'torque -j works with several jobs' '
+	ids=$(for id in $JOBS; do printf "${id%%.*},"; done) &&
+	O=$(pdsh -j ${ids%,} -q | tail -1) &&
+	test_output_is_expected "$O" "$(expected_wcoll $JOBS)"
+'
+test_expect_success RUNNINGJOBS 'torque -j works with every job on the server' '
+	all=$(all_jobs) &&
+	ids=$(for id in $all; do printf "${id%%.*},"; done) &&
+	O=$(pdsh -j ${ids%,} -q | tail -1) &&
+	test_output_is_expected "$O" "$(expected_wcoll $all)"
+'
+test_expect_success RUNNINGJOBS 'torque -j ignores repeated job ids' '
+	id=$(echo $JOBS | cut -d" " -f1) &&
+	O=$(pdsh -j ${id%%.*},${id%%.*} -q 2>&1 | tail -1) &&
+	test_output_is_expected "$O" "$(expected_wcoll $id)"
+'
+test_expect_success RUNNINGJOBS 'torque module reads PBS_JOBID' '
+	id=$(echo $JOBS | cut -d" " -f1) &&
+	O=$(PBS_JOBID=$id pdsh -q | tail -1) &&
+	test_output_is_expected "$O" "$(expected_wcoll $id)"
+'
+test_expect_success 'torque -j reports unknown jobs' '
+	pdsh -j 99999998,99999999 -q 2>&1 |
+	    grep "Failed to retrieve information for job 99999999"
+'
+test_expect_success 'torque -j rejects invalid job ids' '
+	pdsh -j 1x -q 2>&1 | grep "invalid jobid format"
+'
+
+test_done
@@ -38,4 +38,41 @@ test_expect_success 'exec cmd susbstitution works interactive mode' '
 test_debug '
 	echo Output: $OUTPUT
 '
+test -d /proc/self/fd && test_set_prereq PROC_FD
+test_expect_success PROC_FD 'exec cmd inherits no stray file descriptors' '
+	OUTPUT=$(pdsh -Rexec -w foo[0-9] sh -c "ls /proc/\$\$/fd" 3>/dev/null) &&
+	test $(echo "$OUTPUT" | grep -c "foo[0-9]: [012]$") -eq 30 &&
+	test $(echo "$OUTPUT" | wc -l) -eq 30
+'
+test_debug '
+	echo Output: $OUTPUT
+'
+test_expect_success 'exec cmd runs in a new session' '
+	OUTPUT=$(pdsh -Rexec -w foo sh -c "ps -o sid= -p \$\$; ps -o pid= -p \$\$")
+	test $(echo "$OUTPUT" | sed "s/foo: *//" | uniq | wc -l) -eq 1
+'
+test_debug '
+	echo Output: $OUTPUT
+'
+test_expect_success 'exec module works with fanout 512' '
+	pdsh -Rexec -f 512 -w foo[0-1023] echo %n >output &&
+	test $(sort -u output | wc -l) -eq 1024
+'
+test_expect_success 'exec -S returns exit status of remote command' '
+	test_expect_code 3 pdsh -S -Rexec -w foo[0-3] sh -c "exit %n"
+'
+test_expect_success 'exec -S is not fooled by output that looks like a status' '
+	OUTPUT=$(pdsh -S -Rexec -w foo echo XXRETCODE:7) &&
+	test "$OUTPUT" = "foo: XXRETCODE:7"
+'
+test_debug '
+	echo Output: $OUTPUT
+'
+test_expect_success 'exec -S reports command killed by signal' '
+	test_expect_code 137 pdsh -S -Rexec -w foo sh -c "kill -9 \$\$"
+'
+test_expect_success 'missing exec cmd fails' '
+	pdsh -Rexec -w foo /nonexistent/cmd >output 2>&1
+	grep "foo" output | grep -q "/nonexistent/cmd"
+'
 test_done
@@ -152,6 +152,52 @@ test_expect_success 'interactive mode works with ssh (Issue 14)' '
 test_debug '
 	echo Output: "$OUTPUT"
 '
+test_expect_success 'PDSH_SSH_CONTROL_PERSIST enables ssh multiplexing' '
+	OUTPUT=$(PDSH_SSH_CONTROL_DIR=$(pwd)/ctl PDSH_SSH_CONTROL_PERSIST=10m \
+	         pdsh -Rssh -wfoo hostname) &&
+	echo "$OUTPUT" | grep -- "-oControlMaster=auto -oControlPersist=10m -oControlPath=$(pwd)/ctl/%C" &&
+	test -d ctl &&
+	test "$(stat -c %a ctl)" = 700
+'
+test_debug '
+	echo Output: "$OUTPUT"
+'
+test_expect_success 'ssh multiplexing is off by default' '
+	OUTPUT=$(pdsh -Rssh -wfoo hostname) &&
+	! echo "$OUTPUT" | grep Control
+'
+test_expect_success 'ssh control dir must be private' '
+	mkdir -p shared && chmod 777 shared &&
+	OUTPUT=$(PDSH_SSH_CONTROL_DIR=$(pwd)/shared PDSH_SSH_CONTROL_PERSIST=60 \
+	         pdsh -Rssh -wfoo hostname 2>&1) &&
+	echo "$OUTPUT" | grep "not a private directory" &&
+	echo "$OUTPUT" | grep "foo: .*foo hostname" &&
+	! echo "$OUTPUT" | grep ControlPath
+'
+test_debug '
+	echo Output: "$OUTPUT"
+'
+test_expect_success 'user ControlPath in PDSH_SSH_ARGS_APPEND takes precedence' '
+	OUTPUT=$(PDSH_SSH_CONTROL_DIR=$(pwd)/ctl PDSH_SSH_CONTROL_PERSIST=60 \
+	         PDSH_SSH_ARGS_APPEND="-oControlPath=/x/%C" \
+	         pdsh -Rssh -wfoo hostname) &&
+	echo "$OUTPUT" | grep -- "-oControlPath=/x/%C" &&
+	! echo "$OUTPUT" | grep ControlPersist
+'
+test_debug '
+	echo Output: "$OUTPUT"
+'
+test_expect_success 'ssh -S has the remote shell exit with its status' '
+	OUTPUT=$(pdsh -S -Rssh -w foo command) &&
+	echo "$OUTPUT" | grep "foo command ;exit \$?\$"
+'
+test_debug '
+	echo Output: "$OUTPUT"
+'
+test_expect_success 'ssh command is unchanged without -S' '
+	OUTPUT=$(pdsh -Rssh -w foo command) &&
+	echo "$OUTPUT" | grep "foo command\$"
+'
 #
 #  Exit code tests:
 #
@@ -213,4 +259,11 @@ test_expect_success 'ssh works with pdsh -k and multiple targets' '
 '
 unset PDSH_SSH_ARGS
 
+test_expect_success 'missing ssh is reported for each host with status 255' '
+	test_expect_code 255 env PATH="$PDSH_BUILD_DIR/src/pdsh" \
+		pdsh -S -Rssh -wfoo[0-1] command >output 2>&1 &&
+	grep "foo0: .*execvp ssh failed" output &&
+	grep "foo1: .*execvp ssh failed" output
+'
+
 test_done
@@ -9,26 +9,152 @@ if ! test_have_prereq MOD_RCMD_MRSH; then
 	test_done
 fi
 
-if ! pdsh -SRmrsh -w localhost /bin/true 2>&1 >/dev/null; then
-	skip_all='skipping mrsh tests, mrsh server not available on localhost'
-	test_done
+if pdsh -SRmrsh -w localhost /bin/true 2>&1 >/dev/null; then
+	test_set_prereq MRSHD
+fi
+if test_have_prereq PYTHON && command -v python3 >/dev/null &&
+   munge -n 2>/dev/null | unmunge >/dev/null 2>&1; then
+	test_set_prereq MUNGE
 fi
 
-test_expect_success 'mrsh module runs' '
+#
+#  mrshd stand-in listening on 127.0.0.2 and up, one address per
+#   target host, so that it does not collide with a real mrshd on
+#   localhost. Credentials are decoded with unmunge(1). Errors are
+#   reported on the stdout socket before connecting back for stderr,
+#   as mrshd does. FAKE_MRSHD_DELAY delays the back-connection.
+#
+cat >fake-mrshd.py <<\EOF
+import os, pwd, selectors, socket, struct, subprocess, sys, threading, time
+
+def readz(s):
+    b = b""
+    while True:
+        c = s.recv(1)
+        if not c:
+            raise EOFError
+        if c == b"\0":
+            return b
+        b += c
+
+def handle(s, peer):
+    e = None
+    try:
+        port = readz(s)
+        p = subprocess.run(["unmunge", "-m", "/dev/null"], input=readz(s),
+                           stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        if p.returncode != 0:
+            raise ValueError("mrshd: unmunge failed")
+        user, vers, addr, eport, rand, cmd = p.stdout.split(b"\0")[:6]
+        if addr != s.getsockname()[0].encode():
+            raise ValueError("mrshd: address mismatch")
+        if eport != port:
+            raise ValueError("mrshd: port mismatch")
+        try:
+            pwd.getpwnam(user.decode())
+        except KeyError:
+            raise ValueError("mrshd: unknown user " + user.decode())
+        if int(eport):
+            time.sleep(float(os.environ.get("FAKE_MRSHD_DELAY", "0")))
+            e = socket.create_connection((peer[0], int(eport)))
+            readz(s)
+            e.sendall(struct.pack("!I", int(rand) & 0xffffffff))
+        s.sendall(b"\0")
+        subprocess.run(["/bin/sh", "-c", cmd], stdin=subprocess.DEVNULL,
+                       stdout=s.fileno(), stderr=(e or s).fileno())
+    except ValueError as x:
+        s.sendall(b"\1" + str(x).encode() + b"\n")
+    except EOFError:
+        pass
+    if e:
+        e.close()
+    s.close()
+
+sel = selectors.DefaultSelector()
+for i in range(int(sys.argv[1])):
+    ls = socket.socket()
+    ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(("127.0.0.%d" % (i + 2), 21212))
+    ls.listen(64)
+    sel.register(ls, selectors.EVENT_READ)
+open("mrshd.pid", "w").write("%d\n" % os.getpid())
+while True:
+    for key, _ in sel.select():
+        s, peer = key.fileobj.accept()
+        threading.Thread(target=handle, args=(s, peer), daemon=True).start()
+EOF
+
+test_expect_success MRSHD 'mrsh module runs' '
 	OUTPUT=$(pdsh -Rmrsh -w localhost echo i am here)
 '
 test_debug '
 	echo Output: "$OUTPUT"
 '
-test_expect_success 'mrsh localhost works' '
+test_expect_success MRSHD 'mrsh localhost works' '
 	echo "$OUTPUT" | grep "localhost: i am here"
 '
-test_expect_success  'mrsh: -S generates empty lines (Issue 54)' '
+test_expect_success MRSHD 'mrsh: -S generates empty lines (Issue 54)' '
 	OUTPUT=$(pdsh -Rmrsh -w localhost -S cd ..)
 	[ -z "$OUTPUT" ]
 '
 test_debug '
 	echo Output: "$OUTPUT"
 '
+test_expect_success MRSHD 'mrsh: -S takes status only from the end of output' '
+	OUTPUT=$(test_expect_code 3 pdsh -Rmrsh -w localhost -S "sh -c \"echo XXRETCODE:7; exit 3\"") &&
+	test "$OUTPUT" = "localhost: XXRETCODE:7"
+'
+test_debug '
+	echo Output: "$OUTPUT"
+'
+
+test_expect_success MUNGE 'start mrshd stand-in' '
+	(FAKE_MRSHD_DELAY=1 python3 fake-mrshd.py 32 >mrshd.log 2>&1 &) &&
+	sleep 1 &&
+	test -f mrshd.pid
+'
+test -f mrshd.pid && test_set_prereq FAKE_MRSHD
+
+test_expect_success FAKE_MRSHD 'mrsh runs command on stand-in' '
+	OUTPUT=$(pdsh -Rmrsh -w 127.0.0.2 echo i am here) &&
+	test "$OUTPUT" = "127.0.0.2: i am here"
+'
+test_expect_success FAKE_MRSHD 'mrsh separates stderr' '
+	pdsh -Rmrsh -w 127.0.0.2 "echo out; echo err >&2" >stdout 2>stderr &&
+	grep "127.0.0.2: out" stdout &&
+	grep "127.0.0.2: err" stderr &&
+	! grep err stdout
+'
+test_expect_success FAKE_MRSHD 'mrsh returns remote exit status with -S' '
+	test_expect_code 3 pdsh -S -Rmrsh -w 127.0.0.2 "sh -c \"exit 3\""
+'
+test_expect_success FAKE_MRSHD 'mrsh -S writes output before the command exits' '
+	(pdsh -S -Rmrsh -w 127.0.0.2 "echo first; sleep 6; echo last" \
+	    >stream.out 2>&1 &) &&
+	for i in $(seq 1 20); do
+		grep -q first stream.out && break
+		sleep 0.2
+	done &&
+	grep "127.0.0.2: first" stream.out &&
+	! grep last stream.out &&
+	for i in $(seq 1 50); do
+		grep -q last stream.out && break
+		sleep 0.2
+	done &&
+	grep "127.0.0.2: last" stream.out &&
+	! grep XXRETCODE stream.out
+'
+test_expect_success FAKE_MRSHD 'mrsh reports daemon errors sent before stderr setup' '
+	OUTPUT=$(pdsh -Rmrsh -l nosuchuser -w 127.0.0.2 true 2>&1);
+	echo "$OUTPUT" | grep "mcmd: Error: mrshd: unknown user nosuchuser"
+'
+test_expect_success FAKE_MRSHD 'mrsh stderr setup to many hosts proceeds concurrently' '
+	start=$(date +%s) &&
+	OUTPUT=$(pdsh -Rmrsh -f 32 -w "127.0.0.[2-33]" echo ok | sort) &&
+	test $(($(date +%s) - start)) -lt 8 &&
+	test $(echo "$OUTPUT" | grep -c ": ok$") -eq 32
+'
+
+test -f mrshd.pid && kill $(cat mrshd.pid)
 
 test_done
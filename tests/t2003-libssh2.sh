@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='pdsh libssh2 module tests
+
+Run the libssh2 module against a private sshd started on localhost.'
+
+. ${srcdir:-.}/test-lib.sh
+
+if ! test_have_prereq MOD_RCMD_LIBSSH2; then
+	skip_all='skipping libssh2 tests, libssh2 module not available'
+	test_done
+fi
+
+SSHD=$(command -v sshd || echo /usr/sbin/sshd)
+if ! test -x "$SSHD" || ! command -v ssh-keygen >/dev/null; then
+	skip_all='skipping libssh2 tests, sshd or ssh-keygen not available'
+	test_done
+fi
+
+PDSH_LIBSSH2_PORT=$((20000 + $$ % 10000))
+export PDSH_LIBSSH2_PORT
+HOME=$(pwd)
+export HOME
+unset SSH_AUTH_SOCK
+
+test_expect_success 'start private sshd' '
+	mkdir -m 700 .ssh &&
+	ssh-keygen -q -t ed25519 -N "" -f hostkey &&
+	ssh-keygen -q -t ed25519 -N "" -f .ssh/id_ed25519 &&
+	cp .ssh/id_ed25519.pub .ssh/authorized_keys &&
+	echo "[localhost]:$PDSH_LIBSSH2_PORT $(cat hostkey.pub)" \
+	    >.ssh/known_hosts &&
+	cat >sshd_config <<-EOF &&
+	Port $PDSH_LIBSSH2_PORT
+	ListenAddress 127.0.0.1
+	HostKey $HOME/hostkey
+	PidFile $HOME/sshd.pid
+	AuthorizedKeysFile $HOME/.ssh/authorized_keys
+	StrictModes no
+	UsePAM no
+	EOF
+	"$SSHD" -f sshd_config &&
+	sleep 1 &&
+	test -f sshd.pid
+'
+if ! test -f sshd.pid; then
+	skip_all='skipping libssh2 tests, unable to start sshd'
+	test_done
+fi
+
+test_expect_success 'libssh2 module runs command' '
+	OUTPUT=$(pdsh -Rlibssh2 -w localhost echo i am here) &&
+	test "$OUTPUT" = "localhost: i am here"
+'
+test_expect_success 'libssh2 module returns remote exit status with -S' '
+	test_expect_code 3 pdsh -S -Rlibssh2 -w localhost "exit 3"
+'
+test_expect_success 'libssh2 module separates stderr' '
+	pdsh -Rlibssh2 -w localhost "echo out; echo err >&2" \
+	    >stdout 2>stderr &&
+	grep "localhost: out" stdout &&
+	grep "localhost: err" stderr
+'
+test_expect_success 'libssh2 module rejects unknown host keys' '
+	mv .ssh/known_hosts known_hosts.save &&
+	test_when_finished "mv known_hosts.save .ssh/known_hosts" &&
+	OUTPUT=$(pdsh -Rlibssh2 -w localhost echo hi 2>&1) ;
+	echo "$OUTPUT" | grep "host key not found"
+'
+
+kill $(cat sshd.pid)
+
+test_done